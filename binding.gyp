@@ -53,15 +53,23 @@
             #'-lcups -lgssapi_krb5 -lkrb5 -lk5crypto -lcom_err -lz -lpthread -lm -lcrypt -lz'
           ],
           'libraries':[
-            '<!(cups-config --libs)'
+            '<!(cups-config --libs)',
+            '-lz'
             #'-lcups -lgssapi_krb5 -lkrb5 -lk5crypto -lcom_err -lz -lpthread -lm -lcrypt -lz'
           ],
           'link_settings': {
             'libraries': [
-              '<!(cups-config --libs)'
+              '<!(cups-config --libs)',
+              '-lz'
             ]
           }
         }],
+        ['OS=="linux"', {
+          'link_settings': {
+            # shm_open is in librt before glibc 2.34
+            'libraries': [ '-lrt' ]
+          }
+        }],
         ['OS=="mac"', {
           'cflags':[
             "-stdlib=libc++"
@@ -0,0 +1,23 @@
+// Throughput of printDirect through the addon alone: the null backend acknowledges
+// every job at once, the file backend writes them to a directory.
+// node examples/benchPrintDirect.js [null|file] [jobs]
+var printer = require("../lib"),
+    fs = require("fs"),
+    os = require("os"),
+    path = require("path");
+
+var backend = process.argv[2] || 'null',
+    jobs = parseInt(process.argv[3] || '100000', 10),
+    label = Buffer.from('^XA^FO50,50^ADN,36,20^FDSHIP TO 12345^FS^XZ');
+
+// a new directory per run: the files of the previous runs are left as they are
+printer.setPrintBackend(backend, backend === 'file' ? {directory: fs.mkdtempSync(path.join(os.tmpdir(), 'node-printer-bench-'))} : {});
+
+var start = process.hrtime.bigint();
+for(var i = 0; i < jobs; ++i) {
+    printer.printDirect({data: label, printer: 'bench', type: 'RAW', success: function(){}, error: function(err){ throw err; }});
+}
+var elapsed = Number(process.hrtime.bigint() - start) / 1e9;
+
+var stats = printer.getPrintBackend();
+console.log(stats.name + ": " + stats.jobs + " jobs in " + elapsed.toFixed(3) + " s, " + Math.round(stats.jobs / elapsed) + " jobs/s");
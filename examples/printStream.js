@@ -0,0 +1,20 @@
+// use: node printStream.js [filePath printerName]
+var printer = require("../lib/printer"),
+    fs = require('fs'),
+    filename = process.argv[2] || __filename;
+
+var printStream = printer.createPrintStream({
+    printer: process.argv[3], // printer name, if missing then will print to default printer
+    docname: filename,
+    type: 'AUTO' // type: RAW, TEXT, PDF, JPEG, .. depends on platform
+});
+
+printStream.on('job', function(jobID){
+    console.log("sent to printer with ID: "+jobID);
+});
+printStream.on('error', function(err){
+    console.log(err);
+});
+
+// the file is read and sent by chunks, it is never loaded completely in memory
+fs.createReadStream(filename).pipe(printStream);
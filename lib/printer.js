@@ -1,5 +1,6 @@
 var printer_helper = {},
     fs = require("fs"),
+    stream = require("stream"),
     child_process = require("child_process"),
     os = require("os"),
     path = require("path"),
@@ -16,6 +17,70 @@ if(fs.existsSync(binding_path)) {
  */
 module.exports.getPrinters = getPrinters;
 
+/** Return all installed printers including active jobs, asynchronously.
+ * Concurrent calls share one query to the print server.
+ * getPrintersAsync([options], [callback]), options: {maxAge: ms} reuses a result not older than maxAge.
+ * Results are kept one minute at most, a bigger maxAge queries again after that.
+ * Returns a Promise if callback is not provided.
+ */
+module.exports.getPrintersAsync = getPrintersAsync;
+
+/** Return the printers of several CUPS servers, queried in parallel:
+ * getPrintersMulti(servers, [options], [callback]), servers: ['host', 'host:port', ...],
+ * options: {timeout: ms} to connect to each server.
+ * The result is {printers, errors}: printers of all servers, each one with its `server`,
+ * and one {server, message} per unreachable server. Fails only if no server answered.
+ * Returns a Promise if callback is not provided.
+ */
+module.exports.getPrintersMulti = getPrintersMulti;
+
+/** Share printers between the processes of the host, e.g. cluster workers:
+ * enableSharedCache({name, maxAge, owner, size}). getPrinters and getPrinter then read the
+ * printers published in the shared memory segment `name` (`node-printer` by default) without
+ * querying the print server, as long as they are not older than maxAge ms (2000 by default).
+ * Older printers are fetched as usual and published. The process with `owner: true` refreshes
+ * the segment every maxAge / 2 ms off the main thread, so the others normally never query.
+ * `size` is the segment size in bytes (4 MiB by default), the same in all processes.
+ * POSIX only.
+ */
+module.exports.enableSharedCache = enableSharedCache;
+/// stop using the shared cache of enableSharedCache in this process
+module.exports.disableSharedCache = disableSharedCache;
+
+/** Open a durable spool journal: openSpoolJournal(directory, {segmentSize, syncInterval, syncBytes, retryTimeout, onJob}).
+ * journal.append(params) takes printDirect parameters, copies the job into a memory mapped segment
+ * file and returns its sequence at once. Appended jobs are synced to disk every syncInterval ms
+ * (10 by default) and submitted to CUPS in order by a background drainer, which retries while cupsd
+ * is down; a job still failing after retryTimeout ms (10 minutes by default, 0 for no limit) is
+ * dropped so the next ones are not held back. onJob(err, {sequence, id}) reports each submission.
+ * Jobs still pending when the process exits are submitted when the journal is opened again.
+ * printDirect({journal, ...}) appends too, and calls success with the sequence. POSIX only.
+ */
+module.exports.openSpoolJournal = printer_helper.openSpoolJournal;
+
+/** Select where jobs go, to measure the addon without a scheduler: setPrintBackend(name, [options]),
+ * name: 'cups' (default), 'null' (jobs are acknowledged at once and dropped) or 'file'
+ * ({directory, sync}: each job is written to DIRECTORY/JOBID-PRINTER.prn).
+ * Applies to printDirect, printFile, coalesced jobs and spool journals. POSIX only.
+ */
+module.exports.setPrintBackend = printer_helper.setPrintBackend;
+/// {name, jobs, bytes, errors} of the backend selected by setPrintBackend
+module.exports.getPrintBackend = printer_helper.getPrintBackend;
+
+/** Create a submission scheduler shared by several tenants: createJobScheduler({concurrency, classes, aging, tenants}).
+ * scheduler.submit({data, printer, server, docname, type, options, class, tenant, preflight}, callback) queues the job;
+ * classes ({name: job-priority}, urgent/normal/bulk by default) are served by priority, a class being promoted
+ * for each `aging` ms its oldest job waited, and tenants of a class share it by their weights.
+ * callback(err, {id, class, tenant, waitMs}); scheduler.stats() gives the queue wait per class. POSIX only.
+ */
+module.exports.createJobScheduler = printer_helper.createJobScheduler;
+
+/** Check options against the printer capabilities without printing: checkPrintOptions(printer, options, [{server}])
+ * returns {valid, errors}. Capabilities are cached for 5 minutes and each result memoized, so checking
+ * options already seen costs no request to the server. POSIX only.
+ */
+module.exports.checkPrintOptions = printer_helper.checkPrintOptions;
+
 /** send data to printer
  */
 module.exports.printDirect = printDirect;
@@ -23,6 +88,68 @@ module.exports.printDirect = printDirect;
 /// send file to printer
 module.exports.printFile = printFile;
 
+/// create a writable stream which sends its data to printer as one job
+module.exports.createPrintStream = createPrintStream;
+
+/** Open a printer handle which keeps the resolved printer and its connection
+ * for fast repeated submissions. Handle methods (all synchronous):
+ *   print({data, type, docname, options}) - returns {id}
+ *   printFile({filename, type, docname, options}) - returns {id}
+ *   jobs(which) - which: 'all' (default), 'active' or 'completed'
+ *   cancel(jobId) - returns true on success
+ *   close() - release the connection
+ */
+module.exports.openPrinter = printer_helper.openPrinter;
+
+/** Open a printer by its ipp:// or ipps:// URI, talking IPP to the device without CUPS scheduler:
+ * openIppPrinter(uri, [callback]). With a callback, the printer is connected on a worker
+ * and callback(err, handle) is called once it answered. Same handle as openPrinter
+ * (which also accepts such URIs), plus
+ *   attributes([names]) - printer attributes, all of them by default
+ * Each handle method also takes a callback(err, result) as last argument: the request then runs
+ * on a worker instead of blocking, and the requests of one handle are sent in call order.
+ * printDirect and printFile use ipp:// printers this way.
+ */
+module.exports.openIppPrinter = printer_helper.openIppPrinter;
+
+/** Create a pool of identical printers: createPrinterPool(printerNames, {strategy, refreshInterval}).
+ *   pool.print({data, type, docname, options}, callback) - sends the job to the least loaded
+ *     idle member (or the next one with strategy 'round-robin'), callback(err, {id, printer})
+ *   pool.stats() - load of every member
+ * Stopped printers and printers which reject jobs are skipped. A job failing because its member cannot be
+ * reached or refuses jobs is sent to the next member; a job refused for itself (options, format) fails at once.
+ */
+module.exports.createPrinterPool = printer_helper.createPrinterPool;
+
+/** Precompile CUPS options once to reuse them as `options` of many print jobs.
+ * e.g. var labelOptions = printer.createOptionSet({media: 'w4h6', 'print-quality': '5'});
+ */
+module.exports.createOptionSet = printer_helper.createOptionSet;
+
+/** Compile a label template with {{name}} placeholders once, then render labels straight into Buffers:
+ * e.g. var label = printer.compileLabelTemplate('^XA^FO50,50^FD{{sku}}^FS^XZ');
+ *      printer.printDirect({data: label.renderBatch(rows), type: 'RAW', ...});
+ *   render(fields) - one label, renderBatch(rows) - all the labels concatenated in one Buffer
+ */
+module.exports.compileLabelTemplate = printer_helper.compileLabelTemplate;
+
+/** Convert RGBA/RGB/grayscale pixels to a thermal printer graphic, sent as RAW data:
+ * e.g. printer.convertImage({data: rgba, width: 300, height: 120}, {width: 400, dither: 'floyd-steinberg', compress: true});
+ * returns a Buffer with a ZPL ^GF label, or ESC/POS GS v 0 commands with {format: 'escpos'}
+ */
+module.exports.convertImage = printer_helper.convertImage;
+
+/** Encode barcodes straight to printer raster, for printers without barcode fonts:
+ * e.g. printer.encodeBarcode('code128', skus, {dpi: 300, format: 'escpos'});
+ * an array of data gives all the codes in one Buffer, e.g. for one RAW job
+ */
+module.exports.encodeBarcode = printer_helper.encodeBarcode;
+
+/** Transcode a string to a printer codepage: encode(string, 'cp437', {replacement: '?'}) returns a Buffer.
+ * printDirect does the same with its `encoding` parameter
+ */
+module.exports.encode = printer_helper.encode;
+
 /** Get supported print format for printDirect
  */
 module.exports.getSupportedPrintFormats = printer_helper.getSupportedPrintFormats;
@@ -36,6 +163,8 @@ module.exports.getSupportedJobCommands = printer_helper.getSupportedJobCommands;
 /** get printer info object. It includes all active jobs
  */
 module.exports.getPrinter = getPrinter;
+/// same as getPrinter, asynchronously: getPrinterAsync(printerName, [options], [callback])
+module.exports.getPrinterAsync = getPrinterAsync;
 module.exports.getSelectedPaperSize = getSelectedPaperSize;
 module.exports.getPrinterDriverOptions = getPrinterDriverOptions;
 
@@ -46,6 +175,24 @@ module.exports.getDefaultPrinterName = getDefaultPrinterName;
  */
 module.exports.getJob = getJob;
 module.exports.setJob = setJob;
+/** Apply a command to many jobs in as few requests as possible, asynchronously:
+ * setJobs(printerName, command, jobIds, [callback]), command: CANCEL, CANCEL-MY, PURGE, HOLD, RELEASE or RESTART.
+ * The result is one {id, ok, error} entry per job id. Returns a Promise if callback is not provided.
+ */
+module.exports.setJobs = setJobs;
+/** Reprioritize, hold or retarget queued jobs without sending their documents again:
+ * setJobAttributes(printerName, jobIds, {priority, holdUntil, copies, name, printer, ...}, [callback]).
+ * `printer` moves the jobs to another queue, other names are IPP job attributes.
+ * The result is one {id, ok, error} entry per job id. Returns a Promise if callback is not provided.
+ */
+module.exports.setJobAttributes = setJobAttributes;
+
+/** Create a job state tracker: createJobTracker([printerName]), all printers if printerName is missing.
+ * tracker.poll(callback) calls callback(err, {created, changed, completed, removed}) with only the
+ * jobs which changed since the previous poll. The first poll reports the active jobs as created.
+ * tracker.reset() forgets the tracked state.
+ */
+module.exports.createJobTracker = printer_helper.createJobTracker;
 
 /**
  * return user defined printer, according to https://www.cups.org/documentation.php/doc-2.0/api-cups.html#cupsGetDefault2 :
@@ -83,6 +230,14 @@ function getPrinter(printerName)
     if(!printerName) {
         printerName = getDefaultPrinterName();
     }
+    var cached = readSharedCache();
+    if(cached){
+        for(var i = 0; i < cached.length; ++i){
+            if(cached[i].name === printerName){
+                return cached[i];
+            }
+        }
+    }
     var printer = printer_helper.getPrinter(printerName);
     correctPrinterinfo(printer);
     return printer;
@@ -128,16 +283,179 @@ function setJob(printerName, jobId, command)
 }
 
 function getPrinters(){
-    var printers = printer_helper.getPrinters();
+    var printers = readSharedCache();
+    if(printers){
+        return printers;
+    }
+    printers = printer_helper.getPrinters();
     if(printers && printers.length){
         var i = printers.length;
         for(i in printers){
             correctPrinterinfo(printers[i]);
         }
     }
+    publishSharedCache(printers);
     return printers;
 }
 
+var sharedCache = null;
+
+function enableSharedCache(options){
+    if(!printer_helper.openSharedCache){
+        throw new Error('Not supported');
+    }
+    options = options || {};
+    disableSharedCache();
+    var cache = {
+        segment: printer_helper.openSharedCache(options.name || 'node-printer', {size: options.size}),
+        maxAge: options.maxAge || 2000,
+        timer: null
+    };
+    if(options.owner){
+        // refresh before readers find the printers too old
+        var refresh = function(){
+            getPrintersAsync({maxAge: 0}, function(err, printers){
+                if(!err && sharedCache === cache){
+                    cache.segment.publish(JSON.stringify(printers));
+                }
+            });
+        };
+        cache.timer = setInterval(refresh, Math.max(cache.maxAge / 2, 50));
+        if(cache.timer.unref){
+            cache.timer.unref();
+        }
+        refresh();
+    }
+    sharedCache = cache;
+}
+
+function disableSharedCache(){
+    if(!sharedCache){
+        return;
+    }
+    if(sharedCache.timer){
+        clearInterval(sharedCache.timer);
+    }
+    sharedCache.segment.close();
+    sharedCache = null;
+}
+
+/** @return printers published by another process not older than maxAge, undefined otherwise
+ */
+function readSharedCache(){
+    if(!sharedCache){
+        return undefined;
+    }
+    var entry = sharedCache.segment.read();
+    if(!entry || entry.age > sharedCache.maxAge){
+        return undefined;
+    }
+    return JSON.parse(entry.data, reviveJobDate);
+}
+
+var jobDateKeys = {completedTime: true, creationTime: true, processingTime: true};
+
+// job times are Date objects, published as ISO strings
+function reviveJobDate(key, value){
+    return (jobDateKeys[key] && typeof(value) === 'string') ? new Date(value) : value;
+}
+
+// printers fetched by this process spare the next readers a query
+function publishSharedCache(printers){
+    if(sharedCache && printers){
+        sharedCache.segment.publish(JSON.stringify(printers));
+    }
+}
+
+/** Call native async fn with (args..., callback), or return a Promise if callback is missing.
+ * correct is applied to the result before it is passed on
+ */
+function callQuery(fn, args, callback, correct){
+    function run(done){
+        fn.apply(printer_helper, args.concat(function(err, res){
+            if(!err){
+                correct(res);
+            }
+            done(err, res);
+        }));
+    }
+    if(typeof(callback) === 'function'){
+        return run(callback);
+    }
+    return new Promise(function(resolve, reject){
+        run(function(err, res){
+            if(err){
+                reject(err);
+            } else {
+                resolve(res);
+            }
+        });
+    });
+}
+
+function getPrintersMulti(servers, options, callback){
+    if(typeof(options) === 'function'){
+        callback = options;
+        options = undefined;
+    }
+    if(!printer_helper.getPrintersMulti){
+        throw new Error('Not supported');
+    }
+    return callQuery(printer_helper.getPrintersMulti, [servers, options || {}], callback, function(result){
+        for(var i = 0; i < result.printers.length; ++i){
+            correctPrinterinfo(result.printers[i]);
+        }
+    });
+}
+
+function setJobs(printerName, command, jobIds, callback){
+    if(typeof(jobIds) === 'function'){
+        callback = jobIds;
+        jobIds = undefined;
+    }
+    if(!printer_helper.setJobs){
+        throw new Error('Not supported');
+    }
+    return callQuery(printer_helper.setJobs, [printerName, command, jobIds], callback, function(){});
+}
+
+function setJobAttributes(printerName, jobIds, attributes, callback){
+    if(!printer_helper.setJobAttributes){
+        throw new Error('Not supported');
+    }
+    return callQuery(printer_helper.setJobAttributes, [printerName, jobIds, attributes], callback, function(){});
+}
+
+function getPrintersAsync(options, callback){
+    if(typeof(options) === 'function'){
+        callback = options;
+        options = undefined;
+    }
+    if(!printer_helper.getPrintersAsync){
+        throw new Error('Not supported');
+    }
+    return callQuery(printer_helper.getPrintersAsync, [options || {}], callback, function(printers){
+        for(var i = 0; i < printers.length; ++i){
+            correctPrinterinfo(printers[i]);
+        }
+    });
+}
+
+function getPrinterAsync(printerName, options, callback){
+    if(typeof(options) === 'function'){
+        callback = options;
+        options = undefined;
+    }
+    // the local default printer means nothing on another server
+    if(!printerName && !(options && options.server)) {
+        printerName = getDefaultPrinterName();
+    }
+    if(!printer_helper.getPrinterAsync){
+        throw new Error('Not supported');
+    }
+    return callQuery(printer_helper.getPrinterAsync, [printerName, options || {}], callback, correctPrinterinfo);
+}
+
 function correctPrinterinfo(printer) {
     if(printer.status || !printer.options || !printer.options['printer-state']){
         return;
@@ -172,12 +490,26 @@ function correctPrinterinfo(printer) {
  parameters:
  parameters - Object, parameters objects with the following structure:
  data - String, mandatory, data to printer
- printer - String, optional, name of the printer, if missing, will try to print to default printer
+ printer - String, optional, name of the printer, if missing, will try to print to default printer.
+           A socket://host[:port] URI sends the data straight to the device (AppSocket/JetDirect, port 9100
+           by default) on a kept-alive connection, without the spooler. success is called once the data is written.
+           An ipp://host/path or ipps://host/path URI submits the job straight to the IPP printer, without cupsd
  docname - String, optional, name of document showed in printer status
  type - String, optional, only for wind32, data type, one of the RAW, TEXT
- options - JS object with CUPS options, optional
+ options - JS object with CUPS options or option set created by createOptionSet, optional
  success - Function, optional, callback function
  error - Function, optional, callback function if exists any error
+ coalesce - Boolean or Object {window, maxBytes}, optional, POSIX only, RAW type only. Data sent to the same
+            printer with the same options during window ms (50 by default) is concatenated into one job, sent
+            earlier if it reaches maxBytes (64 KiB by default). success is called with the id of the combined job
+            once CUPS accepted it, not once it is printed: a job failing on the printer is only seen by
+            following the id with getJob or createJobTracker
+ encoding - String, optional, codepage a string data is transcoded to: cp437, cp850, cp858 or windows-1252
+ replacement - String, optional, ASCII written instead of the characters missing from the codepage, '?' by default
+ preflight - Boolean, optional, POSIX only. Options are checked against the printer capabilities first, and the job
+             is rejected without sending data if a value is not supported or options conflict (see checkPrintOptions).
+             Coalesced and journaled jobs are checked before they are queued. Not supported on socket:// and
+             ipp:// printers, which are not CUPS queues
 
  or
 
@@ -196,7 +528,9 @@ function printDirect(parameters){
         , type
         , options
         , success
-        , error;
+        , error
+        , encoding
+        , replacement;
 
     if(arguments.length==1){
         //TODO: check parameters type
@@ -208,6 +542,8 @@ function printDirect(parameters){
         options = parameters.options||{};
         success = parameters.success;
         error = parameters.error;
+        encoding = parameters.encoding;
+        replacement = parameters.replacement;
     }else{
         printer = arguments[1];
         type = arguments[2];
@@ -221,8 +557,27 @@ function printDirect(parameters){
         type = "RAW";
     }
 
+    var preflight = (arguments.length==1) ? parameters.preflight : undefined;
+
+    if(typeof(printer) === 'string' && printer.indexOf('socket://') === 0){
+        if(preflight){
+            // the device is not a CUPS queue: there are no capabilities to check against
+            return (error || function(err){ throw err; })(new TypeError("printDirect:preflight is not supported on socket printers"));
+        }
+        return printSocket(data, printer, success, error, encoding, replacement);
+    }
+    if(isIppPrinterUri(printer)){
+        if(encoding && typeof(data) === 'string'){
+            data = printer_helper.encode(data, encoding, {replacement: replacement});
+        }
+        return printIpp('print', {data: data, type: type, docname: docname, options: options, preflight: preflight}, printer, success, error);
+    }
+
+    // a remote server resolves its own default printer
+    var server = (arguments.length==1) ? parameters.server : undefined;
+
     // Set default printer name
-    if(!printer) {
+    if(!printer && !server) {
         printer = getDefaultPrinterName();
     }
 
@@ -236,12 +591,29 @@ function printDirect(parameters){
         options = {};
     }
 
+    if(arguments.length==1 && parameters.journal){
+        // acknowledged once appended, the journal submits the job
+        try{
+            success(parameters.journal.append({data: data, printer: printer, docname: docname, type: type, options: options,
+                encoding: encoding, replacement: replacement, preflight: preflight}));
+        }catch(e){
+            error(e);
+        }
+        return;
+    }
+
+    if(arguments.length==1 && parameters.coalesce && type === "RAW" && !server){
+        return printDirectCoalesced(data, printer, docname, options, parameters.coalesce, success, error, encoding, replacement, preflight);
+    }
+
     //TODO: check parameters type
     if(printer_helper.printDirect){// call C++ binding
         try{
-            var res = printer_helper.printDirect(data, printer, docname, type, options);
+            var res = printer_helper.printDirect({data: data, printer: printer, docname: docname, type: type, options: options,
+                encoding: encoding, replacement: replacement, server: server, preflight: preflight});
             if(res){
-                success(res);
+                // posix returns the job object, windows a boolean
+                success(res.id !== undefined ? res.id : res);
             }else{
                 error(Error("Something wrong in printDirect"));
             }
@@ -253,14 +625,127 @@ function printDirect(parameters){
     }
 }
 
+function printSocket(data, printer, success, error, encoding, replacement){
+    success = success || function(){};
+    error = error || function(err){ throw err; };
+    try{
+        printer_helper.printSocket({data: data, printer: printer, encoding: encoding, replacement: replacement}, function(err, job){
+            if(err){
+                error(err);
+            }else{
+                success(job.id);
+            }
+        });
+    }catch(e){
+        error(e);
+    }
+}
+
+var ippPrinters = {},
+    // callbacks waiting for a handle being opened, by URI
+    ippPrintersOpening = {};
+
+function isIppPrinterUri(printer){
+    return typeof(printer) === 'string' && (printer.indexOf('ipp://') === 0 || printer.indexOf('ipps://') === 0);
+}
+
+// jobs to the same URI share one handle, so one kept-alive connection to the device.
+// The handle is opened and used asynchronously: the device is never waited for on the main thread
+function printIpp(method, params, printer, success, error){
+    success = success || function(){};
+    error = error || function(err){ throw err; };
+    function submit(err, handle){
+        if(err){
+            return error(err);
+        }
+        try{
+            handle[method](params, function(err, job){
+                if(err){
+                    error(err);
+                }else{
+                    success(job.id);
+                }
+            });
+        }catch(e){
+            error(e);
+        }
+    }
+
+    if(ippPrinters[printer]){
+        return submit(null, ippPrinters[printer]);
+    }
+    if(ippPrintersOpening[printer]){
+        // jobs sent while the handle is being opened wait for it
+        return ippPrintersOpening[printer].push(submit);
+    }
+    var waiting = ippPrintersOpening[printer] = [submit];
+    function opened(err, handle){
+        delete ippPrintersOpening[printer];
+        if(!err){
+            ippPrinters[printer] = handle;
+        }
+        waiting.forEach(function(next){ next(err, handle); });
+    }
+    try{
+        printer_helper.openIppPrinter(printer, opened);
+    }catch(e){
+        opened(e);
+    }
+}
+
+function printDirectCoalesced(data, printer, docname, options, coalesce, success, error, encoding, replacement, preflight){
+    success = success || function(){};
+    error = error || function(err){ throw err; };
+    if(!printer_helper.printDirectCoalesced){
+        return error(new Error("Not supported"));
+    }
+    try{
+        printer_helper.printDirectCoalesced({
+            data: data,
+            printer: printer,
+            docname: docname,
+            options: options,
+            encoding: encoding,
+            replacement: replacement,
+            window: coalesce.window,
+            maxBytes: coalesce.maxBytes,
+            preflight: preflight
+        }, function(err, job){
+            if(err){
+                error(err);
+            }else{
+                success(job.id);
+            }
+        });
+    }catch(e){
+        error(e);
+    }
+}
+
 /**
 parameters:
    parameters - Object, parameters objects with the following structure:
       filename - String, mandatory, data to printer
       docname - String, optional, name of document showed in printer status
-      printer - String, optional, mane of the printer, if missed, will try to retrieve the default printer name
+      printer - String, optional, mane of the printer, if missed, will try to retrieve the default printer name.
+                An ipp:// or ipps:// URI submits the file straight to the IPP printer, without cupsd
       success - Function, optional, callback function
       error - Function, optional, callback function if exists any error
+      chunkSize - Number, optional, POSIX only. If set (or if progress is set), the file is memory mapped and sent
+                  asynchronously by chunks of chunkSize bytes. The call returns then a transfer object with a cancel() method
+      progress - Function, optional, POSIX only, called during a chunked transfer with
+                 {bytesSent, totalBytes, percent, mbPerSecond, eta} (eta in seconds)
+      type - String, optional, data type for chunked transfer (AUTO by default, PDF for split mode)
+      printers - Array of String, optional, POSIX only. Split mode: the pages are split in disjoint page-ranges,
+                 one job per printer, all sent concurrently. success is called with [{printer, pages, ok, id, error}],
+                 progress with {bytesSent, totalBytes, percent, jobsDone, jobs}. Every job uploads the whole file,
+                 CUPS keeping only its pages: N printers send N times the file
+      pageCount - Number, optional, page count of the file for split mode. Without it the pages are counted in the
+                  PDF; if that count is not reliable (compressed object streams, incremental updates) the file is
+                  sent as one job to the first printer, with pages 'all'
+      preflight - Boolean, optional, POSIX only. Options are checked against the printer capabilities first, and
+                  the file is not uploaded if a value is not supported or options conflict (see checkPrintOptions).
+                  Applies to chunked transfers and, against every printer, to split mode. Not supported on ipp:// printers
 */
 function printFile(parameters){
     var filename,
@@ -296,30 +781,47 @@ function printFile(parameters){
         return error(err);
     }
 
+    // set filename if docname is missing
+    if(!docname){
+        docname = filename;
+    }
+
+    if(Array.isArray(parameters.printers)){
+        return printFileSplit(filename, docname, options, parameters, success, error);
+    }
+
+    if(isIppPrinterUri(printer)){
+        return printIpp('printFile', {filename: filename, type: parameters.type, docname: docname, options: options,
+            preflight: parameters.preflight}, printer, success, error);
+    }
+
+    // a remote server resolves its own default printer
+    var server = parameters.server;
+
     // try to define default printer name
-    if(!printer) {
+    if(!printer && !server) {
         printer = getDefaultPrinterName();
     }
 
-    if(!printer) {
+    if(!printer && !server) {
         return error(new Error('Printer parameter of default printer is not defined'));
     }
 
-    // set filename if docname is missing
-    if(!docname){
-        docname = filename;
+    if((parameters.chunkSize || parameters.progress) && !server){
+        return printFileChunked(filename, docname, printer, options, parameters, success, error);
     }
 
     //TODO: check parameters type
     if(printer_helper.printFile){// call C++ binding
         try{
             // TODO: proper success/error callbacks from the extension
-            var res = printer_helper.printFile(filename, docname, printer, options);
+            var res = printer_helper.printFile({filename: filename, docname: docname, printer: printer, options: options, server: server,
+                preflight: parameters.preflight});
 
-            if(!isNaN(parseInt(res))) {
-                success(res);
+            if(res && !isNaN(parseInt(res.id))) {
+                success(res.id);
             } else {
-                error(Error(res));
+                error(Error("Something wrong in printFile"));
             }
         } catch (e) {
             error(e);
@@ -328,3 +830,142 @@ function printFile(parameters){
         error("Not supported");
     }
 }
+
+function printFileChunked(filename, docname, printer, options, parameters, success, error){
+    if(!printer_helper.printFileChunked){
+        return error(new Error("Not supported"));
+    }
+    try{
+        return printer_helper.printFileChunked({
+            filename: filename,
+            docname: docname,
+            printer: printer,
+            type: parameters.type ? parameters.type.toUpperCase() : undefined,
+            options: options,
+            chunkSize: parameters.chunkSize,
+            preflight: parameters.preflight
+        }, parameters.progress || function(){}, function(err, jobId){
+            if(err){
+                error(err);
+            }else{
+                success(jobId);
+            }
+        });
+    }catch(e){
+        error(e);
+    }
+}
+
+function printFileSplit(filename, docname, options, parameters, success, error){
+    if(!printer_helper.printFileSplit){
+        return error(new Error("Not supported"));
+    }
+    try{
+        return printer_helper.printFileSplit({
+            filename: filename,
+            docname: docname,
+            printers: parameters.printers,
+            type: parameters.type ? parameters.type.toUpperCase() : undefined,
+            pageCount: parameters.pageCount,
+            options: options,
+            preflight: parameters.preflight
+        }, parameters.progress || function(){}, function(err, jobs){
+            if(err){
+                err.jobs = jobs;
+                error(err);
+            }else{
+                success(jobs);
+            }
+        });
+    }catch(e){
+        error(e);
+    }
+}
+
+/**
+ Create a Writable stream which sends everything written to it to the printer as one job.
+ The document is spooled chunk by chunk, so only the chunks buffered by the stream are kept in memory.
+ The stream emits 'job' event with the job id when the document was completely sent.
+
+ parameters:
+   parameters - Object, optional, parameters objects with the following structure:
+      printer - String, optional, name of the printer, if missing, will try to print to default printer
+      docname - String, optional, name of document showed in printer status
+      type - String, optional, data type, one of the RAW, TEXT, PDF, ... (see getSupportedPrintFormats)
+      options - JS object with CUPS options, optional
+      highWaterMark - Number, optional, bytes buffered by the stream before write() returns false
+      preflight - Boolean, optional, the options are checked against the printer capabilities
+                  and the stream is not created if the printer would not accept them (see checkPrintOptions)
+*/
+function createPrintStream(parameters){
+    var params = parameters || {},
+        inFlight = 0,
+        onIdle = null,
+        finished = false,
+        handle,
+        printStream;
+
+    if(!printer_helper.createPrintStream){
+        throw new Error("Not supported");
+    }
+
+    handle = printer_helper.createPrintStream({
+        printer: params.printer,
+        docname: params.docname,
+        type: (params.type || "RAW").toUpperCase(),
+        options: params.options || {},
+        preflight: params.preflight
+    });
+
+    // native handle accepts only one operation at a time
+    function call(method, args, callback){
+        inFlight++;
+        handle[method].apply(handle, args.concat(function(err, jobId){
+            inFlight--;
+            callback(err, jobId);
+            if(!inFlight && onIdle){
+                var fn = onIdle;
+                onIdle = null;
+                fn();
+            }
+        }));
+    }
+
+    printStream = new stream.Writable({
+        highWaterMark: params.highWaterMark,
+        construct: function(callback){
+            call('open', [], function(err){ callback(err); });
+        },
+        write: function(chunk, encoding, callback){
+            call('write', [chunk], function(err){ callback(err); });
+        },
+        writev: function(chunks, callback){
+            call('write', [chunks.map(function(item){ return item.chunk; })], function(err){ callback(err); });
+        },
+        final: function(callback){
+            call('finish', [], function(err, jobId){
+                if(!err){
+                    finished = true;
+                    printStream.jobId = jobId;
+                    printStream.emit('job', jobId);
+                }
+                callback(err);
+            });
+        },
+        destroy: function(err, callback){
+            if(finished){
+                return callback(err);
+            }
+            // cancel the partially sent job
+            var abort = function(){
+                handle.abort(function(){ callback(err); });
+            };
+            if(inFlight){
+                onIdle = abort;
+            }else{
+                abort();
+            }
+        }
+    });
+    return printStream;
+}
@@ -1,14 +1,40 @@
 #include "node_printer.hpp"
 
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
+    env.SetInstanceData(new AddonData());
     exports.Set(Napi::String::New(env, "getPrinters"), Napi::Function::New(env, getPrinters));
     exports.Set(Napi::String::New(env, "getDefaultPrinterName"), Napi::Function::New(env, getDefaultPrinterName));
     exports.Set(Napi::String::New(env, "getPrinter"), Napi::Function::New(env, getPrinter));
+    exports.Set(Napi::String::New(env, "getPrintersAsync"), Napi::Function::New(env, getPrintersAsync));
+    exports.Set(Napi::String::New(env, "getPrinterAsync"), Napi::Function::New(env, getPrinterAsync));
+    exports.Set(Napi::String::New(env, "getPrintersMulti"), Napi::Function::New(env, getPrintersMulti));
+    exports.Set(Napi::String::New(env, "openSharedCache"), Napi::Function::New(env, openSharedCache));
+    exports.Set(Napi::String::New(env, "openSpoolJournal"), Napi::Function::New(env, openSpoolJournal));
+    exports.Set(Napi::String::New(env, "setPrintBackend"), Napi::Function::New(env, setPrintBackend));
+    exports.Set(Napi::String::New(env, "getPrintBackend"), Napi::Function::New(env, getPrintBackend));
+    exports.Set(Napi::String::New(env, "createJobScheduler"), Napi::Function::New(env, createJobScheduler));
+    exports.Set(Napi::String::New(env, "checkPrintOptions"), Napi::Function::New(env, checkPrintOptions));
+    exports.Set(Napi::String::New(env, "createJobTracker"), Napi::Function::New(env, createJobTracker));
     exports.Set(Napi::String::New(env, "getPrinterDriverOptions"), Napi::Function::New(env, getPrinterDriverOptions));
     exports.Set(Napi::String::New(env, "getJob"), Napi::Function::New(env, getJob));
     exports.Set(Napi::String::New(env, "setJob"), Napi::Function::New(env, setJob));
+    exports.Set(Napi::String::New(env, "setJobs"), Napi::Function::New(env, setJobs));
+    exports.Set(Napi::String::New(env, "setJobAttributes"), Napi::Function::New(env, setJobAttributes));
     exports.Set(Napi::String::New(env, "printDirect"), Napi::Function::New(env, PrintDirect));
+    exports.Set(Napi::String::New(env, "printDirectCoalesced"), Napi::Function::New(env, PrintDirectCoalesced));
+    exports.Set(Napi::String::New(env, "printSocket"), Napi::Function::New(env, PrintSocket));
     exports.Set(Napi::String::New(env, "printFile"), Napi::Function::New(env, PrintFile));
+    exports.Set(Napi::String::New(env, "printFileChunked"), Napi::Function::New(env, PrintFileChunked));
+    exports.Set(Napi::String::New(env, "printFileSplit"), Napi::Function::New(env, PrintFileSplit));
+    exports.Set(Napi::String::New(env, "createPrintStream"), Napi::Function::New(env, createPrintStream));
+    exports.Set(Napi::String::New(env, "createOptionSet"), Napi::Function::New(env, createOptionSet));
+    exports.Set(Napi::String::New(env, "compileLabelTemplate"), Napi::Function::New(env, compileLabelTemplate));
+    exports.Set(Napi::String::New(env, "convertImage"), Napi::Function::New(env, convertImage));
+    exports.Set(Napi::String::New(env, "encodeBarcode"), Napi::Function::New(env, encodeBarcode));
+    exports.Set(Napi::String::New(env, "encode"), Napi::Function::New(env, encode));
+    exports.Set(Napi::String::New(env, "openPrinter"), Napi::Function::New(env, openPrinter));
+    exports.Set(Napi::String::New(env, "openIppPrinter"), Napi::Function::New(env, openIppPrinter));
+    exports.Set(Napi::String::New(env, "createPrinterPool"), Napi::Function::New(env, createPrinterPool));
     exports.Set(Napi::String::New(env, "getSupportedPrintFormats"), Napi::Function::New(env, getSupportedPrintFormats));
     exports.Set(Napi::String::New(env, "getSupportedJobCommands"), Napi::Function::New(env, getSupportedJobCommands));
     
@@ -19,6 +45,11 @@ NODE_API_MODULE(node_printer, Init)
 
 // Helpers
 
+AddonData& getAddonData(Napi::Env env)
+{
+    return *env.GetInstanceData<AddonData>();
+}
+
 bool getStringOrBufferFromV8Value(Napi::Value iV8Value, std::string &oData)
 {
     if(iV8Value.IsString())
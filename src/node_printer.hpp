@@ -3,6 +3,8 @@
 
 #include <napi.h>
 #include <string>
+#include <map>
+#include <memory>
 
 /**
  * Send data to printer
@@ -11,6 +13,7 @@
  * @param printername String, mandatory, specifying printer name
  * @param docname String, mandatory, specifying document name
  * @param type String, mandatory, specifying data type. E.G.: RAW, TEXT, ...
+ * @param server String, optional, CUPS server (host[:port]) to submit to, on a pooled connection
  *
  * @returns true for success, false for failure.
  */
@@ -22,11 +25,152 @@ Napi::Value PrintDirect(const Napi::CallbackInfo& info);
  * @param filename String, mandatory, specifying filename to print
  * @param docname String, mandatory, specifying document name
  * @param printer String, mandatory, specifying printer name
+ * @param server String, optional, CUPS server (host[:port]) to submit to, on a pooled connection
  *
  * @returns jobId for success, or error message for failure.
  */
 Napi::Value PrintFile(const Napi::CallbackInfo& info);
 
+/**
+ * Send tiny RAW data to printer, concatenated with the other data sent to the same printer
+ * with the same options during a time window, as one job
+ *
+ * @param params Object, mandatory: data String/Buffer, and optional printer, docname, options,
+ *      window Number (ms, 50 by default), maxBytes Number (combined job size which sends the job at once, 64 KiB by default)
+ * @param callback Function, mandatory, called with (error, {id, index, count}) once the combined job is accepted
+ *      by the server, before it is printed: id of the combined job, position of this data in it and number of data combined
+ */
+Napi::Value PrintDirectCoalesced(const Napi::CallbackInfo& info);
+
+/**
+ * Send data straight to an AppSocket/JetDirect device, without CUPS, on a persistent connection
+ *
+ * @param params Object, mandatory: printer String (socket://host[:port], port 9100 by default),
+ *      data String/NativeBuffer, and optional encoding, replacement as printDirect
+ * @param callback Function, mandatory, called with (error, {id, printer}) once the data is written to the connection
+ *
+ * @returns id of the job, local to the process as AppSocket has no job ids
+ */
+Napi::Value PrintSocket(const Napi::CallbackInfo& info);
+
+/**
+ * Precompile CUPS options to reuse them for many jobs
+ *
+ * @param options Object, mandatory, option name/value pairs
+ *
+ * @returns option set handle, accepted as options parameter by all print functions
+ */
+Napi::Value createOptionSet(const Napi::CallbackInfo& info);
+
+/**
+ * Compile a ZPL/EPL/ESC-POS label template with {{name}} placeholders once, to render many labels
+ *
+ * @param source String/NativeBuffer, mandatory, template text
+ *
+ * @returns template handle with render(fields) and renderBatch(rows) methods, returning a Buffer
+ *      to pass as printDirect data, and fields, fixedSize properties
+ */
+Napi::Value compileLabelTemplate(const Napi::CallbackInfo& info);
+
+/**
+ * Convert an image to a 1 bit per dot printer graphic
+ *
+ * @param image Object, mandatory: data NativeBuffer of gray, gray+alpha, RGB or RGBA pixels, width, height
+ *      and optional channels Number (computed from the data size if missing)
+ * @param options Object, optional: width, height (scaled size, the aspect ratio is kept if only one is set),
+ *      dither ('threshold' by default or 'floyd-steinberg'), threshold (128 by default), invert Boolean,
+ *      format ('zpl' by default, 'escpos' or 'bitmap'), compress Boolean (ZPL Z64 data), label Boolean (ZPL ^XA...^XZ, true by default)
+ *
+ * @returns NativeBuffer, ^GF or GS v 0 commands ready to print as RAW data, or packed rows for 'bitmap'
+ */
+Napi::Value convertImage(const Napi::CallbackInfo& info);
+
+/**
+ * Encode Code 128, EAN-13 or QR codes as 1 bit per dot printer graphics
+ *
+ * @param type String, mandatory: 'code128', 'ean13' or 'qr'
+ * @param data String or Array of String, mandatory, one graphic per string
+ * @param options Object, optional: dpi (203 by default), moduleSize (mm) or module (dots), height (mm, linear codes),
+ *      quietZone (modules), errorCorrection ('L', 'M' by default, 'Q' or 'H'), and format, compress, label as convertImage
+ *
+ * @returns NativeBuffer with the graphics of all the codes, ready to print as RAW data
+ */
+Napi::Value encodeBarcode(const Napi::CallbackInfo& info);
+
+/**
+ * Transcode a string to a printer codepage
+ *
+ * @param data String, mandatory
+ * @param encoding String, mandatory: 'cp437', 'cp850', 'cp858', 'windows-1252' or 'utf8'
+ * @param options Object, optional: replacement String, ASCII, written instead of the characters
+ *      missing from the codepage ('?' by default, '' to drop them)
+ *
+ * @returns NativeBuffer
+ */
+Napi::Value encode(const Napi::CallbackInfo& info);
+
+/**
+ * Send file to printer by chunks from a memory mapping, asynchronously
+ *
+ * @param params Object, mandatory, printFile parameters (filename, printer, docname, options)
+ *      and optional type (AUTO by default) and chunkSize in bytes
+ * @param progress Function, mandatory, called with {bytesSent, totalBytes, percent, mbPerSecond, eta}
+ * @param callback Function, mandatory, called with (error, jobId)
+ *
+ * @returns transfer handle with a cancel() method
+ */
+Napi::Value PrintFileChunked(const Napi::CallbackInfo& info);
+
+/**
+ * Print a file as several jobs with disjoint page-ranges, one per printer, sent concurrently.
+ * Each job uploads the whole file, the server keeping only its pages
+ *
+ * @param params Object, mandatory: filename, printers Array of String, and optional
+ *      docname, type (PDF by default), options, pageCount (counted from the PDF if missing,
+ *      the file is sent as one job to the first printer if the count is not reliable)
+ * @param progress Function, mandatory, called with {bytesSent, totalBytes, percent, jobsDone, jobs}
+ * @param callback Function, mandatory, called with (error, [{printer, pages, ok, id, error}])
+ *
+ * @returns transfer handle with a cancel() method
+ */
+Napi::Value PrintFileSplit(const Napi::CallbackInfo& info);
+
+/**
+ * Open a printer handle for fast repeated submissions
+ *
+ * @param printer String, optional, printer name. Default printer is used if missing.
+ *      An ipp:// or ipps:// URI opens the printer without CUPS scheduler, see openIppPrinter
+ * @param options Object, optional, server String: CUPS server (host[:port]) the printer is resolved on
+ *
+ * @returns printer handle with print(params), printFile(params), jobs([which]), cancel(jobId)
+ *      and close() methods, and name, uri properties
+ */
+Napi::Value openPrinter(const Napi::CallbackInfo& info);
+
+/**
+ * Open a handle on a printer reached by its URI, without CUPS scheduler (driverless IPP)
+ *
+ * @param uri String, mandatory, ipp:// or ipps:// printer URI, e.g. ipp://192.168.1.20/ipp/print
+ *
+ * @returns printer handle with the methods of openPrinter, plus attributes([names]) which returns
+ *      the printer attributes (Get-Printer-Attributes)
+ */
+Napi::Value openIppPrinter(const Napi::CallbackInfo& info);
+
+/**
+ * Create a print stream: a job which receives the document by chunks
+ *
+ * @param params Object, mandatory, with the following optional properties:
+ *      printer String, printer name. Default printer is used if missing
+ *      type String, data type. E.G.: RAW, TEXT, ... (RAW by default)
+ *      docname String, document name
+ *      options Object, CUPS options
+ *
+ * @returns native stream handle with open(cb), write(buffers, cb), finish(cb), abort(cb) methods.
+ *      Callbacks are called with (error, jobId)
+ */
+Napi::Value createPrintStream(const Napi::CallbackInfo& info);
+
 /** Retrieve all printers and jobs
  * posix: minimum version: CUPS 1.1.21/OS X 10.4
  */
@@ -42,6 +186,121 @@ Napi::Value getDefaultPrinterName(const Napi::CallbackInfo& info);
  */
 Napi::Value getPrinter(const Napi::CallbackInfo& info);
 
+/** Retrieve all printers and jobs asynchronously.
+ * Concurrent calls share one query to the print server.
+ * @param options Object, optional, maxAge Number: age in ms of an already fetched result which may be reused,
+ *      server String: CUPS server (host[:port]) to query, on a pooled connection
+ * @param callback Function, mandatory, called with (error, printers)
+ */
+Napi::Value getPrintersAsync(const Napi::CallbackInfo& info);
+
+/** Retrieve printers and jobs of several CUPS servers, queried in parallel on worker threads
+ * @param servers Array of String, mandatory, host, host:port or [ipv6]:port
+ * @param options Object, optional, timeout Number: connection timeout in ms per server, 30000 by default
+ * @param callback Function, mandatory, called with (error, {printers, errors}): printers of all servers
+ *      with their server, and one {server, message} per failed server. error only if all servers failed
+ */
+Napi::Value getPrintersMulti(const Napi::CallbackInfo& info);
+
+/** Open or create a named shared memory segment where printers are published for other processes
+ * of the host, e.g. cluster workers, which read them without locks and without querying the print server
+ * @param name String, mandatory, segment name, the same for all processes
+ * @param options Object, optional, size Number: segment size in bytes if it is created, 4 MiB by default
+ *
+ * @returns cache handle with read(), returning {data, age, version} or undefined if nothing was published,
+ *      publish(data String), returning false if another process is publishing or data is too big,
+ *      close() methods, and name, capacity properties
+ */
+Napi::Value openSharedCache(const Napi::CallbackInfo& info);
+
+/** Open a write-ahead spool journal: jobs are appended to memory mapped segment files and
+ * acknowledged at once, then submitted to CUPS in order by a drainer thread which retries while
+ * the server fails. Pending jobs left by a previous process are submitted again.
+ * @param directory String, mandatory, journal directory, used by one process at a time
+ * @param options Object, optional: segmentSize Number (bytes, 16 MiB by default),
+ *      syncInterval Number (ms between two syncs to disk, 10 by default),
+ *      syncBytes Number (appended bytes which sync at once, 1 MiB by default),
+ *      retryTimeout Number (ms a failing job is retried before it is dropped, 10 minutes by default, 0 for no limit),
+ *      onJob Function called with (error, {sequence, id}) once a job is submitted or dropped
+ *
+ * @returns journal handle with append(params) returning the job sequence, params as printDirect,
+ *      sync() returning the last sequence on disk, stats() and close() methods, and directory property
+ */
+Napi::Value openSpoolJournal(const Napi::CallbackInfo& info);
+
+/** Select where jobs are submitted, for all threads: printDirect, printFile, coalesced jobs and the spool journal
+ * @param name String, mandatory: cups (default), null (acknowledged at once, nothing is stored)
+ *      or file (each job written to its own file)
+ * @param options Object, optional, for file: directory String, mandatory, sync Boolean (fsync each job)
+ */
+Napi::Value setPrintBackend(const Napi::CallbackInfo& info);
+
+/** @returns {name, jobs, bytes, errors} of the current backend, counted since it was selected
+ */
+Napi::Value getPrintBackend(const Napi::CallbackInfo& info);
+
+/** Create a job scheduler in front of the print backend: submit(params, callback) queues a job
+ * (printDirect params with server and preflight, plus class and tenant) and calls back with (err, {id, class, tenant, waitMs}) once submitted.
+ * Classes are served by priority, with aging, tenants of a class by weighted fair queuing,
+ * and the class priority is sent as job-priority unless the job options have one.
+ * @param options Object, optional: concurrency Number (submitting threads, 4), classes Object
+ *      ({name: job-priority 1..100}, {urgent: 90, normal: 50, bulk: 10} by default),
+ *      aging Number (ms waited per class promotion, 2000), tenants Object ({name: weight}, 1 by default)
+ * @returns scheduler with submit, stats and close methods
+ */
+Napi::Value createJobScheduler(const Napi::CallbackInfo& info);
+
+/** Check print options against the printer capabilities, without printing.
+ * Capabilities and results are cached, so checking the options of a job printed before costs no request.
+ * @param printer name String, mandatory
+ * @param options Object or option set, optional
+ * @param params Object, optional: server String
+ * @returns {valid, errors} with errors the unsupported values and conflicting options
+ */
+Napi::Value checkPrintOptions(const Napi::CallbackInfo& info);
+
+/** Retrieve printer info and jobs asynchronously.
+ * Concurrent calls for the same printer share one query to the print server.
+ * @param printer name String
+ * @param options Object, optional, maxAge Number: age in ms of an already fetched result which may be reused,
+ *      server String: CUPS server (host[:port]) to query, on a pooled connection
+ * @param callback Function, mandatory, called with (error, printer)
+ */
+Napi::Value getPrinterAsync(const Napi::CallbackInfo& info);
+
+/** Create a job state tracker which reports only what changed between two polls
+ * @param printer name String, optional, all printers if missing
+ * @returns tracker handle with poll(cb) and reset() methods.
+ *      poll callback is called with (error, {created, changed, completed, removed})
+ */
+Napi::Value createJobTracker(const Napi::CallbackInfo& info);
+
+/** Apply a command to many jobs, asynchronously
+ * @param printer name String
+ * @param command String: CANCEL, CANCEL-MY, PURGE, HOLD, RELEASE or RESTART
+ * @param jobIds Array of Number, job ids. Optional for CANCEL-MY (all jobs of the user), not allowed for PURGE
+ * @param callback Function, called with (error, [{id, ok, error}])
+ */
+Napi::Value setJobs(const Napi::CallbackInfo& info);
+
+/** Change attributes of queued jobs without sending their documents again, asynchronously
+ * @param printer name String
+ * @param jobIds Array of Number, job ids
+ * @param attributes Object: priority (1-100), holdUntil, copies, name, any other IPP job attribute,
+ *      and printer String to move the jobs to another queue
+ * @param callback Function, called with (error, [{id, ok, error}])
+ */
+Napi::Value setJobAttributes(const Napi::CallbackInfo& info);
+
+/** Create a pool of printers which routes each job to the least loaded member
+ * @param printers Array of String, mandatory, printer names
+ * @param options Object, optional: strategy String (least-loaded by default, or round-robin),
+ *      refreshInterval Number, ms between two refreshes of the members state and queue depth (1000 by default)
+ * @returns pool handle with print({data, type, docname, options}, cb) and stats() methods.
+ *      print callback is called with (error, {id, printer})
+ */
+Napi::Value createPrinterPool(const Napi::CallbackInfo& info);
+
 /** Retrieve printer driver info
  * @param printer name String
  */
@@ -108,6 +367,30 @@ protected:
     virtual void free() {};
 };
 
+/** Background service of the addon started on first use in an environment, e.g. a thread
+ * calling back into it. Its own environment cleanup hook stops it and removes it from AddonData
+ */
+class AddonService
+{
+public:
+    virtual ~AddonService() {}
+};
+
+/** State of the addon in one environment, the main thread or a worker: constructors of the
+ * wrapped classes and services belong to the environment which created them. Deleted with the environment.
+ */
+struct AddonData
+{
+    /** class name to its constructor, defined on first use */
+    std::map<std::string, Napi::FunctionReference> constructors;
+    /** service name to the service, started on first use */
+    std::map<std::string, std::unique_ptr<AddonService>> services;
+};
+
+/** @returns the addon state of env, created when the addon is loaded in it
+ */
+AddonData& getAddonData(Napi::Env env);
+
 /**
  * try to extract String or buffer from v8 value
  * @param iV8Value - source v8 value
@@ -116,4 +399,16 @@ protected:
  */
 bool getStringOrBufferFromV8Value(Napi::Value iV8Value, std::string &oData);
 
+/** Transcode a JS string to a single byte codepage: cp437, cp850, cp858, windows-1252 (or utf8).
+ * Characters without a byte in the codepage are replaced by iReplacement
+ * @returns false with oError set if the encoding is not supported
+ */
+bool encodeV8String(Napi::Value iString, const std::string &iEncoding, const std::string &iReplacement, std::string &oData, std::string &oError);
+
+/** Transcode the string data of print parameters to their encoding, with their replacement ('?' by default)
+ * @param oEncoded false if data is not a string or there is no encoding
+ * @returns false with oError set if the encoding is not supported
+ */
+bool getEncodedDataFromV8Params(Napi::Object iParams, std::string &oData, bool &oEncoded, std::string &oError);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,336 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace
+{
+    /** libcups, the default: jobs go to the CUPS scheduler
+     */
+    class CupsPrintBackend: public PrintBackend
+    {
+    public:
+        const char* name() const { return "cups"; }
+
+    protected:
+        int submitData(const std::string &iServer, const std::string &iPrinterName, const std::string &iDocname, const std::string &iFormat,
+            const CupsOptions &iOptions, const char *iData, size_t iSize, ipp_status_t &oStatus, std::string &oError)
+        {
+            // the data is streamed as a document of iFormat, on a connection owned until the job is complete:
+            // a failed upload leaves it in an unknown state, and the job is cancelled on another one
+            std::string server = iServer.empty() ? std::string(cupsServer()) : iServer;
+            PooledCupsConnection connection(server);
+            if(connection.get() == NULL)
+            {
+                oError = "Print Error: unable to connect to CUPS server " + server;
+                oStatus = IPP_STATUS_ERROR_SERVICE_UNAVAILABLE;
+                return 0;
+            }
+            int job_id = cupsCreateJob(connection.get(), iPrinterName.c_str(), iDocname.c_str(), iOptions.size(), iOptions.get());
+            if(job_id == 0)
+            {
+                setError(oStatus, oError);
+                connection.discard();
+                return 0;
+            }
+            const char *format = iFormat.empty() ? CUPS_FORMAT_AUTO : iFormat.c_str();
+            if(cupsStartDocument(connection.get(), iPrinterName.c_str(), job_id, iDocname.c_str(), format, 1/*last document*/) != HTTP_STATUS_CONTINUE
+                || cupsWriteRequestData(connection.get(), iData, iSize) != HTTP_STATUS_CONTINUE)
+            {
+                setError(oStatus, oError);
+                connection.discard();
+                PooledCupsConnection cancel_connection(server);
+                cupsCancelJob2(cancel_connection.get(), iPrinterName.c_str(), job_id, 0);
+                return 0;
+            }
+            if(cupsFinishDocument(connection.get(), iPrinterName.c_str()) > IPP_STATUS_OK_CONFLICTING)
+            {
+                setError(oStatus, oError);
+                connection.discard();
+                return 0;
+            }
+            return job_id;
+        }
+
+        int submitFile(const std::string &iServer, const std::string &iPrinterName, const std::string &iFilename, const std::string &iDocname,
+            const CupsOptions &iOptions, ipp_status_t &oStatus, std::string &oError)
+        {
+            PooledCupsConnection connection(iServer);
+            if(!connection.isDefault() && connection.get() == NULL)
+            {
+                oError = "Print Error: unable to connect to CUPS server " + iServer;
+                oStatus = IPP_STATUS_ERROR_SERVICE_UNAVAILABLE;
+                return 0;
+            }
+            int job_id = cupsPrintFile2(connection.get(), iPrinterName.c_str(), iFilename.c_str(), iDocname.c_str(), iOptions.size(), iOptions.get());
+            if(job_id == 0)
+            {
+                setError(oStatus, oError);
+                connection.discard();
+            }
+            return job_id;
+        }
+
+    private:
+        static void setError(ipp_status_t &oStatus, std::string &oError)
+        {
+            // last error is stored per thread, so it is read from the thread of the failed call
+            oStatus = cupsLastError();
+            oError = "Print Error: ";
+            oError += cupsLastErrorString();
+        }
+    };
+
+    /** Acknowledge every job at once, without storing it: measures the addon alone
+     */
+    class NullPrintBackend: public PrintBackend
+    {
+    public:
+        NullPrintBackend(): _last_job_id(0) {}
+
+        const char* name() const { return "null"; }
+
+    protected:
+        int submitData(const std::string&, const std::string&, const std::string&, const std::string&,
+            const CupsOptions&, const char*, size_t, ipp_status_t&, std::string&)
+        {
+            return ++_last_job_id;
+        }
+
+        int submitFile(const std::string&, const std::string&, const std::string&, const std::string&,
+            const CupsOptions&, ipp_status_t&, std::string&)
+        {
+            return ++_last_job_id;
+        }
+
+    private:
+        std::atomic<int> _last_job_id;
+    };
+
+    /** @return highest job id of the JOBID-PRINTER.prn files in iDirectory, 0 if none
+     */
+    int getLastFileJobId(const std::string &iDirectory)
+    {
+        int result = 0;
+        DIR *dir = opendir(iDirectory.c_str());
+        if(dir == NULL)
+        {
+            return result;
+        }
+        while(struct dirent *entry = readdir(dir))
+        {
+            char *end = NULL;
+            long job_id = strtol(entry->d_name, &end, 10);
+            if(end == entry->d_name + 10 && *end == '-' && job_id > result && job_id <= 0x7FFFFFFF)
+            {
+                result = static_cast<int>(job_id);
+            }
+        }
+        closedir(dir);
+        return result;
+    }
+
+    /** Write each job to its own file in a directory: JOBID-PRINTER.prn.
+     * Ids follow the files already in the directory, which are never overwritten
+     */
+    class FilePrintBackend: public PrintBackend
+    {
+    public:
+        FilePrintBackend(const std::string &iDirectory, bool iSync): _directory(iDirectory), _sync(iSync), _last_job_id(getLastFileJobId(iDirectory)) {}
+
+        const char* name() const { return "file"; }
+
+    protected:
+        int submitData(const std::string&, const std::string &iPrinterName, const std::string&, const std::string&,
+            const CupsOptions&, const char *iData, size_t iSize, ipp_status_t &oStatus, std::string &oError)
+        {
+            int job_id = 0;
+            std::string path;
+            int fd = -1;
+            do
+            {
+                // another backend may write to the same directory: the next id is taken
+                job_id = ++_last_job_id;
+                path = getJobPath(job_id, iPrinterName);
+                fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+            }
+            while(fd == -1 && errno == EEXIST);
+            bool ok = (fd != -1);
+            while(ok && iSize > 0)
+            {
+                ssize_t written = ::write(fd, iData, iSize);
+                if(written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                ok = (written > 0);
+                if(ok)
+                {
+                    iData += written;
+                    iSize -= static_cast<size_t>(written);
+                }
+            }
+            ok = ok && (!_sync || fsync(fd) == 0);
+            if(!ok)
+            {
+                oError = "Print Error: unable to write " + path + ": " + strerror(errno);
+                oStatus = IPP_STATUS_ERROR_INTERNAL;
+            }
+            if(fd != -1)
+            {
+                ::close(fd);
+            }
+            return ok ? job_id : 0;
+        }
+
+        int submitFile(const std::string &iServer, const std::string &iPrinterName, const std::string &iFilename, const std::string &iDocname,
+            const CupsOptions &iOptions, ipp_status_t &oStatus, std::string &oError)
+        {
+            MappedFile file;
+            if(!file.open(iFilename, oError))
+            {
+                oError = "Print Error: " + oError;
+                oStatus = IPP_STATUS_ERROR_NOT_FOUND;
+                return 0;
+            }
+            return submitData(iServer, iPrinterName, iDocname, "", iOptions, file.data(), file.size(), oStatus, oError);
+        }
+
+    private:
+        std::string getJobPath(int iJobId, const std::string &iPrinterName) const
+        {
+            char job_id[16];
+            snprintf(job_id, sizeof(job_id), "%010d", iJobId);
+            std::string printer_name = iPrinterName;
+            for(std::string::iterator itChar = printer_name.begin(); itChar != printer_name.end(); ++itChar)
+            {
+                if(*itChar == '/')
+                {
+                    *itChar = '_';
+                }
+            }
+            return _directory + "/" + job_id + "-" + printer_name + ".prn";
+        }
+
+        std::string _directory;
+        bool _sync;
+        std::atomic<int> _last_job_id;
+    };
+
+    std::mutex backend_mutex;
+
+    PrintBackendPtr& getBackendSlot()
+    {
+        // never destroyed: threads may still submit at exit
+        static PrintBackendPtr *result = new PrintBackendPtr(std::make_shared<CupsPrintBackend>());
+        return *result;
+    }
+}
+
+int PrintBackend::printData(const std::string &iServer, const std::string &iPrinterName, const std::string &iDocname, const std::string &iFormat,
+    const CupsOptions &iOptions, const char *iData, size_t iSize, ipp_status_t &oStatus, std::string &oError)
+{
+    oStatus = IPP_STATUS_OK;
+    int job_id = submitData(iServer, iPrinterName, iDocname, iFormat, iOptions, iData, iSize, oStatus, oError);
+    count(job_id, iSize);
+    return job_id;
+}
+
+int PrintBackend::printFile(const std::string &iServer, const std::string &iPrinterName, const std::string &iFilename, const std::string &iDocname,
+    const CupsOptions &iOptions, ipp_status_t &oStatus, std::string &oError)
+{
+    oStatus = IPP_STATUS_OK;
+    int job_id = submitFile(iServer, iPrinterName, iFilename, iDocname, iOptions, oStatus, oError);
+    struct stat file_stat;
+    count(job_id, (job_id != 0 && stat(iFilename.c_str(), &file_stat) == 0) ? static_cast<uint64_t>(file_stat.st_size) : 0);
+    return job_id;
+}
+
+void PrintBackend::count(int iJobId, uint64_t iBytes)
+{
+    if(iJobId == 0)
+    {
+        ++_errors;
+        return;
+    }
+    ++_jobs;
+    _bytes += iBytes;
+}
+
+PrintBackendPtr getCurrentPrintBackend()
+{
+    std::lock_guard<std::mutex> lock(backend_mutex);
+    return getBackendSlot();
+}
+
+Napi::Value setPrintBackend(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 1 || !info[0].IsString())
+    {
+        Napi::TypeError::New(env, "setPrintBackend:first argument must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    std::string name = info[0].As<Napi::String>().Utf8Value();
+    Napi::Object options = (info.Length() > 1 && info[1].IsObject()) ? info[1].As<Napi::Object>() : Napi::Object::New(env);
+
+    PrintBackendPtr backend;
+    if(name == "cups")
+    {
+        backend = std::make_shared<CupsPrintBackend>();
+    }
+    else if(name == "null")
+    {
+        backend = std::make_shared<NullPrintBackend>();
+    }
+    else if(name == "file")
+    {
+        Napi::Value arg_directory = options.Get("directory");
+        if(!arg_directory.IsString())
+        {
+            Napi::TypeError::New(env, "setPrintBackend:directory option must be a string").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        std::string directory = arg_directory.As<Napi::String>().Utf8Value();
+        if(mkdir(directory.c_str(), 0700) == -1 && errno != EEXIST)
+        {
+            Napi::Error::New(env, "setPrintBackend: unable to create " + directory + ": " + strerror(errno)).ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        backend = std::make_shared<FilePrintBackend>(directory, options.Get("sync").ToBoolean().Value());
+    }
+    else
+    {
+        Napi::TypeError::New(env, "setPrintBackend:unknown backend " + name + " (cups, null or file expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // jobs being submitted finish on the previous backend
+    std::lock_guard<std::mutex> lock(backend_mutex);
+    getBackendSlot() = backend;
+    return env.Undefined();
+}
+
+Napi::Value getPrintBackend(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+    PrintBackendPtr backend = getCurrentPrintBackend();
+
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("name", Napi::String::New(env, backend->name()));
+    result.Set("jobs", Napi::Number::New(env, static_cast<double>(backend->jobs())));
+    result.Set("bytes", Napi::Number::New(env, static_cast<double>(backend->bytes())));
+    result.Set("errors", Napi::Number::New(env, static_cast<double>(backend->errors())));
+    return result;
+}
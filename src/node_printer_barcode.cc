@@ -0,0 +1,936 @@
+#include "node_printer_raster.hpp"
+
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+    enum BarcodeType
+    {
+        BARCODE_CODE128,
+        BARCODE_EAN13,
+        BARCODE_QR
+    };
+
+    /** Bar and space widths of the Code 128 symbols, start A/B/C and stop last
+     */
+    const char *CODE128_PATTERNS[] = {
+        "212222", "222122", "222221", "121223", "121322", "131222", "122213", "122312", "132212", "221213",
+        "221312", "231212", "112232", "122132", "122231", "113222", "123122", "123221", "223211", "221132",
+        "221231", "213212", "223112", "312131", "311222", "321122", "321221", "312212", "322112", "322211",
+        "212123", "212321", "232121", "111323", "131123", "131321", "112313", "132113", "132311", "211313",
+        "231113", "231311", "112133", "112331", "132131", "113123", "113321", "133121", "313121", "211331",
+        "231131", "213113", "213311", "213131", "311123", "311321", "331121", "312113", "312311", "332111",
+        "314111", "221411", "431111", "111224", "111422", "121124", "121421", "141122", "141221", "112214",
+        "112412", "122114", "122411", "142112", "142211", "241211", "221114", "413111", "241112", "134111",
+        "111242", "121142", "121241", "114212", "124112", "124211", "411212", "421112", "421211", "212141",
+        "214121", "412121", "111143", "111341", "131141", "114113", "114311", "411113", "411311", "113141",
+        "114131", "311141", "411131", "211412", "211214", "211232", "2331112"
+    };
+
+    const int CODE128_SWITCH_C = 99;
+    const int CODE128_SWITCH_B = 100;
+    const int CODE128_SWITCH_A = 101;
+    const int CODE128_START_A = 103;
+    const int CODE128_STOP = 106;
+
+    /** EAN-13 left hand odd parity (L) digits, R digits are their complement and G digits the reversed R
+     */
+    const char *EAN_L_DIGITS[] = {
+        "0001101", "0011001", "0010011", "0111101", "0100011", "0110001", "0101111", "0111011", "0110111", "0001011"
+    };
+
+    /** Parity of the 6 left digits given by the first digit, 1 for G
+     */
+    const char *EAN_PARITIES[] = {
+        "000000", "001011", "001101", "001110", "010011", "011001", "011100", "010101", "010110", "011010"
+    };
+
+    const char QR_ALPHANUMERIC[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+
+    /** Error correction codewords per block, by error correction level (L, M, Q, H) and version
+     */
+    const int8_t QR_ECC_CODEWORDS_PER_BLOCK[4][41] = {
+        { -1,  7, 10, 15, 20, 26, 18, 20, 24, 30, 18, 20, 24, 26, 30, 22, 24, 28, 30, 28, 28, 28, 28, 30, 30, 26, 28, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30 },
+        { -1, 10, 16, 26, 18, 24, 16, 18, 22, 22, 26, 30, 22, 22, 24, 24, 28, 28, 26, 26, 26, 26, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28 },
+        { -1, 13, 22, 18, 26, 18, 24, 18, 22, 20, 24, 28, 26, 24, 20, 30, 24, 28, 28, 26, 30, 28, 30, 30, 30, 30, 28, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30 },
+        { -1, 17, 28, 22, 16, 22, 28, 26, 26, 24, 28, 24, 28, 22, 24, 24, 30, 28, 28, 26, 28, 30, 24, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30 }
+    };
+
+    /** Error correction blocks, by error correction level (L, M, Q, H) and version
+     */
+    const int8_t QR_ECC_BLOCKS[4][41] = {
+        { -1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 4, 4, 4, 4, 4, 6, 6, 6, 6, 7, 8, 8, 9, 9, 10, 12, 12, 12, 13, 14, 15, 16, 17, 18, 19, 19, 20, 21, 22, 24, 25 },
+        { -1, 1, 1, 1, 2, 2, 4, 4, 4, 5, 5, 5, 8, 9, 9, 10, 10, 11, 13, 14, 16, 17, 17, 18, 20, 21, 23, 25, 26, 28, 29, 31, 33, 35, 37, 38, 40, 43, 45, 47, 49 },
+        { -1, 1, 1, 2, 2, 4, 4, 6, 6, 8, 8, 8, 10, 12, 16, 12, 17, 16, 18, 21, 20, 23, 23, 25, 27, 29, 34, 34, 35, 38, 40, 43, 45, 48, 51, 53, 56, 59, 62, 65, 68 },
+        { -1, 1, 1, 2, 4, 4, 4, 5, 6, 8, 8, 11, 11, 16, 16, 18, 16, 19, 21, 25, 25, 25, 34, 30, 32, 35, 37, 40, 42, 45, 48, 51, 54, 57, 60, 63, 66, 70, 74, 77, 81 }
+    };
+
+    /** Format information bits of the error correction levels L, M, Q, H
+     */
+    const int QR_ECC_FORMAT_BITS[4] = { 1, 0, 3, 2 };
+
+    /** Append the bars of a pattern of widths, starting with a bar
+     */
+    void appendWidths(const char *iWidths, std::vector<uint8_t> &oModules)
+    {
+        for(int i = 0; iWidths[i] != '\0'; ++i)
+        {
+            oModules.insert(oModules.end(), iWidths[i] - '0', (i % 2) == 0 ? 1 : 0);
+        }
+    }
+
+    size_t countDigits(const std::string &iData, size_t iPosition)
+    {
+        size_t end = iPosition;
+        while(end < iData.size() && iData[end] >= '0' && iData[end] <= '9')
+        {
+            ++end;
+        }
+        return end - iPosition;
+    }
+
+    /** Code 128 modules, switching to code set C for runs of digits and to code set A for control characters
+     */
+    bool encodeCode128(const std::string &iData, std::vector<uint8_t> &oModules, std::string &oError)
+    {
+        if(iData.empty())
+        {
+            oError = "Code 128 data must not be empty";
+            return false;
+        }
+        std::vector<int> values;
+        // 0 for code set A, 1 for B, 2 for C
+        int code_set = -1;
+        size_t position = 0;
+        while(position < iData.size())
+        {
+            unsigned char c = static_cast<unsigned char>(iData[position]);
+            if(c > 127)
+            {
+                oError = "Code 128 data must be ASCII";
+                return false;
+            }
+            size_t digits = countDigits(iData, position);
+            // code set C pays off for 4 digits at the ends, 6 in between
+            bool use_c = digits >= 6 || (digits >= 4 && (code_set < 0 || position + digits == iData.size()))
+                || (code_set < 0 && digits == iData.size() && digits == 2);
+            // an odd run starts with a digit in code set A or B, except at the start where it ends with one
+            if((code_set == 2 && digits >= 2) || (use_c && (digits % 2 == 0 || code_set < 0)))
+            {
+                if(code_set != 2)
+                {
+                    values.push_back(code_set < 0 ? CODE128_START_A + 2 : CODE128_SWITCH_C);
+                    code_set = 2;
+                }
+                values.push_back((iData[position] - '0') * 10 + (iData[position + 1] - '0'));
+                position += 2;
+                continue;
+            }
+
+            int wanted = c < 32 ? 0 : (c >= 96 ? 1 : (code_set == 0 ? 0 : 1));
+            if(code_set != wanted)
+            {
+                values.push_back(code_set < 0 ? CODE128_START_A + wanted : (wanted == 0 ? CODE128_SWITCH_A : CODE128_SWITCH_B));
+                code_set = wanted;
+            }
+            values.push_back(c < 32 ? c + 64 : c - 32);
+            ++position;
+        }
+
+        int checksum = values[0];
+        for(size_t i = 1; i < values.size(); ++i)
+        {
+            checksum += static_cast<int>(i) * values[i];
+        }
+        values.push_back(checksum % 103);
+        values.push_back(CODE128_STOP);
+
+        oModules.clear();
+        for(std::vector<int>::const_iterator itValue = values.begin(); itValue != values.end(); ++itValue)
+        {
+            appendWidths(CODE128_PATTERNS[*itValue], oModules);
+        }
+        return true;
+    }
+
+    /** EAN-13 modules of 12 digits, or of 13 digits with a valid check digit
+     */
+    bool encodeEan13(const std::string &iData, std::vector<uint8_t> &oModules, std::string &oError)
+    {
+        if((iData.size() != 12 && iData.size() != 13) || countDigits(iData, 0) != iData.size())
+        {
+            oError = "EAN-13 data must be 12 or 13 digits";
+            return false;
+        }
+        int digits[13];
+        int sum = 0;
+        for(int i = 0; i < 12; ++i)
+        {
+            digits[i] = iData[i] - '0';
+            sum += digits[i] * ((i % 2) ? 3 : 1);
+        }
+        digits[12] = (10 - sum % 10) % 10;
+        if(iData.size() == 13 && iData[12] - '0' != digits[12])
+        {
+            oError = "EAN-13 check digit is wrong";
+            return false;
+        }
+
+        oModules.clear();
+        appendWidths("111", oModules);
+        const char *parities = EAN_PARITIES[digits[0]];
+        for(int i = 1; i < 13; ++i)
+        {
+            if(i == 7)
+            {
+                // center guard, starting with a space
+                static const uint8_t CENTER_GUARD[] = { 0, 1, 0, 1, 0 };
+                oModules.insert(oModules.end(), CENTER_GUARD, CENTER_GUARD + sizeof(CENTER_GUARD));
+            }
+            const char *bits = EAN_L_DIGITS[digits[i]];
+            for(int bit = 0; bit < 7; ++bit)
+            {
+                uint8_t value = 0;
+                if(i >= 7)
+                {
+                    // R digit
+                    value = bits[bit] == '0';
+                }
+                else if(parities[i - 1] == '1')
+                {
+                    // G digit
+                    value = bits[6 - bit] == '0';
+                }
+                else
+                {
+                    value = bits[bit] == '1';
+                }
+                oModules.push_back(value);
+            }
+        }
+        appendWidths("111", oModules);
+        return true;
+    }
+
+    /** QR Code model 2 encoder: one segment in numeric, alphanumeric or byte mode,
+     * smallest version for the error correction level, best mask
+     */
+    class QrEncoder
+    {
+    public:
+        /** @param iLevel 0 to 3 for L, M, Q, H
+         */
+        bool encode(const std::string &iData, int iLevel, std::string &oError);
+
+        int size() const { return _size; }
+        bool module(int iX, int iY) const { return _modules[iY * _size + iX] != 0; }
+
+    private:
+        static int getRawDataModules(int iVersion);
+        static uint8_t multiply(uint8_t iX, uint8_t iY);
+
+        void appendBits(uint32_t iValue, int iCount);
+        void addErrorCorrection(int iVersion, int iLevel);
+
+        void setFunction(int iX, int iY, bool iDark);
+        void drawFunctionPatterns(int iVersion);
+        void drawFinder(int iX, int iY);
+        void drawFormatBits(int iLevel, int iMask);
+        void drawCodewords();
+        void applyMask(int iMask);
+        long getPenalty() const;
+
+        std::vector<uint8_t> _bits;
+        std::vector<uint8_t> _codewords;
+        int _size;
+        std::vector<uint8_t> _modules;
+        std::vector<uint8_t> _functions;
+    };
+
+    int QrEncoder::getRawDataModules(int iVersion)
+    {
+        int result = (16 * iVersion + 128) * iVersion + 64;
+        if(iVersion >= 2)
+        {
+            int alignments = iVersion / 7 + 2;
+            result -= (25 * alignments - 10) * alignments - 55;
+            if(iVersion >= 7)
+            {
+                result -= 36;
+            }
+        }
+        return result;
+    }
+
+    uint8_t QrEncoder::multiply(uint8_t iX, uint8_t iY)
+    {
+        // GF(2^8) with the 0x11D polynomial
+        int result = 0;
+        for(int i = 7; i >= 0; --i)
+        {
+            result = (result << 1) ^ ((result >> 7) * 0x11D);
+            result ^= ((iY >> i) & 1) * iX;
+        }
+        return static_cast<uint8_t>(result);
+    }
+
+    void QrEncoder::appendBits(uint32_t iValue, int iCount)
+    {
+        for(int i = iCount - 1; i >= 0; --i)
+        {
+            _bits.push_back((iValue >> i) & 1);
+        }
+    }
+
+    bool QrEncoder::encode(const std::string &iData, int iLevel, std::string &oError)
+    {
+        // 0 numeric, 1 alphanumeric, 2 byte
+        int mode = 0;
+        for(std::string::const_iterator it = iData.begin(); it != iData.end(); ++it)
+        {
+            if(*it < '0' || *it > '9')
+            {
+                mode = std::max(mode, (*it != '\0' && strchr(QR_ALPHANUMERIC, *it) != NULL) ? 1 : 2);
+            }
+        }
+        static const int MODE_INDICATORS[3] = { 1, 2, 4 };
+        static const int COUNT_BITS[3][3] = { { 10, 12, 14 }, { 9, 11, 13 }, { 8, 16, 16 } };
+
+        size_t length = iData.size();
+        size_t data_bits = mode == 0 ? length / 3 * 10 + (length % 3 == 2 ? 7 : (length % 3 == 1 ? 4 : 0))
+            : (mode == 1 ? length / 2 * 11 + (length % 2) * 6 : length * 8);
+        int version = 1;
+        for(; version <= 40; ++version)
+        {
+            int count_bits = COUNT_BITS[mode][version < 10 ? 0 : (version < 27 ? 1 : 2)];
+            size_t capacity = static_cast<size_t>(getRawDataModules(version) / 8
+                - QR_ECC_CODEWORDS_PER_BLOCK[iLevel][version] * QR_ECC_BLOCKS[iLevel][version]) * 8;
+            if(length < (1u << count_bits) && 4 + count_bits + data_bits <= capacity)
+            {
+                break;
+            }
+        }
+        if(version > 40)
+        {
+            oError = "data too long for a QR Code";
+            return false;
+        }
+
+        _bits.clear();
+        appendBits(MODE_INDICATORS[mode], 4);
+        appendBits(static_cast<uint32_t>(length), COUNT_BITS[mode][version < 10 ? 0 : (version < 27 ? 1 : 2)]);
+        if(mode == 0)
+        {
+            for(size_t i = 0; i < length; i += 3)
+            {
+                size_t digits = std::min<size_t>(3, length - i);
+                appendBits(static_cast<uint32_t>(atoi(iData.substr(i, digits).c_str())), static_cast<int>(digits * 3 + 1));
+            }
+        }
+        else if(mode == 1)
+        {
+            for(size_t i = 0; i < length; i += 2)
+            {
+                uint32_t value = static_cast<uint32_t>(strchr(QR_ALPHANUMERIC, iData[i]) - QR_ALPHANUMERIC);
+                if(i + 1 < length)
+                {
+                    appendBits(value * 45 + static_cast<uint32_t>(strchr(QR_ALPHANUMERIC, iData[i + 1]) - QR_ALPHANUMERIC), 11);
+                }
+                else
+                {
+                    appendBits(value, 6);
+                }
+            }
+        }
+        else
+        {
+            for(size_t i = 0; i < length; ++i)
+            {
+                appendBits(static_cast<uint8_t>(iData[i]), 8);
+            }
+        }
+
+        // terminator, byte alignment and pad codewords
+        size_t capacity = static_cast<size_t>(getRawDataModules(version) / 8
+            - QR_ECC_CODEWORDS_PER_BLOCK[iLevel][version] * QR_ECC_BLOCKS[iLevel][version]) * 8;
+        appendBits(0, static_cast<int>(std::min<size_t>(4, capacity - _bits.size())));
+        appendBits(0, static_cast<int>((8 - _bits.size() % 8) % 8));
+        for(uint32_t pad = 0xEC; _bits.size() < capacity; pad ^= 0xEC ^ 0x11)
+        {
+            appendBits(pad, 8);
+        }
+        addErrorCorrection(version, iLevel);
+
+        _size = version * 4 + 17;
+        _modules.assign(_size * _size, 0);
+        _functions.assign(_size * _size, 0);
+        drawFunctionPatterns(version);
+        drawCodewords();
+
+        // mask with the lowest penalty
+        int best_mask = 0;
+        long best_penalty = -1;
+        for(int mask = 0; mask < 8; ++mask)
+        {
+            applyMask(mask);
+            drawFormatBits(iLevel, mask);
+            long penalty = getPenalty();
+            if(best_penalty < 0 || penalty < best_penalty)
+            {
+                best_mask = mask;
+                best_penalty = penalty;
+            }
+            // masks are xor: applied again to undo
+            applyMask(mask);
+        }
+        applyMask(best_mask);
+        drawFormatBits(iLevel, best_mask);
+        return true;
+    }
+
+    void QrEncoder::addErrorCorrection(int iVersion, int iLevel)
+    {
+        std::vector<uint8_t> data(_bits.size() / 8, 0);
+        for(size_t i = 0; i < _bits.size(); ++i)
+        {
+            data[i >> 3] |= static_cast<uint8_t>(_bits[i] << (7 - (i & 7)));
+        }
+
+        int blocks_count = QR_ECC_BLOCKS[iLevel][iVersion];
+        int ecc_length = QR_ECC_CODEWORDS_PER_BLOCK[iLevel][iVersion];
+        int raw_codewords = getRawDataModules(iVersion) / 8;
+        int short_blocks = blocks_count - raw_codewords % blocks_count;
+        int short_block_length = raw_codewords / blocks_count;
+
+        // Reed-Solomon generator polynomial, highest coefficient dropped
+        std::vector<uint8_t> divisor(ecc_length, 0);
+        divisor[ecc_length - 1] = 1;
+        uint8_t root = 1;
+        for(int i = 0; i < ecc_length; ++i)
+        {
+            for(int j = 0; j < ecc_length; ++j)
+            {
+                divisor[j] = multiply(divisor[j], root);
+                if(j + 1 < ecc_length)
+                {
+                    divisor[j] ^= divisor[j + 1];
+                }
+            }
+            root = multiply(root, 0x02);
+        }
+
+        std::vector<std::vector<uint8_t> > blocks(blocks_count);
+        size_t offset = 0;
+        for(int i = 0; i < blocks_count; ++i)
+        {
+            size_t data_length = short_block_length - ecc_length + (i < short_blocks ? 0 : 1);
+            std::vector<uint8_t> &block = blocks[i];
+            block.assign(data.begin() + offset, data.begin() + offset + data_length);
+            offset += data_length;
+
+            std::vector<uint8_t> remainder(ecc_length, 0);
+            for(size_t j = 0; j < data_length; ++j)
+            {
+                uint8_t factor = block[j] ^ remainder[0];
+                remainder.erase(remainder.begin());
+                remainder.push_back(0);
+                for(int k = 0; k < ecc_length; ++k)
+                {
+                    remainder[k] ^= multiply(divisor[k], factor);
+                }
+            }
+            if(i < short_blocks)
+            {
+                // placeholder, skipped by the interleaving
+                block.push_back(0);
+            }
+            block.insert(block.end(), remainder.begin(), remainder.end());
+        }
+
+        _codewords.clear();
+        for(size_t i = 0; i < blocks[0].size(); ++i)
+        {
+            for(int j = 0; j < blocks_count; ++j)
+            {
+                if(static_cast<int>(i) != short_block_length - ecc_length || j >= short_blocks)
+                {
+                    _codewords.push_back(blocks[j][i]);
+                }
+            }
+        }
+    }
+
+    void QrEncoder::setFunction(int iX, int iY, bool iDark)
+    {
+        _modules[iY * _size + iX] = iDark ? 1 : 0;
+        _functions[iY * _size + iX] = 1;
+    }
+
+    void QrEncoder::drawFinder(int iX, int iY)
+    {
+        for(int dy = -4; dy <= 4; ++dy)
+        {
+            for(int dx = -4; dx <= 4; ++dx)
+            {
+                int x = iX + dx, y = iY + dy;
+                if(x >= 0 && x < _size && y >= 0 && y < _size)
+                {
+                    int distance = std::max(std::abs(dx), std::abs(dy));
+                    setFunction(x, y, distance != 2 && distance != 4);
+                }
+            }
+        }
+    }
+
+    void QrEncoder::drawFunctionPatterns(int iVersion)
+    {
+        for(int i = 0; i < _size; ++i)
+        {
+            setFunction(6, i, i % 2 == 0);
+            setFunction(i, 6, i % 2 == 0);
+        }
+        drawFinder(3, 3);
+        drawFinder(_size - 4, 3);
+        drawFinder(3, _size - 4);
+
+        if(iVersion >= 2)
+        {
+            int alignments = iVersion / 7 + 2;
+            int step = iVersion == 32 ? 26 : (iVersion * 4 + alignments * 2 + 1) / (alignments * 2 - 2) * 2;
+            std::vector<int> positions(alignments);
+            positions[0] = 6;
+            for(int i = alignments - 1, position = _size - 7; i >= 1; --i, position -= step)
+            {
+                positions[i] = position;
+            }
+            for(int i = 0; i < alignments; ++i)
+            {
+                for(int j = 0; j < alignments; ++j)
+                {
+                    // corners of the finders
+                    if((i == 0 && j == 0) || (i == 0 && j == alignments - 1) || (i == alignments - 1 && j == 0))
+                    {
+                        continue;
+                    }
+                    for(int dy = -2; dy <= 2; ++dy)
+                    {
+                        for(int dx = -2; dx <= 2; ++dx)
+                        {
+                            setFunction(positions[i] + dx, positions[j] + dy, std::max(std::abs(dx), std::abs(dy)) != 1);
+                        }
+                    }
+                }
+            }
+        }
+
+        // reserved until the mask is known
+        drawFormatBits(0, 0);
+
+        if(iVersion >= 7)
+        {
+            int remainder = iVersion;
+            for(int i = 0; i < 12; ++i)
+            {
+                remainder = (remainder << 1) ^ ((remainder >> 11) * 0x1F25);
+            }
+            long bits = static_cast<long>(iVersion) << 12 | remainder;
+            for(int i = 0; i < 18; ++i)
+            {
+                bool dark = ((bits >> i) & 1) != 0;
+                int a = _size - 11 + i % 3, b = i / 3;
+                setFunction(a, b, dark);
+                setFunction(b, a, dark);
+            }
+        }
+    }
+
+    void QrEncoder::drawFormatBits(int iLevel, int iMask)
+    {
+        int data = QR_ECC_FORMAT_BITS[iLevel] << 3 | iMask;
+        int remainder = data;
+        for(int i = 0; i < 10; ++i)
+        {
+            remainder = (remainder << 1) ^ ((remainder >> 9) * 0x537);
+        }
+        int bits = (data << 10 | remainder) ^ 0x5412;
+
+        // around the top left finder
+        for(int i = 0; i <= 5; ++i)
+        {
+            setFunction(8, i, ((bits >> i) & 1) != 0);
+        }
+        setFunction(8, 7, ((bits >> 6) & 1) != 0);
+        setFunction(8, 8, ((bits >> 7) & 1) != 0);
+        setFunction(7, 8, ((bits >> 8) & 1) != 0);
+        for(int i = 9; i < 15; ++i)
+        {
+            setFunction(14 - i, 8, ((bits >> i) & 1) != 0);
+        }
+
+        // copy next to the other finders
+        for(int i = 0; i < 8; ++i)
+        {
+            setFunction(_size - 1 - i, 8, ((bits >> i) & 1) != 0);
+        }
+        for(int i = 8; i < 15; ++i)
+        {
+            setFunction(8, _size - 15 + i, ((bits >> i) & 1) != 0);
+        }
+        setFunction(8, _size - 8, true);
+    }
+
+    void QrEncoder::drawCodewords()
+    {
+        size_t i = 0;
+        size_t bits_count = _codewords.size() * 8;
+        // columns pairs from the right, zigzagging up and down
+        for(int right = _size - 1; right >= 1; right -= 2)
+        {
+            if(right == 6)
+            {
+                right = 5;
+            }
+            for(int vertical = 0; vertical < _size; ++vertical)
+            {
+                for(int j = 0; j < 2; ++j)
+                {
+                    int x = right - j;
+                    bool upward = ((right + 1) & 2) == 0;
+                    int y = upward ? _size - 1 - vertical : vertical;
+                    if(!_functions[y * _size + x] && i < bits_count)
+                    {
+                        _modules[y * _size + x] = (_codewords[i >> 3] >> (7 - (i & 7))) & 1;
+                        ++i;
+                    }
+                }
+            }
+        }
+    }
+
+    void QrEncoder::applyMask(int iMask)
+    {
+        for(int y = 0; y < _size; ++y)
+        {
+            for(int x = 0; x < _size; ++x)
+            {
+                bool invert = false;
+                switch(iMask)
+                {
+                case 0: invert = (x + y) % 2 == 0; break;
+                case 1: invert = y % 2 == 0; break;
+                case 2: invert = x % 3 == 0; break;
+                case 3: invert = (x + y) % 3 == 0; break;
+                case 4: invert = (x / 3 + y / 2) % 2 == 0; break;
+                case 5: invert = x * y % 2 + x * y % 3 == 0; break;
+                case 6: invert = (x * y % 2 + x * y % 3) % 2 == 0; break;
+                default: invert = ((x + y) % 2 + x * y % 3) % 2 == 0; break;
+                }
+                if(invert && !_functions[y * _size + x])
+                {
+                    _modules[y * _size + x] ^= 1;
+                }
+            }
+        }
+    }
+
+    long QrEncoder::getPenalty() const
+    {
+        static const uint8_t FINDER_LIKE[2][11] = {
+            { 1, 0, 1, 1, 1, 0, 1, 0, 0, 0, 0 },
+            { 0, 0, 0, 0, 1, 0, 1, 1, 1, 0, 1 }
+        };
+        long result = 0;
+        for(int pass = 0; pass < 2; ++pass)
+        {
+            // rows, then columns
+            for(int line = 0; line < _size; ++line)
+            {
+                int run = 0;
+                uint8_t color = 2;
+                for(int i = 0; i < _size; ++i)
+                {
+                    uint8_t value = pass == 0 ? _modules[line * _size + i] : _modules[i * _size + line];
+                    if(value == color)
+                    {
+                        ++run;
+                        if(run == 5)
+                        {
+                            result += 3;
+                        }
+                        else if(run > 5)
+                        {
+                            ++result;
+                        }
+                    }
+                    else
+                    {
+                        color = value;
+                        run = 1;
+                    }
+
+                    for(int pattern = 0; pattern < 2 && i + 11 <= _size; ++pattern)
+                    {
+                        int k = 0;
+                        for(; k < 11; ++k)
+                        {
+                            uint8_t other = pass == 0 ? _modules[line * _size + i + k] : _modules[(i + k) * _size + line];
+                            if(other != FINDER_LIKE[pattern][k])
+                            {
+                                break;
+                            }
+                        }
+                        if(k == 11)
+                        {
+                            result += 40;
+                        }
+                    }
+                }
+            }
+        }
+
+        int dark = 0;
+        for(int y = 0; y < _size; ++y)
+        {
+            for(int x = 0; x < _size; ++x)
+            {
+                uint8_t color = _modules[y * _size + x];
+                dark += color;
+                if(x + 1 < _size && y + 1 < _size && color == _modules[y * _size + x + 1]
+                    && color == _modules[(y + 1) * _size + x] && color == _modules[(y + 1) * _size + x + 1])
+                {
+                    result += 3;
+                }
+            }
+        }
+        int total = _size * _size;
+        int k = (std::abs(dark * 20 - total * 10) + total - 1) / total - 1;
+        result += k * 10;
+        return result;
+    }
+
+    /** Set iCount dots from iX in a row
+     */
+    void fillRun(uint8_t *ioRow, int iX, int iCount)
+    {
+        for(int x = iX; x < iX + iCount; ++x)
+        {
+            ioRow[x >> 3] |= static_cast<uint8_t>(0x80 >> (x & 7));
+        }
+    }
+
+    /** Draw bars of iModuleDots wide and iHeight high, after a quiet zone of iQuietZone modules
+     */
+    void drawLinear(const std::vector<uint8_t> &iModules, int iModuleDots, int iHeight, int iQuietZone, MonoBitmap &oBitmap)
+    {
+        oBitmap.reset((static_cast<int>(iModules.size()) + iQuietZone * 2) * iModuleDots, iHeight);
+        if(iHeight == 0)
+        {
+            return;
+        }
+        uint8_t *first = oBitmap.row(0);
+        for(size_t i = 0; i < iModules.size(); ++i)
+        {
+            if(iModules[i])
+            {
+                fillRun(first, (iQuietZone + static_cast<int>(i)) * iModuleDots, iModuleDots);
+            }
+        }
+        // every row is the same
+        for(int y = 1; y < iHeight; ++y)
+        {
+            memcpy(oBitmap.row(y), first, oBitmap.stride);
+        }
+    }
+
+    void drawMatrix(const QrEncoder &iQr, int iModuleDots, int iQuietZone, MonoBitmap &oBitmap)
+    {
+        int side = (iQr.size() + iQuietZone * 2) * iModuleDots;
+        oBitmap.reset(side, side);
+        for(int y = 0; y < iQr.size(); ++y)
+        {
+            int top = (iQuietZone + y) * iModuleDots;
+            uint8_t *row = oBitmap.row(top);
+            for(int x = 0; x < iQr.size(); ++x)
+            {
+                if(iQr.module(x, y))
+                {
+                    fillRun(row, (iQuietZone + x) * iModuleDots, iModuleDots);
+                }
+            }
+            for(int dy = 1; dy < iModuleDots; ++dy)
+            {
+                memcpy(oBitmap.row(top + dy), row, oBitmap.stride);
+            }
+        }
+    }
+
+    /** Dots of a length in millimeters at iDpi, at least 1
+     */
+    int millimetersToDots(double iMillimeters, int iDpi)
+    {
+        return std::max(1, static_cast<int>(std::lround(iMillimeters * iDpi / 25.4)));
+    }
+
+    bool getNumberOption(Napi::Object iOptions, const char *iName, double &oValue)
+    {
+        Napi::Value value = iOptions.Get(iName);
+        if(value.IsUndefined() || value.IsNull())
+        {
+            return true;
+        }
+        if(!value.IsNumber() || !(value.As<Napi::Number>().DoubleValue() >= 0))
+        {
+            return false;
+        }
+        oValue = value.As<Napi::Number>().DoubleValue();
+        return true;
+    }
+}
+
+Napi::Value encodeBarcode(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 2)
+    {
+        Napi::TypeError::New(env, "encodeBarcode:invalid number of arguments (2 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    if(!info[0].IsString())
+    {
+        Napi::TypeError::New(env, "encodeBarcode:type must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    std::string type_name = info[0].As<Napi::String>().Utf8Value();
+    BarcodeType type = BARCODE_CODE128;
+    // defaults: X dimension in mm and quiet zone in modules
+    double module_size = 0.25;
+    double quiet_zone = 10;
+    if(type_name == "code128")
+    {
+        type = BARCODE_CODE128;
+    }
+    else if(type_name == "ean13")
+    {
+        type = BARCODE_EAN13;
+        module_size = 0.33;
+        quiet_zone = 11;
+    }
+    else if(type_name == "qr")
+    {
+        type = BARCODE_QR;
+        module_size = 0.5;
+        quiet_zone = 4;
+    }
+    else
+    {
+        Napi::TypeError::New(env, "encodeBarcode:type must be 'code128', 'ean13' or 'qr'").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // a string, or an array of strings for a batch
+    std::vector<std::string> values;
+    if(info[1].IsArray())
+    {
+        Napi::Array arg_values = info[1].As<Napi::Array>();
+        values.reserve(arg_values.Length());
+        for(uint32_t i = 0; i < arg_values.Length(); ++i)
+        {
+            Napi::Value value = arg_values.Get(i);
+            if(!value.IsString())
+            {
+                Napi::TypeError::New(env, "encodeBarcode:data must be a string or an array of strings").ThrowAsJavaScriptException();
+                return env.Undefined();
+            }
+            values.push_back(value.As<Napi::String>().Utf8Value());
+        }
+    }
+    else if(info[1].IsString())
+    {
+        values.push_back(info[1].As<Napi::String>().Utf8Value());
+    }
+    else
+    {
+        Napi::TypeError::New(env, "encodeBarcode:data must be a string or an array of strings").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    Napi::Object arg_options = (info.Length() > 2 && info[2].IsObject()) ? info[2].As<Napi::Object>() : Napi::Object::New(env);
+    double dpi = 203, height = 15, module_dots = 0;
+    if(!getNumberOption(arg_options, "dpi", dpi) || !getNumberOption(arg_options, "moduleSize", module_size)
+        || !getNumberOption(arg_options, "module", module_dots) || !getNumberOption(arg_options, "height", height)
+        || !getNumberOption(arg_options, "quietZone", quiet_zone) || dpi < 1 || dpi > 2400)
+    {
+        Napi::TypeError::New(env, "encodeBarcode:dpi, moduleSize, module, height and quietZone must be positive numbers").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    int dots = module_dots >= 1 ? static_cast<int>(module_dots) : millimetersToDots(module_size, static_cast<int>(dpi));
+    int height_dots = millimetersToDots(height, static_cast<int>(dpi));
+    int quiet_modules = static_cast<int>(quiet_zone);
+
+    int level = 1;
+    Napi::Value arg_level = arg_options.Get("errorCorrection");
+    if(arg_level.IsString())
+    {
+        std::string level_name = arg_level.As<Napi::String>().Utf8Value();
+        const char *levels = "LMQH";
+        if(level_name.size() != 1 || strchr(levels, level_name[0]) == NULL)
+        {
+            Napi::TypeError::New(env, "encodeBarcode:errorCorrection must be 'L', 'M', 'Q' or 'H'").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        level = static_cast<int>(strchr(levels, level_name[0]) - levels);
+    }
+
+    RasterOutput output;
+    std::string error;
+    if(!getRasterOutputFromV8Value(arg_options, output, error))
+    {
+        Napi::TypeError::New(env, "encodeBarcode:" + error).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // every code is appended to the same data, working buffers are reused
+    std::string result;
+    std::vector<uint8_t> modules;
+    QrEncoder qr;
+    MonoBitmap bitmap;
+    for(size_t i = 0; i < values.size(); ++i)
+    {
+        bool encoded = false;
+        switch(type)
+        {
+        case BARCODE_CODE128:
+            encoded = encodeCode128(values[i], modules, error);
+            break;
+        case BARCODE_EAN13:
+            encoded = encodeEan13(values[i], modules, error);
+            break;
+        case BARCODE_QR:
+            encoded = qr.encode(values[i], level, error);
+            break;
+        }
+        if(!encoded)
+        {
+            Napi::TypeError::New(env, "encodeBarcode:" + error + " (" + values[i] + ")").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        if(type == BARCODE_QR)
+        {
+            drawMatrix(qr, dots, quiet_modules, bitmap);
+        }
+        else
+        {
+            drawLinear(modules, dots, height_dots, quiet_modules, bitmap);
+        }
+        if(!encodeMonoBitmap(bitmap, output, result, error))
+        {
+            Napi::Error::New(env, "encodeBarcode:" + error).ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+    }
+    return Napi::Buffer<char>::Copy(env, result.data(), result.size());
+}
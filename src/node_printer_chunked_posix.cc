@@ -0,0 +1,318 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::~MappedFile()
+{
+    if(_data != NULL)
+    {
+        munmap(_data, _size);
+    }
+}
+
+bool MappedFile::open(const std::string &iFilename, std::string &oError)
+{
+    int fd = ::open(iFilename.c_str(), O_RDONLY);
+    if(fd == -1)
+    {
+        oError = "printFile: unable to open file " + iFilename;
+        return false;
+    }
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) == -1)
+    {
+        ::close(fd);
+        oError = "printFile: unable to stat file " + iFilename;
+        return false;
+    }
+    _size = static_cast<size_t>(file_stat.st_size);
+    if(_size > 0)
+    {
+        void *data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED)
+        {
+            ::close(fd);
+            _size = 0;
+            oError = "printFile: unable to map file " + iFilename;
+            return false;
+        }
+        _data = static_cast<char*>(data);
+        madvise(_data, _size, MADV_SEQUENTIAL);
+    }
+    // the mapping stays valid after close
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::release(size_t iOffset)
+{
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t length = iOffset - (iOffset % page_size);
+    if(length > 0)
+    {
+        madvise(_data, length, MADV_DONTNEED);
+    }
+}
+
+namespace
+{
+    const size_t DEFAULT_CHUNK_SIZE = 256 * 1024;
+    const size_t MIN_CHUNK_SIZE = 4 * 1024;
+    // progress is reported at most every PROGRESS_INTERVAL_MS, and after the last chunk
+    const int PROGRESS_INTERVAL_MS = 100;
+
+    typedef std::shared_ptr<std::atomic<bool> > CancelFlagType;
+
+    struct ChunkedPrintFileJob
+    {
+        ChunkedPrintFileJob(): format(CUPS_FORMAT_AUTO), chunk_size(DEFAULT_CHUNK_SIZE) {}
+
+        std::string filename;
+        std::string printer_name;
+        std::string docname;
+        std::string format;
+        CupsOptionsPtr options;
+        size_t chunk_size;
+    };
+
+    struct TransferProgress
+    {
+        size_t bytes_sent;
+        size_t total_bytes;
+        double elapsed_seconds;
+    };
+
+    /** Send a mapped file by chunks and report the progress to JS
+     */
+    class ChunkedPrintFileWorker: public Napi::AsyncProgressWorker<TransferProgress>
+    {
+    public:
+        ChunkedPrintFileWorker(const Napi::Function& iCallback, const Napi::Function& iProgress, const CancelFlagType& iCancelled, const ChunkedPrintFileJob& iJob):
+            Napi::AsyncProgressWorker<TransferProgress>(iCallback, "node-printer:printFileChunked"),
+            _progress(Napi::Persistent(iProgress)),
+            _cancelled(iCancelled),
+            _job(iJob),
+            _job_id(0)
+        {}
+
+    protected:
+        void Execute(const ExecutionProgress& progress)
+        {
+            std::string error_str;
+            MappedFile file;
+            if(!file.open(_job.filename, error_str))
+            {
+                SetError(error_str);
+                return;
+            }
+
+            CupsJobUpload upload;
+            if(!upload.start(_job.printer_name, _job.docname, _job.format, *_job.options, error_str))
+            {
+                SetError(error_str);
+                return;
+            }
+
+            std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+            std::chrono::steady_clock::time_point reported = started;
+            size_t offset = 0;
+            while(offset < file.size())
+            {
+                if(*_cancelled)
+                {
+                    upload.cancel();
+                    SetError("printFile: transfer cancelled");
+                    return;
+                }
+                size_t length = std::min(_job.chunk_size, file.size() - offset);
+                if(!upload.write(file.data() + offset, length, error_str))
+                {
+                    SetError(error_str);
+                    return;
+                }
+                offset += length;
+                file.release(offset);
+
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                if(offset == file.size() || std::chrono::duration_cast<std::chrono::milliseconds>(now - reported).count() >= PROGRESS_INTERVAL_MS)
+                {
+                    TransferProgress transfer_progress;
+                    transfer_progress.bytes_sent = offset;
+                    transfer_progress.total_bytes = file.size();
+                    transfer_progress.elapsed_seconds = std::chrono::duration<double>(now - started).count();
+                    progress.Send(&transfer_progress, 1);
+                    reported = now;
+                }
+            }
+
+            if(!upload.finish(error_str))
+            {
+                SetError(error_str);
+                return;
+            }
+            _job_id = upload.jobId();
+        }
+
+        void OnProgress(const TransferProgress* data, size_t count)
+        {
+            if(data == NULL || count == 0 || _progress.IsEmpty())
+            {
+                return;
+            }
+            Napi::Env env = Env();
+            Napi::HandleScope scope(env);
+
+            const TransferProgress& last = data[count - 1];
+            double bytes_per_second = (last.elapsed_seconds > 0) ? (last.bytes_sent / last.elapsed_seconds) : 0;
+
+            Napi::Object result = Napi::Object::New(env);
+            result.Set("bytesSent", Napi::Number::New(env, static_cast<double>(last.bytes_sent)));
+            result.Set("totalBytes", Napi::Number::New(env, static_cast<double>(last.total_bytes)));
+            result.Set("percent", Napi::Number::New(env, last.total_bytes ? (100.0 * last.bytes_sent / last.total_bytes) : 100.0));
+            result.Set("mbPerSecond", Napi::Number::New(env, bytes_per_second / (1024.0 * 1024.0)));
+            // estimated seconds until the transfer is done
+            result.Set("eta", Napi::Number::New(env, (bytes_per_second > 0) ? ((last.total_bytes - last.bytes_sent) / bytes_per_second) : 0));
+            _progress.Call({ result });
+        }
+
+        std::vector<napi_value> GetResult(Napi::Env env)
+        {
+            std::vector<napi_value> result;
+            result.push_back(env.Null());
+            result.push_back(Napi::Number::New(env, _job_id));
+            return result;
+        }
+
+    private:
+        Napi::FunctionReference _progress;
+        CancelFlagType _cancelled;
+        ChunkedPrintFileJob _job;
+        int _job_id;
+    };
+}
+
+Napi::Value PrintFileChunked(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 3)
+    {
+        Napi::TypeError::New(env, "printFileChunked:invalid number of arguments (3 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[0].IsObject())
+    {
+        Napi::TypeError::New(env, "printFileChunked:first argument must be an object").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[1].IsFunction() || !info[2].IsFunction())
+    {
+        Napi::TypeError::New(env, "printFileChunked:progress and callback arguments must be functions").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    Napi::Object arg_params = info[0].As<Napi::Object>();
+
+    // filename
+    Napi::Value arg_value_filename = arg_params.Get("filename");
+    if(!arg_value_filename.IsString())
+    {
+        Napi::TypeError::New(env, "printFileChunked:filename parameter must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // the worker owns a thread safe function from its construction: it is only created once the job is valid
+    ChunkedPrintFileJob job;
+    job.filename = arg_value_filename.As<Napi::String>().Utf8Value();
+    job.docname = job.filename;
+
+    std::string error_str;
+    // printer name
+    Napi::Value arg_value_printer = arg_params.Get("printer");
+    if(arg_value_printer.IsString())
+    {
+        job.printer_name = arg_value_printer.As<Napi::String>().Utf8Value();
+    }
+    else if(arg_value_printer.IsUndefined())
+    {
+        // if printer is not specified, then use default printer.
+        const char * default_printer_name = cupsGetDefault();
+        if(default_printer_name != NULL)
+        {
+            job.printer_name = default_printer_name;
+        }
+    }
+    else
+    {
+        error_str = "printFileChunked:printer parameter must be a string";
+    }
+
+    // docname
+    Napi::Value arg_value_docname = arg_params.Get("docname");
+    if(arg_value_docname.IsString())
+    {
+        job.docname = arg_value_docname.As<Napi::String>().Utf8Value();
+    }
+
+    // type, AUTO lets CUPS detect the file format like cupsPrintFile does
+    Napi::Value arg_value_type = arg_params.Get("type");
+    if(arg_value_type.IsString())
+    {
+        FormatMapType::const_iterator itFormat = getPrinterFormatMap().find(arg_value_type.As<Napi::String>().Utf8Value());
+        if(itFormat == getPrinterFormatMap().end())
+        {
+            error_str = "printFileChunked: unsupported format type";
+        }
+        else
+        {
+            job.format = itFormat->second;
+        }
+    }
+
+    // chunk size
+    Napi::Value arg_value_chunk_size = arg_params.Get("chunkSize");
+    if(arg_value_chunk_size.IsNumber())
+    {
+        job.chunk_size = std::max(static_cast<size_t>(arg_value_chunk_size.As<Napi::Number>().Int64Value()), MIN_CHUNK_SIZE);
+    }
+
+    // options
+    Napi::Value arg_value_options = arg_params.Get("options");
+    if(!getCupsOptionsFromV8Value(arg_value_options, job.options))
+    {
+        error_str = "printFileChunked:options parameter must be an object";
+    }
+
+    if(!error_str.empty())
+    {
+        Napi::TypeError::New(env, error_str).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    // rejected before the file is mapped and uploaded
+    if(!preflightV8Params(arg_params, "", job.printer_name, *job.options, error_str))
+    {
+        Napi::Error::New(env, "printFileChunked: " + error_str).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    CancelFlagType cancelled(new std::atomic<bool>(false));
+    ChunkedPrintFileWorker *worker = new ChunkedPrintFileWorker(info[2].As<Napi::Function>(), info[1].As<Napi::Function>(), cancelled, job);
+    worker->Queue();
+
+    // transfer handle: cancel() aborts the upload before the next chunk and cancels the job
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("cancel", Napi::Function::New(env, [cancelled](const Napi::CallbackInfo& cancel_info) -> Napi::Value {
+        *cancelled = true;
+        return cancel_info.Env().Undefined();
+    }, "cancel"));
+    return result;
+}
@@ -0,0 +1,396 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+namespace
+{
+    const int DEFAULT_WINDOW_MS = 50;
+    const size_t DEFAULT_MAX_BYTES = 64 * 1024;
+
+    typedef std::chrono::steady_clock ClockType;
+
+    /** Jobs waiting to be sent together. Callbacks are created and released on the main thread
+     */
+    struct Batch
+    {
+        Batch(): max_bytes(DEFAULT_MAX_BYTES) {}
+
+        std::string printer_name;
+        std::string docname;
+        CupsOptionsPtr options;
+        std::string data;
+        std::vector<Napi::FunctionReference*> callbacks;
+        ClockType::time_point deadline;
+        size_t max_bytes;
+    };
+
+    typedef std::shared_ptr<Batch> BatchPtr;
+
+    /** Result of a sent batch, passed to the main thread
+     */
+    class RawCoalescer;
+
+    struct FlushResult
+    {
+        RawCoalescer *coalescer;
+        BatchPtr batch;
+        int job_id;
+        std::string error;
+    };
+
+    /** Coalesce tiny RAW jobs of the same printer and options into one CUPS job.
+     * A batch is sent when its time window expires or when it reaches its size limit,
+     * by a flusher thread, and every caller is called back with the id of the combined job once CUPS
+     * accepted it: the job is not followed until it completes.
+     */
+    class RawCoalescer: public AddonService
+    {
+    public:
+        static RawCoalescer& getInstance(Napi::Env env);
+
+        /** Add a job to the batch of its printer and options. Main thread only
+         */
+        void add(Napi::Env env, const std::string &iPrinterName, const std::string &iDocname, const CupsOptionsPtr &iOptions,
+            const char *iData, size_t iSize, int iWindowMs, size_t iMaxBytes, const Napi::Function &iCallback);
+
+    private:
+        RawCoalescer(Napi::Env env);
+
+        /** Stop the flusher thread at environment teardown, sending the pending batches, and delete the coalescer
+         */
+        static void cleanup(void *iData);
+
+        void run();
+        void send(const BatchPtr &iBatch);
+        static void onFlushed(Napi::Env env, Napi::Function iFunction, FlushResult *iResult);
+
+        /** Key of the batches which may be concatenated: same printer and same options
+         */
+        static std::string getBatchKey(const std::string &iPrinterName, const CupsOptions &iOptions);
+
+        napi_env _env;
+        Napi::ThreadSafeFunction _tsfn;
+        /** callbacks not called yet, main thread only. The event loop is kept alive while it is not 0 */
+        size_t _pending_callbacks;
+
+        std::mutex _mutex;
+        std::condition_variable _wakeup;
+        std::map<std::string, BatchPtr> _batches;
+        bool _stopping;
+        std::thread _flusher;
+    };
+
+    RawCoalescer& RawCoalescer::getInstance(Napi::Env env)
+    {
+        // one per environment: its callbacks are called on the thread of the environment
+        std::unique_ptr<AddonService> &instance = getAddonData(env).services["RawCoalescer"];
+        if(!instance)
+        {
+            instance.reset(new RawCoalescer(env));
+        }
+        return static_cast<RawCoalescer&>(*instance);
+    }
+
+    RawCoalescer::RawCoalescer(Napi::Env env):
+        _env(env),
+        _pending_callbacks(0),
+        _stopping(false)
+    {
+        _tsfn = Napi::ThreadSafeFunction::New(env, Napi::Function::New(env, [](const Napi::CallbackInfo& info) -> Napi::Value {
+            return info.Env().Undefined();
+        }), "node-printer:coalesce", 0, 1);
+        _tsfn.Unref(env);
+        _flusher = std::thread(&RawCoalescer::run, this);
+        napi_add_env_cleanup_hook(env, &RawCoalescer::cleanup, this);
+    }
+
+    void RawCoalescer::cleanup(void *iData)
+    {
+        RawCoalescer *coalescer = static_cast<RawCoalescer*>(iData);
+        {
+            std::lock_guard<std::mutex> lock(coalescer->_mutex);
+            coalescer->_stopping = true;
+        }
+        coalescer->_wakeup.notify_one();
+        coalescer->_flusher.join();
+        coalescer->_tsfn.Abort();
+        getAddonData(Napi::Env(coalescer->_env)).services.erase("RawCoalescer");
+    }
+
+    std::string RawCoalescer::getBatchKey(const std::string &iPrinterName, const CupsOptions &iOptions)
+    {
+        std::string result = iPrinterName;
+        cups_option_t *option = iOptions.get();
+        for(int i = 0; i < iOptions.size(); ++i, ++option)
+        {
+            result += '\n';
+            result += option->name;
+            result += '=';
+            result += option->value;
+        }
+        return result;
+    }
+
+    void RawCoalescer::add(Napi::Env env, const std::string &iPrinterName, const std::string &iDocname, const CupsOptionsPtr &iOptions,
+        const char *iData, size_t iSize, int iWindowMs, size_t iMaxBytes, const Napi::Function &iCallback)
+    {
+        if(_pending_callbacks++ == 0)
+        {
+            _tsfn.Ref(env);
+        }
+        Napi::FunctionReference *callback = new Napi::FunctionReference(Napi::Persistent(iCallback));
+        std::string key = getBatchKey(iPrinterName, *iOptions);
+
+        bool wakeup = false;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            BatchPtr &batch = _batches[key];
+            if(!batch)
+            {
+                batch = std::make_shared<Batch>();
+                batch->printer_name = iPrinterName;
+                batch->docname = iDocname;
+                batch->options = iOptions;
+                batch->deadline = ClockType::now() + std::chrono::milliseconds(iWindowMs);
+                batch->max_bytes = iMaxBytes;
+                // the flusher may wait for a later deadline
+                wakeup = true;
+            }
+            batch->data.append(iData, iSize);
+            batch->callbacks.push_back(callback);
+            if(batch->data.size() >= batch->max_bytes)
+            {
+                batch->deadline = ClockType::now();
+                wakeup = true;
+            }
+        }
+        if(wakeup)
+        {
+            _wakeup.notify_one();
+        }
+    }
+
+    void RawCoalescer::run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while(true)
+        {
+            // batches which are due, or all of them when stopping
+            ClockType::time_point now = ClockType::now();
+            ClockType::time_point next_deadline = ClockType::time_point::max();
+            std::vector<BatchPtr> due;
+            for(std::map<std::string, BatchPtr>::iterator itBatch = _batches.begin(); itBatch != _batches.end();)
+            {
+                if(_stopping || itBatch->second->deadline <= now)
+                {
+                    due.push_back(itBatch->second);
+                    _batches.erase(itBatch++);
+                }
+                else
+                {
+                    next_deadline = std::min(next_deadline, itBatch->second->deadline);
+                    ++itBatch;
+                }
+            }
+
+            if(!due.empty())
+            {
+                // new jobs are batched while the due ones are sent
+                lock.unlock();
+                for(std::vector<BatchPtr>::const_iterator itBatch = due.begin(); itBatch != due.end(); ++itBatch)
+                {
+                    send(*itBatch);
+                }
+                lock.lock();
+                continue;
+            }
+            if(_stopping)
+            {
+                return;
+            }
+            if(next_deadline == ClockType::time_point::max())
+            {
+                _wakeup.wait(lock);
+            }
+            else
+            {
+                _wakeup.wait_until(lock, next_deadline);
+            }
+        }
+    }
+
+    void RawCoalescer::send(const BatchPtr &iBatch)
+    {
+        FlushResult *result = new FlushResult();
+        result->coalescer = this;
+        result->batch = iBatch;
+        result->job_id = 0;
+
+        ipp_status_t status;
+        result->job_id = getCurrentPrintBackend()->printData("", iBatch->printer_name, iBatch->docname, CUPS_FORMAT_RAW, *iBatch->options,
+            iBatch->data.data(), iBatch->data.size(), status, result->error);
+        // the data is not needed anymore, only the callbacks
+        std::string().swap(iBatch->data);
+
+        if(_tsfn.BlockingCall(result, &RawCoalescer::onFlushed) != napi_ok)
+        {
+            // environment is being torn down: callbacks cannot be called anymore
+            delete result;
+        }
+    }
+
+    void RawCoalescer::onFlushed(Napi::Env env, Napi::Function, FlushResult *iResult)
+    {
+        std::unique_ptr<FlushResult> result(iResult);
+        RawCoalescer &coalescer = *result->coalescer;
+        std::vector<Napi::FunctionReference*> &callbacks = result->batch->callbacks;
+        Napi::Error first_error;
+        for(size_t i = 0; i < callbacks.size(); ++i)
+        {
+            Napi::HandleScope scope(env);
+            if(result->error.empty())
+            {
+                Napi::Object job = Napi::Object::New(env);
+                job.Set("id", Napi::Number::New(env, result->job_id));
+                // position of the logical job in the combined job
+                job.Set("index", Napi::Number::New(env, static_cast<double>(i)));
+                job.Set("count", Napi::Number::New(env, static_cast<double>(callbacks.size())));
+                callbacks[i]->Call({ env.Null(), job });
+            }
+            else
+            {
+                callbacks[i]->Call({ Napi::Error::New(env, result->error).Value() });
+            }
+            delete callbacks[i];
+            if(env.IsExceptionPending())
+            {
+                Napi::Error error = env.GetAndClearPendingException();
+                if(first_error.IsEmpty())
+                {
+                    first_error = error;
+                }
+            }
+        }
+
+        coalescer._pending_callbacks -= callbacks.size();
+        if(coalescer._pending_callbacks == 0)
+        {
+            coalescer._tsfn.Unref(env);
+        }
+        if(!first_error.IsEmpty())
+        {
+            first_error.ThrowAsJavaScriptException();
+        }
+    }
+}
+
+Napi::Value PrintDirectCoalesced(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 2)
+    {
+        Napi::TypeError::New(env, "printDirectCoalesced:invalid number of arguments (2 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[0].IsObject())
+    {
+        Napi::TypeError::New(env, "printDirectCoalesced:first argument must be an object").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[1].IsFunction())
+    {
+        Napi::TypeError::New(env, "printDirectCoalesced:second argument must be a callback function").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    Napi::Object arg_params = info[0].As<Napi::Object>();
+
+    // data, copied into the batch
+    std::string data_storage;
+    struct iovec data;
+    bool encoded = false;
+    std::string encoding_error;
+    if(!getEncodedDataFromV8Params(arg_params, data_storage, encoded, encoding_error))
+    {
+        Napi::TypeError::New(env, "printDirectCoalesced:" + encoding_error).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    if(encoded)
+    {
+        data.iov_base = const_cast<char*>(data_storage.data());
+        data.iov_len = data_storage.size();
+    }
+    else if(!getDataFromV8Value(arg_params.Get("data"), data_storage, data))
+    {
+        Napi::TypeError::New(env, "printDirectCoalesced:data parameter must be a string or Buffer").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // printer name
+    std::string printer_name;
+    Napi::Value arg_value_printer = arg_params.Get("printer");
+    if(arg_value_printer.IsString())
+    {
+        printer_name = arg_value_printer.As<Napi::String>().Utf8Value();
+    }
+    else
+    {
+        const char *default_printer_name = cupsGetDefault();
+        if(default_printer_name == NULL)
+        {
+            Napi::TypeError::New(env, "printDirectCoalesced:printer parameter must be a string").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        printer_name = default_printer_name;
+    }
+
+    // docname of the combined job: the one of its first job
+    std::string docname = "node print job";
+    Napi::Value arg_value_docname = arg_params.Get("docname");
+    if(arg_value_docname.IsString())
+    {
+        docname = arg_value_docname.As<Napi::String>().Utf8Value();
+    }
+
+    CupsOptionsPtr options;
+    if(!getCupsOptionsFromV8Value(arg_params.Get("options"), options))
+    {
+        Napi::TypeError::New(env, "printDirectCoalesced:options parameter must be an object").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    std::string preflight_error;
+    if(!preflightV8Params(arg_params, "", printer_name, *options, preflight_error))
+    {
+        Napi::Error::New(env, "printDirectCoalesced: " + preflight_error).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    int window_ms = DEFAULT_WINDOW_MS;
+    Napi::Value arg_value_window = arg_params.Get("window");
+    if(arg_value_window.IsNumber())
+    {
+        window_ms = std::max(arg_value_window.As<Napi::Number>().Int32Value(), 0);
+    }
+
+    size_t max_bytes = DEFAULT_MAX_BYTES;
+    Napi::Value arg_value_max_bytes = arg_params.Get("maxBytes");
+    if(arg_value_max_bytes.IsNumber())
+    {
+        max_bytes = static_cast<size_t>(std::max(arg_value_max_bytes.As<Napi::Number>().Int64Value(), static_cast<int64_t>(1)));
+    }
+
+    RawCoalescer::getInstance(env).add(env, printer_name, docname, options, static_cast<const char*>(data.iov_base), data.iov_len,
+        window_ms, max_bytes, info[1].As<Napi::Function>());
+    return env.Undefined();
+}
@@ -0,0 +1,303 @@
+#include "node_printer.hpp"
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define NODE_PRINTER_SSE2
+#   include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#   define NODE_PRINTER_NEON
+#   include <arm_neon.h>
+#endif
+
+namespace
+{
+    /** Unicode code points of the bytes 0x80 to 0xFF, 0 if the byte is undefined
+     */
+    const uint16_t CP437_HIGH[128] = {
+        0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+        0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+        0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+        0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+        0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+        0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+        0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+        0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+        0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F,
+        0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+        0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B,
+        0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+        0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4,
+        0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+        0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248,
+        0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0
+    };
+
+    const uint16_t CP850_HIGH[128] = {
+        0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+        0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+        0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+        0x00FF, 0x00D6, 0x00DC, 0x00F8, 0x00A3, 0x00D8, 0x00D7, 0x0192,
+        0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+        0x00BF, 0x00AE, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+        0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x00C1, 0x00C2, 0x00C0,
+        0x00A9, 0x2563, 0x2551, 0x2557, 0x255D, 0x00A2, 0x00A5, 0x2510,
+        0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x00E3, 0x00C3,
+        0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x00A4,
+        0x00F0, 0x00D0, 0x00CA, 0x00CB, 0x00C8, 0x0131, 0x00CD, 0x00CE,
+        0x00CF, 0x2518, 0x250C, 0x2588, 0x2584, 0x00A6, 0x00CC, 0x2580,
+        0x00D3, 0x00DF, 0x00D4, 0x00D2, 0x00F5, 0x00D5, 0x00B5, 0x00FE,
+        0x00DE, 0x00DA, 0x00DB, 0x00D9, 0x00FD, 0x00DD, 0x00AF, 0x00B4,
+        0x00AD, 0x00B1, 0x2017, 0x00BE, 0x00B6, 0x00A7, 0x00F7, 0x00B8,
+        0x00B0, 0x00A8, 0x00B7, 0x00B9, 0x00B3, 0x00B2, 0x25A0, 0x00A0
+    };
+
+    const uint16_t WINDOWS_1252_HIGH[128] = {
+        0x20AC, 0x0000, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+        0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x0000, 0x017D, 0x0000,
+        0x0000, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+        0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x0000, 0x017E, 0x0178,
+        0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+        0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+        0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+        0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+        0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+        0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+        0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+        0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+        0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+        0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+        0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+        0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF
+    };
+
+    /** Byte of every UTF-16 code unit in a single byte codepage, 0 if it has none.
+     * Bytes below 0x80 are ASCII in all the supported codepages.
+     */
+    class CodepageTable
+    {
+    public:
+        /** @param iEuroByte byte replaced by the euro sign, 0 for none (CP858 is CP850 with the euro sign)
+         */
+        CodepageTable(const uint16_t *iHigh, uint8_t iEuroByte = 0):
+            _bytes(0x10000, 0)
+        {
+            for(int i = 0; i < 128; ++i)
+            {
+                uint16_t code = (iEuroByte == 0x80 + i) ? 0x20AC : iHigh[i];
+                if(code != 0)
+                {
+                    _bytes[code] = static_cast<uint8_t>(0x80 + i);
+                }
+            }
+        }
+
+        uint8_t get(char16_t iCode) const { return _bytes[iCode]; }
+
+    private:
+        std::vector<uint8_t> _bytes;
+    };
+
+    /** @returns table of the codepage named iName, NULL if it is not supported
+     */
+    const CodepageTable* getCodepageTable(const std::string &iName)
+    {
+        // built on first use
+        if(iName == "cp437")
+        {
+            static const CodepageTable table(CP437_HIGH);
+            return &table;
+        }
+        if(iName == "cp850")
+        {
+            static const CodepageTable table(CP850_HIGH);
+            return &table;
+        }
+        if(iName == "cp858")
+        {
+            static const CodepageTable table(CP850_HIGH, 0xD5);
+            return &table;
+        }
+        if(iName == "windows-1252" || iName == "cp1252")
+        {
+            static const CodepageTable table(WINDOWS_1252_HIGH);
+            return &table;
+        }
+        return NULL;
+    }
+
+    /** Copy the leading ASCII code units as bytes
+     * @returns number of code units copied
+     */
+    size_t copyAscii(const char16_t *iInput, size_t iLength, char *oOutput)
+    {
+        size_t i = 0;
+#if defined(NODE_PRINTER_SSE2)
+        const __m128i non_ascii = _mm_set1_epi16(static_cast<short>(0xFF80));
+        const __m128i zero = _mm_setzero_si128();
+        for(; i + 16 <= iLength; i += 16)
+        {
+            __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iInput + i));
+            __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iInput + i + 8));
+            __m128i outside = _mm_and_si128(_mm_or_si128(low, high), non_ascii);
+            if(_mm_movemask_epi8(_mm_cmpeq_epi16(outside, zero)) != 0xFFFF)
+            {
+                break;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(oOutput + i), _mm_packus_epi16(low, high));
+        }
+#elif defined(NODE_PRINTER_NEON)
+        for(; i + 16 <= iLength; i += 16)
+        {
+            uint16x8_t low = vld1q_u16(reinterpret_cast<const uint16_t*>(iInput + i));
+            uint16x8_t high = vld1q_u16(reinterpret_cast<const uint16_t*>(iInput + i + 8));
+            // saturated: not 0 as soon as a code unit is 0x80 or more
+            uint8x8_t outside = vqshrn_n_u16(vorrq_u16(low, high), 7);
+            if(vget_lane_u64(vreinterpret_u64_u8(outside), 0) != 0)
+            {
+                break;
+            }
+            vst1q_u8(reinterpret_cast<uint8_t*>(oOutput + i), vcombine_u8(vmovn_u16(low), vmovn_u16(high)));
+        }
+#endif
+        for(; i < iLength && iInput[i] < 0x80; ++i)
+        {
+            oOutput[i] = static_cast<char>(iInput[i]);
+        }
+        return i;
+    }
+
+    /** Transcode UTF-16 code units. oOutput must hold iLength * max(1, replacement size) bytes
+     * @returns number of bytes written
+     */
+    size_t transcode(const char16_t *iInput, size_t iLength, const CodepageTable &iTable, const std::string &iReplacement, char *oOutput)
+    {
+        char *output = oOutput;
+        size_t i = 0;
+        while(i < iLength)
+        {
+            size_t ascii = copyAscii(iInput + i, iLength - i, output);
+            i += ascii;
+            output += ascii;
+            // non ASCII run: table lookups until the next ASCII code unit
+            for(; i < iLength && iInput[i] >= 0x80; ++i)
+            {
+                uint8_t byte = iTable.get(iInput[i]);
+                if(byte != 0)
+                {
+                    *output++ = static_cast<char>(byte);
+                    continue;
+                }
+                // a surrogate pair is one character
+                if(iInput[i] >= 0xD800 && iInput[i] < 0xDC00 && i + 1 < iLength && iInput[i + 1] >= 0xDC00 && iInput[i + 1] < 0xE000)
+                {
+                    ++i;
+                }
+                memcpy(output, iReplacement.data(), iReplacement.size());
+                output += iReplacement.size();
+            }
+        }
+        return output - oOutput;
+    }
+}
+
+bool encodeV8String(Napi::Value iString, const std::string &iEncoding, const std::string &iReplacement, std::string &oData, std::string &oError)
+{
+    const CodepageTable *table = getCodepageTable(iEncoding);
+    if(table == NULL)
+    {
+        if(iEncoding == "utf8" || iEncoding == "utf-8")
+        {
+            oData = iString.As<Napi::String>().Utf8Value();
+            return true;
+        }
+        oError = "unsupported encoding " + iEncoding;
+        return false;
+    }
+    for(std::string::const_iterator it = iReplacement.begin(); it != iReplacement.end(); ++it)
+    {
+        if(static_cast<unsigned char>(*it) >= 0x80)
+        {
+            oError = "replacement must be ASCII";
+            return false;
+        }
+    }
+
+    napi_env env = iString.Env();
+    size_t length = 0;
+    napi_get_value_string_utf16(env, iString, NULL, 0, &length);
+    std::u16string input(length, u'\0');
+    // the size includes the terminating NUL
+    napi_get_value_string_utf16(env, iString, &input[0], length + 1, &length);
+
+    // at most one byte per code unit, unless the replacement is longer
+    oData.resize(length * std::max<size_t>(1, iReplacement.size()));
+    oData.resize(transcode(input.data(), length, *table, iReplacement, &oData[0]));
+    return true;
+}
+
+bool getEncodedDataFromV8Params(Napi::Object iParams, std::string &oData, bool &oEncoded, std::string &oError)
+{
+    oEncoded = false;
+    Napi::Value data = iParams.Get("data");
+    Napi::Value encoding = iParams.Get("encoding");
+    if(!data.IsString() || !encoding.IsString())
+    {
+        return true;
+    }
+    std::string replacement = "?";
+    Napi::Value arg_replacement = iParams.Get("replacement");
+    if(arg_replacement.IsString())
+    {
+        replacement = arg_replacement.As<Napi::String>().Utf8Value();
+    }
+    oEncoded = encodeV8String(data, encoding.As<Napi::String>().Utf8Value(), replacement, oData, oError);
+    return oEncoded;
+}
+
+Napi::Value encode(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 2)
+    {
+        Napi::TypeError::New(env, "encode:invalid number of arguments (2 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    if(!info[0].IsString())
+    {
+        Napi::TypeError::New(env, "encode:first argument must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    if(!info[1].IsString())
+    {
+        Napi::TypeError::New(env, "encode:encoding must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    std::string replacement = "?";
+    if(info.Length() > 2 && info[2].IsObject())
+    {
+        Napi::Value arg_replacement = info[2].As<Napi::Object>().Get("replacement");
+        if(arg_replacement.IsString())
+        {
+            replacement = arg_replacement.As<Napi::String>().Utf8Value();
+        }
+    }
+
+    std::unique_ptr<std::string> data(new std::string());
+    std::string error;
+    if(!encodeV8String(info[0], info[1].As<Napi::String>().Utf8Value(), replacement, *data, error))
+    {
+        Napi::TypeError::New(env, "encode:" + error).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    // the transcoded string is the Buffer memory, copied only where external buffers are not allowed
+    std::string *result = data.release();
+    return Napi::Buffer<char>::NewOrCopy(env, &(*result)[0], result->size(),
+        [](Napi::Env, char*, std::string *iData) { delete iData; }, result);
+}
@@ -0,0 +1,443 @@
+#include "node_printer_ipp_codec.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace
+{
+    /** Alignment of the arena allocations: enough for pointers and the structures of the codec */
+    const size_t ARENA_ALIGN = sizeof(void*) > 8 ? sizeof(void*) : 8;
+
+    const IppView EMPTY_VIEW = { "", 0 };
+
+    uint16_t readShort(const uint8_t *iData)
+    {
+        return static_cast<uint16_t>((iData[0] << 8) | iData[1]);
+    }
+
+    int32_t readInt(const uint8_t *iData)
+    {
+        return static_cast<int32_t>((static_cast<uint32_t>(iData[0]) << 24) | (static_cast<uint32_t>(iData[1]) << 16)
+                                    | (static_cast<uint32_t>(iData[2]) << 8) | iData[3]);
+    }
+
+    bool isDelimiterTag(uint8_t iTag)
+    {
+        return iTag < 0x10;
+    }
+
+    /** Reader of the value entries of a message: tag, name and value
+     */
+    class IppReader
+    {
+    public:
+        IppReader(const char *iData, size_t iSize):
+            _data(reinterpret_cast<const uint8_t*>(iData)),
+            _size(iSize),
+            _position(0)
+        {}
+
+        size_t position() const { return _position; }
+        void seek(size_t iPosition) { _position = iPosition; }
+        bool atEnd() const { return _position >= _size; }
+
+        /** @return tag at the current position, the position is not changed. -1 at the end
+         */
+        int peekTag() const
+        {
+            return atEnd() ? -1 : _data[_position];
+        }
+
+        /** Read a value entry. The extension tag 0x7f is not supported
+         * @return false if the entry is truncated
+         */
+        bool readValue(uint8_t &oTag, IppView &oName, IppView &oValue)
+        {
+            if(_size - _position < 3)
+            {
+                return false;
+            }
+            oTag = _data[_position];
+            size_t name_length = readShort(_data + _position + 1);
+            _position += 3;
+            if(_size - _position < name_length + 2)
+            {
+                return false;
+            }
+            oName.data = reinterpret_cast<const char*>(_data + _position);
+            oName.length = name_length;
+            _position += name_length;
+            size_t value_length = readShort(_data + _position);
+            _position += 2;
+            if(_size - _position < value_length)
+            {
+                return false;
+            }
+            oValue.data = reinterpret_cast<const char*>(_data + _position);
+            oValue.length = value_length;
+            _position += value_length;
+            return true;
+        }
+
+    private:
+        const uint8_t *_data;
+        size_t _size;
+        size_t _position;
+    };
+
+    /** Same as strrchr(iUri, '/') + 1 on a view
+     */
+    IppView lastPathComponent(const IppView &iUri)
+    {
+        const char *end = iUri.data + iUri.length;
+        const char *begin = end;
+        while(begin > iUri.data && begin[-1] != '/')
+        {
+            --begin;
+        }
+        IppView result = { begin, static_cast<size_t>(end - begin) };
+        return result;
+    }
+}
+
+bool IppView::equals(const char *iValue) const
+{
+    size_t value_length = strlen(iValue);
+    return value_length == length && memcmp(data, iValue, length) == 0;
+}
+
+IppArena::~IppArena()
+{
+    for(std::vector<Block>::iterator itBlock = _blocks.begin(); itBlock != _blocks.end(); ++itBlock)
+    {
+        free(itBlock->data);
+    }
+}
+
+void* IppArena::allocate(size_t iSize)
+{
+    iSize = (iSize + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    while(_block < _blocks.size())
+    {
+        Block &block = _blocks[_block];
+        if(block.size - _offset >= iSize)
+        {
+            void *result = block.data + _offset;
+            _offset += iSize;
+            return result;
+        }
+        ++_block;
+        _offset = 0;
+    }
+    // blocks double up to 1 MiB, so a big response needs only a few of them
+    size_t block_size = _blocks.empty() ? _block_size : _blocks.back().size * 2;
+    if(block_size > 1024 * 1024)
+    {
+        block_size = 1024 * 1024;
+    }
+    if(block_size < iSize)
+    {
+        block_size = iSize;
+    }
+    Block block = { static_cast<char*>(malloc(block_size)), block_size };
+    if(block.data == NULL)
+    {
+        return NULL;
+    }
+    _blocks.push_back(block);
+    _block = _blocks.size() - 1;
+    _offset = iSize;
+    return block.data;
+}
+
+void IppArena::reset()
+{
+    _block = 0;
+    _offset = 0;
+}
+
+int32_t IppAttribute::integer(int iIndex) const
+{
+    if(iIndex >= count)
+    {
+        return 0;
+    }
+    const IppView &value = values[iIndex];
+    if(value.length == 4)
+    {
+        return readInt(reinterpret_cast<const uint8_t*>(value.data));
+    }
+    if(value.length == 1)
+    {
+        return static_cast<uint8_t>(value.data[0]);
+    }
+    return 0;
+}
+
+const IppAttribute* IppMessage::find(const char *iName, uint8_t iGroup) const
+{
+    for(const IppAttribute *attr = attributes; attr != NULL; attr = attr->next)
+    {
+        if((iGroup == 0 || attr->group == iGroup) && attr->name.equals(iName))
+        {
+            return attr;
+        }
+    }
+    return NULL;
+}
+
+bool decodeIppMessage(const char *iData, size_t iSize, IppArena &ioArena, IppMessage &oMessage, std::string &oError)
+{
+    ioArena.reset();
+    oMessage = IppMessage();
+    if(iSize < 9)
+    {
+        oError = "IPP message is truncated";
+        return false;
+    }
+    const uint8_t *header = reinterpret_cast<const uint8_t*>(iData);
+    oMessage.version = header[0] * 10 + header[1];
+    oMessage.code = readShort(header + 2);
+    oMessage.request_id = readInt(header + 4);
+
+    IppReader reader(iData + 8, iSize - 8);
+    IppAttribute **last = &oMessage.attributes;
+    uint8_t group = 0;
+    bool group_start = false;
+    for(;;)
+    {
+        int tag = reader.peekTag();
+        if(tag < 0)
+        {
+            oError = "IPP message has no end-of-attributes-tag";
+            return false;
+        }
+        if(isDelimiterTag(static_cast<uint8_t>(tag)))
+        {
+            reader.seek(reader.position() + 1);
+            if(tag == IPP_CODEC_TAG_END)
+            {
+                // what follows is document data
+                return true;
+            }
+            group = static_cast<uint8_t>(tag);
+            group_start = true;
+            continue;
+        }
+
+        IppAttribute *attr = ioArena.allocate<IppAttribute>(1);
+        if(attr == NULL)
+        {
+            oError = "out of memory";
+            return false;
+        }
+        IppView first_value;
+        if(!reader.readValue(attr->tag, attr->name, first_value) || attr->name.length == 0)
+        {
+            oError = "IPP message has an invalid attribute";
+            return false;
+        }
+
+        // additional values have an empty name: count them, then read them into one array
+        size_t values_position = reader.position();
+        int count = 1;
+        uint8_t value_tag;
+        IppView name, value;
+        while(!reader.atEnd() && !isDelimiterTag(static_cast<uint8_t>(reader.peekTag()))
+              && reader.readValue(value_tag, name, value) && name.length == 0)
+        {
+            values_position = reader.position();
+            ++count;
+        }
+
+        attr->group = group;
+        attr->group_start = group_start;
+        group_start = false;
+        attr->count = count;
+        attr->next = NULL;
+        attr->values = ioArena.allocate<IppView>(count);
+        if(attr->values == NULL)
+        {
+            oError = "out of memory";
+            return false;
+        }
+        attr->values[0] = first_value;
+        // values_position is after the last additional value: read them again from the first one
+        reader.seek(static_cast<size_t>(first_value.data + first_value.length - (iData + 8)));
+        for(int i = 1; i < count; ++i)
+        {
+            reader.readValue(value_tag, name, attr->values[i]);
+        }
+        reader.seek(values_position);
+
+        *last = attr;
+        last = &attr->next;
+    }
+}
+
+void IppEncoder::writeShort(size_t iValue)
+{
+    _buffer.push_back(static_cast<char>((iValue >> 8) & 0xff));
+    _buffer.push_back(static_cast<char>(iValue & 0xff));
+}
+
+void IppEncoder::writeValue(uint8_t iTag, const char *iName, size_t iNameLength, const char *iValue, size_t iValueLength)
+{
+    _buffer.push_back(static_cast<char>(iTag));
+    writeShort(iNameLength);
+    _buffer.append(iName, iNameLength);
+    writeShort(iValueLength);
+    _buffer.append(iValue, iValueLength);
+}
+
+void IppEncoder::begin(int iOperation, int32_t iRequestId)
+{
+    // clear() keeps the capacity: encoding a request does not allocate once the buffer is big enough
+    _buffer.clear();
+    _buffer.push_back(2);
+    _buffer.push_back(0);
+    writeShort(static_cast<size_t>(iOperation));
+    uint32_t request_id = static_cast<uint32_t>(iRequestId);
+    _buffer.push_back(static_cast<char>((request_id >> 24) & 0xff));
+    _buffer.push_back(static_cast<char>((request_id >> 16) & 0xff));
+    _buffer.push_back(static_cast<char>((request_id >> 8) & 0xff));
+    _buffer.push_back(static_cast<char>(request_id & 0xff));
+    group(IPP_CODEC_TAG_OPERATION);
+    addString(IPP_CODEC_TAG_CHARSET, "attributes-charset", "utf-8");
+    addString(IPP_CODEC_TAG_LANGUAGE, "attributes-natural-language", "en");
+}
+
+void IppEncoder::group(uint8_t iGroup)
+{
+    _buffer.push_back(static_cast<char>(iGroup));
+}
+
+void IppEncoder::addString(uint8_t iTag, const char *iName, const char *iValue)
+{
+    writeValue(iTag, iName, strlen(iName), iValue, strlen(iValue));
+}
+
+void IppEncoder::addString(uint8_t iTag, const char *iName, const std::string &iValue)
+{
+    writeValue(iTag, iName, strlen(iName), iValue.data(), iValue.size());
+}
+
+void IppEncoder::addStrings(uint8_t iTag, const char *iName, const char * const *iValues, size_t iCount)
+{
+    for(size_t i = 0; i < iCount; ++i)
+    {
+        // additional values of a 1setOf have an empty name
+        writeValue(iTag, iName, (i == 0) ? strlen(iName) : 0, iValues[i], strlen(iValues[i]));
+    }
+}
+
+void IppEncoder::addInteger(uint8_t iTag, const char *iName, int32_t iValue)
+{
+    uint32_t value = static_cast<uint32_t>(iValue);
+    char bytes[4] = {
+        static_cast<char>((value >> 24) & 0xff),
+        static_cast<char>((value >> 16) & 0xff),
+        static_cast<char>((value >> 8) & 0xff),
+        static_cast<char>(value & 0xff)
+    };
+    writeValue(iTag, iName, strlen(iName), bytes, sizeof(bytes));
+}
+
+void IppEncoder::addBoolean(const char *iName, bool iValue)
+{
+    char value = iValue ? 1 : 0;
+    writeValue(IPP_CODEC_TAG_BOOLEAN, iName, strlen(iName), &value, 1);
+}
+
+void IppEncoder::end()
+{
+    _buffer.push_back(static_cast<char>(IPP_CODEC_TAG_END));
+}
+
+void getIppJobViews(const IppMessage &iMessage, std::vector<IppJobView> &oJobs)
+{
+    // jobs are groups of job attributes, separated by other groups
+    const IppAttribute *attr = iMessage.attributes;
+    while(attr != NULL)
+    {
+        while(attr != NULL && attr->group != IPP_CODEC_TAG_JOB)
+        {
+            attr = attr->next;
+        }
+        if(attr == NULL)
+        {
+            break;
+        }
+
+        IppJobView job;
+        // same defaults as IppJob
+        job.id = 0;
+        job.state = 3/*IPP_JOB_PENDING*/;
+        job.size = 0;
+        job.priority = 50;
+        job.completed_time = 0;
+        job.creation_time = 0;
+        job.processing_time = 0;
+        job.dest = job.title = job.user = job.format = EMPTY_VIEW;
+
+        const IppAttribute *first = attr;
+        for(; attr != NULL && attr->group == IPP_CODEC_TAG_JOB && (attr == first || !attr->group_start); attr = attr->next)
+        {
+            const IppView &name = attr->name;
+            if(attr->tag == IPP_CODEC_TAG_INTEGER || attr->tag == IPP_CODEC_TAG_ENUM)
+            {
+                int value = attr->integer();
+                if(name.equals("job-id"))
+                {
+                    job.id = value;
+                }
+                else if(name.equals("job-state"))
+                {
+                    job.state = value;
+                }
+                else if(name.equals("job-priority"))
+                {
+                    job.priority = value;
+                }
+                else if(name.equals("job-k-octets"))
+                {
+                    job.size = value;
+                }
+                else if(name.equals("time-at-completed"))
+                {
+                    job.completed_time = value;
+                }
+                else if(name.equals("time-at-creation"))
+                {
+                    job.creation_time = value;
+                }
+                else if(name.equals("time-at-processing"))
+                {
+                    job.processing_time = value;
+                }
+                continue;
+            }
+            const IppView &value = attr->values[0];
+            if(name.equals("job-printer-uri"))
+            {
+                job.dest = lastPathComponent(value);
+            }
+            else if(name.equals("job-name"))
+            {
+                job.title = value;
+            }
+            else if(name.equals("job-originating-user-name"))
+            {
+                job.user = value;
+            }
+            else if(name.equals("document-format"))
+            {
+                job.format = value;
+            }
+        }
+        if(job.id > 0)
+        {
+            oJobs.push_back(job);
+        }
+    }
+}
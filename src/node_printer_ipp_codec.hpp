@@ -0,0 +1,183 @@
+#ifndef NODE_PRINTER_IPP_CODEC_HPP
+#define NODE_PRINTER_IPP_CODEC_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Native IPP message codec (RFC 8010) for the hot paths: requests are encoded into a
+// reusable buffer and responses are decoded in place, the attributes in an arena
+// and their values as views on the received bytes. Independent from libcups.
+
+/** IPP tags used by the codec, same values as ipp_tag_t
+ */
+enum IppCodecTag
+{
+    IPP_CODEC_TAG_OPERATION = 0x01,
+    IPP_CODEC_TAG_JOB = 0x02,
+    IPP_CODEC_TAG_END = 0x03,
+    IPP_CODEC_TAG_PRINTER = 0x04,
+    IPP_CODEC_TAG_INTEGER = 0x21,
+    IPP_CODEC_TAG_BOOLEAN = 0x22,
+    IPP_CODEC_TAG_ENUM = 0x23,
+    IPP_CODEC_TAG_TEXT = 0x41,
+    IPP_CODEC_TAG_NAME = 0x42,
+    IPP_CODEC_TAG_KEYWORD = 0x44,
+    IPP_CODEC_TAG_URI = 0x45,
+    IPP_CODEC_TAG_CHARSET = 0x47,
+    IPP_CODEC_TAG_LANGUAGE = 0x48,
+    IPP_CODEC_TAG_MIMETYPE = 0x49
+};
+
+/** Bytes of a decoded message, not NUL terminated
+ */
+struct IppView
+{
+    const char *data;
+    size_t length;
+
+    bool equals(const char *iValue) const;
+    std::string str() const { return std::string(data, length); }
+};
+
+/** Bump allocator for the decoded attributes.
+ * reset() makes all blocks available again without freeing them, so a
+ * decoder which is reused allocates only while its messages get bigger.
+ */
+class IppArena
+{
+public:
+    explicit IppArena(size_t iBlockSize = 16 * 1024): _block_size(iBlockSize), _block(0), _offset(0) {}
+    ~IppArena();
+
+    /** @return iSize bytes aligned for any IPP codec structure, valid until reset
+     */
+    void* allocate(size_t iSize);
+
+    template<typename T> T* allocate(size_t iCount)
+    {
+        return static_cast<T*>(allocate(iCount * sizeof(T)));
+    }
+
+    void reset();
+
+    /** number of blocks allocated since construction */
+    size_t blocks() const { return _blocks.size(); }
+
+private:
+    IppArena(const IppArena&);
+    IppArena& operator=(const IppArena&);
+
+    struct Block
+    {
+        char *data;
+        size_t size;
+    };
+
+    size_t _block_size;
+    std::vector<Block> _blocks;
+    /** current block */
+    size_t _block;
+    size_t _offset;
+};
+
+/** Decoded attribute. Values are the raw value bytes: big endian integers, booleans as one byte
+ */
+struct IppAttribute
+{
+    uint8_t group;
+    /** first attribute after a delimiter tag: consecutive jobs are consecutive groups with the same tag */
+    bool group_start;
+    uint8_t tag;
+    IppView name;
+    IppView *values;
+    int count;
+    IppAttribute *next;
+
+    /** value iIndex of an integer, enum or boolean attribute, 0 if it has another size */
+    int32_t integer(int iIndex = 0) const;
+};
+
+/** IPP message decoded in place: views point into the decoded bytes, attributes into the arena
+ */
+struct IppMessage
+{
+    IppMessage(): version(0), code(0), request_id(0), attributes(NULL) {}
+
+    /** major * 10 + minor */
+    int version;
+    /** operation-id of a request, status-code of a response */
+    int code;
+    int32_t request_id;
+    IppAttribute *attributes;
+
+    /** @return first attribute named iName in group iGroup (any group if 0), NULL if missing
+     */
+    const IppAttribute* find(const char *iName, uint8_t iGroup = 0) const;
+};
+
+/** Decode iSize bytes at iData. The bytes must live as long as the message.
+ * ioArena is reset first: one arena reset per message.
+ * @return false with oError set if the message is truncated or malformed
+ */
+bool decodeIppMessage(const char *iData, size_t iSize, IppArena &ioArena, IppMessage &oMessage, std::string &oError);
+
+/** Request encoder writing into a buffer which keeps its capacity between requests
+ */
+class IppEncoder
+{
+public:
+    /** Start a new IPP/2.0 request, with attributes-charset and attributes-natural-language
+     */
+    void begin(int iOperation, int32_t iRequestId);
+
+    /** Start a group: following attributes are in group iGroup
+     */
+    void group(uint8_t iGroup);
+
+    void addString(uint8_t iTag, const char *iName, const char *iValue);
+    void addString(uint8_t iTag, const char *iName, const std::string &iValue);
+    void addStrings(uint8_t iTag, const char *iName, const char * const *iValues, size_t iCount);
+    void addInteger(uint8_t iTag, const char *iName, int32_t iValue);
+    void addBoolean(const char *iName, bool iValue);
+
+    /** Close the request with end-of-attributes-tag
+     */
+    void end();
+
+    const std::string& data() const { return _buffer; }
+
+private:
+    void writeValue(uint8_t iTag, const char *iName, size_t iNameLength, const char *iValue, size_t iValueLength);
+    void writeShort(size_t iValue);
+
+    std::string _buffer;
+};
+
+/** Job of a Get-Jobs response, strings viewing the response bytes
+ */
+struct IppJobView
+{
+    int id;
+    /** ipp_jstate_t */
+    int state;
+    /** job-k-octets */
+    int size;
+    int priority;
+    int completed_time;
+    int creation_time;
+    int processing_time;
+    /** last path component of job-printer-uri */
+    IppView dest;
+    IppView title;
+    IppView user;
+    IppView format;
+};
+
+/** Append the jobs of a decoded Get-Jobs or Get-Job-Attributes response to oJobs,
+ * which keeps its capacity between listings
+ */
+void getIppJobViews(const IppMessage &iMessage, std::vector<IppJobView> &oJobs);
+
+#endif
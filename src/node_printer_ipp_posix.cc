@@ -0,0 +1,970 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+namespace
+{
+    const int CONNECT_TIMEOUT_MS = 30000;
+    const size_t FILE_CHUNK_SIZE = 64 * 1024;
+    /** Raw data for a device: there is no CUPS filter to pass application/vnd.cups-raw to */
+    const char *DEVICE_FORMAT_RAW = "application/octet-stream";
+
+    /** Document sent after the IPP request: a memory block, or a file if fd is not -1
+     */
+    struct IppDocument
+    {
+        const char *data;
+        size_t size;
+        int fd;
+    };
+
+    enum IppOperation
+    {
+        IPP_OPERATION_OPEN,
+        IPP_OPERATION_PRINT,
+        IPP_OPERATION_PRINT_FILE,
+        IPP_OPERATION_JOBS,
+        IPP_OPERATION_CANCEL,
+        IPP_OPERATION_ATTRIBUTES
+    };
+
+    /** One call of a handle method: its parsed arguments, then its result.
+     * Created and deleted on the main thread, run on the main thread or on a worker
+     */
+    struct IppTask
+    {
+        IppTask(IppOperation iOperation): operation(iOperation), data(NULL), size(0), job_id(0), cancelled(false), response(NULL) {}
+        ~IppTask() { ippDelete(response); }
+
+        IppOperation operation;
+        /** print: data, in storage or in the referenced Buffer */
+        std::string storage;
+        Napi::ObjectReference buffer;
+        const char *data;
+        size_t size;
+        /** printFile */
+        std::string filename;
+        std::string format;
+        std::string docname;
+        CupsOptionsPtr options;
+        /** jobs */
+        std::string which_jobs;
+        /** attributes */
+        std::vector<std::string> names;
+
+        /** print and printFile result, or cancel argument */
+        int job_id;
+        bool cancelled;
+        std::vector<IppJob> jobs;
+        /** attributes response, converted on the main thread */
+        ipp_t *response;
+        std::string error;
+    };
+
+    class IppRequestWorker;
+
+    /** Printer reached directly by its ipp:// or ipps:// URI, see openIppPrinter.
+     * Talks IPP to the device (or any IPP server) over one kept-alive connection,
+     * without cupsd: no cups_dest_t, no PPD, only Get-Printer-Attributes, Print-Job
+     * (or Create-Job + Send-Document), Get-Jobs and Cancel-Job.
+     * Same methods as the handles of openPrinter, plus attributes(). They are synchronous,
+     * or run on a worker when a callback is given as last argument: the asynchronous calls
+     * of a handle are sent one after the other on its connection.
+     */
+    class IppPrinter: public Napi::ObjectWrap<IppPrinter>
+    {
+    public:
+        static Napi::Function GetClass(Napi::Env env);
+
+        /** @param info URI, then true to connect later with an IPP_OPERATION_OPEN task
+         */
+        IppPrinter(const Napi::CallbackInfo& info);
+        ~IppPrinter();
+
+        /** Run a task on the connection, from any thread
+         * @return false with iTask.error set on failure
+         */
+        bool run(IppTask &ioTask);
+
+        /** Convert the result of a run task, main thread only
+         */
+        Napi::Value taskResultToV8(Napi::Env env, IppTask &iTask);
+
+        /** Start an asynchronous task, or queue it behind the running one
+         */
+        void enqueue(IppRequestWorker *iWorker);
+
+        /** Called on the main thread when an asynchronous task is complete: start the next one
+         */
+        void next();
+
+        /** Connection closed after an asynchronous open failure
+         */
+        void release();
+
+    private:
+        Napi::Value Print(const Napi::CallbackInfo& info);
+        Napi::Value PrintFile(const Napi::CallbackInfo& info);
+        Napi::Value Jobs(const Napi::CallbackInfo& info);
+        Napi::Value Cancel(const Napi::CallbackInfo& info);
+        Napi::Value Attributes(const Napi::CallbackInfo& info);
+        Napi::Value Close(const Napi::CallbackInfo& info);
+        Napi::Value GetName(const Napi::CallbackInfo& info);
+        Napi::Value GetUri(const Napi::CallbackInfo& info);
+
+        /** Throw if the handle was closed
+         * @return false if closed
+         */
+        bool checkOpened(Napi::Env env, const char *iMethodName);
+
+        /** Run iTask now, or on a worker if the last argument is a callback
+         * @return result of a synchronous call, undefined otherwise
+         */
+        Napi::Value runTask(const Napi::CallbackInfo& info, std::unique_ptr<IppTask> iTask);
+
+        bool open(IppTask &ioTask);
+        bool reconnect();
+        void closeConnection();
+
+        /** New request for the printer, with printer-uri and requesting-user-name
+         */
+        ipp_t* newRequest(ipp_op_t iOperation) const;
+
+        /** Send iRequest followed by iDocument if any, and read the response.
+         * The request is retried once on a new connection if the kept alive one was dropped.
+         * iRequest is not freed
+         * @return response, NULL on failure with cupsLastErrorString set. Free it with ippDelete
+         */
+        ipp_t* exchange(ipp_t *iRequest, const IppDocument *iDocument);
+
+        bool writeDocument(const IppDocument &iDocument);
+
+        /** Submit one document as a new job
+         * @return job id, 0 on failure with oError set
+         */
+        int submit(const std::string &iDocname, const std::string &iFormat, const CupsOptionsPtr &iOptions, const IppDocument &iDocument, std::string &oError);
+
+        /** Parse {type, docname, options} parameters shared by print and printFile
+         * @return false if an exception was thrown
+         */
+        bool parseJobParameters(Napi::Env env, Napi::Object iParams, const char *iMethodName, const char *iDefaultType, std::string &oFormat, std::string &oDocname, CupsOptionsPtr &oOptions);
+
+        /** the connection is used by one task at a time, synchronous or not */
+        std::mutex _mutex;
+        http_t *_http;
+        std::string _uri;
+        std::string _host;
+        int _port;
+        std::string _resource;
+        http_encryption_t _encryption;
+        std::string _name;
+        /** Print-Job is in operations-supported. Otherwise jobs are sent with Create-Job + Send-Document */
+        bool _print_job;
+        /** asynchronous tasks waiting for the running one, main thread only */
+        std::deque<IppRequestWorker*> _queue;
+        bool _busy;
+        /** close() was called while tasks were running: the connection is closed after them */
+        bool _closing;
+    };
+
+    /** Run one task of a handle and call back with its result
+     */
+    class IppRequestWorker: public Napi::AsyncWorker
+    {
+    public:
+        IppRequestWorker(const Napi::Function& iCallback, IppPrinter *iPrinter, std::unique_ptr<IppTask> iTask):
+            Napi::AsyncWorker(iCallback, "node-printer:ippPrinter"),
+            _printer(iPrinter),
+            _handle(Napi::Persistent(iPrinter->Value())),
+            _task(std::move(iTask))
+        {}
+
+    protected:
+        void Execute()
+        {
+            if(!_printer->run(*_task))
+            {
+                SetError(_task->error);
+            }
+        }
+
+        void OnOK()
+        {
+            Napi::Env env = Env();
+            Napi::HandleScope scope(env);
+            _printer->next();
+            Callback().Call({ env.Null(), _printer->taskResultToV8(env, *_task) });
+        }
+
+        void OnError(const Napi::Error& e)
+        {
+            Napi::HandleScope scope(Env());
+            if(_task->operation == IPP_OPERATION_OPEN)
+            {
+                _printer->release();
+            }
+            _printer->next();
+            Callback().Call({ e.Value() });
+        }
+
+    private:
+        IppPrinter *_printer;
+        /** the handle is not collected while it has tasks */
+        Napi::ObjectReference _handle;
+        std::unique_ptr<IppTask> _task;
+    };
+
+    /** Convert the values of an IPP attribute: Number, Boolean or String, an Array if there are several
+     */
+    Napi::Value ippAttributeToV8(ipp_attribute_t *iAttr, Napi::Env env)
+    {
+        int count = ippGetCount(iAttr);
+        std::vector<Napi::Value> values;
+        for(int i = 0; i < count; ++i)
+        {
+            switch(ippGetValueTag(iAttr))
+            {
+            case IPP_TAG_INTEGER:
+            case IPP_TAG_ENUM:
+                values.push_back(Napi::Number::New(env, ippGetInteger(iAttr, i)));
+                break;
+            case IPP_TAG_BOOLEAN:
+                values.push_back(Napi::Boolean::New(env, ippGetBoolean(iAttr, i) != 0));
+                break;
+            case IPP_TAG_TEXT:
+            case IPP_TAG_NAME:
+            case IPP_TAG_KEYWORD:
+            case IPP_TAG_URI:
+            case IPP_TAG_URISCHEME:
+            case IPP_TAG_CHARSET:
+            case IPP_TAG_LANGUAGE:
+            case IPP_TAG_MIMETYPE:
+            case IPP_TAG_TEXTLANG:
+            case IPP_TAG_NAMELANG:
+                {
+                    const char *value = ippGetString(iAttr, i, NULL);
+                    values.push_back(Napi::String::New(env, value != NULL ? value : ""));
+                }
+                break;
+            default:
+                {
+                    // collections, ranges, resolutions, dates...: the IPP string form of the whole attribute
+                    char buffer[4096];
+                    ippAttributeString(iAttr, buffer, sizeof(buffer));
+                    return Napi::String::New(env, buffer);
+                }
+            }
+        }
+        if(values.size() == 1)
+        {
+            return values[0];
+        }
+        Napi::Array result = Napi::Array::New(env, values.size());
+        for(uint32_t i = 0; i < values.size(); ++i)
+        {
+            result.Set(i, values[i]);
+        }
+        return result;
+    }
+
+    Napi::Function IppPrinter::GetClass(Napi::Env env)
+    {
+        Napi::FunctionReference &constructor = getAddonData(env).constructors["IppPrinter"];
+        if(constructor.IsEmpty())
+        {
+            constructor = Napi::Persistent(DefineClass(env, "IppPrinter", {
+                InstanceMethod("print", &IppPrinter::Print),
+                InstanceMethod("printFile", &IppPrinter::PrintFile),
+                InstanceMethod("jobs", &IppPrinter::Jobs),
+                InstanceMethod("cancel", &IppPrinter::Cancel),
+                InstanceMethod("attributes", &IppPrinter::Attributes),
+                InstanceMethod("close", &IppPrinter::Close),
+                InstanceAccessor("name", &IppPrinter::GetName, nullptr),
+                InstanceAccessor("uri", &IppPrinter::GetUri, nullptr)
+            }));
+        }
+        return constructor.Value();
+    }
+
+    IppPrinter::IppPrinter(const Napi::CallbackInfo& info):
+        Napi::ObjectWrap<IppPrinter>(info),
+        _http(NULL),
+        _port(0),
+        _encryption(HTTP_ENCRYPTION_IF_REQUESTED),
+        _print_job(true),
+        _busy(false),
+        _closing(false)
+    {
+        Napi::Env env = info.Env();
+
+        if(info.Length() < 1 || !info[0].IsString())
+        {
+            Napi::TypeError::New(env, "openIppPrinter:first argument must be an ipp:// or ipps:// URI").ThrowAsJavaScriptException();
+            return;
+        }
+        _uri = info[0].As<Napi::String>().Utf8Value();
+
+        char scheme[32], username[256], host[256], resource[1024];
+        if(httpSeparateURI(HTTP_URI_CODING_ALL, _uri.c_str(), scheme, sizeof(scheme), username, sizeof(username),
+                           host, sizeof(host), &_port, resource, sizeof(resource)) < HTTP_URI_STATUS_OK
+           || (std::string(scheme) != "ipp" && std::string(scheme) != "ipps"))
+        {
+            Napi::TypeError::New(env, "openIppPrinter: invalid printer URI " + _uri).ThrowAsJavaScriptException();
+            return;
+        }
+        _host = host;
+        _resource = resource[0] != '\0' ? resource : "/";
+        _encryption = (std::string(scheme) == "ipps") ? HTTP_ENCRYPTION_ALWAYS : HTTP_ENCRYPTION_IF_REQUESTED;
+        _name = _host;
+
+        if(info.Length() > 1 && info[1].IsBoolean() && info[1].As<Napi::Boolean>().Value())
+        {
+            // opened by a worker
+            return;
+        }
+        IppTask task(IPP_OPERATION_OPEN);
+        if(!run(task))
+        {
+            Napi::Error::New(env, task.error).ThrowAsJavaScriptException();
+        }
+    }
+
+    IppPrinter::~IppPrinter()
+    {
+        closeConnection();
+    }
+
+    void IppPrinter::release()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        closeConnection();
+    }
+
+    void IppPrinter::closeConnection()
+    {
+        if(_http != NULL)
+        {
+            httpClose(_http);
+            _http = NULL;
+        }
+    }
+
+    bool IppPrinter::reconnect()
+    {
+        if(_http != NULL)
+        {
+            return (httpReconnect2(_http, CONNECT_TIMEOUT_MS, NULL) == 0);
+        }
+        _http = httpConnect2(_host.c_str(), _port, NULL, AF_UNSPEC, _encryption, 1/*blocking*/, CONNECT_TIMEOUT_MS, NULL);
+        return (_http != NULL);
+    }
+
+    bool IppPrinter::open(IppTask &ioTask)
+    {
+        if(!reconnect())
+        {
+            ioTask.error = "openIppPrinter: unable to connect to printer " + _uri;
+            return false;
+        }
+
+        // one round trip to check the URI and get what the submissions depend on
+        static const char * const attrs[] = { "operations-supported", "printer-name" };
+        ipp_t *request = newRequest(IPP_OP_GET_PRINTER_ATTRIBUTES);
+        ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", sizeof(attrs) / sizeof(attrs[0]), NULL, attrs);
+        ipp_t *response = exchange(request, NULL);
+        ippDelete(request);
+        if(response == NULL)
+        {
+            ioTask.error = std::string("openIppPrinter: ") + cupsLastErrorString();
+            closeConnection();
+            return false;
+        }
+
+        ipp_attribute_t *attr = ippFindAttribute(response, "printer-name", IPP_TAG_NAME);
+        if(attr != NULL && ippGetString(attr, 0, NULL) != NULL)
+        {
+            _name = ippGetString(attr, 0, NULL);
+        }
+        attr = ippFindAttribute(response, "operations-supported", IPP_TAG_ENUM);
+        if(attr != NULL && !ippContainsInteger(attr, IPP_OP_PRINT_JOB)
+           && ippContainsInteger(attr, IPP_OP_CREATE_JOB) && ippContainsInteger(attr, IPP_OP_SEND_DOCUMENT))
+        {
+            _print_job = false;
+        }
+        ippDelete(response);
+        return true;
+    }
+
+    bool IppPrinter::checkOpened(Napi::Env env, const char *iMethodName)
+    {
+        if(_http == NULL || _closing)
+        {
+            std::string error_str(iMethodName);
+            error_str += ": printer handle is closed";
+            Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
+            return false;
+        }
+        return true;
+    }
+
+    ipp_t* IppPrinter::newRequest(ipp_op_t iOperation) const
+    {
+        ipp_t *request = ippNewRequest(iOperation);
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, _uri.c_str());
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+        return request;
+    }
+
+    bool IppPrinter::writeDocument(const IppDocument &iDocument)
+    {
+        if(iDocument.fd < 0)
+        {
+            return (cupsWriteRequestData(_http, iDocument.data, iDocument.size) == HTTP_STATUS_CONTINUE);
+        }
+        std::vector<char> buffer(FILE_CHUNK_SIZE);
+        ssize_t bytes;
+        while((bytes = read(iDocument.fd, &buffer[0], buffer.size())) != 0)
+        {
+            if(bytes < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            if(cupsWriteRequestData(_http, &buffer[0], static_cast<size_t>(bytes)) != HTTP_STATUS_CONTINUE)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    ipp_t* IppPrinter::exchange(ipp_t *iRequest, const IppDocument *iDocument)
+    {
+        size_t length = (iDocument != NULL) ? iDocument->size : 0;
+        http_status_t status = cupsSendRequest(_http, iRequest, _resource.c_str(), length);
+        if(status != HTTP_STATUS_CONTINUE && reconnect())
+        {
+            // nothing of the document was sent yet: the device may have closed the idle connection
+            status = cupsSendRequest(_http, iRequest, _resource.c_str(), length);
+        }
+        if(status != HTTP_STATUS_CONTINUE)
+        {
+            return NULL;
+        }
+        if(iDocument != NULL && !writeDocument(*iDocument))
+        {
+            // interrupted upload leaves the connection in an unknown state
+            reconnect();
+            return NULL;
+        }
+        ipp_t *response = cupsGetResponse(_http, _resource.c_str());
+        if(response == NULL || cupsLastError() > IPP_STATUS_OK_CONFLICTING)
+        {
+            ippDelete(response);
+            return NULL;
+        }
+        return response;
+    }
+
+    int IppPrinter::submit(const std::string &iDocname, const std::string &iFormat, const CupsOptionsPtr &iOptions, const IppDocument &iDocument, std::string &oError)
+    {
+        ipp_t *request = newRequest(_print_job ? IPP_OP_PRINT_JOB : IPP_OP_CREATE_JOB);
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "job-name", NULL, iDocname.c_str());
+        if(_print_job)
+        {
+            ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, iFormat.c_str());
+        }
+        cupsEncodeOptions2(request, iOptions->size(), iOptions->get(), IPP_TAG_OPERATION);
+        cupsEncodeOptions2(request, iOptions->size(), iOptions->get(), IPP_TAG_JOB);
+
+        ipp_t *response = exchange(request, _print_job ? &iDocument : NULL);
+        ippDelete(request);
+        if(response == NULL)
+        {
+            oError = cupsLastErrorString();
+            return 0;
+        }
+        ipp_attribute_t *attr = ippFindAttribute(response, "job-id", IPP_TAG_INTEGER);
+        int job_id = (attr != NULL) ? ippGetInteger(attr, 0) : 0;
+        ippDelete(response);
+        if(job_id == 0)
+        {
+            oError = "no job-id in the response";
+            return 0;
+        }
+        if(_print_job)
+        {
+            return job_id;
+        }
+
+        request = newRequest(IPP_OP_SEND_DOCUMENT);
+        ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", job_id);
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "document-name", NULL, iDocname.c_str());
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_MIMETYPE, "document-format", NULL, iFormat.c_str());
+        ippAddBoolean(request, IPP_TAG_OPERATION, "last-document", 1);
+        response = exchange(request, &iDocument);
+        ippDelete(request);
+        if(response == NULL)
+        {
+            // the job would wait for its document forever
+            oError = cupsLastErrorString();
+            ipp_t *cancel_request = newRequest(IPP_OP_CANCEL_JOB);
+            ippAddInteger(cancel_request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", job_id);
+            ippDelete(exchange(cancel_request, NULL));
+            ippDelete(cancel_request);
+            return 0;
+        }
+        ippDelete(response);
+        return job_id;
+    }
+
+    bool IppPrinter::parseJobParameters(Napi::Env env, Napi::Object iParams, const char *iMethodName, const char *iDefaultType, std::string &oFormat, std::string &oDocname, CupsOptionsPtr &oOptions)
+    {
+        std::string method_name(iMethodName);
+
+        // type
+        std::string type_str = iDefaultType;
+        Napi::Value arg_value_type = iParams.Get("type");
+        if(!arg_value_type.IsUndefined())
+        {
+            if(!arg_value_type.IsString())
+            {
+                Napi::TypeError::New(env, method_name + ":type parameter must be a string").ThrowAsJavaScriptException();
+                return false;
+            }
+            type_str = arg_value_type.As<Napi::String>().Utf8Value();
+        }
+        FormatMapType::const_iterator itFormat = getPrinterFormatMap().find(type_str);
+        if(itFormat == getPrinterFormatMap().end() || itFormat->second == CUPS_FORMAT_COMMAND)
+        {
+            Napi::TypeError::New(env, method_name + ": unsupported format type").ThrowAsJavaScriptException();
+            return false;
+        }
+        oFormat = itFormat->second;
+        if(oFormat == CUPS_FORMAT_RAW || oFormat == CUPS_FORMAT_AUTO)
+        {
+            oFormat = DEVICE_FORMAT_RAW;
+        }
+
+        // docname
+        Napi::Value arg_value_docname = iParams.Get("docname");
+        if(!arg_value_docname.IsUndefined())
+        {
+            if(!arg_value_docname.IsString())
+            {
+                Napi::TypeError::New(env, method_name + ":docname parameter must be a string").ThrowAsJavaScriptException();
+                return false;
+            }
+            oDocname = arg_value_docname.As<Napi::String>().Utf8Value();
+        }
+
+        // options
+        if(!getCupsOptionsFromV8Value(iParams.Get("options"), oOptions))
+        {
+            Napi::TypeError::New(env, method_name + ":options parameter must be an object").ThrowAsJavaScriptException();
+            return false;
+        }
+        // preflight uses the capabilities of CUPS queues
+        if(iParams.Get("preflight").ToBoolean().Value())
+        {
+            Napi::TypeError::New(env, method_name + ":preflight is not supported on IPP printers").ThrowAsJavaScriptException();
+            return false;
+        }
+        return true;
+    }
+
+    bool IppPrinter::run(IppTask &ioTask)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        switch(ioTask.operation)
+        {
+        case IPP_OPERATION_OPEN:
+            return open(ioTask);
+        case IPP_OPERATION_PRINT:
+            {
+                IppDocument document = { ioTask.data, ioTask.size, -1 };
+                ioTask.job_id = submit(ioTask.docname, ioTask.format, ioTask.options, document, ioTask.error);
+                break;
+            }
+        case IPP_OPERATION_PRINT_FILE:
+            {
+                int fd = ::open(ioTask.filename.c_str(), O_RDONLY);
+                struct stat file_stat;
+                if(fd == -1 || fstat(fd, &file_stat) != 0)
+                {
+                    if(fd != -1)
+                    {
+                        close(fd);
+                    }
+                    ioTask.error = "printFile: unable to open file " + ioTask.filename;
+                    return false;
+                }
+                // the file size is the Content-Length: no chunked encoding, which some devices do not support
+                IppDocument document = { NULL, static_cast<size_t>(file_stat.st_size), fd };
+                ioTask.job_id = submit(ioTask.docname, ioTask.format, ioTask.options, document, ioTask.error);
+                close(fd);
+                break;
+            }
+        case IPP_OPERATION_JOBS:
+            {
+                // through exchange: a listing after an idle period finds the connection closed by the device
+                ipp_t *request = newRequest(IPP_OP_GET_JOBS);
+                ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "which-jobs", NULL, ioTask.which_jobs.c_str());
+                addIppJobRequestedAttributes(request);
+                ipp_t *response = exchange(request, NULL);
+                ippDelete(request);
+                if(response == NULL)
+                {
+                    ioTask.error = std::string("Print Error: ") + cupsLastErrorString();
+                    return false;
+                }
+                parseIppJobs(response, ioTask.jobs);
+                ippDelete(response);
+                for(std::vector<IppJob>::iterator itJob = ioTask.jobs.begin(); itJob != ioTask.jobs.end(); ++itJob)
+                {
+                    // job-printer-uri of a device ends with its resource (e.g. ipp/print), not a queue name
+                    itJob->dest = _name;
+                }
+                return true;
+            }
+        case IPP_OPERATION_CANCEL:
+            {
+                ipp_t *request = newRequest(IPP_OP_CANCEL_JOB);
+                ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", ioTask.job_id);
+                ipp_t *response = exchange(request, NULL);
+                ioTask.cancelled = (response != NULL);
+                ippDelete(request);
+                ippDelete(response);
+                return true;
+            }
+        case IPP_OPERATION_ATTRIBUTES:
+            {
+                std::vector<const char*> names_ptr;
+                for(std::vector<std::string>::const_iterator itName = ioTask.names.begin(); itName != ioTask.names.end(); ++itName)
+                {
+                    names_ptr.push_back(itName->c_str());
+                }
+                ipp_t *request = newRequest(IPP_OP_GET_PRINTER_ATTRIBUTES);
+                ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", static_cast<int>(names_ptr.size()), NULL, &names_ptr[0]);
+                ioTask.response = exchange(request, NULL);
+                ippDelete(request);
+                if(ioTask.response == NULL)
+                {
+                    ioTask.error = std::string("Print Error: ") + cupsLastErrorString();
+                    return false;
+                }
+                return true;
+            }
+        }
+        // print and printFile
+        if(ioTask.job_id == 0)
+        {
+            ioTask.error = "Print Error: " + ioTask.error;
+            return false;
+        }
+        return true;
+    }
+
+    Napi::Value IppPrinter::taskResultToV8(Napi::Env env, IppTask &iTask)
+    {
+        switch(iTask.operation)
+        {
+        case IPP_OPERATION_OPEN:
+            return Value();
+        case IPP_OPERATION_PRINT:
+        case IPP_OPERATION_PRINT_FILE:
+            {
+                Napi::Object result = Napi::Object::New(env);
+                result.Set("id", Napi::Number::New(env, iTask.job_id));
+                return result;
+            }
+        case IPP_OPERATION_JOBS:
+            {
+                Napi::Array result = Napi::Array::New(env, iTask.jobs.size());
+                for(uint32_t j = 0; j < iTask.jobs.size(); ++j)
+                {
+                    result.Set(j, ippJobToV8(iTask.jobs[j], env));
+                }
+                return result;
+            }
+        case IPP_OPERATION_CANCEL:
+            return Napi::Boolean::New(env, iTask.cancelled);
+        case IPP_OPERATION_ATTRIBUTES:
+            {
+                Napi::Object result = Napi::Object::New(env);
+                for(ipp_attribute_t *attr = ippFirstAttribute(iTask.response); attr != NULL; attr = ippNextAttribute(iTask.response))
+                {
+                    const char *name = ippGetName(attr);
+                    if(name != NULL && ippGetGroupTag(attr) == IPP_TAG_PRINTER)
+                    {
+                        result.Set(name, ippAttributeToV8(attr, env));
+                    }
+                }
+                return result;
+            }
+        }
+        return env.Undefined();
+    }
+
+    Napi::Value IppPrinter::runTask(const Napi::CallbackInfo& info, std::unique_ptr<IppTask> iTask)
+    {
+        Napi::Env env = info.Env();
+        if(info.Length() > 0 && info[info.Length() - 1].IsFunction())
+        {
+            enqueue(new IppRequestWorker(info[info.Length() - 1].As<Napi::Function>(), this, std::move(iTask)));
+            return env.Undefined();
+        }
+        // waits for an asynchronous task using the connection
+        if(!run(*iTask))
+        {
+            Napi::Error::New(env, iTask->error).ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        return taskResultToV8(env, *iTask);
+    }
+
+    void IppPrinter::enqueue(IppRequestWorker *iWorker)
+    {
+        if(_busy)
+        {
+            _queue.push_back(iWorker);
+            return;
+        }
+        _busy = true;
+        iWorker->Queue();
+    }
+
+    void IppPrinter::next()
+    {
+        if(_queue.empty())
+        {
+            _busy = false;
+            if(_closing)
+            {
+                release();
+            }
+            return;
+        }
+        IppRequestWorker *worker = _queue.front();
+        _queue.pop_front();
+        worker->Queue();
+    }
+
+    Napi::Value IppPrinter::Print(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "print"))
+        {
+            return env.Undefined();
+        }
+
+        if(info.Length() < 1 || !info[0].IsObject())
+        {
+            Napi::TypeError::New(env, "print:first argument must be an object").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        Napi::Object arg_params = info[0].As<Napi::Object>();
+
+        std::unique_ptr<IppTask> task(new IppTask(IPP_OPERATION_PRINT));
+        Napi::Value arg_value_data = arg_params.Get("data");
+        struct iovec data_iov;
+        if(!getDataFromV8Value(arg_value_data, task->storage, data_iov))
+        {
+            Napi::TypeError::New(env, "print:data parameter must be a string or Buffer").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        if(arg_value_data.IsBuffer())
+        {
+            // sent from the Buffer, kept alive until then
+            task->buffer = Napi::Persistent(arg_value_data.As<Napi::Object>());
+        }
+        task->data = static_cast<const char*>(data_iov.iov_base);
+        task->size = data_iov.iov_len;
+
+        task->docname = "node print job";
+        if(!parseJobParameters(env, arg_params, "print", "RAW", task->format, task->docname, task->options))
+        {
+            return env.Undefined();
+        }
+        return runTask(info, std::move(task));
+    }
+
+    Napi::Value IppPrinter::PrintFile(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "printFile"))
+        {
+            return env.Undefined();
+        }
+
+        if(info.Length() < 1 || !info[0].IsObject())
+        {
+            Napi::TypeError::New(env, "printFile:first argument must be an object").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        Napi::Object arg_params = info[0].As<Napi::Object>();
+
+        Napi::Value arg_value_filename = arg_params.Get("filename");
+        if(!arg_value_filename.IsString())
+        {
+            Napi::TypeError::New(env, "printFile:filename parameter must be a string").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        std::unique_ptr<IppTask> task(new IppTask(IPP_OPERATION_PRINT_FILE));
+        task->filename = arg_value_filename.As<Napi::String>().Utf8Value();
+
+        task->docname = task->filename;
+        if(!parseJobParameters(env, arg_params, "printFile", "AUTO", task->format, task->docname, task->options))
+        {
+            return env.Undefined();
+        }
+        return runTask(info, std::move(task));
+    }
+
+    Napi::Value IppPrinter::Jobs(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "jobs"))
+        {
+            return env.Undefined();
+        }
+
+        // "all" (default), "active" or "completed"
+        std::unique_ptr<IppTask> task(new IppTask(IPP_OPERATION_JOBS));
+        task->which_jobs = "all";
+        if(info.Length() > 0 && info[0].IsString())
+        {
+            std::string which_jobs_str = info[0].As<Napi::String>().Utf8Value();
+            if(which_jobs_str == "active")
+            {
+                task->which_jobs = "not-completed";
+            }
+            else if(which_jobs_str == "completed")
+            {
+                task->which_jobs = "completed";
+            }
+        }
+        return runTask(info, std::move(task));
+    }
+
+    Napi::Value IppPrinter::Cancel(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "cancel"))
+        {
+            return env.Undefined();
+        }
+
+        if(info.Length() < 1 || !info[0].IsNumber())
+        {
+            Napi::TypeError::New(env, "cancel:first argument must be a number").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        std::unique_ptr<IppTask> task(new IppTask(IPP_OPERATION_CANCEL));
+        task->job_id = info[0].As<Napi::Number>().Int32Value();
+        return runTask(info, std::move(task));
+    }
+
+    Napi::Value IppPrinter::Attributes(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "attributes"))
+        {
+            return env.Undefined();
+        }
+
+        // requested attribute names or groups, "all" by default
+        std::unique_ptr<IppTask> task(new IppTask(IPP_OPERATION_ATTRIBUTES));
+        if(info.Length() > 0 && !info[0].IsUndefined() && !info[0].IsNull() && !info[0].IsFunction())
+        {
+            if(!info[0].IsArray())
+            {
+                Napi::TypeError::New(env, "attributes:first argument must be an array of attribute names").ThrowAsJavaScriptException();
+                return env.Undefined();
+            }
+            Napi::Array arg_names = info[0].As<Napi::Array>();
+            for(uint32_t i = 0; i < arg_names.Length(); ++i)
+            {
+                Napi::Value name = arg_names.Get(i);
+                if(!name.IsString())
+                {
+                    Napi::TypeError::New(env, "attributes:attribute names must be strings").ThrowAsJavaScriptException();
+                    return env.Undefined();
+                }
+                task->names.push_back(name.As<Napi::String>().Utf8Value());
+            }
+        }
+        if(task->names.empty())
+        {
+            task->names.push_back("all");
+        }
+        return runTask(info, std::move(task));
+    }
+
+    Napi::Value IppPrinter::Close(const Napi::CallbackInfo& info)
+    {
+        if(_busy)
+        {
+            // the connection is in use by a worker: closed once the queued tasks are done
+            _closing = true;
+        }
+        else
+        {
+            release();
+        }
+        return info.Env().Undefined();
+    }
+
+    Napi::Value IppPrinter::GetName(const Napi::CallbackInfo& info)
+    {
+        return Napi::String::New(info.Env(), _name);
+    }
+
+    Napi::Value IppPrinter::GetUri(const Napi::CallbackInfo& info)
+    {
+        return Napi::String::New(info.Env(), _uri);
+    }
+}
+
+bool isIppPrinterUri(const std::string &iPrinter)
+{
+    return iPrinter.compare(0, 6, "ipp://") == 0 || iPrinter.compare(0, 7, "ipps://") == 0;
+}
+
+Napi::Value openIppPrinter(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 1)
+    {
+        Napi::TypeError::New(env, "openIppPrinter:invalid number of arguments (1 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    bool async = info.Length() > 1 && info[1].IsFunction();
+    Napi::Object result = IppPrinter::GetClass(env).New({ info[0], Napi::Boolean::New(env, async) });
+    if(env.IsExceptionPending())
+    {
+        return env.Undefined();
+    }
+    if(async)
+    {
+        // connected on a worker, the handle is passed to the callback
+        IppPrinter *printer = IppPrinter::Unwrap(result);
+        printer->enqueue(new IppRequestWorker(info[1].As<Napi::Function>(), printer, std::unique_ptr<IppTask>(new IppTask(IPP_OPERATION_OPEN))));
+        return env.Undefined();
+    }
+    return result;
+}
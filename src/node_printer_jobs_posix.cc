@@ -0,0 +1,482 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+
+namespace
+{
+    /** Commands of setJobs
+     */
+    enum BulkJobCommand
+    {
+        BULK_CANCEL,
+        BULK_CANCEL_MY,
+        BULK_PURGE,
+        BULK_HOLD,
+        BULK_RELEASE,
+        BULK_RESTART
+    };
+
+    struct BulkJobResult
+    {
+        BulkJobResult(int iId): id(iId), ok(true) {}
+
+        int id;
+        bool ok;
+        std::string error;
+    };
+
+    bool getBulkJobCommand(const std::string &iName, BulkJobCommand &oCommand)
+    {
+        if(iName == "CANCEL")
+        {
+            oCommand = BULK_CANCEL;
+        }
+        else if(iName == "CANCEL-MY")
+        {
+            oCommand = BULK_CANCEL_MY;
+        }
+        else if(iName == "PURGE")
+        {
+            oCommand = BULK_PURGE;
+        }
+        else if(iName == "HOLD")
+        {
+            oCommand = BULK_HOLD;
+        }
+        else if(iName == "RELEASE")
+        {
+            oCommand = BULK_RELEASE;
+        }
+        else if(iName == "RESTART")
+        {
+            oCommand = BULK_RESTART;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    /** Base of the workers which send job requests for a list of jobs, on their own connection.
+     * The result is one {id, ok, error} object per job
+     */
+    class JobsRequestWorker: public Napi::AsyncWorker
+    {
+    public:
+        JobsRequestWorker(const Napi::Function& iCallback, const char *iResourceName, const std::string &iPrinterName, const std::vector<int> &iJobIds):
+            Napi::AsyncWorker(iCallback, iResourceName),
+            _printer_name(iPrinterName),
+            _http(NULL)
+        {
+            for(std::vector<int>::const_iterator itId = iJobIds.begin(); itId != iJobIds.end(); ++itId)
+            {
+                _results.push_back(BulkJobResult(*itId));
+            }
+        }
+
+    protected:
+        /** Send the requests, connected
+         */
+        virtual void run() = 0;
+
+        void Execute()
+        {
+            _http = connectToCupsServer();
+            if(_http == NULL)
+            {
+                SetError("unable to connect to CUPS server");
+                return;
+            }
+            run();
+            httpClose(_http);
+            _http = NULL;
+        }
+
+        std::vector<napi_value> GetResult(Napi::Env env)
+        {
+            Napi::Array jobs = Napi::Array::New(env);
+            for(uint32_t i = 0; i < _results.size(); ++i)
+            {
+                Napi::Object job = Napi::Object::New(env);
+                job.Set("id", Napi::Number::New(env, _results[i].id));
+                job.Set("ok", Napi::Boolean::New(env, _results[i].ok));
+                if(!_results[i].ok)
+                {
+                    job.Set("error", Napi::String::New(env, _results[i].error));
+                }
+                jobs.Set(i, job);
+            }
+
+            std::vector<napi_value> result;
+            result.push_back(env.Null());
+            result.push_back(jobs);
+            return result;
+        }
+
+        ipp_t* newRequest(ipp_op_t iOperation)
+        {
+            ipp_t *request = ippNewRequest(iOperation);
+            ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, getPrinterUri(_printer_name).c_str());
+            ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+            return request;
+        }
+
+        ipp_t* newJobRequest(ipp_op_t iOperation, int iJobId)
+        {
+            ipp_t *request = newRequest(iOperation);
+            ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-id", iJobId);
+            return request;
+        }
+
+        /** Send iRequest
+         * @param oFailedIds jobs reported in job-ids on failure, may be NULL
+         * @return false with oError set if the request failed
+         */
+        bool sendRequest(ipp_t *iRequest, std::set<int> *oFailedIds, std::string &oError)
+        {
+            // like the cancel command, purge is an administrative operation
+            const char *resource = (ippGetOperation(iRequest) == IPP_OP_PURGE_JOBS) ? "/admin/" : "/jobs/";
+            ipp_t *response = cupsDoRequest(_http, iRequest, resource);
+            bool ok = (response != NULL && cupsLastError() <= IPP_STATUS_OK_CONFLICTING);
+            if(!ok)
+            {
+                oError = cupsLastErrorString();
+            }
+            if(!ok && response != NULL && oFailedIds != NULL)
+            {
+                // Cancel-Jobs reports the jobs which could not be cancelled in job-ids
+                ipp_attribute_t *attr = ippFindAttribute(response, "job-ids", IPP_TAG_INTEGER);
+                for(int i = 0; attr != NULL && i < ippGetCount(attr); ++i)
+                {
+                    oFailedIds->insert(ippGetInteger(attr, i));
+                }
+            }
+            ippDelete(response);
+            return ok;
+        }
+
+        std::string _printer_name;
+        std::vector<BulkJobResult> _results;
+        http_t *_http;
+    };
+
+    /** Run one job command on many jobs.
+     * Cancel-Jobs, Cancel-My-Jobs and Purge-Jobs take the whole id list in one request,
+     * Hold-Job, Release-Job and Restart-Job have no multiple jobs form in IPP,
+     * so they are sent one after the other on the same kept-alive connection.
+     */
+    class SetJobsWorker: public JobsRequestWorker
+    {
+    public:
+        SetJobsWorker(const Napi::Function& iCallback, const std::string &iPrinterName, BulkJobCommand iCommand, const std::vector<int> &iJobIds):
+            JobsRequestWorker(iCallback, "node-printer:setJobs", iPrinterName, iJobIds),
+            _command(iCommand)
+        {}
+
+    protected:
+        void run()
+        {
+            switch(_command)
+            {
+            case BULK_CANCEL:
+                runMultiple(IPP_OP_CANCEL_JOBS);
+                break;
+            case BULK_CANCEL_MY:
+                runMultiple(IPP_OP_CANCEL_MY_JOBS);
+                break;
+            case BULK_PURGE:
+                runMultiple(IPP_OP_PURGE_JOBS);
+                break;
+            case BULK_HOLD:
+                runEach(IPP_OP_HOLD_JOB);
+                break;
+            case BULK_RELEASE:
+                runEach(IPP_OP_RELEASE_JOB);
+                break;
+            case BULK_RESTART:
+                runEach(IPP_OP_RESTART_JOB);
+                break;
+            }
+        }
+
+    private:
+        void runMultiple(ipp_op_t iOperation)
+        {
+            ipp_t *request = newRequest(iOperation);
+            if(!_results.empty())
+            {
+                std::vector<int> ids;
+                for(std::vector<BulkJobResult>::const_iterator itJob = _results.begin(); itJob != _results.end(); ++itJob)
+                {
+                    ids.push_back(itJob->id);
+                }
+                ippAddIntegers(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "job-ids", static_cast<int>(ids.size()), &ids[0]);
+            }
+
+            std::set<int> failed_ids;
+            std::string error_str;
+            if(sendRequest(request, &failed_ids, error_str))
+            {
+                return;
+            }
+            ipp_status_t status = cupsLastError();
+            bool denied = status == IPP_STATUS_ERROR_NOT_AUTHENTICATED || status == IPP_STATUS_ERROR_NOT_AUTHORIZED || status == IPP_STATUS_ERROR_FORBIDDEN;
+            if((status == IPP_STATUS_ERROR_OPERATION_NOT_SUPPORTED || denied) && iOperation == IPP_OP_CANCEL_JOBS && !_results.empty())
+            {
+                // server older than CUPS 1.5, or Cancel-Jobs limited to @SYSTEM by the default policy
+                // while the owner of the jobs may still cancel them one by one
+                runEach(IPP_OP_CANCEL_JOB);
+                return;
+            }
+            if(_results.empty())
+            {
+                SetError("setJobs: " + error_str);
+                return;
+            }
+            // the request is atomic: no job is cancelled if one of them cannot be
+            for(std::vector<BulkJobResult>::iterator itJob = _results.begin(); itJob != _results.end(); ++itJob)
+            {
+                itJob->ok = false;
+                itJob->error = (failed_ids.empty() || failed_ids.count(itJob->id) > 0) ? error_str : "not processed: other jobs of the request failed";
+            }
+        }
+
+        void runEach(ipp_op_t iOperation)
+        {
+            for(std::vector<BulkJobResult>::iterator itJob = _results.begin(); itJob != _results.end(); ++itJob)
+            {
+                itJob->ok = sendRequest(newJobRequest(iOperation, itJob->id), NULL, itJob->error);
+            }
+        }
+
+        BulkJobCommand _command;
+    };
+
+    /** Change attributes of queued jobs with Set-Job-Attributes, then move them
+     * to another queue with CUPS-Move-Job, without transferring the documents again.
+     * Both operations are per job in IPP, they are sent on the same kept-alive connection.
+     */
+    class SetJobAttributesWorker: public JobsRequestWorker
+    {
+    public:
+        SetJobAttributesWorker(const Napi::Function& iCallback, const std::string &iPrinterName, const std::vector<int> &iJobIds, const CupsOptionsPtr &iAttributes, const std::string &iMoveTo):
+            JobsRequestWorker(iCallback, "node-printer:setJobAttributes", iPrinterName, iJobIds),
+            _attributes(iAttributes),
+            _move_to(iMoveTo)
+        {}
+
+    protected:
+        void run()
+        {
+            for(std::vector<BulkJobResult>::iterator itJob = _results.begin(); itJob != _results.end(); ++itJob)
+            {
+                if(_attributes->size() > 0)
+                {
+                    ipp_t *request = newJobRequest(IPP_OP_SET_JOB_ATTRIBUTES, itJob->id);
+                    // same encoding as lp -i job-id -o name=value: operation attributes, then job template ones
+                    cupsEncodeOptions2(request, _attributes->size(), _attributes->get(), IPP_TAG_OPERATION);
+                    cupsEncodeOptions2(request, _attributes->size(), _attributes->get(), IPP_TAG_JOB);
+                    if(!(itJob->ok = sendRequest(request, NULL, itJob->error)))
+                    {
+                        continue;
+                    }
+                }
+                if(!_move_to.empty())
+                {
+                    ipp_t *request = newJobRequest(IPP_OP_CUPS_MOVE_JOB, itJob->id);
+                    ippAddString(request, IPP_TAG_JOB, IPP_TAG_URI, "job-printer-uri", NULL, getPrinterUri(_move_to).c_str());
+                    itJob->ok = sendRequest(request, NULL, itJob->error);
+                }
+            }
+        }
+
+    private:
+        CupsOptionsPtr _attributes;
+        std::string _move_to;
+    };
+
+    /** Job ids from a v8 array
+     * @return false if an element is not a number
+     */
+    bool getJobIdsFromV8Value(Napi::Array iIds, std::vector<int> &oJobIds)
+    {
+        for(uint32_t i = 0; i < iIds.Length(); ++i)
+        {
+            Napi::Value id = iIds.Get(i);
+            if(!id.IsNumber())
+            {
+                return false;
+            }
+            oJobIds.push_back(id.As<Napi::Number>().Int32Value());
+        }
+        return true;
+    }
+}
+
+Napi::Value setJobs(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 4)
+    {
+        Napi::TypeError::New(env, "setJobs:invalid number of arguments (4 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[0].IsString())
+    {
+        Napi::TypeError::New(env, "setJobs:first argument must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[1].IsString())
+    {
+        Napi::TypeError::New(env, "setJobs:second argument must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[2].IsArray() && !info[2].IsUndefined() && !info[2].IsNull())
+    {
+        Napi::TypeError::New(env, "setJobs:third argument must be an array of job ids").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[3].IsFunction())
+    {
+        Napi::TypeError::New(env, "setJobs:fourth argument must be a callback function").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    BulkJobCommand command;
+    if(!getBulkJobCommand(info[1].As<Napi::String>().Utf8Value(), command))
+    {
+        Napi::Error::New(env, "setJobs: unsupported job command. Expected CANCEL, CANCEL-MY, PURGE, HOLD, RELEASE or RESTART").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    std::vector<int> job_ids;
+    if(info[2].IsArray())
+    {
+        if(!getJobIdsFromV8Value(info[2].As<Napi::Array>(), job_ids))
+        {
+            Napi::TypeError::New(env, "setJobs:job ids must be numbers").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+    }
+
+    if(job_ids.empty() && command != BULK_CANCEL_MY && command != BULK_PURGE)
+    {
+        Napi::TypeError::New(env, "setJobs:job ids are mandatory for this command").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    if(!job_ids.empty() && command == BULK_PURGE)
+    {
+        Napi::TypeError::New(env, "setJobs:PURGE applies to all jobs of the printer, job ids are not supported").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    (new SetJobsWorker(info[3].As<Napi::Function>(), info[0].As<Napi::String>().Utf8Value(), command, job_ids))->Queue();
+    return env.Undefined();
+}
+
+Napi::Value setJobAttributes(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 4)
+    {
+        Napi::TypeError::New(env, "setJobAttributes:invalid number of arguments (4 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[0].IsString())
+    {
+        Napi::TypeError::New(env, "setJobAttributes:first argument must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[1].IsArray())
+    {
+        Napi::TypeError::New(env, "setJobAttributes:second argument must be an array of job ids").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[2].IsObject())
+    {
+        Napi::TypeError::New(env, "setJobAttributes:third argument must be an object").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[3].IsFunction())
+    {
+        Napi::TypeError::New(env, "setJobAttributes:fourth argument must be a callback function").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    std::vector<int> job_ids;
+    if(!getJobIdsFromV8Value(info[1].As<Napi::Array>(), job_ids))
+    {
+        Napi::TypeError::New(env, "setJobAttributes:job ids must be numbers").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // friendly names of the usual attributes, other names are IPP job attribute names
+    static const char * const aliases[][2] =
+    {
+        { "priority", "job-priority" },
+        { "holdUntil", "job-hold-until" },
+        { "copies", "copies" },
+        { "name", "job-name" }
+    };
+
+    Napi::Object arg_attributes = info[2].As<Napi::Object>();
+    std::shared_ptr<CupsOptions> attributes = std::make_shared<CupsOptions>();
+    std::string move_to;
+    Napi::Array names = arg_attributes.GetPropertyNames();
+    for(uint32_t i = 0; i < names.Length(); ++i)
+    {
+        Napi::Value name_value = names.Get(i);
+        if(!name_value.IsString())
+        {
+            continue;
+        }
+        std::string name = name_value.As<Napi::String>().Utf8Value();
+        Napi::Value value = arg_attributes.Get(name);
+        if(value.IsUndefined() || value.IsNull())
+        {
+            continue;
+        }
+        if(name == "printer")
+        {
+            if(!value.IsString())
+            {
+                Napi::TypeError::New(env, "setJobAttributes:printer attribute must be a string").ThrowAsJavaScriptException();
+                return env.Undefined();
+            }
+            move_to = value.As<Napi::String>().Utf8Value();
+            continue;
+        }
+        for(size_t j = 0; j < sizeof(aliases) / sizeof(aliases[0]); ++j)
+        {
+            if(name == aliases[j][0])
+            {
+                name = aliases[j][1];
+                break;
+            }
+        }
+        attributes->add(name, value.ToString().Utf8Value());
+    }
+
+    if(attributes->size() == 0 && move_to.empty())
+    {
+        Napi::TypeError::New(env, "setJobAttributes:no attribute to set").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    (new SetJobAttributesWorker(info[3].As<Napi::Function>(), info[0].As<Napi::String>().Utf8Value(), job_ids, attributes, move_to))->Queue();
+    return env.Undefined();
+}
@@ -0,0 +1,1053 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace
+{
+    /** "NPJR" */
+    const uint32_t RECORD_MAGIC = 0x524a504e;
+    const size_t DEFAULT_SEGMENT_SIZE = 16 * 1024 * 1024;
+    const int DEFAULT_SYNC_INTERVAL_MS = 10;
+    const size_t DEFAULT_SYNC_BYTES = 1024 * 1024;
+
+    typedef std::chrono::steady_clock ClockType;
+    /** delays between two submissions of a job while the server fails */
+    const int MIN_RETRY_MS = 100;
+    const int MAX_RETRY_MS = 5000;
+    /** a job still failing after this is dropped: it would hold back all the next ones */
+    const int DEFAULT_RETRY_TIMEOUT_MS = 600000;
+    /** close() waits this long for a submission in progress, then leaves it to finish in the background */
+    const int STOP_TIMEOUT_MS = 2000;
+
+    enum RecordState
+    {
+        RECORD_PENDING = 0,
+        RECORD_SUBMITTED = 1,
+        RECORD_FAILED = 2
+    };
+
+    /** Record of one job in a segment, followed by its payload:
+     * printer, docname, format, options count, option names and values as
+     * 32 bits length + bytes, then the data. Records are 8 bytes aligned and
+     * the segment is zero filled after the last one.
+     */
+    struct RecordHeader
+    {
+        uint32_t magic;
+        /** payload bytes */
+        uint32_t length;
+        uint64_t sequence;
+        /** crc32 of the payload: a record torn by a crash ends the segment */
+        uint32_t crc;
+        /** RecordState, updated by the drainer */
+        uint32_t state;
+        /** CUPS job id once submitted */
+        int32_t job_id;
+        uint32_t reserved;
+    };
+
+    size_t getRecordSize(size_t iPayloadSize)
+    {
+        return (sizeof(RecordHeader) + iPayloadSize + 7) & ~static_cast<size_t>(7);
+    }
+
+    void appendField(std::string &ioPayload, const char *iValue, size_t iLength)
+    {
+        uint32_t length = static_cast<uint32_t>(iLength);
+        ioPayload.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        ioPayload.append(iValue, iLength);
+    }
+
+    bool readField(const char *&ioPosition, const char *iEnd, std::string &oValue)
+    {
+        uint32_t length;
+        if(static_cast<size_t>(iEnd - ioPosition) < sizeof(length))
+        {
+            return false;
+        }
+        memcpy(&length, ioPosition, sizeof(length));
+        ioPosition += sizeof(length);
+        if(static_cast<size_t>(iEnd - ioPosition) < length)
+        {
+            return false;
+        }
+        oValue.assign(ioPosition, length);
+        ioPosition += length;
+        return true;
+    }
+
+    /** Allocate the blocks of a new file of iSize bytes. Only Linux has posix_fallocate,
+     * macOS preallocates with F_PREALLOCATE and other systems only set the size
+     * @return 0 or the errno of the failure
+     */
+    int allocateFile(int iFd, off_t iSize)
+    {
+#if defined(__linux__)
+        return posix_fallocate(iFd, 0, iSize);
+#else
+#if defined(__APPLE__)
+        fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, iSize, 0 };
+        if(fcntl(iFd, F_PREALLOCATE, &store) == -1)
+        {
+            // contiguous space is not required
+            store.fst_flags = F_ALLOCATEALL;
+            if(fcntl(iFd, F_PREALLOCATE, &store) == -1)
+            {
+                return errno;
+            }
+        }
+#endif
+        return (ftruncate(iFd, iSize) == -1) ? errno : 0;
+#endif
+    }
+
+    /** Segment file mapped in memory, unmapped on destruction.
+     * Offsets are protected by the journal mutex, records below write_offset are immutable
+     * except their state and job id.
+     */
+    struct JournalSegment
+    {
+        JournalSegment(): data(NULL), size(0), fd(-1), write_offset(0), synced_offset(0), drain_offset(0) {}
+        ~JournalSegment()
+        {
+            if(data != NULL)
+            {
+                munmap(data, size);
+            }
+            if(fd != -1)
+            {
+                ::close(fd);
+            }
+        }
+
+        /** Map an existing segment, or create it with iSize bytes
+         */
+        bool open(const std::string &iPath, size_t iSize, bool iCreate, std::string &oError)
+        {
+            path = iPath;
+            fd = ::open(path.c_str(), iCreate ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, 0600);
+            if(fd == -1)
+            {
+                oError = "unable to open " + path + ": " + strerror(errno);
+                return false;
+            }
+            if(iCreate)
+            {
+                // blocks are allocated now: a full disk fails the append instead of a write to the mapping
+                int error = allocateFile(fd, static_cast<off_t>(iSize));
+                if(error != 0)
+                {
+                    oError = "unable to allocate " + path + ": " + strerror(error);
+                    // the segment is created again by the next append
+                    unlink(path.c_str());
+                    return false;
+                }
+                size = iSize;
+            }
+            else
+            {
+                struct stat segment_stat;
+                if(fstat(fd, &segment_stat) == -1)
+                {
+                    oError = "unable to stat " + path + ": " + strerror(errno);
+                    return false;
+                }
+                size = static_cast<size_t>(segment_stat.st_size);
+            }
+            if(size < sizeof(RecordHeader))
+            {
+                oError = path + " is not a journal segment";
+                return false;
+            }
+            void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(mapping == MAP_FAILED)
+            {
+                oError = "unable to map " + path + ": " + strerror(errno);
+                return false;
+            }
+            data = static_cast<char*>(mapping);
+            return true;
+        }
+
+        /** Write the pages of [iBegin, iEnd) to disk
+         */
+        bool sync(size_t iBegin, size_t iEnd)
+        {
+            static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            size_t begin = iBegin - iBegin % page_size;
+            return msync(data + begin, iEnd - begin, MS_SYNC) == 0;
+        }
+
+        RecordHeader* header(size_t iOffset)
+        {
+            return reinterpret_cast<RecordHeader*>(data + iOffset);
+        }
+
+        std::string path;
+        char *data;
+        size_t size;
+        int fd;
+        /** end of the appended records */
+        size_t write_offset;
+        /** end of the records written to disk */
+        size_t synced_offset;
+        /** next record to submit */
+        size_t drain_offset;
+    };
+
+    typedef std::shared_ptr<JournalSegment> JournalSegmentPtr;
+
+    /** Outcome of a drained job, passed to the main thread
+     */
+    struct DrainResult
+    {
+        uint64_t sequence;
+        int job_id;
+        std::string error;
+    };
+
+    /** State of a journal shared with its threads.
+     * A drainer stuck in a submission when the journal is closed is detached: it keeps this alive,
+     * with the segments and the directory lock, until the submission returns.
+     */
+    struct JournalCore
+    {
+        JournalCore():
+            segment_size(DEFAULT_SEGMENT_SIZE),
+            sync_interval_ms(DEFAULT_SYNC_INTERVAL_MS),
+            sync_bytes(DEFAULT_SYNC_BYTES),
+            retry_timeout_ms(DEFAULT_RETRY_TIMEOUT_MS),
+            lock_fd(-1),
+            has_callback(false),
+            next_sequence(1),
+            synced_sequence(0),
+            unsynced_bytes(0),
+            appended(0),
+            pending(0),
+            submitted(0),
+            failed(0),
+            stopping(false),
+            drain_exited(false),
+            drain_detached(false)
+        {}
+
+        /** Map the segments left by the previous process, or create the first one
+         */
+        bool recover(std::string &oError);
+        /** Create the segment starting at sequence iFirstSequence
+         */
+        JournalSegmentPtr createSegment(uint64_t iFirstSequence, std::string &oError);
+
+        /** Write the appended records of all segments to disk
+         */
+        void syncAppended();
+        void runSync();
+        void runDrain();
+        /** Submit the job of a record
+         * @param oRetry true if the failure is transient: the job stays at the head of the journal
+         */
+        void submit(const RecordHeader *iHeader, DrainResult &oResult, bool &oRetry);
+        void notify(DrainResult *iResult);
+
+        /** Write everything to disk, unmap the segments and unlock the directory, once the threads are done
+         */
+        void close();
+
+        std::string directory;
+        size_t segment_size;
+        int sync_interval_ms;
+        size_t sync_bytes;
+        /** 0 retries without limit */
+        int retry_timeout_ms;
+        int lock_fd;
+        bool has_callback;
+        Napi::ThreadSafeFunction tsfn;
+
+        std::mutex mutex;
+        std::condition_variable drain_wakeup;
+        std::condition_variable sync_wakeup;
+        std::condition_variable drain_exit;
+        /** oldest first, the last one receives the appended records */
+        std::deque<JournalSegmentPtr> segments;
+        uint64_t next_sequence;
+        uint64_t synced_sequence;
+        size_t unsynced_bytes;
+        uint64_t appended;
+        uint64_t pending;
+        uint64_t submitted;
+        uint64_t failed;
+        bool stopping;
+        bool drain_exited;
+        /** the journal was closed without waiting for the drainer, which closes the core when it exits */
+        bool drain_detached;
+
+        /** one sync at a time, from the sync thread or from sync() */
+        std::mutex sync_mutex;
+    };
+
+    typedef std::shared_ptr<JournalCore> JournalCorePtr;
+
+    JournalSegmentPtr JournalCore::createSegment(uint64_t iFirstSequence, std::string &oError)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "/segment-%016llx.journal", static_cast<unsigned long long>(iFirstSequence));
+        JournalSegmentPtr segment = std::make_shared<JournalSegment>();
+        if(!segment->open(directory + name, segment_size, true, oError))
+        {
+            return JournalSegmentPtr();
+        }
+        // the new file name must survive a crash too
+        int directory_fd = ::open(directory.c_str(), O_RDONLY);
+        if(directory_fd != -1)
+        {
+            fsync(directory_fd);
+            ::close(directory_fd);
+        }
+        return segment;
+    }
+
+    bool JournalCore::recover(std::string &oError)
+    {
+        DIR *directory_stream = opendir(directory.c_str());
+        if(directory_stream == NULL)
+        {
+            oError = "unable to read " + directory + ": " + strerror(errno);
+            return false;
+        }
+        std::vector<std::string> names;
+        for(struct dirent *entry = readdir(directory_stream); entry != NULL; entry = readdir(directory_stream))
+        {
+            std::string name = entry->d_name;
+            if(name.compare(0, 8, "segment-") == 0 && name.size() > 8 + 8 && name.compare(name.size() - 8, 8, ".journal") == 0)
+            {
+                names.push_back(name);
+            }
+        }
+        closedir(directory_stream);
+        // fixed width hexadecimal names: lexical order is the sequence order
+        std::sort(names.begin(), names.end());
+
+        for(size_t i = 0; i < names.size(); ++i)
+        {
+            JournalSegmentPtr segment = std::make_shared<JournalSegment>();
+            if(!segment->open(directory + "/" + names[i], 0, false, oError))
+            {
+                return false;
+            }
+            size_t offset = 0;
+            uint64_t expected_sequence = 0;
+            while(offset + sizeof(RecordHeader) <= segment->size)
+            {
+                const RecordHeader *header = segment->header(offset);
+                if(header->magic != RECORD_MAGIC
+                    || header->length > segment->size - offset - sizeof(RecordHeader)
+                    || (expected_sequence != 0 && header->sequence != expected_sequence)
+                    || crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(header + 1), header->length) != header->crc)
+                {
+                    break;
+                }
+                if(header->state == RECORD_PENDING)
+                {
+                    ++pending;
+                }
+                expected_sequence = header->sequence + 1;
+                next_sequence = std::max(next_sequence, expected_sequence);
+                offset += getRecordSize(header->length);
+            }
+            segment->write_offset = segment->synced_offset = std::min(offset, segment->size);
+            segments.push_back(segment);
+        }
+        synced_sequence = next_sequence - 1;
+
+        if(segments.empty())
+        {
+            JournalSegmentPtr segment = createSegment(next_sequence, oError);
+            if(!segment)
+            {
+                return false;
+            }
+            segments.push_back(segment);
+            return true;
+        }
+
+        // appends continue after the last valid record: bytes of a torn record must not look valid later
+        JournalSegmentPtr &last = segments.back();
+        if(last->write_offset < last->size)
+        {
+            memset(last->data + last->write_offset, 0, last->size - last->write_offset);
+            last->sync(last->write_offset, last->size);
+        }
+        return true;
+    }
+
+    void JournalCore::syncAppended()
+    {
+        std::lock_guard<std::mutex> sync_lock(sync_mutex);
+        struct Range
+        {
+            JournalSegmentPtr segment;
+            size_t begin;
+            size_t end;
+        };
+        std::vector<Range> ranges;
+        uint64_t sequence;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(std::deque<JournalSegmentPtr>::const_iterator itSegment = segments.begin(); itSegment != segments.end(); ++itSegment)
+            {
+                if((*itSegment)->synced_offset < (*itSegment)->write_offset)
+                {
+                    Range range = { *itSegment, (*itSegment)->synced_offset, (*itSegment)->write_offset };
+                    ranges.push_back(range);
+                }
+            }
+            sequence = next_sequence - 1;
+            unsynced_bytes = 0;
+        }
+        if(ranges.empty())
+        {
+            return;
+        }
+
+        for(std::vector<Range>::const_iterator itRange = ranges.begin(); itRange != ranges.end(); ++itRange)
+        {
+            itRange->segment->sync(itRange->begin, itRange->end);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(std::vector<Range>::const_iterator itRange = ranges.begin(); itRange != ranges.end(); ++itRange)
+            {
+                itRange->segment->synced_offset = std::max(itRange->segment->synced_offset, itRange->end);
+            }
+            synced_sequence = std::max(synced_sequence, sequence);
+        }
+        // a synced and drained segment may be deleted now
+        drain_wakeup.notify_one();
+    }
+
+    void JournalCore::close()
+    {
+        syncAppended();
+        std::lock_guard<std::mutex> lock(mutex);
+        segments.clear();
+        if(lock_fd != -1)
+        {
+            ::close(lock_fd);
+            lock_fd = -1;
+        }
+    }
+
+    void JournalCore::runSync()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(!stopping)
+        {
+            sync_wakeup.wait(lock, [this]() { return stopping || unsynced_bytes > 0; });
+            // batch the records appended during the interval in one sync
+            sync_wakeup.wait_for(lock, std::chrono::milliseconds(sync_interval_ms), [this]() { return stopping || unsynced_bytes >= sync_bytes; });
+            lock.unlock();
+            syncAppended();
+            lock.lock();
+        }
+    }
+
+    void JournalCore::runDrain()
+    {
+        int retry_ms = MIN_RETRY_MS;
+        /** first failure of the head record, if it is being retried */
+        bool retrying = false;
+        ClockType::time_point retry_since;
+        std::unique_lock<std::mutex> lock(mutex);
+        while(!stopping)
+        {
+            JournalSegmentPtr segment = segments.front();
+            if(segment->drain_offset >= segment->write_offset)
+            {
+                if(segments.size() > 1 && segment->synced_offset >= segment->write_offset)
+                {
+                    // nothing is appended to it anymore and its job ids are on disk
+                    segments.pop_front();
+                    unlink(segment->path.c_str());
+                    continue;
+                }
+                drain_wakeup.wait(lock);
+                continue;
+            }
+
+            size_t offset = segment->drain_offset;
+            RecordHeader *header = segment->header(offset);
+            size_t record_size = getRecordSize(header->length);
+            if(header->state != RECORD_PENDING)
+            {
+                // drained before the previous process exited
+                segment->drain_offset += record_size;
+                continue;
+            }
+
+            lock.unlock();
+            DrainResult *result = new DrainResult();
+            result->sequence = header->sequence;
+            result->job_id = 0;
+            bool retry = false;
+            submit(header, *result, retry);
+            lock.lock();
+
+            if(retry && retrying && retry_timeout_ms > 0
+                && ClockType::now() - retry_since >= std::chrono::milliseconds(retry_timeout_ms))
+            {
+                result->error += " (gave up after retrying for " + std::to_string(retry_timeout_ms / 1000) + "s)";
+                retry = false;
+            }
+            if(retry)
+            {
+                if(!retrying)
+                {
+                    retrying = true;
+                    retry_since = ClockType::now();
+                }
+                // in order: the next jobs wait for this one
+                delete result;
+                drain_wakeup.wait_for(lock, std::chrono::milliseconds(retry_ms), [this]() { return stopping; });
+                retry_ms = std::min(retry_ms * 2, MAX_RETRY_MS);
+                continue;
+            }
+            retry_ms = MIN_RETRY_MS;
+            retrying = false;
+
+            header->job_id = result->job_id;
+            header->state = result->error.empty() ? RECORD_SUBMITTED : RECORD_FAILED;
+            segment->drain_offset += record_size;
+            --pending;
+            if(result->error.empty())
+            {
+                ++submitted;
+            }
+            else
+            {
+                ++failed;
+            }
+            lock.unlock();
+            // the job must not be submitted again after a crash
+            segment->sync(offset, offset + sizeof(RecordHeader));
+            notify(result);
+            lock.lock();
+        }
+        drain_exited = true;
+        bool detached = drain_detached;
+        lock.unlock();
+        drain_exit.notify_all();
+        if(detached)
+        {
+            // the submission in progress when the journal was closed is recorded: the segments can go now
+            close();
+        }
+    }
+
+    void JournalCore::submit(const RecordHeader *iHeader, DrainResult &oResult, bool &oRetry)
+    {
+        const char *position = reinterpret_cast<const char*>(iHeader + 1);
+        const char *end = position + iHeader->length;
+        std::string printer_name, docname, format, options_count;
+        CupsOptions options;
+        bool valid = readField(position, end, printer_name)
+            && readField(position, end, docname)
+            && readField(position, end, format)
+            && readField(position, end, options_count)
+            && options_count.size() == sizeof(uint32_t);
+        if(valid)
+        {
+            uint32_t count;
+            memcpy(&count, options_count.data(), sizeof(count));
+            std::string name, value;
+            for(uint32_t i = 0; valid && i < count; ++i)
+            {
+                valid = readField(position, end, name) && readField(position, end, value);
+                if(valid)
+                {
+                    options.add(name, value);
+                }
+            }
+        }
+        if(!valid)
+        {
+            oResult.error = "Print Error: invalid journal record";
+            return;
+        }
+
+        ipp_status_t status;
+        oResult.job_id = getCurrentPrintBackend()->printData("", printer_name, docname, format, options,
+            position, static_cast<size_t>(end - position), status, oResult.error);
+        if(oResult.job_id != 0)
+        {
+            return;
+        }
+        // client errors (unknown printer, unsupported option...) fail again: the job is dropped
+        oRetry = (status < IPP_STATUS_ERROR_BAD_REQUEST || status >= IPP_STATUS_ERROR_INTERNAL);
+    }
+
+    void JournalCore::notify(DrainResult *iResult)
+    {
+        // the callback is released once the journal is stopping
+        std::lock_guard<std::mutex> lock(mutex);
+        if(stopping || !has_callback || tsfn.BlockingCall(iResult, [](Napi::Env env, Napi::Function iCallback, DrainResult *iData) {
+            std::unique_ptr<DrainResult> result(iData);
+            Napi::Object job = Napi::Object::New(env);
+            job.Set("sequence", Napi::Number::New(env, static_cast<double>(result->sequence)));
+            if(result->error.empty())
+            {
+                job.Set("id", Napi::Number::New(env, result->job_id));
+                iCallback.Call({ env.Null(), job });
+            }
+            else
+            {
+                iCallback.Call({ Napi::Error::New(env, result->error).Value(), job });
+            }
+        }) != napi_ok)
+        {
+            delete iResult;
+        }
+    }
+
+    /** Write-ahead spool, see openSpoolJournal.
+     * append() copies the job into the current memory mapped segment and returns: a sync thread
+     * writes the appended records to disk in batches, a drainer thread submits them to CUPS in
+     * order, retrying while the server fails, and records their job id in the journal.
+     * Drained segments are deleted, pending records are submitted again on the next open.
+     */
+    class SpoolJournal: public Napi::ObjectWrap<SpoolJournal>
+    {
+    public:
+        static Napi::Function GetClass(Napi::Env env);
+
+        SpoolJournal(const Napi::CallbackInfo& info);
+        ~SpoolJournal();
+
+    private:
+        Napi::Value Append(const Napi::CallbackInfo& info);
+        Napi::Value Sync(const Napi::CallbackInfo& info);
+        Napi::Value Stats(const Napi::CallbackInfo& info);
+        Napi::Value Close(const Napi::CallbackInfo& info);
+        Napi::Value GetDirectory(const Napi::CallbackInfo& info);
+
+        bool checkOpened(Napi::Env env, const char *iMethodName);
+
+        /** Stop the threads, waiting STOP_TIMEOUT_MS at most for a submission in progress
+         */
+        void stop();
+        static void cleanup(void *iData);
+
+        std::string _directory;
+        napi_env _env;
+        /** payload prefix of the job being appended, main thread only */
+        std::string _payload;
+        JournalCorePtr _core;
+
+        std::thread _sync_thread;
+        std::thread _drain_thread;
+    };
+
+    Napi::Function SpoolJournal::GetClass(Napi::Env env)
+    {
+        Napi::FunctionReference &constructor = getAddonData(env).constructors["SpoolJournal"];
+        if(constructor.IsEmpty())
+        {
+            constructor = Napi::Persistent(DefineClass(env, "SpoolJournal", {
+                InstanceMethod("append", &SpoolJournal::Append),
+                InstanceMethod("sync", &SpoolJournal::Sync),
+                InstanceMethod("stats", &SpoolJournal::Stats),
+                InstanceMethod("close", &SpoolJournal::Close),
+                InstanceAccessor("directory", &SpoolJournal::GetDirectory, nullptr)
+            }));
+        }
+        return constructor.Value();
+    }
+
+    SpoolJournal::SpoolJournal(const Napi::CallbackInfo& info):
+        Napi::ObjectWrap<SpoolJournal>(info),
+        _env(info.Env()),
+        _core(std::make_shared<JournalCore>())
+    {
+        Napi::Env env = info.Env();
+
+        if(info.Length() < 1 || !info[0].IsString())
+        {
+            Napi::TypeError::New(env, "openSpoolJournal:first argument must be a directory").ThrowAsJavaScriptException();
+            return;
+        }
+        _directory = info[0].As<Napi::String>().Utf8Value();
+        _core->directory = _directory;
+
+        Napi::Value arg_on_job = env.Undefined();
+        if(info.Length() > 1 && info[1].IsObject())
+        {
+            Napi::Object arg_options = info[1].As<Napi::Object>();
+            Napi::Value arg_segment_size = arg_options.Get("segmentSize");
+            if(arg_segment_size.IsNumber())
+            {
+                _core->segment_size = std::max(static_cast<size_t>(arg_segment_size.As<Napi::Number>().Int64Value()), static_cast<size_t>(64 * 1024));
+            }
+            Napi::Value arg_sync_interval = arg_options.Get("syncInterval");
+            if(arg_sync_interval.IsNumber())
+            {
+                _core->sync_interval_ms = std::max(arg_sync_interval.As<Napi::Number>().Int32Value(), 0);
+            }
+            Napi::Value arg_sync_bytes = arg_options.Get("syncBytes");
+            if(arg_sync_bytes.IsNumber())
+            {
+                _core->sync_bytes = std::max(static_cast<size_t>(arg_sync_bytes.As<Napi::Number>().Int64Value()), static_cast<size_t>(1));
+            }
+            Napi::Value arg_retry_timeout = arg_options.Get("retryTimeout");
+            if(arg_retry_timeout.IsNumber())
+            {
+                _core->retry_timeout_ms = std::max(arg_retry_timeout.As<Napi::Number>().Int32Value(), 0);
+            }
+            arg_on_job = arg_options.Get("onJob");
+            if(!arg_on_job.IsUndefined() && !arg_on_job.IsFunction())
+            {
+                Napi::TypeError::New(env, "openSpoolJournal:onJob must be a function").ThrowAsJavaScriptException();
+                return;
+            }
+        }
+
+        if(mkdir(_directory.c_str(), 0700) == -1 && errno != EEXIST)
+        {
+            Napi::Error::New(env, "openSpoolJournal: unable to create " + _directory + ": " + strerror(errno)).ThrowAsJavaScriptException();
+            return;
+        }
+        // two processes draining the same journal would submit every job twice
+        std::string lock_path = _directory + "/lock";
+        _core->lock_fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT, 0600);
+        if(_core->lock_fd == -1 || flock(_core->lock_fd, LOCK_EX | LOCK_NB) == -1)
+        {
+            std::string error_str = "openSpoolJournal: " + _directory + " is used by another process";
+            if(_core->lock_fd != -1)
+            {
+                ::close(_core->lock_fd);
+                _core->lock_fd = -1;
+            }
+            Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
+            return;
+        }
+
+        std::string error_str;
+        if(!_core->recover(error_str))
+        {
+            stop();
+            Napi::Error::New(env, "openSpoolJournal: " + error_str).ThrowAsJavaScriptException();
+            return;
+        }
+
+        if(arg_on_job.IsFunction())
+        {
+            _core->tsfn = Napi::ThreadSafeFunction::New(env, arg_on_job.As<Napi::Function>(), "node-printer:journal", 0, 1);
+            // pending records are submitted on the next open, they do not keep the process alive
+            _core->tsfn.Unref(env);
+            _core->has_callback = true;
+        }
+        _sync_thread = std::thread(&JournalCore::runSync, _core);
+        _drain_thread = std::thread(&JournalCore::runDrain, _core);
+        napi_add_env_cleanup_hook(env, &SpoolJournal::cleanup, this);
+    }
+
+    SpoolJournal::~SpoolJournal()
+    {
+        stop();
+    }
+
+    void SpoolJournal::cleanup(void *iData)
+    {
+        static_cast<SpoolJournal*>(iData)->stop();
+    }
+
+    void SpoolJournal::stop()
+    {
+        if(_core->stopping)
+        {
+            return;
+        }
+        bool started = _drain_thread.joinable();
+        {
+            std::lock_guard<std::mutex> lock(_core->mutex);
+            _core->stopping = true;
+        }
+        _core->drain_wakeup.notify_one();
+        _core->sync_wakeup.notify_one();
+        bool detached = false;
+        if(started)
+        {
+            // a sync only waits for the disk
+            _sync_thread.join();
+            // the drainer may be waiting for a server which does not answer
+            std::unique_lock<std::mutex> lock(_core->mutex);
+            if(!_core->drain_exit.wait_for(lock, std::chrono::milliseconds(STOP_TIMEOUT_MS), [this]() { return _core->drain_exited; }))
+            {
+                _core->drain_detached = detached = true;
+            }
+            lock.unlock();
+            if(detached)
+            {
+                _drain_thread.detach();
+            }
+            else
+            {
+                _drain_thread.join();
+            }
+            napi_remove_env_cleanup_hook(_env, &SpoolJournal::cleanup, this);
+        }
+        _core->syncAppended();
+        {
+            // notify() does not call it anymore once stopping
+            std::lock_guard<std::mutex> lock(_core->mutex);
+            if(_core->has_callback)
+            {
+                _core->tsfn.Release();
+                _core->has_callback = false;
+            }
+        }
+        if(!detached)
+        {
+            _core->close();
+        }
+    }
+
+    bool SpoolJournal::checkOpened(Napi::Env env, const char *iMethodName)
+    {
+        if(_core->stopping)
+        {
+            Napi::Error::New(env, std::string(iMethodName) + ": journal is closed").ThrowAsJavaScriptException();
+            return false;
+        }
+        return true;
+    }
+
+    Napi::Value SpoolJournal::Append(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "append"))
+        {
+            return env.Undefined();
+        }
+        if(info.Length() < 1 || !info[0].IsObject())
+        {
+            Napi::TypeError::New(env, "append:first argument must be an object").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        Napi::Object arg_params = info[0].As<Napi::Object>();
+
+        // data, copied straight into the segment
+        std::string data_storage;
+        struct iovec data;
+        bool encoded = false;
+        std::string encoding_error;
+        if(!getEncodedDataFromV8Params(arg_params, data_storage, encoded, encoding_error))
+        {
+            Napi::TypeError::New(env, "append:" + encoding_error).ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        if(encoded)
+        {
+            data.iov_base = const_cast<char*>(data_storage.data());
+            data.iov_len = data_storage.size();
+        }
+        else if(!getDataFromV8Value(arg_params.Get("data"), data_storage, data))
+        {
+            Napi::TypeError::New(env, "append:data parameter must be a string or Buffer").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+
+        // the default printer is resolved now: the journal replays what was asked
+        std::string printer_name;
+        Napi::Value arg_value_printer = arg_params.Get("printer");
+        if(arg_value_printer.IsString())
+        {
+            printer_name = arg_value_printer.As<Napi::String>().Utf8Value();
+        }
+        else
+        {
+            const char *default_printer_name = cupsGetDefault();
+            if(default_printer_name == NULL)
+            {
+                Napi::TypeError::New(env, "append:printer parameter must be a string").ThrowAsJavaScriptException();
+                return env.Undefined();
+            }
+            printer_name = default_printer_name;
+        }
+
+        std::string docname = "node print job";
+        Napi::Value arg_value_docname = arg_params.Get("docname");
+        if(arg_value_docname.IsString())
+        {
+            docname = arg_value_docname.As<Napi::String>().Utf8Value();
+        }
+
+        std::string type_str = "RAW";
+        Napi::Value arg_value_type = arg_params.Get("type");
+        if(arg_value_type.IsString())
+        {
+            type_str = arg_value_type.As<Napi::String>().Utf8Value();
+        }
+        FormatMapType::const_iterator itFormat = getPrinterFormatMap().find(type_str);
+        if(itFormat == getPrinterFormatMap().end())
+        {
+            Napi::TypeError::New(env, "append: unsupported format type").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+
+        CupsOptionsPtr options;
+        if(!getCupsOptionsFromV8Value(arg_params.Get("options"), options))
+        {
+            Napi::TypeError::New(env, "append:options parameter must be an object").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        // a job the printer would refuse is not journaled: it would be retried or failed much later
+        std::string preflight_error;
+        if(!preflightV8Params(arg_params, "", printer_name, *options, preflight_error))
+        {
+            Napi::Error::New(env, "append: " + preflight_error).ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+
+        _payload.clear();
+        appendField(_payload, printer_name.data(), printer_name.size());
+        appendField(_payload, docname.data(), docname.size());
+        appendField(_payload, itFormat->second.data(), itFormat->second.size());
+        uint32_t options_count = static_cast<uint32_t>(options->size());
+        appendField(_payload, reinterpret_cast<const char*>(&options_count), sizeof(options_count));
+        cups_option_t *option = options->get();
+        for(int i = 0; i < options->size(); ++i, ++option)
+        {
+            appendField(_payload, option->name, strlen(option->name));
+            appendField(_payload, option->value, strlen(option->value));
+        }
+
+        size_t payload_size = _payload.size() + data.iov_len;
+        size_t record_size = getRecordSize(payload_size);
+        if(record_size > _core->segment_size || payload_size > UINT32_MAX)
+        {
+            Napi::Error::New(env, "append: job is bigger than a journal segment").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+
+        // only this thread appends: the current segment and its write offset change only here
+        JournalSegmentPtr segment;
+        uint64_t sequence;
+        {
+            std::lock_guard<std::mutex> lock(_core->mutex);
+            segment = _core->segments.back();
+            sequence = _core->next_sequence;
+        }
+        if(segment->write_offset + record_size > segment->size)
+        {
+            std::string error_str;
+            segment = _core->createSegment(sequence, error_str);
+            if(!segment)
+            {
+                Napi::Error::New(env, "append: " + error_str).ThrowAsJavaScriptException();
+                return env.Undefined();
+            }
+            std::lock_guard<std::mutex> lock(_core->mutex);
+            _core->segments.push_back(segment);
+        }
+
+        RecordHeader *header = segment->header(segment->write_offset);
+        char *payload = reinterpret_cast<char*>(header + 1);
+        memcpy(payload, _payload.data(), _payload.size());
+        memcpy(payload + _payload.size(), data.iov_base, data.iov_len);
+        header->length = static_cast<uint32_t>(payload_size);
+        header->sequence = sequence;
+        header->crc = crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(payload), static_cast<uInt>(payload_size));
+        header->state = RECORD_PENDING;
+        header->job_id = 0;
+        header->magic = RECORD_MAGIC;
+
+        bool sync_now;
+        {
+            // the lock publishes the record to the sync and drain threads
+            std::lock_guard<std::mutex> lock(_core->mutex);
+            segment->write_offset += record_size;
+            ++_core->next_sequence;
+            ++_core->appended;
+            ++_core->pending;
+            _core->unsynced_bytes += record_size;
+            sync_now = (_core->unsynced_bytes == record_size || _core->unsynced_bytes >= _core->sync_bytes);
+        }
+        if(sync_now)
+        {
+            _core->sync_wakeup.notify_one();
+        }
+        _core->drain_wakeup.notify_one();
+        return Napi::Number::New(env, static_cast<double>(sequence));
+    }
+
+    Napi::Value SpoolJournal::Sync(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "sync"))
+        {
+            return env.Undefined();
+        }
+        _core->syncAppended();
+        std::lock_guard<std::mutex> lock(_core->mutex);
+        return Napi::Number::New(env, static_cast<double>(_core->synced_sequence));
+    }
+
+    Napi::Value SpoolJournal::Stats(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        Napi::Object result = Napi::Object::New(env);
+        std::lock_guard<std::mutex> lock(_core->mutex);
+        result.Set("appended", Napi::Number::New(env, static_cast<double>(_core->appended)));
+        result.Set("pending", Napi::Number::New(env, static_cast<double>(_core->pending)));
+        result.Set("submitted", Napi::Number::New(env, static_cast<double>(_core->submitted)));
+        result.Set("failed", Napi::Number::New(env, static_cast<double>(_core->failed)));
+        result.Set("sequence", Napi::Number::New(env, static_cast<double>(_core->next_sequence - 1)));
+        result.Set("syncedSequence", Napi::Number::New(env, static_cast<double>(_core->synced_sequence)));
+        result.Set("segments", Napi::Number::New(env, static_cast<double>(_core->segments.size())));
+        return result;
+    }
+
+    Napi::Value SpoolJournal::Close(const Napi::CallbackInfo& info)
+    {
+        stop();
+        return info.Env().Undefined();
+    }
+
+    Napi::Value SpoolJournal::GetDirectory(const Napi::CallbackInfo& info)
+    {
+        return Napi::String::New(info.Env(), _directory);
+    }
+}
+
+Napi::Value openSpoolJournal(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    Napi::Value directory = (info.Length() > 0) ? info[0] : env.Undefined();
+    Napi::Value options = (info.Length() > 1) ? info[1] : env.Undefined();
+    Napi::Object result = SpoolJournal::GetClass(env).New({ directory, options });
+    if(env.IsExceptionPending())
+    {
+        return env.Undefined();
+    }
+    return result;
+}
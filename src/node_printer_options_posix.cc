@@ -0,0 +1,133 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <memory>
+
+namespace
+{
+    /** Precompiled CUPS options, see createOptionSet.
+     * The cups_option_t array is built once and shared by every job which uses the set.
+     */
+    class OptionSet: public Napi::ObjectWrap<OptionSet>
+    {
+    public:
+        static Napi::Function GetClass(Napi::Env env);
+
+        OptionSet(const Napi::CallbackInfo& info);
+
+        const CupsOptionsPtr& options() const { return _options; }
+
+    private:
+        Napi::Value GetSize(const Napi::CallbackInfo& info);
+        Napi::Value ToObject(const Napi::CallbackInfo& info);
+
+        CupsOptionsPtr _options;
+    };
+
+    /** Build options from an object of option name/value pairs
+     */
+    CupsOptionsPtr buildCupsOptions(Napi::Object iOptions)
+    {
+        std::shared_ptr<CupsOptions> result = std::make_shared<CupsOptions>();
+        Napi::Array options_names = iOptions.GetPropertyNames();
+
+        for(uint32_t i = 0; i < options_names.Length(); ++i)
+        {
+            Napi::Value name_value = options_names.Get(i);
+            if(!name_value.IsString())
+            {
+                continue;
+            }
+            std::string name = name_value.As<Napi::String>().Utf8Value();
+            Napi::Value option_value = iOptions.Get(name);
+            result->add(name, option_value.ToString().Utf8Value());
+        }
+        return result;
+    }
+
+    Napi::Function OptionSet::GetClass(Napi::Env env)
+    {
+        Napi::FunctionReference &constructor = getAddonData(env).constructors["OptionSet"];
+        if(constructor.IsEmpty())
+        {
+            constructor = Napi::Persistent(DefineClass(env, "OptionSet", {
+                InstanceAccessor("size", &OptionSet::GetSize, nullptr),
+                InstanceMethod("toObject", &OptionSet::ToObject)
+            }));
+        }
+        return constructor.Value();
+    }
+
+    OptionSet::OptionSet(const Napi::CallbackInfo& info):
+        Napi::ObjectWrap<OptionSet>(info)
+    {
+        Napi::Env env = info.Env();
+
+        if(info.Length() < 1 || !info[0].IsObject())
+        {
+            Napi::TypeError::New(env, "createOptionSet:first argument must be an object").ThrowAsJavaScriptException();
+            return;
+        }
+        _options = buildCupsOptions(info[0].As<Napi::Object>());
+    }
+
+    Napi::Value OptionSet::GetSize(const Napi::CallbackInfo& info)
+    {
+        return Napi::Number::New(info.Env(), _options ? _options->size() : 0);
+    }
+
+    Napi::Value OptionSet::ToObject(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        Napi::Object result = Napi::Object::New(env);
+        if(_options)
+        {
+            cups_option_t *option = _options->get();
+            for(int i = 0; i < _options->size(); ++i, ++option)
+            {
+                result.Set(option->name, Napi::String::New(env, option->value));
+            }
+        }
+        return result;
+    }
+}
+
+bool getCupsOptionsFromV8Value(Napi::Value iV8Value, CupsOptionsPtr &oOptions)
+{
+    if(iV8Value.IsUndefined() || iV8Value.IsNull())
+    {
+        oOptions = std::make_shared<CupsOptions>();
+        return true;
+    }
+    if(!iV8Value.IsObject())
+    {
+        return false;
+    }
+    Napi::Object arg_options = iV8Value.As<Napi::Object>();
+    if(arg_options.InstanceOf(OptionSet::GetClass(iV8Value.Env())))
+    {
+        // precompiled: no marshalling at all
+        oOptions = OptionSet::Unwrap(arg_options)->options();
+        return true;
+    }
+    oOptions = buildCupsOptions(arg_options);
+    return true;
+}
+
+Napi::Value createOptionSet(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 1)
+    {
+        Napi::TypeError::New(env, "createOptionSet:invalid number of arguments (1 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    Napi::Object result = OptionSet::GetClass(env).New({ info[0] });
+    if(env.IsExceptionPending())
+    {
+        return env.Undefined();
+    }
+    return result;
+}
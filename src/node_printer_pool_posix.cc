@@ -0,0 +1,531 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+
+namespace
+{
+    const int DEFAULT_REFRESH_INTERVAL_MS = 1000;
+
+    enum PoolStrategy
+    {
+        POOL_LEAST_LOADED,
+        POOL_ROUND_ROBIN
+    };
+
+    /** Load of one pool member: server side counters refreshed periodically,
+     * and local counters of the jobs which are being submitted
+     */
+    struct PoolMember
+    {
+        PoolMember(const std::string &iName): name(iName), state(IPP_PSTATE_IDLE), accepting(true), available(true), queued(0), in_flight(0), in_flight_bytes(0), submitted(0) {}
+
+        std::string name;
+        ipp_pstate_t state;
+        bool accepting;
+        /** false after a submission failed because of the member, until the next refresh */
+        bool available;
+        /** jobs in the server queue at the last refresh, plus jobs submitted since */
+        int queued;
+        int in_flight;
+        size_t in_flight_bytes;
+        /** jobs submitted through the pool */
+        int submitted;
+
+        bool isUsable() const { return available && accepting && state != IPP_PSTATE_STOPPED; }
+    };
+
+    /** @return true if a submission failed because of the member, not of the job: the server cannot be
+     * reached or the printer refuses jobs. Errors of the job itself (options, format...) fail on any member
+     */
+    bool isMemberFailure(ipp_status_t iStatus)
+    {
+        return iStatus == IPP_STATUS_ERROR_SERVICE_UNAVAILABLE
+            // reported by CUPS for I/O errors on the connection
+            || iStatus == IPP_STATUS_ERROR_INTERNAL
+            || iStatus == IPP_STATUS_ERROR_NOT_ACCEPTING_JOBS
+            || iStatus == IPP_STATUS_ERROR_BUSY
+            || iStatus == IPP_STATUS_ERROR_NOT_FOUND;
+    }
+
+    /** Pool members and their load, shared by the pool object and its print workers
+     */
+    class PoolState
+    {
+    public:
+        PoolState(const std::vector<std::string> &iNames, PoolStrategy iStrategy, int iRefreshIntervalMs):
+            _strategy(iStrategy),
+            _refresh_interval(std::chrono::milliseconds(iRefreshIntervalMs)),
+            _next(0),
+            _http(NULL)
+        {
+            for(std::vector<std::string>::const_iterator itName = iNames.begin(); itName != iNames.end(); ++itName)
+            {
+                _members.push_back(PoolMember(*itName));
+            }
+        }
+
+        ~PoolState()
+        {
+            if(_http != NULL)
+            {
+                httpClose(_http);
+            }
+        }
+
+        /** Refresh queue depth and state of all members if they are older than the refresh interval.
+         * Only one thread refreshes, the others keep using the current values.
+         */
+        void refreshIfStale()
+        {
+            std::unique_lock<std::mutex> refresh_lock(_refresh_mutex, std::try_to_lock);
+            if(!refresh_lock.owns_lock())
+            {
+                return;
+            }
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(_refreshed.time_since_epoch().count() != 0 && now - _refreshed < _refresh_interval)
+                {
+                    return;
+                }
+            }
+            if(_http == NULL && (_http = connectToCupsServer()) == NULL)
+            {
+                return;
+            }
+
+            for(size_t i = 0; i < _members.size(); ++i)
+            {
+                std::string name;
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    name = _members[i].name;
+                }
+                ipp_t *request = ippNewRequest(IPP_OP_GET_PRINTER_ATTRIBUTES);
+                ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, getPrinterUri(name).c_str());
+                ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+                static const char * const attrs[] = { "printer-state", "printer-is-accepting-jobs", "queued-job-count" };
+                ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", 3, NULL, attrs);
+
+                ipp_t *response = cupsDoRequest(_http, request, "/");
+                bool found = (response != NULL && cupsLastError() <= IPP_STATUS_OK_CONFLICTING);
+
+                std::lock_guard<std::mutex> lock(_mutex);
+                PoolMember &member = _members[i];
+                if(!found)
+                {
+                    // unknown printer or server error: do not route to it until it answers
+                    member.available = false;
+                    ippDelete(response);
+                    continue;
+                }
+                ipp_attribute_t *attr = ippFindAttribute(response, "printer-state", IPP_TAG_ENUM);
+                member.state = (attr != NULL) ? static_cast<ipp_pstate_t>(ippGetInteger(attr, 0)) : IPP_PSTATE_IDLE;
+                attr = ippFindAttribute(response, "printer-is-accepting-jobs", IPP_TAG_BOOLEAN);
+                member.accepting = (attr == NULL) || ippGetBoolean(attr, 0);
+                attr = ippFindAttribute(response, "queued-job-count", IPP_TAG_INTEGER);
+                member.queued = (attr != NULL) ? ippGetInteger(attr, 0) : 0;
+                member.available = true;
+                ippDelete(response);
+            }
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            _refreshed = now;
+        }
+
+        /** Choose a member and count the job as in flight on it
+         * @param iExcluded members which already failed for this job
+         * @return member index, -1 if no member is usable
+         */
+        int acquire(size_t iBytes, const std::vector<bool> &iExcluded)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            int result = -1;
+            size_t count = _members.size();
+            for(size_t n = 0; n < count; ++n)
+            {
+                size_t i = (_next + n) % count;
+                const PoolMember &member = _members[i];
+                if(iExcluded[i] || !member.isUsable())
+                {
+                    continue;
+                }
+                if(_strategy == POOL_ROUND_ROBIN)
+                {
+                    result = static_cast<int>(i);
+                    break;
+                }
+                if(result == -1 || isLessLoaded(member, _members[result]))
+                {
+                    result = static_cast<int>(i);
+                }
+            }
+            if(result != -1)
+            {
+                // round robin start point also spreads the ties of least loaded
+                _next = (result + 1) % count;
+                PoolMember &member = _members[result];
+                ++member.in_flight;
+                member.in_flight_bytes += iBytes;
+            }
+            return result;
+        }
+
+        /** The job sent to member iIndex is accepted (iOk) or failed
+         * @param iMemberFailed the failure is the one of the member, which is not used until the next refresh
+         */
+        void release(int iIndex, size_t iBytes, bool iOk, bool iMemberFailed)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            PoolMember &member = _members[iIndex];
+            --member.in_flight;
+            member.in_flight_bytes -= iBytes;
+            if(iOk)
+            {
+                ++member.queued;
+                ++member.submitted;
+            }
+            else if(iMemberFailed)
+            {
+                member.available = false;
+            }
+        }
+
+        std::string getName(int iIndex)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _members[iIndex].name;
+        }
+
+        size_t size() const { return _members.size(); }
+
+        std::vector<PoolMember> getMembers()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _members;
+        }
+
+    private:
+        /** Idle printers first, then the shortest queue, then the fewest bytes being sent
+         */
+        static bool isLessLoaded(const PoolMember &iMember, const PoolMember &iOther)
+        {
+            bool idle = (iMember.state == IPP_PSTATE_IDLE && iMember.queued + iMember.in_flight == 0);
+            bool other_idle = (iOther.state == IPP_PSTATE_IDLE && iOther.queued + iOther.in_flight == 0);
+            if(idle != other_idle)
+            {
+                return idle;
+            }
+            int load = iMember.queued + iMember.in_flight;
+            int other_load = iOther.queued + iOther.in_flight;
+            if(load != other_load)
+            {
+                return load < other_load;
+            }
+            return iMember.in_flight_bytes < iOther.in_flight_bytes;
+        }
+
+        PoolStrategy _strategy;
+        std::chrono::steady_clock::duration _refresh_interval;
+        std::chrono::steady_clock::time_point _refreshed;
+        size_t _next;
+
+        std::mutex _mutex;
+        std::vector<PoolMember> _members;
+
+        /** owned by the refreshing thread */
+        std::mutex _refresh_mutex;
+        http_t *_http;
+    };
+
+    typedef std::shared_ptr<PoolState> PoolStatePtr;
+
+    class PoolPrintWorker: public Napi::AsyncWorker
+    {
+    public:
+        PoolPrintWorker(const Napi::Function& iCallback, const PoolStatePtr &iPool):
+            Napi::AsyncWorker(iCallback, "node-printer:PrinterPool"),
+            _pool(iPool),
+            _format(CUPS_FORMAT_RAW),
+            _docname("node print job"),
+            _job_id(0)
+        {
+            _data.iov_base = NULL;
+            _data.iov_len = 0;
+        }
+
+        /** @return false if data is not a String or Buffer
+         */
+        bool setData(Napi::Value iData)
+        {
+            if(!getDataFromV8Value(iData, _storage, _data))
+            {
+                return false;
+            }
+            if(iData.IsBuffer())
+            {
+                _data_ref = Napi::Persistent(iData.As<Napi::Object>());
+            }
+            return true;
+        }
+
+        std::string& format() { return _format; }
+        std::string& docname() { return _docname; }
+        CupsOptionsPtr& options() { return _options; }
+
+    protected:
+        void Execute()
+        {
+            _pool->refreshIfStale();
+
+            std::vector<bool> excluded(_pool->size(), false);
+            std::string error_str = "Print Error: no printer of the pool is available";
+            int index;
+            // a member which fails is skipped, and the job is sent to the next one
+            while((index = _pool->acquire(_data.iov_len, excluded)) != -1)
+            {
+                _printer_name = _pool->getName(index);
+                CupsJobUpload upload;
+                bool ok = upload.start(_printer_name, _docname, _format, *_options, error_str)
+                    && upload.write(static_cast<const char*>(_data.iov_base), _data.iov_len, error_str)
+                    && upload.finish(error_str);
+                bool member_failed = !ok && isMemberFailure(upload.status());
+                _pool->release(index, _data.iov_len, ok, member_failed);
+                if(ok)
+                {
+                    _job_id = upload.jobId();
+                    return;
+                }
+                if(!member_failed)
+                {
+                    // the job would fail on the other members too
+                    break;
+                }
+                excluded[index] = true;
+            }
+            SetError(error_str);
+        }
+
+        std::vector<napi_value> GetResult(Napi::Env env)
+        {
+            Napi::Object job = Napi::Object::New(env);
+            job.Set("id", Napi::Number::New(env, _job_id));
+            job.Set("printer", Napi::String::New(env, _printer_name));
+
+            std::vector<napi_value> result;
+            result.push_back(env.Null());
+            result.push_back(job);
+            return result;
+        }
+
+    private:
+        PoolStatePtr _pool;
+        std::string _storage;
+        struct iovec _data;
+        Napi::ObjectReference _data_ref;
+        std::string _format;
+        std::string _docname;
+        CupsOptionsPtr _options;
+        std::string _printer_name;
+        int _job_id;
+    };
+
+    /** Printers pool, see createPrinterPool.
+     * Each job goes to the usable member with the lowest load: idle printers first,
+     * then the shortest queue (server queue at the last refresh plus jobs sent since),
+     * then the fewest bytes being sent. Stopped printers, printers which do not accept
+     * jobs and printers which could not take a job (server unreachable, printer refusing
+     * jobs) are skipped until the next refresh; a job refused for itself is not retried.
+     */
+    class PrinterPool: public Napi::ObjectWrap<PrinterPool>
+    {
+    public:
+        static Napi::Function GetClass(Napi::Env env);
+
+        PrinterPool(const Napi::CallbackInfo& info);
+
+    private:
+        Napi::Value Print(const Napi::CallbackInfo& info);
+        Napi::Value Stats(const Napi::CallbackInfo& info);
+
+        PoolStatePtr _pool;
+    };
+
+    Napi::Function PrinterPool::GetClass(Napi::Env env)
+    {
+        Napi::FunctionReference &constructor = getAddonData(env).constructors["PrinterPool"];
+        if(constructor.IsEmpty())
+        {
+            constructor = Napi::Persistent(DefineClass(env, "PrinterPool", {
+                InstanceMethod("print", &PrinterPool::Print),
+                InstanceMethod("stats", &PrinterPool::Stats)
+            }));
+        }
+        return constructor.Value();
+    }
+
+    PrinterPool::PrinterPool(const Napi::CallbackInfo& info):
+        Napi::ObjectWrap<PrinterPool>(info)
+    {
+        Napi::Env env = info.Env();
+
+        if(info.Length() < 1 || !info[0].IsArray())
+        {
+            Napi::TypeError::New(env, "createPrinterPool:first argument must be an array of printer names").ThrowAsJavaScriptException();
+            return;
+        }
+        std::vector<std::string> names;
+        Napi::Array arg_names = info[0].As<Napi::Array>();
+        for(uint32_t i = 0; i < arg_names.Length(); ++i)
+        {
+            Napi::Value name = arg_names.Get(i);
+            if(!name.IsString())
+            {
+                Napi::TypeError::New(env, "createPrinterPool:printer names must be strings").ThrowAsJavaScriptException();
+                return;
+            }
+            names.push_back(name.As<Napi::String>().Utf8Value());
+        }
+        if(names.empty())
+        {
+            Napi::TypeError::New(env, "createPrinterPool:at least one printer is expected").ThrowAsJavaScriptException();
+            return;
+        }
+
+        PoolStrategy strategy = POOL_LEAST_LOADED;
+        int refresh_interval_ms = DEFAULT_REFRESH_INTERVAL_MS;
+        if(info.Length() > 1 && info[1].IsObject())
+        {
+            Napi::Object arg_options = info[1].As<Napi::Object>();
+            Napi::Value arg_strategy = arg_options.Get("strategy");
+            if(arg_strategy.IsString())
+            {
+                std::string strategy_name = arg_strategy.As<Napi::String>().Utf8Value();
+                if(strategy_name == "round-robin")
+                {
+                    strategy = POOL_ROUND_ROBIN;
+                }
+                else if(strategy_name != "least-loaded")
+                {
+                    Napi::TypeError::New(env, "createPrinterPool:strategy must be least-loaded or round-robin").ThrowAsJavaScriptException();
+                    return;
+                }
+            }
+            Napi::Value arg_refresh = arg_options.Get("refreshInterval");
+            if(arg_refresh.IsNumber())
+            {
+                refresh_interval_ms = arg_refresh.As<Napi::Number>().Int32Value();
+            }
+        }
+        _pool = std::make_shared<PoolState>(names, strategy, refresh_interval_ms);
+    }
+
+    Napi::Value PrinterPool::Print(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+
+        if(info.Length() < 2 || !info[0].IsObject() || !info[1].IsFunction())
+        {
+            Napi::TypeError::New(env, "PrinterPool:print expects a parameters object and a callback function").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        Napi::Object arg_params = info[0].As<Napi::Object>();
+
+        PoolPrintWorker *worker = new PoolPrintWorker(info[1].As<Napi::Function>(), _pool);
+        std::string error_str;
+        if(!worker->setData(arg_params.Get("data")))
+        {
+            error_str = "PrinterPool:data parameter must be a string or Buffer";
+        }
+
+        Napi::Value arg_value_type = arg_params.Get("type");
+        if(arg_value_type.IsString())
+        {
+            FormatMapType::const_iterator itFormat = getPrinterFormatMap().find(arg_value_type.As<Napi::String>().Utf8Value());
+            if(itFormat == getPrinterFormatMap().end())
+            {
+                error_str = "PrinterPool: unsupported format type";
+            }
+            else
+            {
+                worker->format() = itFormat->second;
+            }
+        }
+
+        Napi::Value arg_value_docname = arg_params.Get("docname");
+        if(arg_value_docname.IsString())
+        {
+            worker->docname() = arg_value_docname.As<Napi::String>().Utf8Value();
+        }
+
+        if(!getCupsOptionsFromV8Value(arg_params.Get("options"), worker->options()))
+        {
+            error_str = "PrinterPool:options parameter must be an object";
+        }
+
+        if(!error_str.empty())
+        {
+            delete worker;
+            Napi::TypeError::New(env, error_str).ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        // the job may be routed to any member: all of them must accept the options
+        std::vector<PoolMember> members = _pool->getMembers();
+        for(std::vector<PoolMember>::const_iterator itMember = members.begin(); itMember != members.end(); ++itMember)
+        {
+            if(!preflightV8Params(arg_params, "", itMember->name, *worker->options(), error_str))
+            {
+                delete worker;
+                Napi::Error::New(env, "PrinterPool: " + error_str).ThrowAsJavaScriptException();
+                return env.Undefined();
+            }
+        }
+        worker->Queue();
+        return env.Undefined();
+    }
+
+    Napi::Value PrinterPool::Stats(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        std::vector<PoolMember> members = _pool->getMembers();
+        Napi::Array result = Napi::Array::New(env);
+        for(uint32_t i = 0; i < members.size(); ++i)
+        {
+            const PoolMember &member = members[i];
+            Napi::Object result_member = Napi::Object::New(env);
+            result_member.Set("name", Napi::String::New(env, member.name));
+            const char *state = (member.state == IPP_PSTATE_PROCESSING) ? "PRINTING" : ((member.state == IPP_PSTATE_STOPPED) ? "STOPPED" : "IDLE");
+            result_member.Set("status", Napi::String::New(env, state));
+            result_member.Set("available", Napi::Boolean::New(env, member.isUsable()));
+            result_member.Set("queued", Napi::Number::New(env, member.queued));
+            result_member.Set("inFlight", Napi::Number::New(env, member.in_flight));
+            result_member.Set("inFlightBytes", Napi::Number::New(env, static_cast<double>(member.in_flight_bytes)));
+            result_member.Set("submitted", Napi::Number::New(env, member.submitted));
+            result.Set(i, result_member);
+        }
+        return result;
+    }
+}
+
+Napi::Value createPrinterPool(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 1)
+    {
+        Napi::TypeError::New(env, "createPrinterPool:invalid number of arguments (1 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    Napi::Object result = PrinterPool::GetClass(env).New({ info[0], (info.Length() > 1) ? info[1] : env.Undefined() });
+    if(env.IsExceptionPending())
+    {
+        return env.Undefined();
+    }
+    return result;
+}
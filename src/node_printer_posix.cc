@@ -1,11 +1,15 @@
-#include "node_printer.hpp"
+#include "node_printer_posix.hpp"
 
 #include <string>
 #include <map>
 #include <utility>
+#include <algorithm>
 #include <sstream>
+#include <thread>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 
 #include <cups/cups.h>
 #include <cups/ppd.h>
@@ -15,7 +19,6 @@
 namespace
 {
     typedef std::map<std::string, int> StatusMapType;
-    typedef std::map<std::string, std::string> FormatMapType;
 
     const StatusMapType& getJobStatusMap()
     {
@@ -40,106 +43,585 @@ namespace
         return result;
     }
 
-    const FormatMapType& getPrinterFormatMap()
+}
+
+std::string parseJobObject(const cups_job_t *job, Napi::Object& result_printer_job, Napi::Env& env)
+{
+    //Common fields
+    result_printer_job.Set("id", Napi::Number::New(env, job->id));
+    result_printer_job.Set("name", Napi::String::New(env, job->title));
+    result_printer_job.Set("printerName", Napi::String::New(env, job->dest));
+    result_printer_job.Set("user", Napi::String::New(env, job->user));
+    std::string job_format(job->format);
+
+    // Try to parse the data format, otherwise will write the unformatted one
+    for(FormatMapType::const_iterator itFormat = getPrinterFormatMap().begin(); itFormat != getPrinterFormatMap().end(); ++itFormat)
     {
-        static FormatMapType result;
-        if(!result.empty())
+        if(itFormat->second == job_format)
         {
-            return result;
+            job_format = itFormat->first;
+            break;
         }
-        result.insert(std::make_pair("RAW", CUPS_FORMAT_RAW));
-        result.insert(std::make_pair("TEXT", CUPS_FORMAT_TEXT));
+    }
+
+    result_printer_job.Set("format", Napi::String::New(env, job_format.c_str()));
+    result_printer_job.Set("priority", Napi::Number::New(env, job->priority));
+    result_printer_job.Set("size", Napi::Number::New(env, job->size));
+    
+    Napi::Array result_printer_job_status = Napi::Array::New(env);
+    int i_status = 0;
+    for(StatusMapType::const_iterator itStatus = getJobStatusMap().begin(); itStatus != getJobStatusMap().end(); ++itStatus)
+    {
+        if(job->state == itStatus->second)
+        {
+            result_printer_job_status.Set(i_status++, Napi::String::New(env, itStatus->first));
+        }
+    }
+    if(i_status == 0)
+    {
+        // state_reasons is not available in all CUPS versions, use state value instead
+        result_printer_job_status.Set(i_status++, Napi::String::New(env, std::to_string(job->state)));
+    }
+    result_printer_job.Set("status", result_printer_job_status);
+
+    //Specific fields
+    result_printer_job.Set("completedTime", Napi::Date::New(env, job->completed_time * 1000));
+    result_printer_job.Set("creationTime", Napi::Date::New(env, job->creation_time * 1000));
+    result_printer_job.Set("processingTime", Napi::Date::New(env, job->processing_time * 1000));
+
+    // No error
+    return "";
+}
+
+std::string parsePrinterinfo(const cups_dest_t * printer, Napi::Object& result_printer, Napi::Env& env)
+{
+    result_printer.Set("name", Napi::String::New(env, printer->name));
+    if(printer->instance)
+    {
+        result_printer.Set("instance", Napi::String::New(env, printer->instance));
+    }
+    
+    result_printer.Set("isDefault", Napi::Boolean::New(env, static_cast<bool>(printer->is_default)));
+    
+    Napi::Object result_printer_options = Napi::Object::New(env);
+    cups_option_t *dest_option = printer->options;
+    for(int j = 0; j < printer->num_options; ++j, ++dest_option)
+    {
+        result_printer_options.Set(dest_option->name, Napi::String::New(env, dest_option->value));
+    }
+    result_printer.Set("options", result_printer_options);
+
+    return "";
+}
+
+const FormatMapType& getPrinterFormatMap()
+{
+    static FormatMapType result;
+    if(!result.empty())
+    {
+        return result;
+    }
+    result.insert(std::make_pair("RAW", CUPS_FORMAT_RAW));
+    result.insert(std::make_pair("TEXT", CUPS_FORMAT_TEXT));
 #ifdef CUPS_FORMAT_PDF
-        result.insert(std::make_pair("PDF", CUPS_FORMAT_PDF));
+    result.insert(std::make_pair("PDF", CUPS_FORMAT_PDF));
 #endif
 #ifdef CUPS_FORMAT_JPEG
-        result.insert(std::make_pair("JPEG", CUPS_FORMAT_JPEG));
+    result.insert(std::make_pair("JPEG", CUPS_FORMAT_JPEG));
 #endif
 #ifdef CUPS_FORMAT_POSTSCRIPT
-        result.insert(std::make_pair("POSTSCRIPT", CUPS_FORMAT_POSTSCRIPT));
+    result.insert(std::make_pair("POSTSCRIPT", CUPS_FORMAT_POSTSCRIPT));
 #endif
 #ifdef CUPS_FORMAT_COMMAND
-        result.insert(std::make_pair("COMMAND", CUPS_FORMAT_COMMAND));
+    result.insert(std::make_pair("COMMAND", CUPS_FORMAT_COMMAND));
 #endif
 #ifdef CUPS_FORMAT_AUTO
-        result.insert(std::make_pair("AUTO", CUPS_FORMAT_AUTO));
+    result.insert(std::make_pair("AUTO", CUPS_FORMAT_AUTO));
 #endif
-        return result;
+    return result;
+}
+
+http_t* connectToCupsServer()
+{
+    return httpConnect2(cupsServer(), ippPort(), NULL, AF_UNSPEC, cupsEncryption(), 1/*blocking*/, 30000, NULL);
+}
+
+std::string getPrinterUri(const std::string &iPrinterName)
+{
+    char uri[HTTP_MAX_URI];
+    if(iPrinterName.empty())
+    {
+        httpAssembleURIf(HTTP_URI_CODING_ALL, uri, sizeof(uri), "ipp", NULL, "localhost", 0, "/");
+    }
+    else
+    {
+        httpAssembleURIf(HTTP_URI_CODING_ALL, uri, sizeof(uri), "ipp", NULL, "localhost", 0, "/printers/%s", iPrinterName.c_str());
+    }
+    return uri;
+}
+
+namespace
+{
+    /** Job attributes of a listing, as requested by cupsGetJobs */
+    const char * const IPP_JOB_ATTRIBUTES[] =
+    {
+        "document-format",
+        "job-id",
+        "job-k-octets",
+        "job-name",
+        "job-originating-user-name",
+        "job-printer-uri",
+        "job-priority",
+        "job-state",
+        "time-at-completed",
+        "time-at-creation",
+        "time-at-processing"
+    };
+
+    /** Connection of the calling thread for the codec requests on CUPS_HTTP_DEFAULT,
+     * like the per-thread connection of libcups
+     */
+    struct ThreadCupsConnection
+    {
+        ThreadCupsConnection(): http(NULL) {}
+        ~ThreadCupsConnection()
+        {
+            if(http != NULL)
+            {
+                httpClose(http);
+            }
+        }
+
+        http_t *http;
+        /** server:port it is connected to */
+        std::string server;
+    };
+
+    http_t* getThreadCupsConnection()
+    {
+        static thread_local ThreadCupsConnection connection;
+        // cupsSetServer or ippSetPort since the last request: libcups connects again too
+        std::string server = std::string(cupsServer()) + ":" + std::to_string(ippPort());
+        if(connection.http != NULL && connection.server != server)
+        {
+            httpClose(connection.http);
+            connection.http = NULL;
+        }
+        if(connection.http == NULL)
+        {
+            connection.http = connectToCupsServer();
+            connection.server = server;
+        }
+        return connection.http;
     }
 
-    /** Parse job info object.
-     * @return error string. if empty, then no error
+    /** POST the encoded request and read the whole response body into ioBuffers.response
+     * @return HTTP status, HTTP_STATUS_ERROR if the request could not be sent
      */
-    std::string parseJobObject(const cups_job_t *job, Napi::Object& result_printer_job, Napi::Env& env)
+    http_status_t postIppRequest(http_t *iHttp, const char *iResource, IppCodecBuffers &ioBuffers, size_t &oResponseSize)
     {
-        //Common fields
-        result_printer_job.Set("id", Napi::Number::New(env, job->id));
-        result_printer_job.Set("name", Napi::String::New(env, job->title));
-        result_printer_job.Set("printerName", Napi::String::New(env, job->dest));
-        result_printer_job.Set("user", Napi::String::New(env, job->user));
-        std::string job_format(job->format);
+        const std::string &request = ioBuffers.request.data();
+        httpClearFields(iHttp);
+        httpSetField(iHttp, HTTP_FIELD_CONTENT_TYPE, "application/ipp");
+        // credentials of a previous cupsDoAuthentication on this connection
+        const char *auth_string = httpGetAuthString(iHttp);
+        if(auth_string != NULL)
+        {
+            httpSetField(iHttp, HTTP_FIELD_AUTHORIZATION, auth_string);
+        }
+        httpSetLength(iHttp, request.size());
+        if(httpPost(iHttp, iResource) != 0
+           || httpWrite2(iHttp, request.data(), request.size()) != static_cast<ssize_t>(request.size()))
+        {
+            return HTTP_STATUS_ERROR;
+        }
 
-        // Try to parse the data format, otherwise will write the unformatted one
-        for(FormatMapType::const_iterator itFormat = getPrinterFormatMap().begin(); itFormat != getPrinterFormatMap().end(); ++itFormat)
+        http_status_t status;
+        while((status = httpUpdate(iHttp)) == HTTP_STATUS_CONTINUE)
         {
-            if(itFormat->second == job_format)
+        }
+        if(status != HTTP_STATUS_OK)
+        {
+            httpFlush(iHttp);
+            return status;
+        }
+
+        // the buffer keeps its size between responses: no allocation once it fits the biggest one
+        std::vector<char> &response = ioBuffers.response;
+        oResponseSize = 0;
+        for(;;)
+        {
+            if(response.size() - oResponseSize < 4096)
+            {
+                response.resize(std::max<size_t>(response.size() * 2, 64 * 1024));
+            }
+            ssize_t bytes = httpRead2(iHttp, &response[oResponseSize], response.size() - oResponseSize);
+            if(bytes < 0)
+            {
+                return HTTP_STATUS_ERROR;
+            }
+            if(bytes == 0)
             {
-                job_format = itFormat->first;
                 break;
             }
+            oResponseSize += static_cast<size_t>(bytes);
+        }
+        return status;
+    }
+
+    /** postIppRequest, sent again once on a new connection if the kept alive one was closed by the server
+     */
+    http_status_t postIppRequestOrReconnect(http_t *iHttp, const char *iResource, IppCodecBuffers &ioBuffers, size_t &oResponseSize)
+    {
+        http_status_t status = postIppRequest(iHttp, iResource, ioBuffers, oResponseSize);
+        if(status == HTTP_STATUS_ERROR && httpReconnect2(iHttp, 30000, NULL) == 0)
+        {
+            status = postIppRequest(iHttp, iResource, ioBuffers, oResponseSize);
         }
+        return status;
+    }
+}
+
+void addIppJobRequestedAttributes(ipp_t *ioRequest)
+{
+    ippAddStrings(ioRequest, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", sizeof(IPP_JOB_ATTRIBUTES) / sizeof(IPP_JOB_ATTRIBUTES[0]), NULL, IPP_JOB_ATTRIBUTES);
+}
+
+bool ippCodecExchange(http_t *iHttp, const char *iResource, IppCodecBuffers &ioBuffers, std::string &oError)
+{
+    http_t *http = (iHttp != CUPS_HTTP_DEFAULT) ? iHttp : getThreadCupsConnection();
+    if(http == NULL)
+    {
+        oError = "unable to connect to CUPS server";
+        return false;
+    }
 
-        result_printer_job.Set("format", Napi::String::New(env, job_format.c_str()));
-        result_printer_job.Set("priority", Napi::Number::New(env, job->priority));
-        result_printer_job.Set("size", Napi::Number::New(env, job->size));
-        
-        Napi::Array result_printer_job_status = Napi::Array::New(env);
-        int i_status = 0;
-        for(StatusMapType::const_iterator itStatus = getJobStatusMap().begin(); itStatus != getJobStatusMap().end(); ++itStatus)
+    size_t response_size = 0;
+    http_status_t status = postIppRequestOrReconnect(http, iResource, ioBuffers, response_size);
+    // as cupsDoRequest: authenticate, or upgrade the connection to TLS, and send the request again
+    for(int attempt = 0; attempt < 3 && (status == HTTP_STATUS_UNAUTHORIZED || status == HTTP_STATUS_UPGRADE_REQUIRED); ++attempt)
+    {
+        if(status == HTTP_STATUS_UNAUTHORIZED)
         {
-            if(job->state == itStatus->second)
+            if(cupsDoAuthentication(http, "POST", iResource) != 0)
             {
-                result_printer_job_status.Set(i_status++, Napi::String::New(env, itStatus->first));
+                break;
             }
         }
-        if(i_status == 0)
+        else if(httpReconnect2(http, 30000, NULL) != 0 || httpEncryption(http, HTTP_ENCRYPTION_REQUIRED) != 0)
         {
-            // state_reasons is not available in all CUPS versions, use state value instead
-            result_printer_job_status.Set(i_status++, Napi::String::New(env, std::to_string(job->state)));
+            break;
         }
-        result_printer_job.Set("status", result_printer_job_status);
+        status = postIppRequestOrReconnect(http, iResource, ioBuffers, response_size);
+    }
+    if(status != HTTP_STATUS_OK)
+    {
+        oError = (status == HTTP_STATUS_ERROR) ? "unable to send the request" : httpStatus(status);
+        return false;
+    }
+
+    if(!decodeIppMessage(&ioBuffers.response[0], response_size, ioBuffers.arena, ioBuffers.message, oError))
+    {
+        return false;
+    }
+    if(ioBuffers.message.code > IPP_STATUS_OK_CONFLICTING)
+    {
+        const IppAttribute *message = ioBuffers.message.find("status-message", IPP_CODEC_TAG_OPERATION);
+        oError = (message != NULL && message->count > 0) ? message->values[0].str() : ippErrorString(static_cast<ipp_status_t>(ioBuffers.message.code));
+        return false;
+    }
+    return true;
+}
 
-        //Specific fields
-        result_printer_job.Set("completedTime", Napi::Date::New(env, job->completed_time * 1000));
-        result_printer_job.Set("creationTime", Napi::Date::New(env, job->creation_time * 1000));
-        result_printer_job.Set("processingTime", Napi::Date::New(env, job->processing_time * 1000));
+IppCodecBuffers& getThreadIppCodecBuffers()
+{
+    static thread_local IppCodecBuffers buffers;
+    return buffers;
+}
+
+bool fetchIppJobViews(http_t *iHttp, const char *iResource, const std::string &iPrinterUri, const char *iWhichJobs, IppCodecBuffers &ioBuffers, std::vector<IppJobView> &oJobs, std::string &oError)
+{
+    IppEncoder &request = ioBuffers.request;
+    request.begin(IPP_OP_GET_JOBS, ++ioBuffers.request_id);
+    request.addString(IPP_CODEC_TAG_URI, "printer-uri", iPrinterUri);
+    request.addString(IPP_CODEC_TAG_NAME, "requesting-user-name", cupsUser());
+    request.addString(IPP_CODEC_TAG_KEYWORD, "which-jobs", iWhichJobs);
+    request.addStrings(IPP_CODEC_TAG_KEYWORD, "requested-attributes", IPP_JOB_ATTRIBUTES, sizeof(IPP_JOB_ATTRIBUTES) / sizeof(IPP_JOB_ATTRIBUTES[0]));
+    request.end();
+
+    if(!ippCodecExchange(iHttp, iResource, ioBuffers, oError))
+    {
+        return false;
+    }
+    getIppJobViews(ioBuffers.message, oJobs);
+    return true;
+}
+
+void parseIppJobs(ipp_t *iResponse, std::vector<IppJob> &oJobs)
+{
+    // jobs are groups of IPP_TAG_JOB attributes, separated by other groups
+    ipp_attribute_t *attr = ippFirstAttribute(iResponse);
+    while(attr != NULL)
+    {
+        while(attr != NULL && ippGetGroupTag(attr) != IPP_TAG_JOB)
+        {
+            attr = ippNextAttribute(iResponse);
+        }
+        if(attr == NULL)
+        {
+            break;
+        }
 
-        // No error
-        return "";
+        IppJob job;
+        for(; attr != NULL && ippGetGroupTag(attr) == IPP_TAG_JOB; attr = ippNextAttribute(iResponse))
+        {
+            const char *name = ippGetName(attr);
+            if(name == NULL)
+            {
+                continue;
+            }
+            ipp_tag_t value_tag = ippGetValueTag(attr);
+            std::string attr_name(name);
+            if(value_tag == IPP_TAG_INTEGER || value_tag == IPP_TAG_ENUM)
+            {
+                int value = ippGetInteger(attr, 0);
+                if(attr_name == "job-id")
+                {
+                    job.id = value;
+                }
+                else if(attr_name == "job-state")
+                {
+                    job.state = static_cast<ipp_jstate_t>(value);
+                }
+                else if(attr_name == "job-priority")
+                {
+                    job.priority = value;
+                }
+                else if(attr_name == "job-k-octets")
+                {
+                    job.size = value;
+                }
+                else if(attr_name == "time-at-completed")
+                {
+                    job.completed_time = value;
+                }
+                else if(attr_name == "time-at-creation")
+                {
+                    job.creation_time = value;
+                }
+                else if(attr_name == "time-at-processing")
+                {
+                    job.processing_time = value;
+                }
+                continue;
+            }
+            const char *value = ippGetString(attr, 0, NULL);
+            if(value == NULL)
+            {
+                continue;
+            }
+            if(attr_name == "job-printer-uri")
+            {
+                const char *dest = strrchr(value, '/');
+                job.dest = (dest != NULL) ? dest + 1 : value;
+            }
+            else if(attr_name == "job-name")
+            {
+                job.title = value;
+            }
+            else if(attr_name == "job-originating-user-name")
+            {
+                job.user = value;
+            }
+            else if(attr_name == "document-format")
+            {
+                job.format = value;
+            }
+        }
+        if(job.id > 0)
+        {
+            oJobs.push_back(job);
+        }
     }
+}
+
+Napi::Object ippJobToV8(const IppJob &iJob, Napi::Env env)
+{
+    cups_job_t job;
+    job.id = iJob.id;
+    job.dest = const_cast<char*>(iJob.dest.c_str());
+    job.title = const_cast<char*>(iJob.title.c_str());
+    job.user = const_cast<char*>(iJob.user.c_str());
+    job.format = const_cast<char*>(iJob.format.c_str());
+    job.state = iJob.state;
+    job.size = iJob.size;
+    job.priority = iJob.priority;
+    job.completed_time = iJob.completed_time;
+    job.creation_time = iJob.creation_time;
+    job.processing_time = iJob.processing_time;
+
+    Napi::Object result = Napi::Object::New(env);
+    parseJobObject(&job, result, env);
+    return result;
+}
 
-    std::string parsePrinterinfo(const cups_dest_t * printer, Napi::Object& result_printer, Napi::Env& env)
+Napi::Object ippJobViewToV8(const IppJobView &iJob, Napi::Env env)
+{
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("id", Napi::Number::New(env, iJob.id));
+    result.Set("name", Napi::String::New(env, iJob.title.data, iJob.title.length));
+    result.Set("printerName", Napi::String::New(env, iJob.dest.data, iJob.dest.length));
+    result.Set("user", Napi::String::New(env, iJob.user.data, iJob.user.length));
+
+    // same format and status names as parseJobObject, without building C strings
+    Napi::String format;
+    for(FormatMapType::const_iterator itFormat = getPrinterFormatMap().begin(); itFormat != getPrinterFormatMap().end(); ++itFormat)
     {
-        result_printer.Set("name", Napi::String::New(env, printer->name));
-        if(printer->instance)
+        if(iJob.format.equals(itFormat->second.c_str()))
         {
-            result_printer.Set("instance", Napi::String::New(env, printer->instance));
+            format = Napi::String::New(env, itFormat->first);
+            break;
         }
-        
-        result_printer.Set("isDefault", Napi::Boolean::New(env, static_cast<bool>(printer->is_default)));
-        
-        Napi::Object result_printer_options = Napi::Object::New(env);
-        cups_option_t *dest_option = printer->options;
-        for(int j = 0; j < printer->num_options; ++j, ++dest_option)
+    }
+    result.Set("format", format.IsEmpty() ? Napi::String::New(env, iJob.format.data, iJob.format.length) : format);
+    result.Set("priority", Napi::Number::New(env, iJob.priority));
+    result.Set("size", Napi::Number::New(env, iJob.size));
+
+    Napi::Array result_status = Napi::Array::New(env);
+    uint32_t i_status = 0;
+    for(StatusMapType::const_iterator itStatus = getJobStatusMap().begin(); itStatus != getJobStatusMap().end(); ++itStatus)
+    {
+        if(iJob.state == itStatus->second)
         {
-            result_printer_options.Set(dest_option->name, Napi::String::New(env, dest_option->value));
+            result_status.Set(i_status++, Napi::String::New(env, itStatus->first));
         }
-        result_printer.Set("options", result_printer_options);
+    }
+    if(i_status == 0)
+    {
+        result_status.Set(i_status++, Napi::String::New(env, std::to_string(iJob.state)));
+    }
+    result.Set("status", result_status);
+
+    result.Set("completedTime", Napi::Date::New(env, iJob.completed_time * 1000.0));
+    result.Set("creationTime", Napi::Date::New(env, iJob.creation_time * 1000.0));
+    result.Set("processingTime", Napi::Date::New(env, iJob.processing_time * 1000.0));
+    return result;
+}
+
+bool CupsJobUpload::start(const std::string &iPrinterName, const std::string &iDocname, const std::string &iFormat, const CupsOptions &iOptions, std::string &oError)
+{
+    _printer_name = iPrinterName;
+    _http = connectToCupsServer();
+    if(_http == NULL)
+    {
+        oError = "Print Error: unable to connect to CUPS server";
+        _status = IPP_STATUS_ERROR_SERVICE_UNAVAILABLE;
+        return false;
+    }
+
+    _job_id = cupsCreateJob(_http, _printer_name.c_str(), iDocname.c_str(), iOptions.size(), iOptions.get());
+    if(_job_id == 0)
+    {
+        setError(oError);
+        closeConnection();
+        return false;
+    }
+    _started = true;
+
+    if(cupsStartDocument(_http, _printer_name.c_str(), _job_id, iDocname.c_str(), iFormat.c_str(), 1/*last document*/) != HTTP_STATUS_CONTINUE)
+    {
+        setError(oError);
+        cancel();
+        return false;
+    }
+    return true;
+}
+
+bool CupsJobUpload::write(const char *iData, size_t iSize, std::string &oError)
+{
+    if(cupsWriteRequestData(_http, iData, iSize) != HTTP_STATUS_CONTINUE)
+    {
+        setError(oError);
+        cancel();
+        return false;
+    }
+    return true;
+}
+
+bool CupsJobUpload::finish(std::string &oError)
+{
+    ipp_status_t status = cupsFinishDocument(_http, _printer_name.c_str());
+    _started = false;
+    if(status > IPP_STATUS_OK_CONFLICTING)
+    {
+        setError(oError);
+        closeConnection();
+        return false;
+    }
+    closeConnection();
+    return true;
+}
+
+void CupsJobUpload::cancel()
+{
+    // dropping the connection interrupts the document upload
+    closeConnection();
+    if(_started)
+    {
+        cupsCancelJob2(CUPS_HTTP_DEFAULT, _printer_name.c_str(), _job_id, 0);
+        _started = false;
+    }
+}
+
+void CupsJobUpload::cancelInBackground()
+{
+    closeConnection();
+    if(_started)
+    {
+        std::string printer_name = _printer_name;
+        int job_id = _job_id;
+        std::thread([printer_name, job_id]() {
+            cupsCancelJob2(CUPS_HTTP_DEFAULT, printer_name.c_str(), job_id, 0);
+        }).detach();
+        _started = false;
+    }
+}
+
+void CupsJobUpload::setError(std::string &oError)
+{
+    // last error is stored per thread, so it is read from the thread of the failed call
+    _status = cupsLastError();
+    oError = "Print Error: ";
+    oError += cupsLastErrorString();
+}
 
-        return "";
+void CupsJobUpload::closeConnection()
+{
+    if(_http != NULL)
+    {
+        httpClose(_http);
+        _http = NULL;
     }
 }
 
+bool getDataFromV8Value(Napi::Value iV8Value, std::string &oStorage, struct iovec &oData)
+{
+    if(iV8Value.IsBuffer())
+    {
+        Napi::Buffer<char> buffer = iV8Value.As<Napi::Buffer<char> >();
+        oData.iov_base = buffer.Data();
+        oData.iov_len = buffer.Length();
+        return true;
+    }
+    if(getStringOrBufferFromV8Value(iV8Value, oStorage))
+    {
+        oData.iov_base = const_cast<char*>(oStorage.data());
+        oData.iov_len = oStorage.size();
+        return true;
+    }
+    return false;
+}
+
 Napi::Value getPrinters(const Napi::CallbackInfo& info)
 {
     Napi::Env env = info.Env();
@@ -150,6 +632,8 @@ Napi::Value getPrinters(const Napi::CallbackInfo& info)
     int i = 0;
     cups_dest_t *printer = printers;
     std::string error_str;
+    // decoded jobs of one printer, views valid until the next listing
+    std::vector<IppJobView> jobs;
     for(; i < printers_size; ++i, ++printer)
     {
         Napi::Object result_printer = Napi::Object::New(env);
@@ -162,25 +646,16 @@ Napi::Value getPrinters(const Napi::CallbackInfo& info)
         // if option is wrong, then the jobs are empty
         if(result_printer.Has("printer-state"))
         {
-            // Get printer jobs
-            cups_job_t *jobs = NULL;
-            int jobs_size = cupsGetJobs(&jobs, printer->name, 0/*0 means all users*/, CUPS_WHICHJOBS_ALL);
-            Napi::Array result_priner_jobs = Napi::Array::New(env);
-            int j = 0;
-            cups_job_t *job = jobs;
-            for(; j < jobs_size; ++j, ++job)
+            // Get printer jobs. Like cupsGetJobs, a failed listing gives no jobs
+            jobs.clear();
+            std::string jobs_error;
+            fetchIppJobViews(CUPS_HTTP_DEFAULT, "/", getPrinterUri(printer->name), "all", getThreadIppCodecBuffers(), jobs, jobs_error);
+            Napi::Array result_priner_jobs = Napi::Array::New(env, jobs.size());
+            for(uint32_t j = 0; j < jobs.size(); ++j)
             {
-                Napi::Object result_printer_job = Napi::Object::New(env);
-                error_str = parseJobObject(job, result_printer_job, env);
-                if(!error_str.empty())
-                {
-                    cupsFreeJobs(jobs_size, jobs);
-                    goto error;
-                }
-                result_priner_jobs.Set(j, result_printer_job);
+                result_priner_jobs.Set(j, ippJobViewToV8(jobs[j], env));
             }
             result_printer.Set("jobs", result_priner_jobs);
-            cupsFreeJobs(jobs_size, jobs);
         }
         result.Set(i, result_printer);
     }
@@ -232,27 +707,16 @@ Napi::Value getPrinter(const Napi::CallbackInfo& info)
             return env.Undefined();
         }
 
-        // Get printer jobs
-        cups_job_t *jobs = NULL;
-        int jobs_size = cupsGetJobs(&jobs, printer->name, 0/*0 means all users*/, CUPS_WHICHJOBS_ALL);
-        Napi::Array result_priner_jobs = Napi::Array::New(env);
-        int j = 0;
-        cups_job_t *job = jobs;
-        for(; j < jobs_size; ++j, ++job)
+        // Get printer jobs. Like cupsGetJobs, a failed listing gives no jobs
+        std::vector<IppJobView> jobs;
+        std::string jobs_error;
+        fetchIppJobViews(CUPS_HTTP_DEFAULT, "/", getPrinterUri(printer->name), "all", getThreadIppCodecBuffers(), jobs, jobs_error);
+        Napi::Array result_priner_jobs = Napi::Array::New(env, jobs.size());
+        for(uint32_t j = 0; j < jobs.size(); ++j)
         {
-            Napi::Object result_printer_job = Napi::Object::New(env);
-            std::string error_str = parseJobObject(job, result_printer_job, env);
-            if(!error_str.empty())
-            {
-                cupsFreeJobs(jobs_size, jobs);
-                cupsFreeDests(printers_size, printers);
-                Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
-                return env.Undefined();
-            }
-            result_priner_jobs.Set(j, result_printer_job);
+            result_priner_jobs.Set(j, ippJobViewToV8(jobs[j], env));
         }
         result_printer.Set("jobs", result_priner_jobs);
-        cupsFreeJobs(jobs_size, jobs);
     }
     // else printer is not found
     cupsFreeDests(printers_size, printers);
@@ -309,35 +773,15 @@ Napi::Value getJob(const Napi::CallbackInfo& info)
     std::string printer_name = info[0].As<Napi::String>().Utf8Value();
     int job_id = info[1].As<Napi::Number>().Int32Value();
     
-    cups_job_t *jobs = NULL;
-    int jobs_size = cupsGetJobs(&jobs, printer_name.c_str(), 0/*0 means all users*/, CUPS_WHICHJOBS_ALL);
-    Napi::Object result_job;
-    int j = 0;
-    cups_job_t *job = jobs;
-    
+    std::vector<IppJobView> jobs;
     std::string error_str;
-    for(; j < jobs_size; ++j, ++job)
+    fetchIppJobViews(CUPS_HTTP_DEFAULT, "/", getPrinterUri(printer_name), "all", getThreadIppCodecBuffers(), jobs, error_str);
+    for(std::vector<IppJobView>::const_iterator itJob = jobs.begin(); itJob != jobs.end(); ++itJob)
     {
-        if(job->id != job_id)
+        if(itJob->id == job_id)
         {
-            continue;
+            return ippJobViewToV8(*itJob, env);
         }
-        result_job = Napi::Object::New(env);
-        error_str = parseJobObject(job, result_job, env);
-        if(!error_str.empty())
-        {
-            cupsFreeJobs(jobs_size, jobs);
-            Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
-            return env.Undefined();
-        }
-        // Stop search
-        break;
-    }
-    cupsFreeJobs(jobs_size, jobs);
-    
-    if(!result_job.IsUndefined())
-    {
-        return result_job;
     }
     
     // return nothing
@@ -415,18 +859,37 @@ Napi::Value PrintDirect(const Napi::CallbackInfo& info)
         return env.Undefined();
     }
     
-    // data
-    Napi::Value arg_value_data = arg_params.Get("data");
+    // data, Buffer content is spooled without intermediate copy and strings are transcoded straight into the spooled data
     std::string data;
-    if(!getStringOrBufferFromV8Value(arg_value_data, data))
+    struct iovec data_iov;
+    bool encoded = false;
+    std::string encoding_error;
+    if(!getEncodedDataFromV8Params(arg_params, data, encoded, encoding_error))
+    {
+        Napi::TypeError::New(env, "printDirect:" + encoding_error).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    if(encoded)
+    {
+        data_iov.iov_base = const_cast<char*>(data.data());
+        data_iov.iov_len = data.size();
+    }
+    else if(!getDataFromV8Value(arg_params.Get("data"), data, data_iov))
     {
         Napi::TypeError::New(env, "printDirect:data parameter must be a string or Buffer").ThrowAsJavaScriptException();
         return env.Undefined();
     }
     
+    // server, the configured one if not set
+    std::string server;
+    if(!getCupsServerFromV8Value(arg_params.Get("server"), server))
+    {
+        Napi::TypeError::New(env, "printDirect:server parameter must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
     std::string printer_name;
-    // printer name
-    if(arg_params.Has("printer"))
+    // printer name, undefined as missing
+    if(!arg_params.Get("printer").IsUndefined())
     {
         Napi::Value arg_value_printer = arg_params.Get("printer");
         if(!arg_value_printer.IsString())
@@ -439,8 +902,9 @@ Napi::Value PrintDirect(const Napi::CallbackInfo& info)
     }
     else
     {
-        // if printer is not specified, then use default printer.
-        const char * default_printer_name = cupsGetDefault();
+        // if printer is not specified, then use default printer of the server.
+        PooledCupsConnection connection(server);
+        const char * default_printer_name = (connection.isDefault() || connection.get() != NULL) ? cupsGetDefault2(connection.get()) : NULL;
         if(default_printer_name != NULL)
         {
             printer_name = default_printer_name;
@@ -474,69 +938,33 @@ Napi::Value PrintDirect(const Napi::CallbackInfo& info)
     }
     
     // options
-    cups_option_t *options = NULL;
-    int num_options = 0;
-    if(arg_params.Has("options"))
+    CupsOptionsPtr options;
+    if(!getCupsOptionsFromV8Value(arg_params.Get("options"), options))
     {
-        Napi::Value arg_value_options = arg_params.Get("options");
-        if(!arg_value_options.IsObject())
-        {
-            Napi::TypeError::New(env, "printDirect:options parameter must be an object").ThrowAsJavaScriptException();
-            return env.Undefined();
-        }
-        Napi::Object arg_options = arg_value_options.As<Napi::Object>();
-        Napi::Array options_names = arg_options.GetPropertyNames();
-        
-        for(uint32_t i = 0; i < options_names.Length(); ++i)
-        {
-            Napi::Value name_value = options_names.Get(i);
-            if(!name_value.IsString())
-            {
-                continue;
-            }
-            std::string name = name_value.As<Napi::String>().Utf8Value();
-            Napi::Value option_value = arg_options.Get(name);
-            num_options = cupsAddOption(name.c_str(), option_value.ToString().Utf8Value().c_str(), num_options, &options);
-        }
+        Napi::TypeError::New(env, "printDirect:options parameter must be an object").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
     
     FormatMapType::const_iterator itFormat = getPrinterFormatMap().find(type_str);
     if(itFormat == getPrinterFormatMap().end())
     {
         Napi::TypeError::New(env, "printDirect: unsupported format type").ThrowAsJavaScriptException();
-        cupsFreeOptions(num_options, options);
-        return env.Undefined();
-    }
-    
-    // cupsPrintJob is deprecated, use cupsPrintFile or cupsPrintFiles
-    // For direct printing, we need to write data to a temporary file first
-    char temp_filename[] = "/tmp/node_printer_XXXXXX";
-    int fd = mkstemp(temp_filename);
-    if(fd == -1)
-    {
-        cupsFreeOptions(num_options, options);
-        Napi::Error::New(env, "printDirect: failed to create temporary file").ThrowAsJavaScriptException();
         return env.Undefined();
     }
     
-    if(write(fd, data.c_str(), data.size()) != (ssize_t)data.size())
+    std::string error_str;
+    // unsupported options are rejected before the data is spooled
+    if(!preflightV8Params(arg_params, server, printer_name, *options, error_str))
     {
-        close(fd);
-        unlink(temp_filename);
-        cupsFreeOptions(num_options, options);
-        Napi::Error::New(env, "printDirect: failed to write data to temporary file").ThrowAsJavaScriptException();
+        Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
         return env.Undefined();
     }
-    close(fd);
-    
-    int job_id = cupsPrintFile(printer_name.c_str(), temp_filename, docname.c_str(), num_options, options);
-    unlink(temp_filename);
-    cupsFreeOptions(num_options, options);
+    ipp_status_t status;
+    int job_id = getCurrentPrintBackend()->printData(server, printer_name, docname, itFormat->second, *options,
+        static_cast<const char*>(data_iov.iov_base), data_iov.iov_len, status, error_str);
     
     if(job_id == 0)
     {
-        std::string error_str = "Print Error: ";
-        error_str += cupsLastErrorString();
         Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
         return env.Undefined();
     }
@@ -581,9 +1009,16 @@ Napi::Value PrintFile(const Napi::CallbackInfo& info)
     }
     std::string filename = arg_value_filename.As<Napi::String>().Utf8Value();
     
+    // server, the configured one if not set
+    std::string server;
+    if(!getCupsServerFromV8Value(arg_params.Get("server"), server))
+    {
+        Napi::TypeError::New(env, "printFile:server parameter must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
     std::string printer_name;
-    // printer name
-    if(arg_params.Has("printer"))
+    // printer name, undefined as missing
+    if(!arg_params.Get("printer").IsUndefined())
     {
         Napi::Value arg_value_printer = arg_params.Get("printer");
         if(!arg_value_printer.IsString())
@@ -595,8 +1030,9 @@ Napi::Value PrintFile(const Napi::CallbackInfo& info)
     }
     else
     {
-        // if printer is not specified, then use default printer.
-        const char * default_printer_name = cupsGetDefault();
+        // if printer is not specified, then use default printer of the server.
+        PooledCupsConnection connection(server);
+        const char * default_printer_name = (connection.isDefault() || connection.get() != NULL) ? cupsGetDefault2(connection.get()) : NULL;
         if(default_printer_name != NULL)
         {
             printer_name = default_printer_name;
@@ -617,39 +1053,25 @@ Napi::Value PrintFile(const Napi::CallbackInfo& info)
     }
     
     // options
-    cups_option_t *options = NULL;
-    int num_options = 0;
-    if(arg_params.Has("options"))
+    CupsOptionsPtr options;
+    if(!getCupsOptionsFromV8Value(arg_params.Get("options"), options))
     {
-        Napi::Value arg_value_options = arg_params.Get("options");
-        if(!arg_value_options.IsObject())
-        {
-            Napi::TypeError::New(env, "printFile:options parameter must be an object").ThrowAsJavaScriptException();
-            return env.Undefined();
-        }
-        Napi::Object arg_options = arg_value_options.As<Napi::Object>();
-        Napi::Array options_names = arg_options.GetPropertyNames();
-        
-        for(uint32_t i = 0; i < options_names.Length(); ++i)
-        {
-            Napi::Value name_value = options_names.Get(i);
-            if(!name_value.IsString())
-            {
-                continue;
-            }
-            std::string name = name_value.As<Napi::String>().Utf8Value();
-            Napi::Value option_value = arg_options.Get(name);
-            num_options = cupsAddOption(name.c_str(), option_value.ToString().Utf8Value().c_str(), num_options, &options);
-        }
+        Napi::TypeError::New(env, "printFile:options parameter must be an object").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
     
-    int job_id = cupsPrintFile(printer_name.c_str(), filename.c_str(), title.c_str(), num_options, options);
-    cupsFreeOptions(num_options, options);
+    std::string error_str;
+    // unsupported options are rejected before the file is uploaded
+    if(!preflightV8Params(arg_params, server, printer_name, *options, error_str))
+    {
+        Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    ipp_status_t status;
+    int job_id = getCurrentPrintBackend()->printFile(server, printer_name, filename, title, *options, status, error_str);
     
     if(job_id == 0)
     {
-        std::string error_str = "Print Error: ";
-        error_str += cupsLastErrorString();
         Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
         return env.Undefined();
     }
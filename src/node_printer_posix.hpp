@@ -0,0 +1,383 @@
+#ifndef NODE_PRINTER_POSIX_HPP
+#define NODE_PRINTER_POSIX_HPP
+
+#include "node_printer.hpp"
+#include "node_printer_ipp_codec.hpp"
+
+#include <atomic>
+#include <string>
+#include <map>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <sys/uio.h>
+
+#include <cups/cups.h>
+
+// Helpers shared between the posix (CUPS) translation units
+
+typedef std::map<std::string, std::string> FormatMapType;
+
+/** Map of the printDirect data types (RAW, TEXT, ...) to CUPS document formats
+ */
+const FormatMapType& getPrinterFormatMap();
+
+/** Parse job info object.
+ * @return error string. if empty, then no error
+ */
+std::string parseJobObject(const cups_job_t *job, Napi::Object& result_printer_job, Napi::Env& env);
+
+/** Parse printer info object, without jobs.
+ * @return error string. if empty, then no error
+ */
+std::string parsePrinterinfo(const cups_dest_t * printer, Napi::Object& result_printer, Napi::Env& env);
+
+/** Open a new connection to the configured CUPS server.
+ * CUPS_HTTP_DEFAULT is a per-thread connection, so every request which is
+ * split between several worker threads must use its own connection.
+ * @return connection handle, NULL on failure. Close it with httpClose
+ */
+http_t* connectToCupsServer();
+
+/** Connection to a CUPS server borrowed from the pool of this server, returned on destruction.
+ * Pools are shared by all threads, a borrowed connection is used by one thread at a time.
+ */
+class PooledCupsConnection
+{
+public:
+    /** @param iServer host, host:port, [ipv6]:port or domain socket path, like CUPS_SERVER.
+     *      Empty for the configured server: get() is then CUPS_HTTP_DEFAULT
+     * @param iTimeoutMs connection timeout if a new connection is needed
+     */
+    explicit PooledCupsConnection(const std::string &iServer, int iTimeoutMs = 30000);
+    ~PooledCupsConnection();
+
+    /** @return connection, NULL if the server could not be reached. CUPS_HTTP_DEFAULT is NULL too,
+     *      so check isDefault() before treating NULL as a failure
+     */
+    http_t* get() const { return _http; }
+    bool isDefault() const { return _server.empty(); }
+
+    /** Close the connection instead of returning it to the pool, e.g. after a transport error
+     */
+    void discard();
+
+private:
+    PooledCupsConnection(const PooledCupsConnection&);
+    PooledCupsConnection& operator=(const PooledCupsConnection&);
+
+    std::string _server;
+    http_t *_http;
+};
+
+/** Read a server parameter: string, or undefined/null for the configured server (empty oServer)
+ * @return false if the value has another type
+ */
+bool getCupsServerFromV8Value(Napi::Value iV8Value, std::string &oServer);
+
+/** @return ipp://localhost/printers/NAME, or ipp://localhost/ for all printers if iPrinterName is empty
+ */
+std::string getPrinterUri(const std::string &iPrinterName);
+
+/** @return true for the ipp:// and ipps:// URIs which are opened without CUPS scheduler, see openIppPrinter
+ */
+bool isIppPrinterUri(const std::string &iPrinter);
+
+/** Job attributes from an IPP response. Unlike cups_job_t it owns its strings
+ */
+struct IppJob
+{
+    IppJob(): id(0), state(IPP_JOB_PENDING), size(0), priority(50), completed_time(0), creation_time(0), processing_time(0) {}
+
+    int id;
+    std::string dest;
+    std::string title;
+    std::string user;
+    std::string format;
+    ipp_jstate_t state;
+    int size;
+    int priority;
+    time_t completed_time;
+    time_t creation_time;
+    time_t processing_time;
+};
+
+/** Add requested-attributes with what parseIppJobs needs, as cupsGetJobs does
+ */
+void addIppJobRequestedAttributes(ipp_t *ioRequest);
+
+/** Append the jobs of a Get-Jobs or Get-Job-Attributes response
+ */
+void parseIppJobs(ipp_t *iResponse, std::vector<IppJob> &oJobs);
+
+/** Same as parseJobObject, from an IppJob
+ */
+Napi::Object ippJobToV8(const IppJob &iJob, Napi::Env env);
+
+/** Same as parseJobObject, from a job decoded by the native IPP codec
+ */
+Napi::Object ippJobViewToV8(const IppJobView &iJob, Napi::Env env);
+
+/** Reusable buffers of the native IPP codec, one per connection or thread.
+ * A listing costs no allocation once the buffers fit the biggest response.
+ */
+struct IppCodecBuffers
+{
+    IppCodecBuffers(): request_id(0) {}
+
+    IppEncoder request;
+    int32_t request_id;
+    /** body of the last response, the decoded message points into it */
+    std::vector<char> response;
+    IppArena arena;
+    IppMessage message;
+};
+
+/** Codec buffers of the calling thread, for requests on CUPS_HTTP_DEFAULT
+ */
+IppCodecBuffers& getThreadIppCodecBuffers();
+
+/** POST ioBuffers.request and decode the response into ioBuffers.message.
+ * Retried once on a new connection if the kept alive one was dropped.
+ * @param iHttp connection, CUPS_HTTP_DEFAULT for a connection of the calling thread to the CUPS server
+ * @return false with oError set on a transport or decoding error, or an IPP error status
+ */
+bool ippCodecExchange(http_t *iHttp, const char *iResource, IppCodecBuffers &ioBuffers, std::string &oError);
+
+/** Get-Jobs with the native codec instead of cupsGetJobs
+ * @param iPrinterUri printer-uri of the request, see getPrinterUri
+ * @param iWhichJobs which-jobs keyword: all, completed or not-completed
+ * @param oJobs jobs appended, viewing ioBuffers.response until its next request
+ */
+bool fetchIppJobViews(http_t *iHttp, const char *iResource, const std::string &iPrinterUri, const char *iWhichJobs, IppCodecBuffers &ioBuffers, std::vector<IppJobView> &oJobs, std::string &oError);
+
+/** CUPS options owner. Options are freed on destruction
+ */
+class CupsOptions
+{
+public:
+    CupsOptions(): _num_options(0), _options(NULL) {}
+    ~CupsOptions() { cupsFreeOptions(_num_options, _options); }
+
+    void add(const std::string& iName, const std::string& iValue)
+    {
+        _num_options = cupsAddOption(iName.c_str(), iValue.c_str(), _num_options, &_options);
+    }
+
+    int size() const { return _num_options; }
+    cups_option_t* get() const { return _options; }
+private:
+    CupsOptions(const CupsOptions&);
+    CupsOptions& operator=(const CupsOptions&);
+
+    int _num_options;
+    cups_option_t *_options;
+};
+
+/** Options are immutable once built, so they can be shared between jobs and threads
+ */
+typedef std::shared_ptr<const CupsOptions> CupsOptionsPtr;
+
+/** Upload of one document as a new job, on its own connection:
+ * cupsCreateJob, cupsStartDocument, cupsWriteRequestData..., cupsFinishDocument.
+ * A started upload which is not finished is cancelled on destruction.
+ * Methods may be called from any thread, but not concurrently.
+ */
+class CupsJobUpload
+{
+public:
+    CupsJobUpload(): _http(NULL), _job_id(0), _started(false), _status(IPP_STATUS_OK) {}
+    ~CupsJobUpload() { cancel(); }
+
+    /** Connect, create the job and start its only document
+     * @param iFormat CUPS document format, e.g. CUPS_FORMAT_RAW
+     * @return false on failure with oError set
+     */
+    bool start(const std::string &iPrinterName, const std::string &iDocname, const std::string &iFormat, const CupsOptions &iOptions, std::string &oError);
+    bool write(const char *iData, size_t iSize, std::string &oError);
+    bool finish(std::string &oError);
+    /** Drop the upload and cancel the job if it was started
+     */
+    void cancel();
+    /** Drop the upload now and cancel the started job from a detached thread, for the main thread:
+     * a GC finalizer must not wait for the CUPS server
+     */
+    void cancelInBackground();
+
+    int jobId() const { return _job_id; }
+    bool isStarted() const { return _started; }
+    /** IPP status of the last failure, IPP_STATUS_ERROR_SERVICE_UNAVAILABLE if the server could not be reached
+     */
+    ipp_status_t status() const { return _status; }
+private:
+    CupsJobUpload(const CupsJobUpload&);
+    CupsJobUpload& operator=(const CupsJobUpload&);
+
+    void setError(std::string &oError);
+    void closeConnection();
+
+    std::string _printer_name;
+    http_t *_http;
+    int _job_id;
+    bool _started;
+    ipp_status_t _status;
+};
+
+/** Read only memory mapping of a whole file
+ */
+class MappedFile
+{
+public:
+    MappedFile(): _data(NULL), _size(0) {}
+    ~MappedFile();
+
+    bool open(const std::string &iFilename, std::string &oError);
+
+    /** Tell the kernel that [0, iOffset) was consumed and may be dropped from memory
+     */
+    void release(size_t iOffset);
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    char *_data;
+    size_t _size;
+};
+
+/** Destination of the submitted jobs, selected at runtime with setPrintBackend:
+ * libcups (default), null (acknowledges at once) or file (one file per job).
+ * printDirect, printFile, coalesced jobs and the spool journal submit through it.
+ * Methods may be called from any thread, concurrently.
+ */
+class PrintBackend
+{
+public:
+    PrintBackend(): _jobs(0), _bytes(0), _errors(0) {}
+    virtual ~PrintBackend() {}
+
+    virtual const char* name() const = 0;
+
+    /** Submit a job whose document is in memory
+     * @param iServer CUPS server, the configured one if empty
+     * @param iFormat CUPS document format, e.g. CUPS_FORMAT_RAW
+     * @return job id, 0 on failure with oStatus and oError set
+     */
+    int printData(const std::string &iServer, const std::string &iPrinterName, const std::string &iDocname, const std::string &iFormat,
+        const CupsOptions &iOptions, const char *iData, size_t iSize, ipp_status_t &oStatus, std::string &oError);
+
+    /** Submit a job whose document is a file, format detected by the backend
+     * @return job id, 0 on failure with oStatus and oError set
+     */
+    int printFile(const std::string &iServer, const std::string &iPrinterName, const std::string &iFilename, const std::string &iDocname,
+        const CupsOptions &iOptions, ipp_status_t &oStatus, std::string &oError);
+
+    uint64_t jobs() const { return _jobs; }
+    uint64_t bytes() const { return _bytes; }
+    uint64_t errors() const { return _errors; }
+
+protected:
+    virtual int submitData(const std::string &iServer, const std::string &iPrinterName, const std::string &iDocname, const std::string &iFormat,
+        const CupsOptions &iOptions, const char *iData, size_t iSize, ipp_status_t &oStatus, std::string &oError) = 0;
+    virtual int submitFile(const std::string &iServer, const std::string &iPrinterName, const std::string &iFilename, const std::string &iDocname,
+        const CupsOptions &iOptions, ipp_status_t &oStatus, std::string &oError) = 0;
+
+private:
+    PrintBackend(const PrintBackend&);
+    PrintBackend& operator=(const PrintBackend&);
+
+    void count(int iJobId, uint64_t iBytes);
+
+    std::atomic<uint64_t> _jobs;
+    std::atomic<uint64_t> _bytes;
+    std::atomic<uint64_t> _errors;
+};
+
+typedef std::shared_ptr<PrintBackend> PrintBackendPtr;
+
+/** @return backend selected by setPrintBackend, kept alive by the caller while it submits
+ */
+PrintBackendPtr getCurrentPrintBackend();
+
+/** Check job options against the capabilities of the printer, before any data is sent: each value with
+ * cupsCheckDestSupported, then the whole set with cupsCopyDestConflicts. The printer capabilities are
+ * cached, and each result memoized per printer and option value (or option set), so a known job is
+ * checked without request to the server. Options the printer does not advertise are accepted.
+ * @param iServer CUPS server, empty for the configured one
+ * @param oErrors unsupported values and conflicts, or the reason the capabilities could not be loaded
+ * @return false if the job would be rejected or its options ignored
+ */
+bool preflightPrintOptions(const std::string &iServer, const std::string &iPrinterName, const CupsOptions &iOptions, std::vector<std::string> &oErrors);
+
+/** Same as above, with the errors joined in one message
+ */
+bool preflightPrintOptions(const std::string &iServer, const std::string &iPrinterName, const CupsOptions &iOptions, std::string &oError);
+
+/** Run the preflight check if iParams has preflight set, for the job submission functions
+ * @return false if the job must be rejected, with oError set
+ */
+bool preflightV8Params(Napi::Object iParams, const std::string &iServer, const std::string &iPrinterName, const CupsOptions &iOptions, std::string &oError);
+
+/** Printers as returned by libcups, freed on destruction, and their jobs decoded by the native IPP codec.
+ * A snapshot is immutable once fetched, so it may be converted for many callers.
+ */
+struct PrintersSnapshot
+{
+    struct Jobs
+    {
+        Jobs(): fetched(false) {}
+        /** false if the jobs were not retrieved */
+        bool fetched;
+        /** views into the Get-Jobs response, kept in responses */
+        std::vector<IppJobView> views;
+    };
+
+    PrintersSnapshot(): num_dests(0), dests(NULL) {}
+    ~PrintersSnapshot();
+
+    int num_dests;
+    cups_dest_t *dests;
+    /** jobs of each dest, same order as dests */
+    std::vector<Jobs> jobs;
+    /** Get-Jobs responses the job views point into */
+    std::vector<std::vector<char> > responses;
+    std::chrono::steady_clock::time_point fetched;
+private:
+    PrintersSnapshot(const PrintersSnapshot&);
+    PrintersSnapshot& operator=(const PrintersSnapshot&);
+};
+typedef std::shared_ptr<const PrintersSnapshot> PrintersSnapshotPtr;
+
+/** Fetch printers with their jobs. May be called from any thread.
+ * @param iHttp connection, CUPS_HTTP_DEFAULT for the connection of the calling thread
+ * @param iPrinterName printer to fetch, all printers if empty. A missing printer is not an error
+ * @return false on failure with oError set
+ */
+bool fetchPrintersSnapshot(http_t *iHttp, const std::string &iPrinterName, PrintersSnapshot &oSnapshot, std::string &oError);
+
+/** Convert printer iIndex of the snapshot, with its jobs, to a printer info object
+ */
+Napi::Object printerSnapshotToV8(const PrintersSnapshot &iSnapshot, int iIndex, Napi::Env env);
+
+/**
+ * try to extract CUPS options from v8 value
+ * @param iV8Value - source v8 value: option set created by createOptionSet (shared without copy),
+ *      object of option name/value pairs, or undefined/null for no options
+ * @param oOptions - destination options
+ * @return TRUE if value is one of the above, FALSE otherwise
+ */
+bool getCupsOptionsFromV8Value(Napi::Value iV8Value, CupsOptionsPtr &oOptions);
+
+/**
+ * try to get data from a v8 String or Buffer. Buffer memory is referenced, not copied,
+ * so oData is valid only while the Buffer is alive.
+ * @param iV8Value - source v8 value
+ * @param oStorage - storage for String data
+ * @param oData - destination data pointer and size
+ * @return TRUE if value is String or Buffer, FALSE otherwise
+ */
+bool getDataFromV8Value(Napi::Value iV8Value, std::string &oStorage, struct iovec &oData);
+
+#endif
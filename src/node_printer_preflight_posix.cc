@@ -0,0 +1,290 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+
+namespace
+{
+    /** capabilities are loaded again after this: media or finishers may have been changed meanwhile */
+    const int CAPABILITIES_TTL_MS = 300000;
+
+    typedef std::chrono::steady_clock ClockType;
+
+    /** Destination information of one printer, with the checks already made against it.
+     * Checks of an option value, or of a set of options for conflicts, are made once per load.
+     */
+    struct PrinterCapabilities
+    {
+        PrinterCapabilities(): dest(NULL), dinfo(NULL) {}
+        ~PrinterCapabilities()
+        {
+            if(dinfo != NULL)
+            {
+                cupsFreeDestInfo(dinfo);
+            }
+            if(dest != NULL)
+            {
+                cupsFreeDests(1, dest);
+            }
+        }
+
+        /** dest and dinfo are not thread safe: every use is made with this locked */
+        std::mutex mutex;
+        cups_dest_t *dest;
+        cups_dinfo_t *dinfo;
+        ClockType::time_point loaded;
+        /** "name=value" to its error, empty if supported */
+        std::map<std::string, std::string> option_errors;
+        /** all options of a job to their conflict error, empty if none */
+        std::map<std::string, std::string> conflict_errors;
+    };
+
+    typedef std::shared_ptr<PrinterCapabilities> PrinterCapabilitiesPtr;
+
+    class CapabilitiesCache
+    {
+    public:
+        static CapabilitiesCache& instance()
+        {
+            // never destroyed: threads may still check jobs at exit
+            static CapabilitiesCache *result = new CapabilitiesCache();
+            return *result;
+        }
+
+        /** @return capabilities of the printer, not loaded yet if new or expired
+         */
+        PrinterCapabilitiesPtr get(const std::string &iServer, const std::string &iPrinterName)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            PrinterCapabilitiesPtr &result = _printers[iServer + "/" + iPrinterName];
+            if(!result || (result->dinfo != NULL && ClockType::now() - result->loaded > std::chrono::milliseconds(CAPABILITIES_TTL_MS)))
+            {
+                // checks running on the previous capabilities keep them alive
+                result = std::make_shared<PrinterCapabilities>();
+            }
+            return result;
+        }
+
+    private:
+        std::mutex _mutex;
+        std::map<std::string, PrinterCapabilitiesPtr> _printers;
+    };
+
+    /** Load dest and dinfo. Called with the capabilities locked
+     */
+    bool loadCapabilities(http_t *iHttp, const std::string &iPrinterName, PrinterCapabilities &ioCapabilities, std::string &oError)
+    {
+        ioCapabilities.dest = cupsGetNamedDest(iHttp, iPrinterName.c_str(), NULL);
+        if(ioCapabilities.dest == NULL)
+        {
+            oError = "printer not found: " + iPrinterName;
+            return false;
+        }
+        ioCapabilities.dinfo = cupsCopyDestInfo(iHttp, ioCapabilities.dest);
+        if(ioCapabilities.dinfo == NULL)
+        {
+            oError = "unable to get the capabilities of " + iPrinterName + ": " + cupsLastErrorString();
+            cupsFreeDests(1, ioCapabilities.dest);
+            ioCapabilities.dest = NULL;
+            return false;
+        }
+        ioCapabilities.loaded = ClockType::now();
+        return true;
+    }
+
+    /** @return error of the option value, empty if supported. Called with the capabilities locked
+     */
+    std::string checkOption(http_t *iHttp, PrinterCapabilities &ioCapabilities, const cups_option_t &iOption)
+    {
+        // options the printer has no xxx-supported attribute for are left to cupsd: filters, scheduler options...
+        if(cupsFindDestSupported(iHttp, ioCapabilities.dest, ioCapabilities.dinfo, iOption.name) == NULL
+            || cupsCheckDestSupported(iHttp, ioCapabilities.dest, ioCapabilities.dinfo, iOption.name, iOption.value))
+        {
+            return std::string();
+        }
+        std::string result = iOption.name;
+        result += "=";
+        result += iOption.value;
+        result += " is not supported by ";
+        result += ioCapabilities.dest->name;
+        return result;
+    }
+
+    /** @return error listing the conflicting options, empty if none. Called with the capabilities locked
+     */
+    std::string checkConflicts(http_t *iHttp, PrinterCapabilities &ioCapabilities, const CupsOptions &iOptions)
+    {
+        // the last option is checked against all the others
+        const cups_option_t &last = iOptions.get()[iOptions.size() - 1];
+        int num_conflicts = 0;
+        cups_option_t *conflicts = NULL;
+        if(cupsCopyDestConflicts(iHttp, ioCapabilities.dest, ioCapabilities.dinfo, iOptions.size(), iOptions.get(), last.name, last.value,
+            &num_conflicts, &conflicts, NULL, NULL) != 1)
+        {
+            return std::string();
+        }
+        std::string result = "conflicting options for ";
+        result += ioCapabilities.dest->name;
+        result += ":";
+        for(int i = 0; i < num_conflicts; ++i)
+        {
+            result += (i == 0) ? " " : ", ";
+            result += conflicts[i].name;
+            result += "=";
+            result += conflicts[i].value;
+        }
+        cupsFreeOptions(num_conflicts, conflicts);
+        return result;
+    }
+
+    /** Connect to iServer unless ioConnection is already set. A check without connection would be memoized as failed
+     * @return false if the server is not reachable
+     */
+    bool connectOnce(const std::string &iServer, std::unique_ptr<PooledCupsConnection> &ioConnection, std::vector<std::string> &oErrors)
+    {
+        if(!ioConnection)
+        {
+            ioConnection.reset(new PooledCupsConnection(iServer));
+        }
+        if(ioConnection->get() == NULL)
+        {
+            oErrors.push_back("unable to connect to CUPS server " + iServer);
+            return false;
+        }
+        return true;
+    }
+}
+
+bool preflightPrintOptions(const std::string &iServer, const std::string &iPrinterName, const CupsOptions &iOptions, std::vector<std::string> &oErrors)
+{
+    oErrors.clear();
+    PrinterCapabilitiesPtr capabilities = CapabilitiesCache::instance().get(iServer, iPrinterName);
+    std::lock_guard<std::mutex> lock(capabilities->mutex);
+
+    // a connection is only needed for checks not made yet
+    std::unique_ptr<PooledCupsConnection> connection;
+    // dest functions need a connection, not CUPS_HTTP_DEFAULT: the configured server is pooled like the others
+    std::string server = iServer.empty() ? std::string(cupsServer()) : iServer;
+
+    if(capabilities->dinfo == NULL)
+    {
+        std::string error_str;
+        if(!connectOnce(server, connection, oErrors))
+        {
+            return false;
+        }
+        if(!loadCapabilities(connection->get(), iPrinterName, *capabilities, error_str))
+        {
+            oErrors.push_back(error_str);
+            return false;
+        }
+    }
+
+    std::string conflicts_key;
+    cups_option_t *option = iOptions.get();
+    for(int i = 0; i < iOptions.size(); ++i, ++option)
+    {
+        std::string key = option->name;
+        key += '=';
+        key += option->value;
+        std::map<std::string, std::string>::iterator itError = capabilities->option_errors.find(key);
+        if(itError == capabilities->option_errors.end())
+        {
+            if(!connectOnce(server, connection, oErrors))
+            {
+                return false;
+            }
+            itError = capabilities->option_errors.insert(std::make_pair(key, checkOption(connection->get(), *capabilities, *option))).first;
+        }
+        if(!itError->second.empty())
+        {
+            oErrors.push_back(itError->second);
+        }
+        conflicts_key += key;
+        conflicts_key += '\n';
+    }
+
+    // conflicts only matter between supported values
+    if(oErrors.empty() && iOptions.size() > 1)
+    {
+        std::map<std::string, std::string>::iterator itError = capabilities->conflict_errors.find(conflicts_key);
+        if(itError == capabilities->conflict_errors.end())
+        {
+            if(!connectOnce(server, connection, oErrors))
+            {
+                return false;
+            }
+            itError = capabilities->conflict_errors.insert(std::make_pair(conflicts_key, checkConflicts(connection->get(), *capabilities, iOptions))).first;
+        }
+        if(!itError->second.empty())
+        {
+            oErrors.push_back(itError->second);
+        }
+    }
+    return oErrors.empty();
+}
+
+bool preflightPrintOptions(const std::string &iServer, const std::string &iPrinterName, const CupsOptions &iOptions, std::string &oError)
+{
+    std::vector<std::string> errors;
+    if(preflightPrintOptions(iServer, iPrinterName, iOptions, errors))
+    {
+        return true;
+    }
+    oError = "Preflight Error: ";
+    for(size_t i = 0; i < errors.size(); ++i)
+    {
+        oError += (i == 0) ? "" : "; ";
+        oError += errors[i];
+    }
+    return false;
+}
+
+bool preflightV8Params(Napi::Object iParams, const std::string &iServer, const std::string &iPrinterName, const CupsOptions &iOptions, std::string &oError)
+{
+    return !iParams.Get("preflight").ToBoolean().Value() || preflightPrintOptions(iServer, iPrinterName, iOptions, oError);
+}
+
+Napi::Value checkPrintOptions(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 1 || !info[0].IsString())
+    {
+        Napi::TypeError::New(env, "checkPrintOptions:first argument must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    std::string printer_name = info[0].As<Napi::String>().Utf8Value();
+
+    CupsOptionsPtr options;
+    if(!getCupsOptionsFromV8Value((info.Length() > 1) ? info[1] : env.Undefined(), options))
+    {
+        Napi::TypeError::New(env, "checkPrintOptions:options must be an object").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    std::string server;
+    if(info.Length() > 2 && info[2].IsObject()
+        && !getCupsServerFromV8Value(info[2].As<Napi::Object>().Get("server"), server))
+    {
+        Napi::TypeError::New(env, "checkPrintOptions:server option must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    std::vector<std::string> errors;
+    bool valid = preflightPrintOptions(server, printer_name, *options, errors);
+
+    Napi::Array result_errors = Napi::Array::New(env);
+    for(uint32_t i = 0; i < errors.size(); ++i)
+    {
+        result_errors.Set(i, Napi::String::New(env, errors[i]));
+    }
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("valid", Napi::Boolean::New(env, valid));
+    result.Set("errors", result_errors);
+    return result;
+}
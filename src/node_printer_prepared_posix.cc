@@ -0,0 +1,531 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    const int CONNECT_TIMEOUT_MS = 30000;
+    const size_t FILE_CHUNK_SIZE = 64 * 1024;
+
+    /** @return true if a request failed on the connection, e.g. closed by the server while kept alive:
+     * only those are sent again on a new connection, a refused request would be refused again
+     */
+    bool isTransportFailure(http_t *iHttp, ipp_status_t iStatus)
+    {
+        return iStatus == IPP_STATUS_ERROR_SERVICE_UNAVAILABLE || httpError(iHttp) != 0;
+    }
+
+    /** Printer resolved once, see openPrinter.
+     * Keeps the destination, its connection, its capabilities and its URI,
+     * so a job costs only the IPP requests of the document transfer.
+     * All methods are synchronous, like printDirect.
+     */
+    class PreparedPrinter: public Napi::ObjectWrap<PreparedPrinter>
+    {
+    public:
+        static Napi::Function GetClass(Napi::Env env);
+
+        PreparedPrinter(const Napi::CallbackInfo& info);
+        ~PreparedPrinter();
+
+    private:
+        Napi::Value Print(const Napi::CallbackInfo& info);
+        Napi::Value PrintFile(const Napi::CallbackInfo& info);
+        Napi::Value Jobs(const Napi::CallbackInfo& info);
+        Napi::Value Cancel(const Napi::CallbackInfo& info);
+        Napi::Value Close(const Napi::CallbackInfo& info);
+        Napi::Value GetName(const Napi::CallbackInfo& info);
+        Napi::Value GetUri(const Napi::CallbackInfo& info);
+
+        /** Throw if the handle was closed
+         * @return false if closed
+         */
+        bool checkOpened(Napi::Env env, const char *iMethodName);
+
+        /** Reconnect a connection which was dropped by the server (e.g. keep-alive timeout)
+         */
+        bool reconnect();
+
+        /** Parse {type, docname, options} parameters shared by print and printFile
+         * @param iDefaultType type used if the type parameter is missing
+         * @return false if an exception was thrown
+         */
+        bool parseJobParameters(Napi::Env env, Napi::Object iParams, const char *iMethodName, const char *iDefaultType, std::string &oFormat, std::string &oDocname, CupsOptionsPtr &oOptions);
+
+        /** Create the job and start its document, with one reconnection attempt
+         * @return job id, 0 on failure
+         */
+        int startJob(const std::string &iDocname, const std::string &iFormat, const CupsOptionsPtr &iOptions);
+
+        /** Finish the document of iJobId or cancel it if iOk is false
+         * @return true if the job was accepted
+         */
+        bool finishJob(int iJobId, bool iOk);
+
+        void release();
+
+        cups_dest_t *_dest;
+        cups_dinfo_t *_dinfo;
+        http_t *_http;
+        std::string _name;
+        std::string _uri;
+        /** server the printer was resolved on, empty for the configured one */
+        std::string _server;
+        IppCodecBuffers _codec;
+        std::vector<IppJobView> _jobs;
+    };
+
+    Napi::Value throwPrintError(Napi::Env env)
+    {
+        std::string error_str = "Print Error: ";
+        error_str += cupsLastErrorString();
+        Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    Napi::Function PreparedPrinter::GetClass(Napi::Env env)
+    {
+        Napi::FunctionReference &constructor = getAddonData(env).constructors["PreparedPrinter"];
+        if(constructor.IsEmpty())
+        {
+            constructor = Napi::Persistent(DefineClass(env, "PreparedPrinter", {
+                InstanceMethod("print", &PreparedPrinter::Print),
+                InstanceMethod("printFile", &PreparedPrinter::PrintFile),
+                InstanceMethod("jobs", &PreparedPrinter::Jobs),
+                InstanceMethod("cancel", &PreparedPrinter::Cancel),
+                InstanceMethod("close", &PreparedPrinter::Close),
+                InstanceAccessor("name", &PreparedPrinter::GetName, nullptr),
+                InstanceAccessor("uri", &PreparedPrinter::GetUri, nullptr)
+            }));
+        }
+        return constructor.Value();
+    }
+
+    PreparedPrinter::PreparedPrinter(const Napi::CallbackInfo& info):
+        Napi::ObjectWrap<PreparedPrinter>(info),
+        _dest(NULL),
+        _dinfo(NULL),
+        _http(NULL)
+    {
+        Napi::Env env = info.Env();
+
+        std::string printer_name;
+        if(info.Length() > 0 && !info[0].IsUndefined() && !info[0].IsNull())
+        {
+            if(!info[0].IsString())
+            {
+                Napi::TypeError::New(env, "openPrinter:first argument must be a string").ThrowAsJavaScriptException();
+                return;
+            }
+            printer_name = info[0].As<Napi::String>().Utf8Value();
+        }
+
+        // server the printer is resolved on, the configured one if not set
+        std::string server;
+        if(info.Length() > 1 && info[1].IsObject()
+            && !getCupsServerFromV8Value(info[1].As<Napi::Object>().Get("server"), server))
+        {
+            Napi::TypeError::New(env, "openPrinter:server option must be a string").ThrowAsJavaScriptException();
+            return;
+        }
+        PooledCupsConnection connection(server);
+        if(!connection.isDefault() && connection.get() == NULL)
+        {
+            Napi::Error::New(env, "openPrinter: unable to connect to CUPS server " + server).ThrowAsJavaScriptException();
+            return;
+        }
+
+        // NULL name resolves the default destination, including lpoptions default.
+        // The handle then talks to the printer-uri-supported of the resolved printer, on its server
+        _dest = cupsGetNamedDest(connection.get(), printer_name.empty() ? NULL : printer_name.c_str(), NULL);
+        if(_dest == NULL)
+        {
+            std::string error_str = "openPrinter: printer not found: ";
+            error_str += printer_name.empty() ? "(default)" : printer_name;
+            if(!server.empty())
+            {
+                error_str += " on " + server;
+            }
+            Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
+            return;
+        }
+        _name = _dest->name;
+        _server = server;
+
+        const char *uri = cupsGetOption("printer-uri-supported", _dest->num_options, _dest->options);
+        if(uri == NULL)
+        {
+            uri = cupsGetOption("device-uri", _dest->num_options, _dest->options);
+        }
+        if(uri != NULL)
+        {
+            _uri = uri;
+        }
+
+        if(!reconnect())
+        {
+            release();
+            Napi::Error::New(env, "openPrinter: unable to connect to printer " + _name).ThrowAsJavaScriptException();
+            return;
+        }
+        _dinfo = cupsCopyDestInfo(_http, _dest);
+        if(_dinfo == NULL)
+        {
+            // jobs are created from the capabilities
+            std::string error_str = "openPrinter: unable to get the capabilities of " + _name + ": " + cupsLastErrorString();
+            release();
+            Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
+            return;
+        }
+    }
+
+    PreparedPrinter::~PreparedPrinter()
+    {
+        release();
+    }
+
+    void PreparedPrinter::release()
+    {
+        if(_dinfo != NULL)
+        {
+            cupsFreeDestInfo(_dinfo);
+            _dinfo = NULL;
+        }
+        if(_http != NULL)
+        {
+            httpClose(_http);
+            _http = NULL;
+        }
+        if(_dest != NULL)
+        {
+            cupsFreeDests(1, _dest);
+            _dest = NULL;
+        }
+    }
+
+    bool PreparedPrinter::reconnect()
+    {
+        if(_http != NULL)
+        {
+            return (httpReconnect2(_http, CONNECT_TIMEOUT_MS, NULL) == 0);
+        }
+        char resource[1024];
+        _http = cupsConnectDest(_dest, CUPS_DEST_FLAGS_NONE, CONNECT_TIMEOUT_MS, NULL, resource, sizeof(resource), NULL, NULL);
+        return (_http != NULL);
+    }
+
+    bool PreparedPrinter::checkOpened(Napi::Env env, const char *iMethodName)
+    {
+        if(_dest == NULL)
+        {
+            std::string error_str(iMethodName);
+            error_str += ": printer handle is closed";
+            Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
+            return false;
+        }
+        return true;
+    }
+
+    bool PreparedPrinter::parseJobParameters(Napi::Env env, Napi::Object iParams, const char *iMethodName, const char *iDefaultType, std::string &oFormat, std::string &oDocname, CupsOptionsPtr &oOptions)
+    {
+        std::string method_name(iMethodName);
+
+        // type
+        std::string type_str = iDefaultType;
+        Napi::Value arg_value_type = iParams.Get("type");
+        if(!arg_value_type.IsUndefined())
+        {
+            if(!arg_value_type.IsString())
+            {
+                Napi::TypeError::New(env, method_name + ":type parameter must be a string").ThrowAsJavaScriptException();
+                return false;
+            }
+            type_str = arg_value_type.As<Napi::String>().Utf8Value();
+        }
+        FormatMapType::const_iterator itFormat = getPrinterFormatMap().find(type_str);
+        if(itFormat == getPrinterFormatMap().end())
+        {
+            Napi::TypeError::New(env, method_name + ": unsupported format type").ThrowAsJavaScriptException();
+            return false;
+        }
+        oFormat = itFormat->second;
+
+        // docname
+        Napi::Value arg_value_docname = iParams.Get("docname");
+        if(!arg_value_docname.IsUndefined())
+        {
+            if(!arg_value_docname.IsString())
+            {
+                Napi::TypeError::New(env, method_name + ":docname parameter must be a string").ThrowAsJavaScriptException();
+                return false;
+            }
+            oDocname = arg_value_docname.As<Napi::String>().Utf8Value();
+        }
+
+        // options
+        if(!getCupsOptionsFromV8Value(iParams.Get("options"), oOptions))
+        {
+            Napi::TypeError::New(env, method_name + ":options parameter must be an object").ThrowAsJavaScriptException();
+            return false;
+        }
+        std::string preflight_error;
+        if(!preflightV8Params(iParams, _server, _name, *oOptions, preflight_error))
+        {
+            Napi::Error::New(env, method_name + ": " + preflight_error).ThrowAsJavaScriptException();
+            return false;
+        }
+        return true;
+    }
+
+    int PreparedPrinter::startJob(const std::string &iDocname, const std::string &iFormat, const CupsOptionsPtr &iOptions)
+    {
+        int job_id = 0;
+        ipp_status_t status = cupsCreateDestJob(_http, _dest, _dinfo, &job_id, iDocname.c_str(), iOptions->size(), iOptions->get());
+        if(status > IPP_STATUS_OK_CONFLICTING && isTransportFailure(_http, status) && reconnect())
+        {
+            // the kept alive connection may have been closed by the server: retry once
+            status = cupsCreateDestJob(_http, _dest, _dinfo, &job_id, iDocname.c_str(), iOptions->size(), iOptions->get());
+        }
+        if(status > IPP_STATUS_OK_CONFLICTING || job_id == 0)
+        {
+            return 0;
+        }
+        if(cupsStartDestDocument(_http, _dest, _dinfo, job_id, iDocname.c_str(), iFormat.c_str(), 0, NULL, 1/*last document*/) != HTTP_STATUS_CONTINUE)
+        {
+            cupsCancelDestJob(_http, _dest, job_id);
+            return 0;
+        }
+        return job_id;
+    }
+
+    bool PreparedPrinter::finishJob(int iJobId, bool iOk)
+    {
+        if(!iOk)
+        {
+            // interrupted upload leaves the connection in an unknown state
+            reconnect();
+            cupsCancelDestJob(_http, _dest, iJobId);
+            return false;
+        }
+        return (cupsFinishDestDocument(_http, _dest, _dinfo) <= IPP_STATUS_OK_CONFLICTING);
+    }
+
+    Napi::Value PreparedPrinter::Print(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "print"))
+        {
+            return env.Undefined();
+        }
+
+        if(info.Length() < 1 || !info[0].IsObject())
+        {
+            Napi::TypeError::New(env, "print:first argument must be an object").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        Napi::Object arg_params = info[0].As<Napi::Object>();
+
+        std::string data;
+        struct iovec data_iov;
+        if(!getDataFromV8Value(arg_params.Get("data"), data, data_iov))
+        {
+            Napi::TypeError::New(env, "print:data parameter must be a string or Buffer").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+
+        std::string format;
+        std::string docname = "node print job";
+        CupsOptionsPtr options;
+        if(!parseJobParameters(env, arg_params, "print", "RAW", format, docname, options))
+        {
+            return env.Undefined();
+        }
+
+        int job_id = startJob(docname, format, options);
+        if(job_id == 0)
+        {
+            return throwPrintError(env);
+        }
+        bool ok = (cupsWriteRequestData(_http, static_cast<const char*>(data_iov.iov_base), data_iov.iov_len) == HTTP_STATUS_CONTINUE);
+        if(!finishJob(job_id, ok))
+        {
+            return throwPrintError(env);
+        }
+
+        Napi::Object result = Napi::Object::New(env);
+        result.Set("id", Napi::Number::New(env, job_id));
+        return result;
+    }
+
+    Napi::Value PreparedPrinter::PrintFile(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "printFile"))
+        {
+            return env.Undefined();
+        }
+
+        if(info.Length() < 1 || !info[0].IsObject())
+        {
+            Napi::TypeError::New(env, "printFile:first argument must be an object").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        Napi::Object arg_params = info[0].As<Napi::Object>();
+
+        Napi::Value arg_value_filename = arg_params.Get("filename");
+        if(!arg_value_filename.IsString())
+        {
+            Napi::TypeError::New(env, "printFile:filename parameter must be a string").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        std::string filename = arg_value_filename.As<Napi::String>().Utf8Value();
+
+        std::string format;
+        std::string docname = filename;
+        CupsOptionsPtr options;
+        // AUTO lets CUPS detect the file format like cupsPrintFile does
+        if(!parseJobParameters(env, arg_params, "printFile", "AUTO", format, docname, options))
+        {
+            return env.Undefined();
+        }
+
+        int fd = open(filename.c_str(), O_RDONLY);
+        if(fd == -1)
+        {
+            Napi::Error::New(env, "printFile: unable to open file " + filename).ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+
+        int job_id = startJob(docname, format, options);
+        if(job_id == 0)
+        {
+            close(fd);
+            return throwPrintError(env);
+        }
+
+        std::vector<char> buffer(FILE_CHUNK_SIZE);
+        bool ok = true;
+        ssize_t bytes;
+        while(ok && (bytes = read(fd, &buffer[0], buffer.size())) != 0)
+        {
+            if(bytes < 0)
+            {
+                ok = (errno == EINTR);
+                continue;
+            }
+            ok = (cupsWriteRequestData(_http, &buffer[0], static_cast<size_t>(bytes)) == HTTP_STATUS_CONTINUE);
+        }
+        close(fd);
+
+        if(!finishJob(job_id, ok))
+        {
+            return throwPrintError(env);
+        }
+
+        Napi::Object result = Napi::Object::New(env);
+        result.Set("id", Napi::Number::New(env, job_id));
+        return result;
+    }
+
+    Napi::Value PreparedPrinter::Jobs(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "jobs"))
+        {
+            return env.Undefined();
+        }
+
+        // "all" (default), "active" or "completed"
+        const char *which_jobs = "all";
+        if(info.Length() > 0 && info[0].IsString())
+        {
+            std::string which_jobs_str = info[0].As<Napi::String>().Utf8Value();
+            if(which_jobs_str == "active")
+            {
+                which_jobs = "not-completed";
+            }
+            else if(which_jobs_str == "completed")
+            {
+                which_jobs = "completed";
+            }
+        }
+
+        // native codec on the kept alive connection: the handle buffers are reused by every listing
+        _jobs.clear();
+        std::string error_str;
+        if(!fetchIppJobViews(_http, "/", getPrinterUri(_name), which_jobs, _codec, _jobs, error_str))
+        {
+            Napi::Error::New(env, "Print Error: " + error_str).ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+
+        Napi::Array result = Napi::Array::New(env, _jobs.size());
+        for(uint32_t j = 0; j < _jobs.size(); ++j)
+        {
+            result.Set(j, ippJobViewToV8(_jobs[j], env));
+        }
+        return result;
+    }
+
+    Napi::Value PreparedPrinter::Cancel(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "cancel"))
+        {
+            return env.Undefined();
+        }
+
+        if(info.Length() < 1 || !info[0].IsNumber())
+        {
+            Napi::TypeError::New(env, "cancel:first argument must be a number").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        int job_id = info[0].As<Napi::Number>().Int32Value();
+
+        ipp_status_t status = cupsCancelDestJob(_http, _dest, job_id);
+        if(status > IPP_STATUS_OK_CONFLICTING && isTransportFailure(_http, status) && reconnect())
+        {
+            status = cupsCancelDestJob(_http, _dest, job_id);
+        }
+        return Napi::Boolean::New(env, status <= IPP_STATUS_OK_CONFLICTING);
+    }
+
+    Napi::Value PreparedPrinter::Close(const Napi::CallbackInfo& info)
+    {
+        release();
+        return info.Env().Undefined();
+    }
+
+    Napi::Value PreparedPrinter::GetName(const Napi::CallbackInfo& info)
+    {
+        return Napi::String::New(info.Env(), _name);
+    }
+
+    Napi::Value PreparedPrinter::GetUri(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        return _uri.empty() ? env.Undefined() : Napi::String::New(env, _uri);
+    }
+}
+
+Napi::Value openPrinter(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    Napi::Value printer_name = (info.Length() > 0) ? info[0] : env.Undefined();
+    if(printer_name.IsString() && isIppPrinterUri(printer_name.As<Napi::String>().Utf8Value()))
+    {
+        return openIppPrinter(info);
+    }
+    Napi::Value options = (info.Length() > 1) ? info[1] : env.Undefined();
+    Napi::Object result = PreparedPrinter::GetClass(env).New({ printer_name, options });
+    if(env.IsExceptionPending())
+    {
+        return env.Undefined();
+    }
+    return result;
+}
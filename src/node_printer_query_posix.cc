@@ -0,0 +1,437 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+
+PrintersSnapshot::~PrintersSnapshot()
+{
+    cupsFreeDests(num_dests, dests);
+}
+
+bool fetchPrintersSnapshot(http_t *iHttp, const std::string &iPrinterName, PrintersSnapshot &oSnapshot, std::string &oError)
+{
+    cups_dest_t *dests = NULL;
+    int num_dests = cupsGetDests2(iHttp, &dests);
+    if(num_dests == 0 && cupsLastError() > IPP_STATUS_OK_CONFLICTING)
+    {
+        oError = "Error on getting printers: ";
+        oError += cupsLastErrorString();
+        return false;
+    }
+
+    bool all_printers = iPrinterName.empty();
+    if(all_printers)
+    {
+        oSnapshot.num_dests = num_dests;
+        oSnapshot.dests = dests;
+    }
+    else
+    {
+        cups_dest_t *dest = cupsGetDest(iPrinterName.c_str(), NULL, num_dests, dests);
+        if(dest != NULL)
+        {
+            oSnapshot.num_dests = cupsCopyDest(dest, 0, &oSnapshot.dests);
+        }
+        cupsFreeDests(num_dests, dests);
+    }
+
+    oSnapshot.jobs.resize(oSnapshot.num_dests);
+    oSnapshot.responses.reserve(oSnapshot.num_dests);
+    IppCodecBuffers &buffers = getThreadIppCodecBuffers();
+    cups_dest_t *dest = oSnapshot.dests;
+    for(int i = 0; i < oSnapshot.num_dests; ++i, ++dest)
+    {
+        // same rule as getPrinters/getPrinter: destinations without state have no jobs
+        if(!all_printers || cupsGetOption("printer-state", dest->num_options, dest->options) != NULL)
+        {
+            PrintersSnapshot::Jobs &dest_jobs = oSnapshot.jobs[i];
+            dest_jobs.fetched = true;
+            std::string jobs_error;
+            // a failed listing gives no jobs, as with cupsGetJobs
+            if(fetchIppJobViews(iHttp, "/", getPrinterUri(dest->name), "all", buffers, dest_jobs.views, jobs_error) && !dest_jobs.views.empty())
+            {
+                // the snapshot keeps the response the views point into
+                oSnapshot.responses.push_back(std::vector<char>());
+                oSnapshot.responses.back().swap(buffers.response);
+            }
+        }
+    }
+    oSnapshot.fetched = std::chrono::steady_clock::now();
+    return true;
+}
+
+Napi::Object printerSnapshotToV8(const PrintersSnapshot &iSnapshot, int iIndex, Napi::Env env)
+{
+    Napi::Object result_printer = Napi::Object::New(env);
+    parsePrinterinfo(iSnapshot.dests + iIndex, result_printer, env);
+
+    const PrintersSnapshot::Jobs &dest_jobs = iSnapshot.jobs[iIndex];
+    if(dest_jobs.fetched)
+    {
+        Napi::Array result_printer_jobs = Napi::Array::New(env, dest_jobs.views.size());
+        for(uint32_t j = 0; j < dest_jobs.views.size(); ++j)
+        {
+            result_printer_jobs.Set(j, ippJobViewToV8(dest_jobs.views[j], env));
+        }
+        result_printer.Set("jobs", result_printer_jobs);
+    }
+    return result_printer;
+}
+
+namespace
+{
+    /** results older than this are dropped, a caller accepting older ones queries again */
+    const int RESULT_RETENTION_MS = 60000;
+
+    /** Callers waiting for one query. Identical concurrent queries share one entry,
+     * so cupsd load depends on the number of distinct queries, not on the number of callers.
+     */
+    struct QueryEntry
+    {
+        QueryEntry(): in_flight(false) {}
+
+        bool in_flight;
+        std::vector<Napi::FunctionReference> waiters;
+        PrintersSnapshotPtr result;
+    };
+
+    /** Query entries by key of one environment: its waiters are called on its thread.
+     * Main thread of the environment only
+     */
+    class QueryEntries: public AddonService
+    {
+    public:
+        static QueryEntries& getInstance(Napi::Env env);
+
+        /** @return entry of iKey, created if missing
+         */
+        QueryEntry& get(const std::string &iKey) { return _entries[iKey]; }
+        void erase(const std::string &iKey) { _entries.erase(iKey); }
+
+        /** Remove the idle entries whose result expired, at most once per retention period:
+         * every printer and server ever queried would otherwise keep its entry and its snapshot
+         */
+        void prune();
+
+    private:
+        QueryEntries(Napi::Env env);
+
+        /** Release the waiters before the environment teardown and delete the entries
+         */
+        static void cleanup(void *iData);
+
+        typedef std::map<std::string, QueryEntry> QueryEntriesType;
+
+        napi_env _env;
+        QueryEntriesType _entries;
+        std::chrono::steady_clock::time_point _last_prune;
+    };
+
+    QueryEntries& QueryEntries::getInstance(Napi::Env env)
+    {
+        std::unique_ptr<AddonService> &instance = getAddonData(env).services["QueryEntries"];
+        if(!instance)
+        {
+            instance.reset(new QueryEntries(env));
+        }
+        return static_cast<QueryEntries&>(*instance);
+    }
+
+    QueryEntries::QueryEntries(Napi::Env env):
+        _env(env),
+        _last_prune(std::chrono::steady_clock::now())
+    {
+        napi_add_env_cleanup_hook(env, &QueryEntries::cleanup, this);
+    }
+
+    void QueryEntries::cleanup(void *iData)
+    {
+        QueryEntries *entries = static_cast<QueryEntries*>(iData);
+        getAddonData(Napi::Env(entries->_env)).services.erase("QueryEntries");
+    }
+
+    void QueryEntries::prune()
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::chrono::milliseconds retention(RESULT_RETENTION_MS);
+        if(now - _last_prune < retention)
+        {
+            return;
+        }
+        _last_prune = now;
+        for(QueryEntriesType::iterator itEntry = _entries.begin(); itEntry != _entries.end();)
+        {
+            const QueryEntry &entry = itEntry->second;
+            if(!entry.in_flight && entry.waiters.empty() && (!entry.result || now - entry.result->fetched > retention))
+            {
+                _entries.erase(itEntry++);
+            }
+            else
+            {
+                ++itEntry;
+            }
+        }
+    }
+
+    /** Convert the result for one caller: printers array, or printer object if iPrinterName is set
+     */
+    Napi::Value querySnapshotToV8(const PrintersSnapshot &iSnapshot, const std::string &iPrinterName, Napi::Env env)
+    {
+        if(!iPrinterName.empty())
+        {
+            // printer is not found: empty object, like getPrinter
+            return (iSnapshot.num_dests > 0) ? printerSnapshotToV8(iSnapshot, 0, env) : Napi::Object::New(env);
+        }
+        Napi::Array result = Napi::Array::New(env);
+        for(int i = 0; i < iSnapshot.num_dests; ++i)
+        {
+            result.Set(i, printerSnapshotToV8(iSnapshot, i, env));
+        }
+        return result;
+    }
+
+    /** Call every waiter, each one with its own result objects.
+     * The first exception thrown by a callback is rethrown once all waiters were called.
+     */
+    void notifyWaiters(Napi::Env env, std::vector<Napi::FunctionReference> &iWaiters, const PrintersSnapshotPtr &iResult, const std::string &iPrinterName, const std::string &iError)
+    {
+        Napi::Error first_error;
+        for(std::vector<Napi::FunctionReference>::iterator itWaiter = iWaiters.begin(); itWaiter != iWaiters.end(); ++itWaiter)
+        {
+            Napi::HandleScope scope(env);
+            if(iResult)
+            {
+                itWaiter->Call({ env.Null(), querySnapshotToV8(*iResult, iPrinterName, env) });
+            }
+            else
+            {
+                itWaiter->Call({ Napi::Error::New(env, iError).Value() });
+            }
+            if(env.IsExceptionPending())
+            {
+                Napi::Error error = env.GetAndClearPendingException();
+                if(first_error.IsEmpty())
+                {
+                    first_error = error;
+                }
+            }
+        }
+        if(!first_error.IsEmpty())
+        {
+            first_error.ThrowAsJavaScriptException();
+        }
+    }
+
+    /** Run the query of an entry and notify all its waiters
+     */
+    class QueryWorker: public Napi::AsyncWorker
+    {
+    public:
+        QueryWorker(Napi::Env env, const std::string &iKey, const std::string &iServer, const std::string &iPrinterName):
+            Napi::AsyncWorker(env, "node-printer:query"),
+            _key(iKey),
+            _server(iServer),
+            _printer_name(iPrinterName)
+        {}
+
+    protected:
+        void Execute()
+        {
+            PooledCupsConnection connection(_server);
+            if(!connection.isDefault() && connection.get() == NULL)
+            {
+                SetError("unable to connect to CUPS server " + _server);
+                return;
+            }
+            std::shared_ptr<PrintersSnapshot> snapshot = std::make_shared<PrintersSnapshot>();
+            std::string error_str;
+            if(!fetchPrintersSnapshot(connection.get(), _printer_name, *snapshot, error_str))
+            {
+                connection.discard();
+                SetError(error_str);
+                return;
+            }
+            _result = snapshot;
+        }
+
+        void OnOK()
+        {
+            complete("");
+        }
+
+        void OnError(const Napi::Error& e)
+        {
+            complete(e.Message());
+        }
+
+    private:
+        void complete(const std::string &iError)
+        {
+            QueryEntries &entries = QueryEntries::getInstance(Env());
+            QueryEntry &entry = entries.get(_key);
+            // callbacks arriving from now on start a new query or use the new result
+            std::vector<Napi::FunctionReference> waiters;
+            waiters.swap(entry.waiters);
+            entry.in_flight = false;
+            if(_result)
+            {
+                entry.result = _result;
+            }
+            else if(!entry.result)
+            {
+                // nothing to share: a failed query of a printer which does not exist must not stay
+                entries.erase(_key);
+            }
+            notifyWaiters(Env(), waiters, _result, _printer_name, iError);
+        }
+
+        std::string _key;
+        std::string _server;
+        std::string _printer_name;
+        PrintersSnapshotPtr _result;
+    };
+
+    /** Deliver a cached result asynchronously, like a fetched one
+     */
+    class CachedQueryWorker: public Napi::AsyncWorker
+    {
+    public:
+        CachedQueryWorker(const Napi::Function &iCallback, const PrintersSnapshotPtr &iResult, const std::string &iPrinterName):
+            Napi::AsyncWorker(iCallback, "node-printer:query"),
+            _result(iResult),
+            _printer_name(iPrinterName)
+        {}
+
+    protected:
+        void Execute() {}
+
+        std::vector<napi_value> GetResult(Napi::Env env)
+        {
+            std::vector<napi_value> result;
+            result.push_back(env.Null());
+            result.push_back(querySnapshotToV8(*_result, _printer_name, env));
+            return result;
+        }
+
+    private:
+        PrintersSnapshotPtr _result;
+        std::string _printer_name;
+    };
+
+    /** Join the query iPrinterName (all printers if empty) of server iServer, or start it.
+     * @param iServer CUPS server, the configured one if empty
+     * @param iMaxAgeMs age of an already fetched result which is still accepted, 0 to always join a fresh query
+     */
+    void requestQuery(Napi::Env env, const std::string &iServer, const std::string &iPrinterName, double iMaxAgeMs, const Napi::Function &iCallback)
+    {
+        std::string key = iPrinterName.empty() ? "printers" : "printer:" + iPrinterName;
+        if(!iServer.empty())
+        {
+            key = iServer + "/" + key;
+        }
+        // before the lookup: the entry of this query may be removed
+        QueryEntries &entries = QueryEntries::getInstance(env);
+        entries.prune();
+        QueryEntry &entry = entries.get(key);
+
+        if(iMaxAgeMs > 0 && entry.result)
+        {
+            double age_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - entry.result->fetched).count();
+            if(age_ms <= iMaxAgeMs)
+            {
+                (new CachedQueryWorker(iCallback, entry.result, iPrinterName))->Queue();
+                return;
+            }
+        }
+
+        entry.waiters.push_back(Napi::Persistent(iCallback));
+        if(!entry.in_flight)
+        {
+            entry.in_flight = true;
+            (new QueryWorker(env, key, iServer, iPrinterName))->Queue();
+        }
+    }
+
+    /** @return maxAge option in milliseconds, 0 if missing
+     */
+    double getMaxAge(Napi::Value iOptions)
+    {
+        if(!iOptions.IsObject())
+        {
+            return 0;
+        }
+        Napi::Value max_age = iOptions.As<Napi::Object>().Get("maxAge");
+        return max_age.IsNumber() ? max_age.As<Napi::Number>().DoubleValue() : 0;
+    }
+
+    /** @return false if the server option is set but is not a string
+     */
+    bool getServer(Napi::Value iOptions, std::string &oServer)
+    {
+        return getCupsServerFromV8Value(iOptions.IsObject() ? iOptions.As<Napi::Object>().Get("server") : iOptions.Env().Undefined(), oServer);
+    }
+}
+
+Napi::Value getPrintersAsync(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 2 || !info[1].IsFunction())
+    {
+        Napi::TypeError::New(env, "getPrintersAsync:second argument must be a callback function").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    std::string server;
+    if(!getServer(info[0], server))
+    {
+        Napi::TypeError::New(env, "getPrintersAsync:server option must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    requestQuery(env, server, "", getMaxAge(info[0]), info[1].As<Napi::Function>());
+    return env.Undefined();
+}
+
+Napi::Value getPrinterAsync(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 3)
+    {
+        Napi::TypeError::New(env, "getPrinterAsync:invalid number of arguments (3 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[0].IsString())
+    {
+        Napi::TypeError::New(env, "getPrinterAsync:first argument must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[2].IsFunction())
+    {
+        Napi::TypeError::New(env, "getPrinterAsync:third argument must be a callback function").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    std::string printer_name = info[0].As<Napi::String>().Utf8Value();
+    if(printer_name.empty())
+    {
+        Napi::TypeError::New(env, "getPrinterAsync:printer name must not be empty").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    std::string server;
+    if(!getServer(info[1], server))
+    {
+        Napi::TypeError::New(env, "getPrinterAsync:server option must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    requestQuery(env, server, printer_name, getMaxAge(info[1]), info[2].As<Napi::Function>());
+    return env.Undefined();
+}
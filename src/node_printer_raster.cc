@@ -0,0 +1,614 @@
+#include "node_printer_raster.hpp"
+
+#include <string.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#   include <zlib.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define NODE_PRINTER_SSE2
+#   include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#   define NODE_PRINTER_NEON
+#   include <arm_neon.h>
+#endif
+
+void MonoBitmap::reset(int iWidth, int iHeight)
+{
+    width = iWidth;
+    height = iHeight;
+    stride = (static_cast<size_t>(iWidth) + 7) / 8;
+    bits.assign(stride * iHeight, 0);
+}
+
+namespace
+{
+    /** Luma weights, sum is 256 */
+    const int LUMA_RED = 77;
+    const int LUMA_GREEN = 150;
+    const int LUMA_BLUE = 29;
+
+    const char HEX_DIGITS[] = "0123456789ABCDEF";
+    const char BASE64_DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    enum DitherMode
+    {
+        DITHER_THRESHOLD,
+        DITHER_FLOYD_STEINBERG
+    };
+
+    /** Bit order of a byte reversed: movemask gives the first pixel in the lowest bit,
+     * printers expect it in the highest one
+     */
+    struct ReversedBits
+    {
+        ReversedBits()
+        {
+            for(int i = 0; i < 256; ++i)
+            {
+                uint8_t reversed = 0;
+                for(int bit = 0; bit < 8; ++bit)
+                {
+                    if(i & (1 << bit))
+                    {
+                        reversed |= static_cast<uint8_t>(0x80 >> bit);
+                    }
+                }
+                table[i] = reversed;
+            }
+        }
+
+        uint8_t table[256];
+    };
+
+    const ReversedBits REVERSED_BITS;
+
+    /** Luma of a pixel composited over white paper
+     */
+    inline uint8_t grayOverWhite(int iRed, int iGreen, int iBlue, int iAlpha)
+    {
+        int ink = 255 - ((iRed * LUMA_RED + iGreen * LUMA_GREEN + iBlue * LUMA_BLUE) >> 8);
+        // ink * alpha / 255, rounded
+        int covered = ink * iAlpha + 128;
+        covered = (covered + (covered >> 8)) >> 8;
+        return static_cast<uint8_t>(255 - covered);
+    }
+
+    void grayFromRgba(const uint8_t *iPixels, size_t iCount, uint8_t *oGray)
+    {
+        size_t i = 0;
+#if defined(NODE_PRINTER_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i weights = _mm_setr_epi16(LUMA_RED, LUMA_GREEN, LUMA_BLUE, 0, LUMA_RED, LUMA_GREEN, LUMA_BLUE, 0);
+        const __m128i white = _mm_set1_epi16(255);
+        const __m128i half = _mm_set1_epi16(128);
+        for(; i + 16 <= iCount; i += 16)
+        {
+            // 4 pixels per register: luma and alpha as 32 bits lanes
+            __m128i luma[4], alpha[4];
+            for(int j = 0; j < 4; ++j)
+            {
+                __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iPixels + (i + j * 4) * 4));
+                __m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+                __m128i high = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+                // red + green and blue sums of a pixel are adjacent
+                low = _mm_add_epi32(low, _mm_srli_epi64(low, 32));
+                high = _mm_add_epi32(high, _mm_srli_epi64(high, 32));
+                luma[j] = _mm_srli_epi32(_mm_unpacklo_epi64(_mm_shuffle_epi32(low, _MM_SHUFFLE(3, 1, 2, 0)),
+                    _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 1, 2, 0))), 8);
+                alpha[j] = _mm_srli_epi32(pixels, 24);
+            }
+            __m128i halves[2];
+            for(int j = 0; j < 2; ++j)
+            {
+                __m128i ink = _mm_sub_epi16(white, _mm_packs_epi32(luma[j * 2], luma[j * 2 + 1]));
+                __m128i covered = _mm_add_epi16(_mm_mullo_epi16(ink, _mm_packs_epi32(alpha[j * 2], alpha[j * 2 + 1])), half);
+                covered = _mm_srli_epi16(_mm_add_epi16(covered, _mm_srli_epi16(covered, 8)), 8);
+                halves[j] = _mm_sub_epi16(white, covered);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(oGray + i), _mm_packus_epi16(halves[0], halves[1]));
+        }
+#elif defined(NODE_PRINTER_NEON)
+        const uint16x8_t half = vdupq_n_u16(128);
+        for(; i + 16 <= iCount; i += 16)
+        {
+            uint8x16x4_t pixels = vld4q_u8(iPixels + i * 4);
+            uint8x8_t halves[2];
+            for(int j = 0; j < 2; ++j)
+            {
+                uint8x8_t red = j ? vget_high_u8(pixels.val[0]) : vget_low_u8(pixels.val[0]);
+                uint8x8_t green = j ? vget_high_u8(pixels.val[1]) : vget_low_u8(pixels.val[1]);
+                uint8x8_t blue = j ? vget_high_u8(pixels.val[2]) : vget_low_u8(pixels.val[2]);
+                uint8x8_t alpha = j ? vget_high_u8(pixels.val[3]) : vget_low_u8(pixels.val[3]);
+                uint16x8_t sum = vmull_u8(red, vdup_n_u8(LUMA_RED));
+                sum = vmlal_u8(sum, green, vdup_n_u8(LUMA_GREEN));
+                sum = vmlal_u8(sum, blue, vdup_n_u8(LUMA_BLUE));
+                uint8x8_t ink = vmvn_u8(vshrn_n_u16(sum, 8));
+                uint16x8_t covered = vaddq_u16(vmull_u8(ink, alpha), half);
+                halves[j] = vmvn_u8(vshrn_n_u16(vsraq_n_u16(covered, covered, 8), 8));
+            }
+            vst1q_u8(oGray + i, vcombine_u8(halves[0], halves[1]));
+        }
+#endif
+        for(; i < iCount; ++i)
+        {
+            const uint8_t *pixel = iPixels + i * 4;
+            oGray[i] = grayOverWhite(pixel[0], pixel[1], pixel[2], pixel[3]);
+        }
+    }
+
+    /** Grayscale of 1 (gray), 2 (gray, alpha), 3 (RGB) or 4 (RGBA) channels pixels
+     */
+    void grayFromPixels(const uint8_t *iPixels, size_t iCount, int iChannels, uint8_t *oGray)
+    {
+        switch(iChannels)
+        {
+        case 1:
+            memcpy(oGray, iPixels, iCount);
+            break;
+        case 2:
+            for(size_t i = 0; i < iCount; ++i)
+            {
+                oGray[i] = grayOverWhite(iPixels[i * 2], iPixels[i * 2], iPixels[i * 2], iPixels[i * 2 + 1]);
+            }
+            break;
+        case 3:
+            for(size_t i = 0; i < iCount; ++i)
+            {
+                const uint8_t *pixel = iPixels + i * 3;
+                oGray[i] = grayOverWhite(pixel[0], pixel[1], pixel[2], 255);
+            }
+            break;
+        default:
+            grayFromRgba(iPixels, iCount, oGray);
+            break;
+        }
+    }
+
+    /** Resize a grayscale image, averaging the source pixels covered by each destination pixel
+     */
+    void scaleGray(const std::vector<uint8_t> &iSource, int iSourceWidth, int iSourceHeight,
+        std::vector<uint8_t> &oDestination, int iWidth, int iHeight)
+    {
+        oDestination.resize(static_cast<size_t>(iWidth) * iHeight);
+        std::vector<int> columns(iWidth + 1);
+        for(int x = 0; x <= iWidth; ++x)
+        {
+            columns[x] = static_cast<int>(static_cast<int64_t>(x) * iSourceWidth / iWidth);
+        }
+        for(int y = 0; y < iHeight; ++y)
+        {
+            int top = static_cast<int>(static_cast<int64_t>(y) * iSourceHeight / iHeight);
+            int bottom = std::max(top + 1, static_cast<int>(static_cast<int64_t>(y + 1) * iSourceHeight / iHeight));
+            uint8_t *output = &oDestination[static_cast<size_t>(y) * iWidth];
+            for(int x = 0; x < iWidth; ++x)
+            {
+                int left = columns[x];
+                int right = std::max(left + 1, columns[x + 1]);
+                uint32_t sum = 0;
+                for(int sourceY = top; sourceY < bottom; ++sourceY)
+                {
+                    const uint8_t *input = &iSource[static_cast<size_t>(sourceY) * iSourceWidth];
+                    for(int sourceX = left; sourceX < right; ++sourceX)
+                    {
+                        sum += input[sourceX];
+                    }
+                }
+                uint32_t count = static_cast<uint32_t>((bottom - top) * (right - left));
+                output[x] = static_cast<uint8_t>((sum + count / 2) / count);
+            }
+        }
+    }
+
+    /** Pack a row: a dot is black when its gray level is below iThreshold
+     */
+    void packThreshold(const uint8_t *iGray, int iWidth, uint8_t iThreshold, uint8_t *oRow)
+    {
+        int x = 0;
+        if(iThreshold == 0)
+        {
+            memset(oRow, 0, (iWidth + 7) / 8);
+            return;
+        }
+#if defined(NODE_PRINTER_SSE2)
+        // no unsigned comparison: gray < threshold <=> min(gray, threshold - 1) == gray
+        const __m128i limit = _mm_set1_epi8(static_cast<char>(iThreshold - 1));
+        for(; x + 16 <= iWidth; x += 16)
+        {
+            __m128i gray = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iGray + x));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(gray, limit), gray));
+            oRow[x / 8] = REVERSED_BITS.table[mask & 0xFF];
+            oRow[x / 8 + 1] = REVERSED_BITS.table[(mask >> 8) & 0xFF];
+        }
+#elif defined(NODE_PRINTER_NEON)
+        static const uint8_t BIT_WEIGHTS[16] = { 128, 64, 32, 16, 8, 4, 2, 1, 128, 64, 32, 16, 8, 4, 2, 1 };
+        const uint8x16_t weights = vld1q_u8(BIT_WEIGHTS);
+        const uint8x16_t limit = vdupq_n_u8(iThreshold);
+        for(; x + 16 <= iWidth; x += 16)
+        {
+            uint8x16_t black = vandq_u8(vcltq_u8(vld1q_u8(iGray + x), limit), weights);
+            // horizontal sums of each half give its byte
+            uint8x8_t sum = vpadd_u8(vget_low_u8(black), vget_high_u8(black));
+            sum = vpadd_u8(sum, sum);
+            sum = vpadd_u8(sum, sum);
+            oRow[x / 8] = vget_lane_u8(sum, 0);
+            oRow[x / 8 + 1] = vget_lane_u8(sum, 1);
+        }
+#endif
+        for(; x < iWidth; x += 8)
+        {
+            uint8_t packed = 0;
+            for(int bit = 0; bit < 8 && x + bit < iWidth; ++bit)
+            {
+                if(iGray[x + bit] < iThreshold)
+                {
+                    packed |= static_cast<uint8_t>(0x80 >> bit);
+                }
+            }
+            oRow[x / 8] = packed;
+        }
+    }
+
+    /** Floyd-Steinberg error diffusion: a dot is black when its gray level plus the error
+     * spread by its neighbours is below iThreshold
+     */
+    void ditherFloydSteinberg(const std::vector<uint8_t> &iGray, uint8_t iThreshold, MonoBitmap &ioBitmap)
+    {
+        int width = ioBitmap.width;
+        // errors of the current and next rows, with a margin on each side
+        std::vector<int> current(width + 2, 0), next(width + 2, 0);
+        for(int y = 0; y < ioBitmap.height; ++y)
+        {
+            const uint8_t *input = &iGray[static_cast<size_t>(y) * width];
+            uint8_t *output = ioBitmap.row(y);
+            std::fill(next.begin(), next.end(), 0);
+            for(int x = 0; x < width; ++x)
+            {
+                int value = input[x] + current[x + 1] / 16;
+                int error = value;
+                if(value < iThreshold)
+                {
+                    output[x / 8] |= static_cast<uint8_t>(0x80 >> (x & 7));
+                }
+                else
+                {
+                    error = value - 255;
+                }
+                current[x + 2] += error * 7;
+                next[x] += error * 3;
+                next[x + 1] += error * 5;
+                next[x + 2] += error;
+            }
+            current.swap(next);
+        }
+    }
+
+    /** Invert every dot, leaving the padding bits of the rows white
+     */
+    void invertBitmap(MonoBitmap &ioBitmap)
+    {
+        uint8_t last_mask = static_cast<uint8_t>(0xFF << ((8 - ioBitmap.width % 8) % 8));
+        for(int y = 0; y < ioBitmap.height; ++y)
+        {
+            uint8_t *row = ioBitmap.row(y);
+            for(size_t i = 0; i < ioBitmap.stride; ++i)
+            {
+                row[i] = static_cast<uint8_t>(~row[i]);
+            }
+            row[ioBitmap.stride - 1] &= last_mask;
+        }
+    }
+
+    void appendBase64(const uint8_t *iData, size_t iSize, std::string &oData)
+    {
+        size_t i = 0;
+        for(; i + 3 <= iSize; i += 3)
+        {
+            uint32_t triple = (iData[i] << 16) | (iData[i + 1] << 8) | iData[i + 2];
+            oData += BASE64_DIGITS[(triple >> 18) & 0x3F];
+            oData += BASE64_DIGITS[(triple >> 12) & 0x3F];
+            oData += BASE64_DIGITS[(triple >> 6) & 0x3F];
+            oData += BASE64_DIGITS[triple & 0x3F];
+        }
+        if(i < iSize)
+        {
+            uint32_t triple = iData[i] << 16;
+            if(i + 1 < iSize)
+            {
+                triple |= iData[i + 1] << 8;
+            }
+            oData += BASE64_DIGITS[(triple >> 18) & 0x3F];
+            oData += BASE64_DIGITS[(triple >> 12) & 0x3F];
+            oData += i + 1 < iSize ? BASE64_DIGITS[(triple >> 6) & 0x3F] : '=';
+            oData += '=';
+        }
+    }
+
+    /** CRC-16/XMODEM, checksum of the Z64 data
+     */
+    uint16_t crc16(const char *iData, size_t iSize)
+    {
+        uint16_t crc = 0;
+        for(size_t i = 0; i < iSize; ++i)
+        {
+            crc ^= static_cast<uint16_t>(static_cast<uint8_t>(iData[i]) << 8);
+            for(int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    bool appendZplGraphic(const MonoBitmap &iBitmap, const RasterOutput &iOutput, std::string &oData, std::string &oError)
+    {
+        size_t total = iBitmap.bits.size();
+        if(iOutput.label)
+        {
+            oData += "^XA^FO0,0";
+        }
+        oData += "^GFA," + std::to_string(total) + "," + std::to_string(total) + "," + std::to_string(iBitmap.stride) + ",";
+        if(iOutput.compress)
+        {
+#ifdef _WIN32
+            oError = "compress is not implemented yet on Windows";
+            return false;
+#else
+            uLongf compressed_size = compressBound(static_cast<uLong>(total));
+            std::vector<uint8_t> compressed(compressed_size);
+            if(compress2(&compressed[0], &compressed_size, total ? &iBitmap.bits[0] : NULL, static_cast<uLong>(total), Z_BEST_COMPRESSION) != Z_OK)
+            {
+                oError = "cannot compress the graphic";
+                return false;
+            }
+            oData += ":Z64:";
+            size_t begin = oData.size();
+            appendBase64(&compressed[0], compressed_size, oData);
+            uint16_t crc = crc16(oData.data() + begin, oData.size() - begin);
+            oData += ':';
+            for(int shift = 12; shift >= 0; shift -= 4)
+            {
+                oData += HEX_DIGITS[(crc >> shift) & 0xF];
+            }
+#endif
+        }
+        else
+        {
+            size_t begin = oData.size();
+            oData.resize(begin + total * 2);
+            char *output = &oData[begin];
+            for(size_t i = 0; i < total; ++i)
+            {
+                *output++ = HEX_DIGITS[iBitmap.bits[i] >> 4];
+                *output++ = HEX_DIGITS[iBitmap.bits[i] & 0xF];
+            }
+        }
+        if(iOutput.label)
+        {
+            oData += "^FS^XZ";
+        }
+        return true;
+    }
+
+    bool appendEscPosRaster(const MonoBitmap &iBitmap, std::string &oData, std::string &oError)
+    {
+        if(iBitmap.stride > 0xFFFF || iBitmap.height > 0xFFFF)
+        {
+            oError = "image too large for GS v 0";
+            return false;
+        }
+        // GS v 0 m xL xH yL yH, normal density
+        const char header[] = {
+            0x1D, 'v', '0', 0,
+            static_cast<char>(iBitmap.stride & 0xFF), static_cast<char>(iBitmap.stride >> 8),
+            static_cast<char>(iBitmap.height & 0xFF), static_cast<char>(iBitmap.height >> 8)
+        };
+        oData.append(header, sizeof(header));
+        oData.append(reinterpret_cast<const char*>(iBitmap.bits.data()), iBitmap.bits.size());
+        return true;
+    }
+
+    /** Read the integer option iName, between iMin and iMax
+     * @returns false if it is set but is not a number in range
+     */
+    bool getIntOption(Napi::Object iOptions, const char *iName, int iMin, int iMax, int &oValue)
+    {
+        Napi::Value value = iOptions.Get(iName);
+        if(value.IsUndefined() || value.IsNull())
+        {
+            return true;
+        }
+        if(!value.IsNumber())
+        {
+            return false;
+        }
+        int64_t number = value.As<Napi::Number>().Int64Value();
+        if(number < iMin || number > iMax)
+        {
+            return false;
+        }
+        oValue = static_cast<int>(number);
+        return true;
+    }
+}
+
+bool getRasterOutputFromV8Value(Napi::Object iOptions, RasterOutput &oOutput, std::string &oError)
+{
+    Napi::Value format = iOptions.Get("format");
+    if(format.IsString())
+    {
+        std::string format_name = format.As<Napi::String>().Utf8Value();
+        if(format_name == "zpl")
+        {
+            oOutput.format = RASTER_FORMAT_ZPL;
+        }
+        else if(format_name == "escpos")
+        {
+            oOutput.format = RASTER_FORMAT_ESCPOS;
+        }
+        else if(format_name == "bitmap")
+        {
+            oOutput.format = RASTER_FORMAT_BITMAP;
+        }
+        else
+        {
+            oError = "format must be 'zpl', 'escpos' or 'bitmap'";
+            return false;
+        }
+    }
+    else if(!format.IsUndefined())
+    {
+        oError = "format must be a string";
+        return false;
+    }
+
+    Napi::Value compress = iOptions.Get("compress");
+    if(!compress.IsUndefined())
+    {
+        oOutput.compress = compress.ToBoolean().Value();
+    }
+    Napi::Value label = iOptions.Get("label");
+    if(!label.IsUndefined())
+    {
+        oOutput.label = label.ToBoolean().Value();
+    }
+    return true;
+}
+
+bool encodeMonoBitmap(const MonoBitmap &iBitmap, const RasterOutput &iOutput, std::string &oData, std::string &oError)
+{
+    switch(iOutput.format)
+    {
+    case RASTER_FORMAT_ZPL:
+        return appendZplGraphic(iBitmap, iOutput, oData, oError);
+    case RASTER_FORMAT_ESCPOS:
+        return appendEscPosRaster(iBitmap, oData, oError);
+    case RASTER_FORMAT_BITMAP:
+        oData.append(reinterpret_cast<const char*>(iBitmap.bits.data()), iBitmap.bits.size());
+        return true;
+    }
+    return false;
+}
+
+Napi::Value convertImage(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 1 || !info[0].IsObject())
+    {
+        Napi::TypeError::New(env, "convertImage:first argument must be an image object").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    Napi::Object arg_image = info[0].As<Napi::Object>();
+    Napi::Object arg_options = (info.Length() > 1 && info[1].IsObject()) ? info[1].As<Napi::Object>() : Napi::Object::New(env);
+
+    // source image
+    Napi::Value arg_data = arg_image.Get("data");
+    if(!arg_data.IsBuffer())
+    {
+        Napi::TypeError::New(env, "convertImage:image data must be a Buffer").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    Napi::Buffer<uint8_t> data = arg_data.As<Napi::Buffer<uint8_t> >();
+    int source_width = 0, source_height = 0;
+    if(!getIntOption(arg_image, "width", 1, 0xFFFF, source_width) || !getIntOption(arg_image, "height", 1, 0xFFFF, source_height)
+        || source_width == 0 || source_height == 0)
+    {
+        Napi::TypeError::New(env, "convertImage:image width and height must be positive numbers").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    size_t pixels_count = static_cast<size_t>(source_width) * source_height;
+    int channels = static_cast<int>(data.Length() / pixels_count);
+    if(!getIntOption(arg_image, "channels", 1, 4, channels) || channels < 1 || channels > 4 || data.Length() < pixels_count * channels)
+    {
+        Napi::TypeError::New(env, "convertImage:image data must hold width * height pixels of 1 to 4 channels").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // conversion options
+    int width = 0, height = 0, threshold = 128;
+    if(!getIntOption(arg_options, "width", 1, 0xFFFF, width) || !getIntOption(arg_options, "height", 1, 0xFFFF, height))
+    {
+        Napi::TypeError::New(env, "convertImage:width and height must be positive numbers").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    if(!getIntOption(arg_options, "threshold", 0, 255, threshold))
+    {
+        Napi::TypeError::New(env, "convertImage:threshold must be a number between 0 and 255").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    // missing dimension keeps the aspect ratio
+    if(width == 0 && height == 0)
+    {
+        width = source_width;
+        height = source_height;
+    }
+    else if(width == 0)
+    {
+        width = std::max(1, static_cast<int>(static_cast<int64_t>(source_width) * height / source_height));
+    }
+    else if(height == 0)
+    {
+        height = std::max(1, static_cast<int>(static_cast<int64_t>(source_height) * width / source_width));
+    }
+
+    DitherMode dither = DITHER_THRESHOLD;
+    Napi::Value arg_dither = arg_options.Get("dither");
+    if(arg_dither.IsString() && arg_dither.As<Napi::String>().Utf8Value() == "floyd-steinberg")
+    {
+        dither = DITHER_FLOYD_STEINBERG;
+    }
+    else if(!arg_dither.IsUndefined() && !(arg_dither.IsString() && arg_dither.As<Napi::String>().Utf8Value() == "threshold"))
+    {
+        Napi::TypeError::New(env, "convertImage:dither must be 'threshold' or 'floyd-steinberg'").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    bool invert = arg_options.Get("invert").ToBoolean().Value();
+
+    RasterOutput output;
+    std::string error;
+    if(!getRasterOutputFromV8Value(arg_options, output, error))
+    {
+        Napi::TypeError::New(env, "convertImage:" + error).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // grayscale, scaled, then 1 bit per dot
+    std::vector<uint8_t> gray(pixels_count);
+    grayFromPixels(data.Data(), pixels_count, channels, &gray[0]);
+    if(width != source_width || height != source_height)
+    {
+        std::vector<uint8_t> scaled;
+        scaleGray(gray, source_width, source_height, scaled, width, height);
+        gray.swap(scaled);
+    }
+
+    uint8_t limit = static_cast<uint8_t>(threshold);
+    MonoBitmap bitmap;
+    bitmap.reset(width, height);
+    if(dither == DITHER_FLOYD_STEINBERG)
+    {
+        ditherFloydSteinberg(gray, limit, bitmap);
+    }
+    else
+    {
+        for(int y = 0; y < height; ++y)
+        {
+            packThreshold(&gray[static_cast<size_t>(y) * width], width, limit, bitmap.row(y));
+        }
+    }
+    if(invert)
+    {
+        invertBitmap(bitmap);
+    }
+
+    std::string result;
+    if(!encodeMonoBitmap(bitmap, output, result, error))
+    {
+        Napi::Error::New(env, "convertImage:" + error).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    return Napi::Buffer<char>::Copy(env, result.data(), result.size());
+}
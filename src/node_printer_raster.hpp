@@ -0,0 +1,63 @@
+#ifndef NODE_PRINTER_RASTER_HPP
+#define NODE_PRINTER_RASTER_HPP
+
+#include "node_printer.hpp"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** 1 bit per pixel bitmap in printer order: rows of stride bytes,
+ * most significant bit first, 1 for a black dot
+ */
+struct MonoBitmap
+{
+    MonoBitmap(): width(0), height(0), stride(0) {}
+
+    /** Reset to a white bitmap of the given size
+     */
+    void reset(int iWidth, int iHeight);
+
+    uint8_t* row(int iY) { return &bits[iY * stride]; }
+    const uint8_t* row(int iY) const { return &bits[iY * stride]; }
+
+    int width;
+    int height;
+    size_t stride;
+    std::vector<uint8_t> bits;
+};
+
+/** Printer command a bitmap is encoded to
+ */
+enum RasterFormat
+{
+    /** ZPL ^GF graphic field */
+    RASTER_FORMAT_ZPL,
+    /** ESC/POS GS v 0 raster bit image */
+    RASTER_FORMAT_ESCPOS,
+    /** packed rows only */
+    RASTER_FORMAT_BITMAP
+};
+
+struct RasterOutput
+{
+    RasterOutput(): format(RASTER_FORMAT_ZPL), compress(false), label(true) {}
+
+    RasterFormat format;
+    /** ZPL only: Z64 (deflate + base64) data instead of hexadecimal */
+    bool compress;
+    /** ZPL only: wrap the graphic field in a complete ^XA...^XZ label */
+    bool label;
+};
+
+/** Read format, compress and label options of a raster conversion
+ * @returns false with oError set if an option is invalid
+ */
+bool getRasterOutputFromV8Value(Napi::Object iOptions, RasterOutput &oOutput, std::string &oError);
+
+/** Append the printer commands which print iBitmap to oData
+ * @returns false with oError set on failure
+ */
+bool encodeMonoBitmap(const MonoBitmap &iBitmap, const RasterOutput &iOutput, std::string &oData, std::string &oError);
+
+#endif
@@ -0,0 +1,610 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+
+namespace
+{
+    const int DEFAULT_CONCURRENCY = 4;
+    const int DEFAULT_AGING_MS = 2000;
+    /** cost of a job for the fair queuing: its bytes, at least this */
+    const double MIN_JOB_COST = 1024;
+
+    typedef std::chrono::steady_clock ClockType;
+
+    /** Job waiting in the scheduler. Its callback is created and released on the main thread
+     */
+    struct ScheduledJob
+    {
+        /** CUPS server, empty for the configured one */
+        std::string server;
+        std::string printer_name;
+        std::string docname;
+        std::string format;
+        CupsOptionsPtr options;
+        std::string data;
+        std::string tenant;
+        size_t class_index;
+        /** fair queuing finish tag in its class: served in increasing order */
+        double finish;
+        uint64_t sequence;
+        ClockType::time_point queued;
+        Napi::FunctionReference *callback;
+    };
+
+    typedef std::shared_ptr<ScheduledJob> ScheduledJobPtr;
+
+    struct ScheduledJobOrder
+    {
+        bool operator()(const ScheduledJobPtr &iLeft, const ScheduledJobPtr &iRight) const
+        {
+            return (iLeft->finish != iRight->finish) ? (iLeft->finish < iRight->finish) : (iLeft->sequence < iRight->sequence);
+        }
+    };
+
+    /** Priority class: its own fair queue between tenants, and its queue wait statistics
+     */
+    struct JobClass
+    {
+        JobClass(): priority(50), virtual_time(0), submitted(0), failed(0), waited(0), wait_total_ms(0), wait_max_ms(0) {}
+
+        std::string name;
+        /** IPP job-priority of its jobs, 1 to 100 */
+        int priority;
+        std::set<ScheduledJobPtr, ScheduledJobOrder> queue;
+        /** queue time of the jobs of queue by sequence, oldest first: the class ages on its oldest job,
+         * which is not the next one served when its tenant is behind the others */
+        std::map<uint64_t, ClockType::time_point> arrivals;
+        /** finish tag of the last job served */
+        double virtual_time;
+        /** finish tag of the last job queued by each tenant */
+        std::map<std::string, double> tenant_finish;
+
+        uint64_t submitted;
+        uint64_t failed;
+        uint64_t waited;
+        double wait_total_ms;
+        double wait_max_ms;
+    };
+
+    class JobScheduler;
+
+    /** Outcome of a submitted job, passed to the main thread
+     */
+    struct ScheduledResult
+    {
+        JobScheduler *scheduler;
+        ScheduledJobPtr job;
+        int job_id;
+        std::string error;
+        double wait_ms;
+    };
+
+    /** Submission scheduler, see createJobScheduler.
+     * Worker threads take the next job from the classes in priority order, except that a class
+     * whose oldest job waited iAgingMs is served as if it was one class higher, for each iAgingMs
+     * waited, so lower classes are never starved. Inside a class, tenants share the workers in
+     * proportion to their weights (self-clocked fair queuing on the job bytes: jobs are served
+     * by increasing finish tag, the virtual time being the finish tag of the last job served),
+     * so one tenant sending a batch does not delay the others.
+     */
+    class JobScheduler: public Napi::ObjectWrap<JobScheduler>
+    {
+    public:
+        static Napi::Function GetClass(Napi::Env env);
+
+        JobScheduler(const Napi::CallbackInfo& info);
+        ~JobScheduler();
+
+    private:
+        Napi::Value Submit(const Napi::CallbackInfo& info);
+        Napi::Value Stats(const Napi::CallbackInfo& info);
+        Napi::Value Close(const Napi::CallbackInfo& info);
+
+        /** Classes from the classes option, highest priority first
+         * @return false if an exception was thrown
+         */
+        bool parseClasses(Napi::Env env, Napi::Value iClasses);
+
+        /** @return next job to submit, NULL if none. Called with the mutex locked
+         */
+        ScheduledJobPtr next(ClockType::time_point iNow);
+        void run();
+        static void onSubmitted(Napi::Env env, Napi::Function, ScheduledResult *iResult);
+
+        /** Stop the workers, queued jobs are dropped
+         */
+        void stop();
+        static void cleanup(void *iData);
+
+        napi_env _env;
+        Napi::ThreadSafeFunction _tsfn;
+        /** callbacks not called yet, main thread only. The event loop and this object are kept alive while it is not 0 */
+        size_t _pending_callbacks;
+        std::chrono::milliseconds _aging;
+        std::map<std::string, double> _tenant_weights;
+
+        std::mutex _mutex;
+        std::condition_variable _wakeup;
+        std::vector<JobClass> _classes;
+        uint64_t _next_sequence;
+        bool _closing;
+        bool _stopping;
+        std::vector<std::thread> _workers;
+    };
+
+    Napi::Function JobScheduler::GetClass(Napi::Env env)
+    {
+        Napi::FunctionReference &constructor = getAddonData(env).constructors["JobScheduler"];
+        if(constructor.IsEmpty())
+        {
+            constructor = Napi::Persistent(DefineClass(env, "JobScheduler", {
+                InstanceMethod("submit", &JobScheduler::Submit),
+                InstanceMethod("stats", &JobScheduler::Stats),
+                InstanceMethod("close", &JobScheduler::Close)
+            }));
+        }
+        return constructor.Value();
+    }
+
+    JobScheduler::JobScheduler(const Napi::CallbackInfo& info):
+        Napi::ObjectWrap<JobScheduler>(info),
+        _env(info.Env()),
+        _pending_callbacks(0),
+        _aging(DEFAULT_AGING_MS),
+        _next_sequence(0),
+        _closing(false),
+        _stopping(false)
+    {
+        Napi::Env env = info.Env();
+        Napi::Object options = (info.Length() > 0 && info[0].IsObject()) ? info[0].As<Napi::Object>() : Napi::Object::New(env);
+
+        if(!parseClasses(env, options.Get("classes")))
+        {
+            return;
+        }
+
+        int concurrency = DEFAULT_CONCURRENCY;
+        Napi::Value arg_concurrency = options.Get("concurrency");
+        if(arg_concurrency.IsNumber())
+        {
+            concurrency = std::max(arg_concurrency.As<Napi::Number>().Int32Value(), 1);
+        }
+
+        Napi::Value arg_aging = options.Get("aging");
+        if(arg_aging.IsNumber())
+        {
+            _aging = std::chrono::milliseconds(std::max(arg_aging.As<Napi::Number>().Int64Value(), static_cast<int64_t>(1)));
+        }
+
+        Napi::Value arg_tenants = options.Get("tenants");
+        if(arg_tenants.IsObject())
+        {
+            Napi::Object tenants = arg_tenants.As<Napi::Object>();
+            Napi::Array names = tenants.GetPropertyNames();
+            for(uint32_t i = 0; i < names.Length(); ++i)
+            {
+                Napi::Value weight = tenants.Get(names.Get(i));
+                if(!weight.IsNumber() || weight.As<Napi::Number>().DoubleValue() <= 0)
+                {
+                    Napi::TypeError::New(env, "createJobScheduler:tenant weights must be positive numbers").ThrowAsJavaScriptException();
+                    return;
+                }
+                _tenant_weights[names.Get(i).ToString().Utf8Value()] = weight.As<Napi::Number>().DoubleValue();
+            }
+        }
+
+        _tsfn = Napi::ThreadSafeFunction::New(env, Napi::Function::New(env, [](const Napi::CallbackInfo& info) -> Napi::Value {
+            return info.Env().Undefined();
+        }), "node-printer:scheduler", 0, 1);
+        _tsfn.Unref(env);
+        for(int i = 0; i < concurrency; ++i)
+        {
+            _workers.push_back(std::thread(&JobScheduler::run, this));
+        }
+        napi_add_env_cleanup_hook(env, &JobScheduler::cleanup, this);
+    }
+
+    JobScheduler::~JobScheduler()
+    {
+        stop();
+    }
+
+    void JobScheduler::cleanup(void *iData)
+    {
+        static_cast<JobScheduler*>(iData)->stop();
+    }
+
+    void JobScheduler::stop()
+    {
+        if(_workers.empty())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wakeup.notify_all();
+        for(size_t i = 0; i < _workers.size(); ++i)
+        {
+            _workers[i].join();
+        }
+        _workers.clear();
+        napi_remove_env_cleanup_hook(_env, &JobScheduler::cleanup, this);
+        // callbacks of the dropped jobs are released with the environment
+        _tsfn.Abort();
+    }
+
+    bool JobScheduler::parseClasses(Napi::Env env, Napi::Value iClasses)
+    {
+        if(iClasses.IsUndefined())
+        {
+            const char *names[] = { "urgent", "normal", "bulk" };
+            const int priorities[] = { 90, 50, 10 };
+            for(size_t i = 0; i < 3; ++i)
+            {
+                JobClass job_class;
+                job_class.name = names[i];
+                job_class.priority = priorities[i];
+                _classes.push_back(job_class);
+            }
+            return true;
+        }
+        if(!iClasses.IsObject())
+        {
+            Napi::TypeError::New(env, "createJobScheduler:classes must be an object of {name: job-priority}").ThrowAsJavaScriptException();
+            return false;
+        }
+        Napi::Object classes = iClasses.As<Napi::Object>();
+        Napi::Array names = classes.GetPropertyNames();
+        for(uint32_t i = 0; i < names.Length(); ++i)
+        {
+            Napi::Value priority = classes.Get(names.Get(i));
+            int value = priority.IsNumber() ? priority.As<Napi::Number>().Int32Value() : 0;
+            if(value < 1 || value > 100)
+            {
+                Napi::TypeError::New(env, "createJobScheduler:class priorities must be job-priority values, 1 to 100").ThrowAsJavaScriptException();
+                return false;
+            }
+            JobClass job_class;
+            job_class.name = names.Get(i).ToString().Utf8Value();
+            job_class.priority = value;
+            _classes.push_back(job_class);
+        }
+        if(_classes.empty())
+        {
+            Napi::TypeError::New(env, "createJobScheduler:classes must not be empty").ThrowAsJavaScriptException();
+            return false;
+        }
+        std::stable_sort(_classes.begin(), _classes.end(), [](const JobClass &iLeft, const JobClass &iRight) {
+            return iLeft.priority > iRight.priority;
+        });
+        return true;
+    }
+
+    ScheduledJobPtr JobScheduler::next(ClockType::time_point iNow)
+    {
+        // rank of a class: its position, minus one for each aging period waited by its oldest job
+        size_t best = _classes.size();
+        int64_t best_rank = 0;
+        for(size_t i = 0; i < _classes.size(); ++i)
+        {
+            if(_classes[i].queue.empty())
+            {
+                continue;
+            }
+            int64_t rank = static_cast<int64_t>(i) - (iNow - _classes[i].arrivals.begin()->second) / _aging;
+            if(best == _classes.size() || rank < best_rank)
+            {
+                best = i;
+                best_rank = rank;
+            }
+        }
+        if(best == _classes.size())
+        {
+            return ScheduledJobPtr();
+        }
+        JobClass &job_class = _classes[best];
+        ScheduledJobPtr job = *job_class.queue.begin();
+        job_class.queue.erase(job_class.queue.begin());
+        job_class.arrivals.erase(job->sequence);
+        job_class.virtual_time = job->finish;
+        return job;
+    }
+
+    void JobScheduler::run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while(true)
+        {
+            ClockType::time_point now = ClockType::now();
+            ScheduledJobPtr job = _stopping ? ScheduledJobPtr() : next(now);
+            if(!job)
+            {
+                if(_stopping || _closing)
+                {
+                    return;
+                }
+                _wakeup.wait(lock);
+                continue;
+            }
+
+            ScheduledResult *result = new ScheduledResult();
+            result->scheduler = this;
+            result->job = job;
+            result->wait_ms = std::chrono::duration<double, std::milli>(now - job->queued).count();
+            JobClass &job_class = _classes[job->class_index];
+            ++job_class.waited;
+            job_class.wait_total_ms += result->wait_ms;
+            job_class.wait_max_ms = std::max(job_class.wait_max_ms, result->wait_ms);
+            lock.unlock();
+
+            ipp_status_t status;
+            result->job_id = getCurrentPrintBackend()->printData(job->server, job->printer_name, job->docname, job->format, *job->options,
+                job->data.data(), job->data.size(), status, result->error);
+            // the data is not needed anymore, only the callback
+            std::string().swap(job->data);
+
+            lock.lock();
+            if(result->job_id != 0)
+            {
+                ++job_class.submitted;
+            }
+            else
+            {
+                ++job_class.failed;
+            }
+            lock.unlock();
+            if(_tsfn.BlockingCall(result, &JobScheduler::onSubmitted) != napi_ok)
+            {
+                // environment is being torn down: callbacks cannot be called anymore
+                delete result;
+            }
+            lock.lock();
+        }
+    }
+
+    void JobScheduler::onSubmitted(Napi::Env env, Napi::Function, ScheduledResult *iResult)
+    {
+        std::unique_ptr<ScheduledResult> result(iResult);
+        std::unique_ptr<Napi::FunctionReference> callback(result->job->callback);
+        JobScheduler *scheduler = result->scheduler;
+        if(--scheduler->_pending_callbacks == 0)
+        {
+            scheduler->_tsfn.Unref(env);
+            scheduler->Unref();
+        }
+
+        if(!result->error.empty())
+        {
+            callback->Call({ Napi::Error::New(env, result->error).Value() });
+            return;
+        }
+        Napi::Object job = Napi::Object::New(env);
+        job.Set("id", Napi::Number::New(env, result->job_id));
+        job.Set("class", Napi::String::New(env, scheduler->_classes[result->job->class_index].name));
+        job.Set("tenant", Napi::String::New(env, result->job->tenant));
+        job.Set("waitMs", Napi::Number::New(env, result->wait_ms));
+        callback->Call({ env.Null(), job });
+    }
+
+    Napi::Value JobScheduler::Submit(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+
+        if(_workers.empty() || _closing)
+        {
+            Napi::Error::New(env, "submit: scheduler is closed").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        if(info.Length() < 2 || !info[0].IsObject() || !info[1].IsFunction())
+        {
+            Napi::TypeError::New(env, "submit:arguments must be an object and a callback function").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        Napi::Object arg_params = info[0].As<Napi::Object>();
+        ScheduledJobPtr job = std::make_shared<ScheduledJob>();
+
+        // data, copied: the job waits on other threads
+        struct iovec data;
+        bool encoded = false;
+        std::string encoding_error;
+        if(!getEncodedDataFromV8Params(arg_params, job->data, encoded, encoding_error))
+        {
+            Napi::TypeError::New(env, "submit:" + encoding_error).ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        if(!encoded)
+        {
+            if(!getDataFromV8Value(arg_params.Get("data"), job->data, data))
+            {
+                Napi::TypeError::New(env, "submit:data parameter must be a string or Buffer").ThrowAsJavaScriptException();
+                return env.Undefined();
+            }
+            if(data.iov_base != job->data.data())
+            {
+                job->data.assign(static_cast<const char*>(data.iov_base), data.iov_len);
+            }
+        }
+
+        if(!getCupsServerFromV8Value(arg_params.Get("server"), job->server))
+        {
+            Napi::TypeError::New(env, "submit:server parameter must be a string").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+
+        Napi::Value arg_value_printer = arg_params.Get("printer");
+        if(arg_value_printer.IsString())
+        {
+            job->printer_name = arg_value_printer.As<Napi::String>().Utf8Value();
+        }
+        else
+        {
+            // default printer of the server of the job
+            PooledCupsConnection connection(job->server);
+            const char *default_printer_name = (connection.isDefault() || connection.get() != NULL) ? cupsGetDefault2(connection.get()) : NULL;
+            if(default_printer_name == NULL)
+            {
+                Napi::TypeError::New(env, "submit:printer parameter must be a string").ThrowAsJavaScriptException();
+                return env.Undefined();
+            }
+            job->printer_name = default_printer_name;
+        }
+
+        job->docname = "node print job";
+        Napi::Value arg_value_docname = arg_params.Get("docname");
+        if(arg_value_docname.IsString())
+        {
+            job->docname = arg_value_docname.As<Napi::String>().Utf8Value();
+        }
+
+        std::string type_str = "RAW";
+        Napi::Value arg_value_type = arg_params.Get("type");
+        if(arg_value_type.IsString())
+        {
+            type_str = arg_value_type.As<Napi::String>().Utf8Value();
+        }
+        FormatMapType::const_iterator itFormat = getPrinterFormatMap().find(type_str);
+        if(itFormat == getPrinterFormatMap().end())
+        {
+            Napi::TypeError::New(env, "submit: unsupported format type").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        job->format = itFormat->second;
+
+        // class, the middle one by default
+        job->class_index = _classes.size() / 2;
+        Napi::Value arg_value_class = arg_params.Get("class");
+        if(!arg_value_class.IsUndefined())
+        {
+            std::string class_name = arg_value_class.ToString().Utf8Value();
+            job->class_index = _classes.size();
+            for(size_t i = 0; i < _classes.size(); ++i)
+            {
+                if(_classes[i].name == class_name)
+                {
+                    job->class_index = i;
+                }
+            }
+            if(job->class_index == _classes.size())
+            {
+                Napi::TypeError::New(env, "submit:unknown class " + class_name).ThrowAsJavaScriptException();
+                return env.Undefined();
+            }
+        }
+
+        Napi::Value arg_value_tenant = arg_params.Get("tenant");
+        if(arg_value_tenant.IsString())
+        {
+            job->tenant = arg_value_tenant.As<Napi::String>().Utf8Value();
+        }
+
+        CupsOptionsPtr options;
+        if(!getCupsOptionsFromV8Value(arg_params.Get("options"), options))
+        {
+            Napi::TypeError::New(env, "submit:options parameter must be an object").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        // rejected before it waits in the queue
+        std::string preflight_error;
+        if(!preflightV8Params(arg_params, job->server, job->printer_name, *options, preflight_error))
+        {
+            Napi::Error::New(env, "submit: " + preflight_error).ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        // the class priority orders the jobs in the printer queue too, unless the job has its own
+        if(cupsGetOption("job-priority", options->size(), options->get()) == NULL)
+        {
+            std::shared_ptr<CupsOptions> prioritized = std::make_shared<CupsOptions>();
+            cups_option_t *option = options->get();
+            for(int i = 0; i < options->size(); ++i, ++option)
+            {
+                prioritized->add(option->name, option->value);
+            }
+            prioritized->add("job-priority", std::to_string(_classes[job->class_index].priority));
+            options = prioritized;
+        }
+        job->options = options;
+
+        job->callback = new Napi::FunctionReference(Napi::Persistent(info[1].As<Napi::Function>()));
+        if(_pending_callbacks++ == 0)
+        {
+            // not collected while its workers may still call back
+            _tsfn.Ref(env);
+            Ref();
+        }
+
+        std::map<std::string, double>::const_iterator itWeight = _tenant_weights.find(job->tenant);
+        double weight = (itWeight != _tenant_weights.end()) ? itWeight->second : 1;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            JobClass &job_class = _classes[job->class_index];
+            double &tenant_finish = job_class.tenant_finish[job->tenant];
+            double start = std::max(job_class.virtual_time, tenant_finish);
+            job->finish = start + std::max(static_cast<double>(job->data.size()), MIN_JOB_COST) / weight;
+            tenant_finish = job->finish;
+            job->sequence = _next_sequence++;
+            job->queued = ClockType::now();
+            job_class.queue.insert(job);
+            job_class.arrivals[job->sequence] = job->queued;
+        }
+        _wakeup.notify_one();
+        return env.Undefined();
+    }
+
+    Napi::Value JobScheduler::Stats(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        Napi::Object result = Napi::Object::New(env);
+        ClockType::time_point now = ClockType::now();
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(std::vector<JobClass>::const_iterator itClass = _classes.begin(); itClass != _classes.end(); ++itClass)
+        {
+            double oldest_ms = itClass->arrivals.empty() ? 0 : std::chrono::duration<double, std::milli>(now - itClass->arrivals.begin()->second).count();
+            Napi::Object stats = Napi::Object::New(env);
+            stats.Set("priority", Napi::Number::New(env, itClass->priority));
+            stats.Set("queued", Napi::Number::New(env, static_cast<double>(itClass->queue.size())));
+            stats.Set("submitted", Napi::Number::New(env, static_cast<double>(itClass->submitted)));
+            stats.Set("failed", Napi::Number::New(env, static_cast<double>(itClass->failed)));
+            stats.Set("waitAvgMs", Napi::Number::New(env, itClass->waited ? itClass->wait_total_ms / itClass->waited : 0));
+            stats.Set("waitMaxMs", Napi::Number::New(env, itClass->wait_max_ms));
+            stats.Set("oldestMs", Napi::Number::New(env, oldest_ms));
+            result.Set(itClass->name, stats);
+        }
+        return result;
+    }
+
+    Napi::Value JobScheduler::Close(const Napi::CallbackInfo& info)
+    {
+        // queued jobs are still submitted, then the workers exit
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closing = true;
+        }
+        _wakeup.notify_all();
+        return info.Env().Undefined();
+    }
+}
+
+Napi::Value createJobScheduler(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    Napi::Value options = (info.Length() > 0) ? info[0] : env.Undefined();
+    Napi::Object result = JobScheduler::GetClass(env).New({ options });
+    if(env.IsExceptionPending())
+    {
+        return env.Undefined();
+    }
+    return result;
+}
@@ -0,0 +1,294 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+namespace
+{
+    /** idle connections kept per server */
+    const size_t MAX_IDLE_CONNECTIONS = 4;
+    /** idle connections older than this are closed instead of reused: the server may have dropped them */
+    const int MAX_IDLE_MS = 30000;
+
+    struct IdleConnection
+    {
+        http_t *http;
+        std::chrono::steady_clock::time_point released;
+    };
+
+    /** Idle connections of every server, shared by all threads.
+     * A connection is either idle here or borrowed by one PooledCupsConnection.
+     */
+    class CupsServerPools
+    {
+    public:
+        static CupsServerPools& instance()
+        {
+            // never destroyed: connections may still be borrowed by threads at exit
+            static CupsServerPools *result = new CupsServerPools();
+            return *result;
+        }
+
+        http_t* acquire(const std::string &iServer, int iTimeoutMs)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                std::vector<IdleConnection> &idle = _idle[iServer];
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                while(!idle.empty())
+                {
+                    IdleConnection connection = idle.back();
+                    idle.pop_back();
+                    if(now - connection.released < std::chrono::milliseconds(MAX_IDLE_MS))
+                    {
+                        return connection.http;
+                    }
+                    httpClose(connection.http);
+                }
+            }
+            // connect outside of the lock: a slow server must not delay the others
+            return connectToServer(iServer, iTimeoutMs);
+        }
+
+        void release(const std::string &iServer, http_t *iHttp)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::vector<IdleConnection> &idle = _idle[iServer];
+            if(idle.size() >= MAX_IDLE_CONNECTIONS)
+            {
+                httpClose(iHttp);
+                return;
+            }
+            IdleConnection connection = { iHttp, std::chrono::steady_clock::now() };
+            idle.push_back(connection);
+        }
+
+    private:
+        /** @param iServer host, host:port, [ipv6]:port or domain socket path, as CUPS_SERVER
+         */
+        static http_t* connectToServer(const std::string &iServer, int iTimeoutMs)
+        {
+            std::string host = iServer;
+            int port = ippPort();
+            if(!host.empty() && host[0] != '/')
+            {
+                size_t colon = host.rfind(':');
+                size_t bracket = host.rfind(']');
+                if(colon != std::string::npos && (bracket == std::string::npos || colon > bracket))
+                {
+                    port = atoi(host.c_str() + colon + 1);
+                    host.erase(colon);
+                }
+                if(host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']')
+                {
+                    host = host.substr(1, host.size() - 2);
+                }
+            }
+            return httpConnect2(host.c_str(), port, NULL, AF_UNSPEC, cupsEncryption(), 1/*blocking*/, iTimeoutMs, NULL);
+        }
+
+        std::mutex _mutex;
+        std::map<std::string, std::vector<IdleConnection> > _idle;
+    };
+
+    /** Printers of one server, fetched on its own thread
+     */
+    struct ServerQuery
+    {
+        std::string server;
+        std::shared_ptr<PrintersSnapshot> snapshot;
+        std::string error;
+    };
+
+    /** Query all servers in parallel, one thread per server: the whole query
+     * takes as long as the slowest server
+     */
+    class MultiServerQueryWorker: public Napi::AsyncWorker
+    {
+    public:
+        MultiServerQueryWorker(const Napi::Function &iCallback, const std::vector<std::string> &iServers, int iTimeoutMs):
+            Napi::AsyncWorker(iCallback, "node-printer:getPrintersMulti"),
+            _timeout_ms(iTimeoutMs)
+        {
+            _queries.resize(iServers.size());
+            for(size_t i = 0; i < iServers.size(); ++i)
+            {
+                _queries[i].server = iServers[i];
+            }
+        }
+
+    protected:
+        void Execute()
+        {
+            std::vector<std::thread> threads;
+            for(size_t i = 0; i < _queries.size(); ++i)
+            {
+                threads.push_back(std::thread(&MultiServerQueryWorker::query, this, std::ref(_queries[i])));
+            }
+            for(size_t i = 0; i < threads.size(); ++i)
+            {
+                threads[i].join();
+            }
+
+            // an error only if no server answered
+            for(size_t i = 0; i < _queries.size(); ++i)
+            {
+                if(_queries[i].snapshot)
+                {
+                    return;
+                }
+            }
+            SetError(_queries.empty() ? "getPrintersMulti: no server" : _queries[0].error);
+        }
+
+        std::vector<napi_value> GetResult(Napi::Env env)
+        {
+            Napi::Array printers = Napi::Array::New(env);
+            Napi::Array errors = Napi::Array::New(env);
+            uint32_t printers_count = 0;
+            uint32_t errors_count = 0;
+            for(std::vector<ServerQuery>::const_iterator itQuery = _queries.begin(); itQuery != _queries.end(); ++itQuery)
+            {
+                Napi::String server = Napi::String::New(env, itQuery->server);
+                if(!itQuery->snapshot)
+                {
+                    Napi::Object error = Napi::Object::New(env);
+                    error.Set("server", server);
+                    error.Set("message", Napi::String::New(env, itQuery->error));
+                    errors.Set(errors_count++, error);
+                    continue;
+                }
+                for(int i = 0; i < itQuery->snapshot->num_dests; ++i)
+                {
+                    Napi::Object printer = printerSnapshotToV8(*itQuery->snapshot, i, env);
+                    printer.Set("server", server);
+                    printers.Set(printers_count++, printer);
+                }
+            }
+
+            Napi::Object result = Napi::Object::New(env);
+            result.Set("printers", printers);
+            result.Set("errors", errors);
+            return { env.Null(), result };
+        }
+
+    private:
+        void query(ServerQuery &ioQuery)
+        {
+            PooledCupsConnection connection(ioQuery.server, _timeout_ms);
+            if(connection.get() == NULL)
+            {
+                ioQuery.error = "unable to connect to CUPS server " + ioQuery.server;
+                return;
+            }
+            std::shared_ptr<PrintersSnapshot> snapshot = std::make_shared<PrintersSnapshot>();
+            if(!fetchPrintersSnapshot(connection.get(), "", *snapshot, ioQuery.error))
+            {
+                ioQuery.error = ioQuery.server + ": " + ioQuery.error;
+                connection.discard();
+                return;
+            }
+            ioQuery.snapshot = snapshot;
+        }
+
+        int _timeout_ms;
+        std::vector<ServerQuery> _queries;
+    };
+}
+
+PooledCupsConnection::PooledCupsConnection(const std::string &iServer, int iTimeoutMs):
+    _server(iServer),
+    _http(CUPS_HTTP_DEFAULT)
+{
+    if(!_server.empty())
+    {
+        _http = CupsServerPools::instance().acquire(_server, iTimeoutMs);
+    }
+}
+
+PooledCupsConnection::~PooledCupsConnection()
+{
+    if(_http != CUPS_HTTP_DEFAULT)
+    {
+        CupsServerPools::instance().release(_server, _http);
+    }
+}
+
+void PooledCupsConnection::discard()
+{
+    if(_http != CUPS_HTTP_DEFAULT)
+    {
+        httpClose(_http);
+        _http = CUPS_HTTP_DEFAULT;
+    }
+}
+
+bool getCupsServerFromV8Value(Napi::Value iV8Value, std::string &oServer)
+{
+    if(iV8Value.IsUndefined() || iV8Value.IsNull())
+    {
+        oServer.clear();
+        return true;
+    }
+    if(!iV8Value.IsString())
+    {
+        return false;
+    }
+    oServer = iV8Value.As<Napi::String>().Utf8Value();
+    return true;
+}
+
+Napi::Value getPrintersMulti(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 3 || !info[2].IsFunction())
+    {
+        Napi::TypeError::New(env, "getPrintersMulti:third argument must be a callback function").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[0].IsArray())
+    {
+        Napi::TypeError::New(env, "getPrintersMulti:first argument must be an array of servers").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    Napi::Array arg_servers = info[0].As<Napi::Array>();
+    std::vector<std::string> servers;
+    for(uint32_t i = 0; i < arg_servers.Length(); ++i)
+    {
+        std::string server;
+        if(!getCupsServerFromV8Value(arg_servers.Get(i), server) || server.empty())
+        {
+            Napi::TypeError::New(env, "getPrintersMulti:servers must be non empty strings").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        servers.push_back(server);
+    }
+
+    // connection timeout of each server
+    int timeout_ms = 30000;
+    if(info[1].IsObject())
+    {
+        Napi::Value arg_timeout = info[1].As<Napi::Object>().Get("timeout");
+        if(!arg_timeout.IsUndefined())
+        {
+            if(!arg_timeout.IsNumber() || arg_timeout.As<Napi::Number>().Int32Value() <= 0)
+            {
+                Napi::TypeError::New(env, "getPrintersMulti:timeout must be a positive number").ThrowAsJavaScriptException();
+                return env.Undefined();
+            }
+            timeout_ms = arg_timeout.As<Napi::Number>().Int32Value();
+        }
+    }
+
+    (new MultiServerQueryWorker(info[2].As<Napi::Function>(), servers, timeout_ms))->Queue();
+    return env.Undefined();
+}
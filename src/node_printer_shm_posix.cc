@@ -0,0 +1,343 @@
+#include "node_printer_posix.hpp"
+
+#include <atomic>
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+    /** 'NPC' + layout version: a segment with another layout is refused */
+    const uint32_t SHARED_CACHE_MAGIC = 0x4e504301;
+    const size_t DEFAULT_SHARED_CACHE_SIZE = 4 * 1024 * 1024;
+    /** read attempts while a writer is publishing, before reporting a miss */
+    const int MAX_READ_ATTEMPTS = 64;
+
+    /** Start of the segment. The data follows the header.
+     * sequence is a seqlock: odd while a writer copies the data, incremented again once done.
+     * Readers copy the data without lock and retry if the sequence moved meanwhile.
+     */
+    struct SharedCacheHeader
+    {
+        std::atomic<uint32_t> magic;
+        /** pid of the process publishing, 0 if none: one writer at a time */
+        std::atomic<uint32_t> writer;
+        std::atomic<uint64_t> sequence;
+        /** CLOCK_REALTIME ms of the publication, shared by all processes of the host */
+        std::atomic<uint64_t> published_ms;
+        std::atomic<uint64_t> length;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared cache needs lock free 64 bits atomics");
+
+    uint64_t realtimeMs()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000 + static_cast<uint64_t>(now.tv_nsec) / 1000000;
+    }
+
+    /** Named shared memory segment holding the last published printers, see openSharedCache.
+     * Any process may publish, readers never block publishers nor each other.
+     */
+    class SharedCache: public Napi::ObjectWrap<SharedCache>
+    {
+    public:
+        static Napi::Function GetClass(Napi::Env env);
+
+        SharedCache(const Napi::CallbackInfo& info);
+        ~SharedCache();
+
+    private:
+        Napi::Value Read(const Napi::CallbackInfo& info);
+        Napi::Value Publish(const Napi::CallbackInfo& info);
+        Napi::Value Close(const Napi::CallbackInfo& info);
+        Napi::Value GetName(const Napi::CallbackInfo& info);
+        Napi::Value GetCapacity(const Napi::CallbackInfo& info);
+
+        /** Throw if the segment was closed
+         * @return false if closed
+         */
+        bool checkOpened(Napi::Env env, const char *iMethodName);
+
+        /** Become the writer, taking over from a writer process which died while publishing
+         * @return false if another process is publishing
+         */
+        bool lockWriter();
+
+        void release();
+
+        std::string _name;
+        SharedCacheHeader *_header;
+        char *_data;
+        size_t _size;
+        size_t _capacity;
+        /** last data read, reused between reads */
+        std::string _read_buffer;
+    };
+
+    Napi::Function SharedCache::GetClass(Napi::Env env)
+    {
+        Napi::FunctionReference &constructor = getAddonData(env).constructors["SharedCache"];
+        if(constructor.IsEmpty())
+        {
+            constructor = Napi::Persistent(DefineClass(env, "SharedCache", {
+                InstanceMethod("read", &SharedCache::Read),
+                InstanceMethod("publish", &SharedCache::Publish),
+                InstanceMethod("close", &SharedCache::Close),
+                InstanceAccessor("name", &SharedCache::GetName, nullptr),
+                InstanceAccessor("capacity", &SharedCache::GetCapacity, nullptr)
+            }));
+        }
+        return constructor.Value();
+    }
+
+    SharedCache::SharedCache(const Napi::CallbackInfo& info):
+        Napi::ObjectWrap<SharedCache>(info),
+        _header(NULL),
+        _data(NULL),
+        _size(0),
+        _capacity(0)
+    {
+        Napi::Env env = info.Env();
+
+        if(info.Length() < 1 || !info[0].IsString())
+        {
+            Napi::TypeError::New(env, "openSharedCache:first argument must be a string").ThrowAsJavaScriptException();
+            return;
+        }
+        _name = info[0].As<Napi::String>().Utf8Value();
+        if(_name.empty() || _name.find('/', 1) != std::string::npos)
+        {
+            Napi::TypeError::New(env, "openSharedCache:name must be non empty, without '/'").ThrowAsJavaScriptException();
+            return;
+        }
+        // POSIX names start with one slash
+        if(_name[0] != '/')
+        {
+            _name.insert(0, "/");
+        }
+
+        size_t size = DEFAULT_SHARED_CACHE_SIZE;
+        if(info.Length() > 1 && info[1].IsObject())
+        {
+            Napi::Value arg_size = info[1].As<Napi::Object>().Get("size");
+            if(!arg_size.IsUndefined())
+            {
+                if(!arg_size.IsNumber() || arg_size.As<Napi::Number>().DoubleValue() < 4096)
+                {
+                    Napi::TypeError::New(env, "openSharedCache:size must be a number of at least 4096").ThrowAsJavaScriptException();
+                    return;
+                }
+                size = static_cast<size_t>(arg_size.As<Napi::Number>().DoubleValue());
+            }
+        }
+
+        int fd = shm_open(_name.c_str(), O_RDWR | O_CREAT, 0600);
+        if(fd == -1)
+        {
+            Napi::Error::New(env, "openSharedCache: unable to open " + _name + ": " + strerror(errno)).ThrowAsJavaScriptException();
+            return;
+        }
+        // the first process sizes the segment, the others use its size
+        struct stat segment_stat;
+        if(fstat(fd, &segment_stat) == -1
+            || (segment_stat.st_size == 0 && ftruncate(fd, static_cast<off_t>(size)) == -1))
+        {
+            std::string error_str = "openSharedCache: unable to size " + _name + ": " + strerror(errno);
+            ::close(fd);
+            Napi::Error::New(env, error_str).ThrowAsJavaScriptException();
+            return;
+        }
+        if(segment_stat.st_size != 0)
+        {
+            size = static_cast<size_t>(segment_stat.st_size);
+        }
+        if(size <= sizeof(SharedCacheHeader))
+        {
+            ::close(fd);
+            Napi::Error::New(env, "openSharedCache: " + _name + " is too small").ThrowAsJavaScriptException();
+            return;
+        }
+
+        void *segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        // the mapping stays valid after close
+        ::close(fd);
+        if(segment == MAP_FAILED)
+        {
+            Napi::Error::New(env, "openSharedCache: unable to map " + _name).ThrowAsJavaScriptException();
+            return;
+        }
+        _size = size;
+        _header = static_cast<SharedCacheHeader*>(segment);
+        _data = static_cast<char*>(segment) + sizeof(SharedCacheHeader);
+        _capacity = size - sizeof(SharedCacheHeader);
+
+        // a new segment is zero filled, which is an empty cache: only the magic is set
+        uint32_t magic = 0;
+        if(!_header->magic.compare_exchange_strong(magic, SHARED_CACHE_MAGIC) && magic != SHARED_CACHE_MAGIC)
+        {
+            release();
+            Napi::Error::New(env, "openSharedCache: " + _name + " is not a printer cache of this version").ThrowAsJavaScriptException();
+            return;
+        }
+    }
+
+    SharedCache::~SharedCache()
+    {
+        release();
+    }
+
+    void SharedCache::release()
+    {
+        if(_header != NULL)
+        {
+            munmap(_header, _size);
+            _header = NULL;
+            _data = NULL;
+        }
+    }
+
+    bool SharedCache::checkOpened(Napi::Env env, const char *iMethodName)
+    {
+        if(_header == NULL)
+        {
+            Napi::Error::New(env, std::string(iMethodName) + ": shared cache is closed").ThrowAsJavaScriptException();
+            return false;
+        }
+        return true;
+    }
+
+    bool SharedCache::lockWriter()
+    {
+        uint32_t self = static_cast<uint32_t>(getpid());
+        uint32_t writer = 0;
+        if(_header->writer.compare_exchange_strong(writer, self))
+        {
+            return true;
+        }
+        // a writer which died while publishing would block all publications
+        if(writer != self && kill(static_cast<pid_t>(writer), 0) == -1 && errno == ESRCH)
+        {
+            return _header->writer.compare_exchange_strong(writer, self);
+        }
+        return false;
+    }
+
+    Napi::Value SharedCache::Read(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "read"))
+        {
+            return env.Undefined();
+        }
+
+        for(int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt)
+        {
+            uint64_t sequence = _header->sequence.load(std::memory_order_acquire);
+            if(sequence & 1)
+            {
+                sched_yield();
+                continue;
+            }
+            uint64_t length = _header->length.load(std::memory_order_relaxed);
+            uint64_t published_ms = _header->published_ms.load(std::memory_order_relaxed);
+            if(length > _capacity)
+            {
+                // torn read of the length, the sequence check below would fail too
+                continue;
+            }
+            _read_buffer.assign(_data, static_cast<size_t>(length));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(_header->sequence.load(std::memory_order_relaxed) != sequence)
+            {
+                continue;
+            }
+
+            if(sequence == 0)
+            {
+                // nothing was ever published
+                return env.Undefined();
+            }
+            uint64_t now_ms = realtimeMs();
+            Napi::Object result = Napi::Object::New(env);
+            result.Set("data", Napi::String::New(env, _read_buffer));
+            // a publication in the future (clock set back) is reported as old as it can be
+            result.Set("age", Napi::Number::New(env, (published_ms <= now_ms) ? static_cast<double>(now_ms - published_ms) : INFINITY));
+            result.Set("version", Napi::Number::New(env, static_cast<double>(sequence / 2)));
+            return result;
+        }
+        // a writer is still publishing: the caller falls back to the print server
+        return env.Undefined();
+    }
+
+    Napi::Value SharedCache::Publish(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(!checkOpened(env, "publish"))
+        {
+            return env.Undefined();
+        }
+        if(info.Length() < 1 || !info[0].IsString())
+        {
+            Napi::TypeError::New(env, "publish:first argument must be a string").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        std::string data = info[0].As<Napi::String>().Utf8Value();
+        if(data.size() > _capacity || !lockWriter())
+        {
+            return Napi::Boolean::New(env, false);
+        }
+
+        uint64_t sequence = _header->sequence.load(std::memory_order_relaxed);
+        // odd if the previous writer died while publishing
+        sequence += (sequence & 1) ? 1 : 2;
+        _header->sequence.store(sequence - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(_data, data.data(), data.size());
+        _header->length.store(data.size(), std::memory_order_relaxed);
+        _header->published_ms.store(realtimeMs(), std::memory_order_relaxed);
+        _header->sequence.store(sequence, std::memory_order_release);
+        _header->writer.store(0, std::memory_order_release);
+        return Napi::Boolean::New(env, true);
+    }
+
+    Napi::Value SharedCache::Close(const Napi::CallbackInfo& info)
+    {
+        release();
+        return info.Env().Undefined();
+    }
+
+    Napi::Value SharedCache::GetName(const Napi::CallbackInfo& info)
+    {
+        return Napi::String::New(info.Env(), _name);
+    }
+
+    Napi::Value SharedCache::GetCapacity(const Napi::CallbackInfo& info)
+    {
+        return Napi::Number::New(info.Env(), static_cast<double>(_capacity));
+    }
+}
+
+Napi::Value openSharedCache(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    Napi::Value name = (info.Length() > 0) ? info[0] : env.Undefined();
+    Napi::Value options = (info.Length() > 1) ? info[1] : env.Undefined();
+    Napi::Object result = SharedCache::GetClass(env).New({ name, options });
+    if(env.IsExceptionPending())
+    {
+        return env.Undefined();
+    }
+    return result;
+}
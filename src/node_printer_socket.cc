@@ -0,0 +1,665 @@
+#include "node_printer.hpp"
+
+#include <uv.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+
+namespace
+{
+    const int DEFAULT_SOCKET_PORT = 9100;
+    const uint64_t CONNECT_TIMEOUT_MS = 10000;
+    /** an unused connection is closed after this delay */
+    const uint64_t IDLE_TIMEOUT_MS = 30000;
+
+    /** Job sent to an AppSocket printer. Buffer data is referenced, not copied
+     */
+    struct SocketJob
+    {
+        int id;
+        std::string storage;
+        Napi::ObjectReference buffer;
+        uv_buf_t data;
+        Napi::FunctionReference callback;
+    };
+
+    typedef std::unique_ptr<SocketJob> SocketJobPtr;
+
+    class SocketConnection;
+    class SocketBackend;
+
+    struct SocketResolve
+    {
+        uv_getaddrinfo_t request;
+        SocketConnection *connection;
+        /** connection attempt the address was resolved for */
+        int attempt;
+    };
+
+    /** Jobs written by one uv_write, i.e. one writev
+     */
+    struct SocketWrite
+    {
+        uv_write_t request;
+        SocketConnection *connection;
+        /** socket written to, the connection may have been reset since */
+        uv_tcp_t *tcp;
+        std::vector<SocketJobPtr> jobs;
+        std::vector<uv_buf_t> buffers;
+    };
+
+    /** Persistent connection to an AppSocket/JetDirect device, driven by the Node.js event loop.
+     * Jobs submitted while a write is in progress are written together by the next one.
+     */
+    class SocketConnection
+    {
+    public:
+        SocketConnection(Napi::Env env, SocketBackend *iBackend, const std::string &iUri, const std::string &iHost, int iPort);
+
+        void submit(SocketJobPtr iJob);
+
+        /** Close the handles at environment teardown, without calling the pending callbacks.
+         * The backend is told once libuv released the connection
+         */
+        void shutdown();
+
+        /** @returns true while libuv may still call back with this connection
+         */
+        bool hasPendingCallbacks() const { return _callbacks > 0; }
+
+    private:
+        enum State
+        {
+            STATE_DISCONNECTED,
+            STATE_RESOLVING,
+            STATE_CONNECTING,
+            STATE_CONNECTED
+        };
+
+        void connect();
+        void flush();
+        /** Fail the given jobs and close the connection. Queued jobs are sent again on a new one
+         */
+        void fail(std::vector<SocketJobPtr> &ioJobs, const std::string &iError);
+        void disconnect();
+        /** Connect again if jobs are waiting
+         */
+        void resume();
+        void complete(std::vector<SocketJobPtr> &ioJobs, const std::string &iError);
+        void startTimer(uint64_t iTimeout);
+        /** Count a libuv callback as called. The connection may be deleted on return at teardown
+         * @returns true if the connection is shut down: the callback must not use it anymore
+         */
+        bool release();
+
+        static void onResolved(uv_getaddrinfo_t *iRequest, int iStatus, struct addrinfo *iResult);
+        static void onConnected(uv_connect_t *iRequest, int iStatus);
+        static void onWritten(uv_write_t *iRequest, int iStatus);
+        static void onAlloc(uv_handle_t *iHandle, size_t iSuggestedSize, uv_buf_t *oBuffer);
+        static void onRead(uv_stream_t *iStream, ssize_t iSize, const uv_buf_t *iBuffer);
+        static void onTimer(uv_timer_t *iTimer);
+        static void onClosed(uv_handle_t *iHandle);
+        static void onTimerClosed(uv_handle_t *iHandle);
+
+        Napi::Env _env;
+        SocketBackend *_backend;
+        std::string _uri;
+        std::string _host;
+        int _port;
+        State _state;
+        /** current socket, a new one is created for each connection */
+        uv_tcp_t *_tcp;
+        uv_timer_t _timer;
+        std::deque<SocketJobPtr> _queue;
+        bool _writing;
+        int _attempt;
+        /** address being resolved for the current attempt, NULL if none */
+        SocketResolve *_resolve;
+        /** requests and handle closings not called back yet */
+        int _callbacks;
+        bool _shutdown;
+        /** status and error messages sent by the printer are read and dropped */
+        char _read_buffer[512];
+    };
+
+    /** Connections of the environment, by printer URI
+     */
+    class SocketBackend: public AddonService
+    {
+    public:
+        static SocketBackend& getInstance(Napi::Env env);
+
+        SocketConnection& getConnection(Napi::Env env, const std::string &iUri, const std::string &iHost, int iPort);
+
+        int nextJobId() { return ++_last_job_id; }
+
+        /** Delete the backend once libuv released all its connections at teardown
+         */
+        void onConnectionReleased();
+
+    private:
+        SocketBackend(Napi::Env env);
+
+        /** Close the connections: the teardown goes on from their close callbacks
+         */
+        static void cleanup(napi_async_cleanup_hook_handle iHandle, void *iData);
+
+        napi_env _env;
+        napi_async_cleanup_hook_handle _cleanup_handle;
+        bool _stopping;
+        std::map<std::string, std::unique_ptr<SocketConnection> > _connections;
+        int _last_job_id;
+    };
+
+    SocketConnection::SocketConnection(Napi::Env env, SocketBackend *iBackend, const std::string &iUri, const std::string &iHost, int iPort):
+        _env(env),
+        _backend(iBackend),
+        _uri(iUri),
+        _host(iHost),
+        _port(iPort),
+        _state(STATE_DISCONNECTED),
+        _tcp(NULL),
+        _writing(false),
+        _attempt(0),
+        _resolve(NULL),
+        _callbacks(0),
+        _shutdown(false)
+    {
+        uv_loop_t *loop = NULL;
+        napi_get_uv_event_loop(env, &loop);
+        uv_timer_init(loop, &_timer);
+        _timer.data = this;
+        // pending requests keep the event loop alive, not the timer
+        uv_unref(reinterpret_cast<uv_handle_t*>(&_timer));
+    }
+
+    void SocketConnection::submit(SocketJobPtr iJob)
+    {
+        _queue.push_back(std::move(iJob));
+        if(_state == STATE_DISCONNECTED)
+        {
+            connect();
+        }
+        else if(_state == STATE_CONNECTED)
+        {
+            flush();
+        }
+    }
+
+    void SocketConnection::startTimer(uint64_t iTimeout)
+    {
+        uv_timer_start(&_timer, &SocketConnection::onTimer, iTimeout, 0);
+    }
+
+    void SocketConnection::connect()
+    {
+        uv_loop_t *loop = NULL;
+        napi_get_uv_event_loop(_env, &loop);
+
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        SocketResolve *resolve = new SocketResolve();
+        resolve->request.data = resolve;
+        resolve->connection = this;
+        resolve->attempt = ++_attempt;
+        _state = STATE_RESOLVING;
+        startTimer(CONNECT_TIMEOUT_MS);
+        int status = uv_getaddrinfo(loop, &resolve->request, &SocketConnection::onResolved, _host.c_str(), std::to_string(_port).c_str(), &hints);
+        if(status != 0)
+        {
+            delete resolve;
+            _state = STATE_DISCONNECTED;
+            std::vector<SocketJobPtr> jobs;
+            fail(jobs, uv_strerror(status));
+            return;
+        }
+        _resolve = resolve;
+        ++_callbacks;
+    }
+
+    void SocketConnection::onResolved(uv_getaddrinfo_t *iRequest, int iStatus, struct addrinfo *iResult)
+    {
+        std::unique_ptr<SocketResolve> resolve(static_cast<SocketResolve*>(iRequest->data));
+        SocketConnection *connection = resolve->connection;
+        if(connection->_resolve == resolve.get())
+        {
+            connection->_resolve = NULL;
+        }
+        if(connection->release())
+        {
+            // cancelled at environment teardown
+            uv_freeaddrinfo(iResult);
+            return;
+        }
+        if(connection->_state != STATE_RESOLVING || resolve->attempt != connection->_attempt)
+        {
+            // timed out meanwhile
+            uv_freeaddrinfo(iResult);
+            return;
+        }
+        std::vector<SocketJobPtr> jobs;
+        if(iStatus != 0)
+        {
+            connection->_state = STATE_DISCONNECTED;
+            connection->fail(jobs, std::string("cannot resolve ") + connection->_host + ": " + uv_strerror(iStatus));
+            return;
+        }
+
+        uv_loop_t *loop = NULL;
+        napi_get_uv_event_loop(connection->_env, &loop);
+        connection->_tcp = new uv_tcp_t();
+        uv_tcp_init(loop, connection->_tcp);
+        connection->_tcp->data = connection;
+        uv_unref(reinterpret_cast<uv_handle_t*>(connection->_tcp));
+        uv_tcp_nodelay(connection->_tcp, 1);
+        uv_tcp_keepalive(connection->_tcp, 1, 60);
+
+        uv_connect_t *request = new uv_connect_t();
+        request->data = connection;
+        connection->_state = STATE_CONNECTING;
+        int status = uv_tcp_connect(request, connection->_tcp, iResult->ai_addr, &SocketConnection::onConnected);
+        uv_freeaddrinfo(iResult);
+        if(status != 0)
+        {
+            delete request;
+            connection->fail(jobs, uv_strerror(status));
+        }
+    }
+
+    void SocketConnection::onConnected(uv_connect_t *iRequest, int iStatus)
+    {
+        SocketConnection *connection = static_cast<SocketConnection*>(iRequest->data);
+        uv_stream_t *stream = iRequest->handle;
+        delete iRequest;
+        if(iStatus == UV_ECANCELED || connection->_state != STATE_CONNECTING || reinterpret_cast<uv_tcp_t*>(stream) != connection->_tcp)
+        {
+            // closed meanwhile
+            return;
+        }
+        std::vector<SocketJobPtr> jobs;
+        if(iStatus != 0)
+        {
+            connection->fail(jobs, std::string("cannot connect to ") + connection->_uri + ": " + uv_strerror(iStatus));
+            return;
+        }
+        connection->_state = STATE_CONNECTED;
+        uv_timer_stop(&connection->_timer);
+        uv_read_start(stream, &SocketConnection::onAlloc, &SocketConnection::onRead);
+        connection->flush();
+    }
+
+    void SocketConnection::flush()
+    {
+        if(_writing || _queue.empty())
+        {
+            return;
+        }
+        uv_timer_stop(&_timer);
+
+        SocketWrite *write = new SocketWrite();
+        write->connection = this;
+        write->tcp = _tcp;
+        write->request.data = write;
+        while(!_queue.empty())
+        {
+            write->buffers.push_back(_queue.front()->data);
+            write->jobs.push_back(std::move(_queue.front()));
+            _queue.pop_front();
+        }
+        _writing = true;
+        int status = uv_write(&write->request, reinterpret_cast<uv_stream_t*>(_tcp), &write->buffers[0],
+            static_cast<unsigned int>(write->buffers.size()), &SocketConnection::onWritten);
+        if(status != 0)
+        {
+            _writing = false;
+            std::vector<SocketJobPtr> jobs;
+            jobs.swap(write->jobs);
+            delete write;
+            fail(jobs, uv_strerror(status));
+            return;
+        }
+        ++_callbacks;
+    }
+
+    void SocketConnection::onWritten(uv_write_t *iRequest, int iStatus)
+    {
+        std::unique_ptr<SocketWrite> write(static_cast<SocketWrite*>(iRequest->data));
+        SocketConnection *connection = write->connection;
+        if(connection->release())
+        {
+            // cancelled at environment teardown: the jobs are released without being called back
+            return;
+        }
+        if(write->tcp != connection->_tcp)
+        {
+            // cancelled by the closing of a previous connection
+            connection->complete(write->jobs, std::string("connection to ") + connection->_uri + " closed");
+            connection->resume();
+            return;
+        }
+        connection->_writing = false;
+        if(iStatus != 0)
+        {
+            connection->fail(write->jobs, std::string("cannot write to ") + connection->_uri + ": " + uv_strerror(iStatus));
+            return;
+        }
+        connection->complete(write->jobs, std::string());
+        if(connection->_state != STATE_CONNECTED)
+        {
+            return;
+        }
+        if(connection->_queue.empty())
+        {
+            connection->startTimer(IDLE_TIMEOUT_MS);
+        }
+        else
+        {
+            connection->flush();
+        }
+    }
+
+    void SocketConnection::onAlloc(uv_handle_t *iHandle, size_t, uv_buf_t *oBuffer)
+    {
+        SocketConnection *connection = static_cast<SocketConnection*>(iHandle->data);
+        *oBuffer = uv_buf_init(connection->_read_buffer, sizeof(connection->_read_buffer));
+    }
+
+    void SocketConnection::onRead(uv_stream_t *iStream, ssize_t iSize, const uv_buf_t*)
+    {
+        if(iSize >= 0)
+        {
+            return;
+        }
+        // closed by the printer: a write in progress is cancelled, then the queued jobs are sent on a new connection
+        SocketConnection *connection = static_cast<SocketConnection*>(iStream->data);
+        connection->disconnect();
+    }
+
+    void SocketConnection::onTimer(uv_timer_t *iTimer)
+    {
+        SocketConnection *connection = static_cast<SocketConnection*>(iTimer->data);
+        if(connection->_state == STATE_CONNECTED)
+        {
+            // idle
+            connection->disconnect();
+            return;
+        }
+        std::vector<SocketJobPtr> jobs;
+        connection->_state = STATE_DISCONNECTED;
+        connection->fail(jobs, std::string("connection to ") + connection->_uri + " timed out");
+    }
+
+    void SocketConnection::onClosed(uv_handle_t *iHandle)
+    {
+        SocketConnection *connection = static_cast<SocketConnection*>(iHandle->data);
+        delete reinterpret_cast<uv_tcp_t*>(iHandle);
+        connection->release();
+    }
+
+    void SocketConnection::onTimerClosed(uv_handle_t *iHandle)
+    {
+        static_cast<SocketConnection*>(iHandle->data)->release();
+    }
+
+    bool SocketConnection::release()
+    {
+        --_callbacks;
+        if(!_shutdown)
+        {
+            return false;
+        }
+        if(_callbacks == 0)
+        {
+            _backend->onConnectionReleased();
+        }
+        return true;
+    }
+
+    void SocketConnection::disconnect()
+    {
+        uv_timer_stop(&_timer);
+        if(_tcp != NULL)
+        {
+            uv_close(reinterpret_cast<uv_handle_t*>(_tcp), &SocketConnection::onClosed);
+            ++_callbacks;
+            _tcp = NULL;
+        }
+        _state = STATE_DISCONNECTED;
+        _writing = false;
+    }
+
+    void SocketConnection::fail(std::vector<SocketJobPtr> &ioJobs, const std::string &iError)
+    {
+        bool connecting = _state != STATE_CONNECTED;
+        disconnect();
+        if(connecting)
+        {
+            // the device cannot be reached: the queued jobs fail too
+            while(!_queue.empty())
+            {
+                ioJobs.push_back(std::move(_queue.front()));
+                _queue.pop_front();
+            }
+        }
+        complete(ioJobs, iError);
+        resume();
+    }
+
+    void SocketConnection::resume()
+    {
+        if(!_queue.empty() && _state == STATE_DISCONNECTED)
+        {
+            connect();
+        }
+    }
+
+    void SocketConnection::complete(std::vector<SocketJobPtr> &ioJobs, const std::string &iError)
+    {
+        Napi::HandleScope scope(_env);
+        for(std::vector<SocketJobPtr>::iterator itJob = ioJobs.begin(); itJob != ioJobs.end(); ++itJob)
+        {
+            SocketJobPtr job(std::move(*itJob));
+            if(iError.empty())
+            {
+                Napi::Object result = Napi::Object::New(_env);
+                result.Set("id", Napi::Number::New(_env, job->id));
+                result.Set("printer", Napi::String::New(_env, _uri));
+                job->callback.MakeCallback(_env.Global(), { _env.Null(), result });
+            }
+            else
+            {
+                job->callback.MakeCallback(_env.Global(), { Napi::Error::New(_env, iError).Value() });
+            }
+            if(_env.IsExceptionPending())
+            {
+                napi_fatal_exception(_env, _env.GetAndClearPendingException().Value());
+            }
+        }
+        ioJobs.clear();
+    }
+
+    void SocketConnection::shutdown()
+    {
+        _shutdown = true;
+        _queue.clear();
+        if(_resolve != NULL)
+        {
+            // fails if the lookup already started: its result is then dropped
+            uv_cancel(reinterpret_cast<uv_req_t*>(&_resolve->request));
+        }
+        // writes in progress are cancelled by the closing of the socket
+        disconnect();
+        uv_close(reinterpret_cast<uv_handle_t*>(&_timer), &SocketConnection::onTimerClosed);
+        ++_callbacks;
+    }
+
+    SocketBackend& SocketBackend::getInstance(Napi::Env env)
+    {
+        // one per environment: its handles belong to the event loop of the environment
+        std::unique_ptr<AddonService> &instance = getAddonData(env).services["SocketBackend"];
+        if(!instance)
+        {
+            instance.reset(new SocketBackend(env));
+        }
+        return static_cast<SocketBackend&>(*instance);
+    }
+
+    SocketBackend::SocketBackend(Napi::Env env):
+        _env(env),
+        _cleanup_handle(NULL),
+        _stopping(false),
+        _last_job_id(0)
+    {
+        napi_add_async_cleanup_hook(env, &SocketBackend::cleanup, this, &_cleanup_handle);
+    }
+
+    void SocketBackend::cleanup(napi_async_cleanup_hook_handle, void *iData)
+    {
+        // the environment waits for the hook to be removed: close callbacks run on its loop meanwhile
+        SocketBackend *backend = static_cast<SocketBackend*>(iData);
+        backend->_stopping = true;
+        typedef std::map<std::string, std::unique_ptr<SocketConnection> >::const_iterator ConnectionIterator;
+        for(ConnectionIterator itConnection = backend->_connections.begin(); itConnection != backend->_connections.end(); ++itConnection)
+        {
+            itConnection->second->shutdown();
+        }
+        backend->onConnectionReleased();
+    }
+
+    void SocketBackend::onConnectionReleased()
+    {
+        if(!_stopping)
+        {
+            return;
+        }
+        typedef std::map<std::string, std::unique_ptr<SocketConnection> >::const_iterator ConnectionIterator;
+        for(ConnectionIterator itConnection = _connections.begin(); itConnection != _connections.end(); ++itConnection)
+        {
+            if(itConnection->second->hasPendingCallbacks())
+            {
+                return;
+            }
+        }
+        napi_remove_async_cleanup_hook(_cleanup_handle);
+        // deletes the backend and its connections
+        getAddonData(Napi::Env(_env)).services.erase("SocketBackend");
+    }
+
+    SocketConnection& SocketBackend::getConnection(Napi::Env env, const std::string &iUri, const std::string &iHost, int iPort)
+    {
+        std::unique_ptr<SocketConnection> &connection = _connections[iUri];
+        if(!connection)
+        {
+            connection.reset(new SocketConnection(env, this, iUri, iHost, iPort));
+        }
+        return *connection;
+    }
+
+    /** Split socket://host[:port][/...] in host and port
+     */
+    bool parseSocketUri(const std::string &iUri, std::string &oHost, int &oPort)
+    {
+        const std::string scheme = "socket://";
+        if(iUri.compare(0, scheme.size(), scheme) != 0)
+        {
+            return false;
+        }
+        std::string authority = iUri.substr(scheme.size());
+        authority = authority.substr(0, authority.find_first_of("/?"));
+        oPort = DEFAULT_SOCKET_PORT;
+
+        size_t port_separator = std::string::npos;
+        if(!authority.empty() && authority[0] == '[')
+        {
+            // [IPv6 address]
+            size_t end = authority.find(']');
+            if(end == std::string::npos)
+            {
+                return false;
+            }
+            oHost = authority.substr(1, end - 1);
+            port_separator = authority.find(':', end);
+        }
+        else
+        {
+            port_separator = authority.find(':');
+            oHost = authority.substr(0, port_separator);
+        }
+        if(port_separator != std::string::npos)
+        {
+            oPort = atoi(authority.c_str() + port_separator + 1);
+        }
+        return !oHost.empty() && oPort > 0 && oPort < 65536;
+    }
+}
+
+Napi::Value PrintSocket(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 2)
+    {
+        Napi::TypeError::New(env, "printSocket:invalid number of arguments (2 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    if(!info[0].IsObject())
+    {
+        Napi::TypeError::New(env, "printSocket:first argument must be an object").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    if(!info[1].IsFunction())
+    {
+        Napi::TypeError::New(env, "printSocket:second argument must be a callback function").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    Napi::Object arg_params = info[0].As<Napi::Object>();
+
+    Napi::Value arg_value_printer = arg_params.Get("printer");
+    std::string uri, host;
+    int port = 0;
+    if(!arg_value_printer.IsString() || !parseSocketUri(uri = arg_value_printer.As<Napi::String>().Utf8Value(), host, port))
+    {
+        Napi::TypeError::New(env, "printSocket:printer parameter must be a socket://host[:port] URI").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    SocketJobPtr job(new SocketJob());
+    Napi::Value arg_value_data = arg_params.Get("data");
+    bool encoded = false;
+    std::string encoding_error;
+    if(!getEncodedDataFromV8Params(arg_params, job->storage, encoded, encoding_error))
+    {
+        Napi::TypeError::New(env, "printSocket:" + encoding_error).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    if(!encoded && arg_value_data.IsBuffer())
+    {
+        // written from the Buffer, kept alive until then
+        Napi::Buffer<char> buffer = arg_value_data.As<Napi::Buffer<char> >();
+        job->buffer = Napi::Persistent(buffer.As<Napi::Object>());
+        job->data = uv_buf_init(buffer.Data(), static_cast<unsigned int>(buffer.Length()));
+    }
+    else if(encoded || getStringOrBufferFromV8Value(arg_value_data, job->storage))
+    {
+        job->data = uv_buf_init(&job->storage[0], static_cast<unsigned int>(job->storage.size()));
+    }
+    else
+    {
+        Napi::TypeError::New(env, "printSocket:data parameter must be a string or Buffer").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    SocketBackend &backend = SocketBackend::getInstance(env);
+    job->id = backend.nextJobId();
+    job->callback = Napi::Persistent(info[1].As<Napi::Function>());
+    int job_id = job->id;
+    backend.getConnection(env, uri, host, port).submit(std::move(job));
+    return Napi::Number::New(env, job_id);
+}
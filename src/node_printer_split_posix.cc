@@ -0,0 +1,451 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+
+namespace
+{
+    const size_t SHARD_CHUNK_SIZE = 256 * 1024;
+    const int PROGRESS_INTERVAL_MS = 100;
+
+    typedef std::shared_ptr<std::atomic<bool> > CancelFlagType;
+
+    /** @return true if iPattern occurs in the data more than iMax times
+     */
+    bool occursMoreThan(const char *iData, size_t iSize, const char *iPattern, int iMax)
+    {
+        size_t pattern_size = strlen(iPattern);
+        int count = 0;
+        for(const char *pos = iData, *end = iData + iSize; static_cast<size_t>(end - pos) >= pattern_size; ++pos)
+        {
+            pos = static_cast<const char*>(memchr(pos, iPattern[0], end - pos - pattern_size + 1));
+            if(pos == NULL)
+            {
+                break;
+            }
+            if(memcmp(pos, iPattern, pattern_size) == 0 && ++count > iMax)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Count the page objects of a PDF: "/Type /Page" but not "/Type /Pages".
+     * This is a scan of the bytes, not a parse: pages stored in compressed object streams
+     * are not visible, and an incrementally updated file repeats the objects it changed.
+     * @return number of pages, 0 if none was found or the count is not reliable
+     */
+    int countPdfPages(const char *iData, size_t iSize)
+    {
+        if(occursMoreThan(iData, iSize, "/ObjStm", 0) || occursMoreThan(iData, iSize, "%%EOF", 1))
+        {
+            return 0;
+        }
+
+        static const char TYPE_KEY[] = "/Type";
+        const size_t type_key_size = sizeof(TYPE_KEY) - 1;
+        int result = 0;
+        const char *end = iData + iSize;
+        const char *pos = iData;
+        while(pos < end)
+        {
+            const char *found = static_cast<const char*>(memchr(pos, '/', end - pos));
+            if(found == NULL)
+            {
+                break;
+            }
+            pos = found + 1;
+            if(static_cast<size_t>(end - found) < type_key_size || memcmp(found, TYPE_KEY, type_key_size) != 0)
+            {
+                continue;
+            }
+            const char *value = found + type_key_size;
+            while(value < end && (*value == ' ' || *value == '\r' || *value == '\n' || *value == '\t'))
+            {
+                ++value;
+            }
+            if(end - value >= 5 && memcmp(value, "/Page", 5) == 0 && (end - value == 5 || value[5] != 's'))
+            {
+                ++result;
+            }
+            pos = value;
+        }
+        return result;
+    }
+
+    /** One job of the split file: a page range sent to one printer, or the whole document if first_page is 0
+     */
+    struct Shard
+    {
+        Shard(): first_page(0), last_page(0), job_id(0), ok(false) {}
+
+        std::string printer_name;
+        int first_page;
+        int last_page;
+        int job_id;
+        bool ok;
+        std::string error;
+    };
+
+    struct SplitProgress
+    {
+        size_t bytes_sent;
+        size_t total_bytes;
+        int shards_done;
+        int shards;
+    };
+
+    struct SplitPrintFileJob
+    {
+        SplitPrintFileJob(): format(CUPS_FORMAT_PDF), page_count(0) {}
+
+        std::string filename;
+        std::string docname;
+        std::string format;
+        std::vector<std::string> printers;
+        CupsOptionsPtr options;
+        /** 0 to count the pages of the file */
+        int page_count;
+    };
+
+    /** Print one file as several jobs with disjoint page-ranges, one per printer,
+     * all uploaded concurrently from the same memory mapping.
+     * CUPS applies page-ranges after receiving the document: every job uploads the whole file,
+     * so N printers cost N times the file size on the network and in the spool.
+     * When the page count is unknown, the file is sent as one job to the first printer.
+     */
+    class SplitPrintFileWorker: public Napi::AsyncProgressWorker<SplitProgress>
+    {
+    public:
+        SplitPrintFileWorker(const Napi::Function& iCallback, const Napi::Function& iProgress, const CancelFlagType& iCancelled, const SplitPrintFileJob& iJob):
+            Napi::AsyncProgressWorker<SplitProgress>(iCallback, "node-printer:printFileSplit"),
+            _progress(Napi::Persistent(iProgress)),
+            _cancelled(iCancelled),
+            _job(iJob),
+            _bytes_sent(0),
+            _shards_done(0)
+        {}
+
+    protected:
+        void Execute(const ExecutionProgress& progress)
+        {
+            std::string error_str;
+            MappedFile file;
+            if(!file.open(_job.filename, error_str))
+            {
+                SetError(error_str);
+                return;
+            }
+
+            int page_count = _job.page_count;
+            if(page_count <= 0)
+            {
+                page_count = countPdfPages(file.data(), file.size());
+            }
+            if(page_count <= 0)
+            {
+                // wrong ranges would drop or repeat pages: the whole document goes to one printer
+                Shard shard;
+                shard.printer_name = _job.printers[0];
+                _shards.push_back(shard);
+            }
+
+            // disjoint ranges of almost the same size, never more shards than pages
+            size_t shards_count = (page_count > 0) ? std::min(_job.printers.size(), static_cast<size_t>(page_count)) : 0;
+            int first_page = 1;
+            for(size_t i = 0; i < shards_count; ++i)
+            {
+                int pages = page_count / static_cast<int>(shards_count) + ((static_cast<int>(i) < page_count % static_cast<int>(shards_count)) ? 1 : 0);
+                Shard shard;
+                shard.printer_name = _job.printers[i];
+                shard.first_page = first_page;
+                shard.last_page = first_page + pages - 1;
+                first_page += pages;
+                _shards.push_back(shard);
+            }
+
+            size_t total_bytes = file.size() * _shards.size();
+            std::vector<std::thread> threads;
+            for(size_t i = 0; i < _shards.size(); ++i)
+            {
+                threads.push_back(std::thread(&SplitPrintFileWorker::sendShard, this, std::ref(file), std::ref(_shards[i])));
+            }
+
+            // aggregate progress of all shards
+            std::unique_lock<std::mutex> lock(_done_mutex);
+            while(true)
+            {
+                bool finished = _done.wait_for(lock, std::chrono::milliseconds(PROGRESS_INTERVAL_MS), [this]() {
+                    return _shards_done == static_cast<int>(_shards.size());
+                });
+                SplitProgress split_progress;
+                split_progress.bytes_sent = _bytes_sent;
+                split_progress.total_bytes = total_bytes;
+                split_progress.shards_done = _shards_done;
+                split_progress.shards = static_cast<int>(_shards.size());
+                progress.Send(&split_progress, 1);
+                if(finished)
+                {
+                    break;
+                }
+            }
+            lock.unlock();
+            for(size_t i = 0; i < threads.size(); ++i)
+            {
+                threads[i].join();
+            }
+
+            int failed = 0;
+            for(size_t i = 0; i < _shards.size(); ++i)
+            {
+                failed += _shards[i].ok ? 0 : 1;
+            }
+            if(failed > 0)
+            {
+                SetError("printFileSplit: " + std::to_string(failed) + " of " + std::to_string(_shards.size()) + " jobs failed");
+            }
+        }
+
+        void OnProgress(const SplitProgress* data, size_t count)
+        {
+            if(data == NULL || count == 0 || _progress.IsEmpty())
+            {
+                return;
+            }
+            Napi::Env env = Env();
+            Napi::HandleScope scope(env);
+
+            const SplitProgress& last = data[count - 1];
+            Napi::Object result = Napi::Object::New(env);
+            result.Set("bytesSent", Napi::Number::New(env, static_cast<double>(last.bytes_sent)));
+            result.Set("totalBytes", Napi::Number::New(env, static_cast<double>(last.total_bytes)));
+            result.Set("percent", Napi::Number::New(env, last.total_bytes ? (100.0 * last.bytes_sent / last.total_bytes) : 100.0));
+            result.Set("jobsDone", Napi::Number::New(env, last.shards_done));
+            result.Set("jobs", Napi::Number::New(env, last.shards));
+            _progress.Call({ result });
+        }
+
+        void OnError(const Napi::Error& e)
+        {
+            // the result of every job is given even if some of them failed
+            Napi::HandleScope scope(Env());
+            Callback().Call({ e.Value(), shardsToV8(Env()) });
+        }
+
+        std::vector<napi_value> GetResult(Napi::Env env)
+        {
+            std::vector<napi_value> result;
+            result.push_back(env.Null());
+            result.push_back(shardsToV8(env));
+            return result;
+        }
+
+    private:
+        /** Upload the whole file as one job limited to the pages of the shard. Runs in its own thread
+         */
+        void sendShard(const MappedFile &iFile, Shard &ioShard)
+        {
+            CupsOptions options;
+            for(int i = 0; i < _job.options->size(); ++i)
+            {
+                options.add(_job.options->get()[i].name, _job.options->get()[i].value);
+            }
+            if(ioShard.first_page > 0)
+            {
+                options.add("page-ranges", std::to_string(ioShard.first_page) + "-" + std::to_string(ioShard.last_page));
+            }
+
+            CupsJobUpload upload;
+            bool ok = upload.start(ioShard.printer_name, _job.docname, _job.format, options, ioShard.error);
+            size_t offset = 0;
+            while(ok && offset < iFile.size())
+            {
+                if(*_cancelled)
+                {
+                    upload.cancel();
+                    ioShard.error = "printFileSplit: transfer cancelled";
+                    ok = false;
+                    break;
+                }
+                size_t length = std::min(SHARD_CHUNK_SIZE, iFile.size() - offset);
+                ok = upload.write(iFile.data() + offset, length, ioShard.error);
+                offset += length;
+                _bytes_sent += length;
+            }
+            if(ok)
+            {
+                ok = upload.finish(ioShard.error);
+            }
+            ioShard.ok = ok;
+            ioShard.job_id = ok ? upload.jobId() : 0;
+
+            std::lock_guard<std::mutex> lock(_done_mutex);
+            ++_shards_done;
+            _done.notify_one();
+        }
+
+        Napi::Array shardsToV8(Napi::Env env)
+        {
+            Napi::Array result = Napi::Array::New(env);
+            for(uint32_t i = 0; i < _shards.size(); ++i)
+            {
+                const Shard &shard = _shards[i];
+                Napi::Object result_shard = Napi::Object::New(env);
+                result_shard.Set("printer", Napi::String::New(env, shard.printer_name));
+                result_shard.Set("pages", Napi::String::New(env, (shard.first_page > 0) ? std::to_string(shard.first_page) + "-" + std::to_string(shard.last_page) : "all"));
+                result_shard.Set("ok", Napi::Boolean::New(env, shard.ok));
+                if(shard.ok)
+                {
+                    result_shard.Set("id", Napi::Number::New(env, shard.job_id));
+                }
+                else
+                {
+                    result_shard.Set("error", Napi::String::New(env, shard.error));
+                }
+                result.Set(i, result_shard);
+            }
+            return result;
+        }
+
+        Napi::FunctionReference _progress;
+        CancelFlagType _cancelled;
+        SplitPrintFileJob _job;
+        std::vector<Shard> _shards;
+        std::atomic<size_t> _bytes_sent;
+        std::mutex _done_mutex;
+        std::condition_variable _done;
+        int _shards_done;
+    };
+}
+
+Napi::Value PrintFileSplit(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 3)
+    {
+        Napi::TypeError::New(env, "printFileSplit:invalid number of arguments (3 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[0].IsObject())
+    {
+        Napi::TypeError::New(env, "printFileSplit:first argument must be an object").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if(!info[1].IsFunction() || !info[2].IsFunction())
+    {
+        Napi::TypeError::New(env, "printFileSplit:progress and callback arguments must be functions").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    Napi::Object arg_params = info[0].As<Napi::Object>();
+
+    // filename
+    Napi::Value arg_value_filename = arg_params.Get("filename");
+    if(!arg_value_filename.IsString())
+    {
+        Napi::TypeError::New(env, "printFileSplit:filename parameter must be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // printers
+    Napi::Value arg_value_printers = arg_params.Get("printers");
+    if(!arg_value_printers.IsArray() || arg_value_printers.As<Napi::Array>().Length() == 0)
+    {
+        Napi::TypeError::New(env, "printFileSplit:printers parameter must be a non empty array of printer names").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // the worker owns a thread safe function from its construction: it is only created once the job is valid
+    SplitPrintFileJob job;
+    job.filename = arg_value_filename.As<Napi::String>().Utf8Value();
+    job.docname = job.filename;
+
+    std::string error_str;
+    Napi::Array arg_printers = arg_value_printers.As<Napi::Array>();
+    for(uint32_t i = 0; i < arg_printers.Length(); ++i)
+    {
+        Napi::Value printer_name = arg_printers.Get(i);
+        if(!printer_name.IsString())
+        {
+            error_str = "printFileSplit:printer names must be strings";
+            break;
+        }
+        job.printers.push_back(printer_name.As<Napi::String>().Utf8Value());
+    }
+
+    // docname
+    Napi::Value arg_value_docname = arg_params.Get("docname");
+    if(arg_value_docname.IsString())
+    {
+        job.docname = arg_value_docname.As<Napi::String>().Utf8Value();
+    }
+
+    // type, PDF by default: page-ranges needs a format which CUPS can split
+    Napi::Value arg_value_type = arg_params.Get("type");
+    if(arg_value_type.IsString())
+    {
+        FormatMapType::const_iterator itFormat = getPrinterFormatMap().find(arg_value_type.As<Napi::String>().Utf8Value());
+        if(itFormat == getPrinterFormatMap().end())
+        {
+            error_str = "printFileSplit: unsupported format type";
+        }
+        else
+        {
+            job.format = itFormat->second;
+        }
+    }
+
+    // page count
+    Napi::Value arg_value_page_count = arg_params.Get("pageCount");
+    if(arg_value_page_count.IsNumber())
+    {
+        job.page_count = arg_value_page_count.As<Napi::Number>().Int32Value();
+    }
+
+    // options
+    if(!getCupsOptionsFromV8Value(arg_params.Get("options"), job.options))
+    {
+        error_str = "printFileSplit:options parameter must be an object";
+    }
+    else if(cupsGetOption("page-ranges", job.options->size(), job.options->get()) != NULL)
+    {
+        error_str = "printFileSplit:page-ranges option is set by the split";
+    }
+
+    if(!error_str.empty())
+    {
+        Napi::TypeError::New(env, error_str).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    // every printer receives the whole file: all of them must accept the options
+    for(std::vector<std::string>::const_iterator itPrinter = job.printers.begin(); itPrinter != job.printers.end(); ++itPrinter)
+    {
+        if(!preflightV8Params(arg_params, "", *itPrinter, *job.options, error_str))
+        {
+            Napi::Error::New(env, "printFileSplit: " + error_str).ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+    }
+    CancelFlagType cancelled(new std::atomic<bool>(false));
+    SplitPrintFileWorker *worker = new SplitPrintFileWorker(info[2].As<Napi::Function>(), info[1].As<Napi::Function>(), cancelled, job);
+    worker->Queue();
+
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("cancel", Napi::Function::New(env, [cancelled](const Napi::CallbackInfo& cancel_info) -> Napi::Value {
+        *cancelled = true;
+        return cancel_info.Env().Undefined();
+    }, "cancel"));
+    return result;
+}
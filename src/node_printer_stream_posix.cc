@@ -0,0 +1,423 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace
+{
+    class PrintStream;
+
+    /** Run one print stream operation on the libuv thread pool.
+     * The stream and the written buffers are referenced until the operation is done,
+     * so the data is sent without being copied.
+     */
+    class PrintStreamWorker: public Napi::AsyncWorker
+    {
+    public:
+        enum Operation { OPEN, WRITE, FINISH, ABORT };
+
+        PrintStreamWorker(PrintStream* iStream, Napi::Object iStreamObject, Operation iOperation, const Napi::Function& iCallback);
+
+        /** Add a chunk to write. The buffer is kept alive until the worker is destroyed
+         */
+        void addChunk(Napi::Buffer<char> iBuffer);
+
+    protected:
+        void Execute();
+        void OnOK();
+        void OnError(const Napi::Error& e);
+        std::vector<napi_value> GetResult(Napi::Env env);
+
+    private:
+        typedef std::vector<std::pair<const char*, size_t> > ChunksType;
+
+        PrintStream *_stream;
+        Napi::ObjectReference _stream_ref;
+        Operation _operation;
+        ChunksType _chunks;
+        std::vector<Napi::ObjectReference> _chunks_refs;
+    };
+
+    /** Native side of createPrintStream: one CUPS job which receives the document by chunks.
+     * Only one operation may be queued at a time, the JS Writable serializes them.
+     */
+    class PrintStream: public Napi::ObjectWrap<PrintStream>
+    {
+    public:
+        static Napi::Function GetClass(Napi::Env env);
+
+        PrintStream(const Napi::CallbackInfo& info);
+        /** Collected without finish or abort: the job is cancelled without waiting for CUPS
+         */
+        ~PrintStream();
+
+        // called from the worker thread
+        bool open(std::string &oError);
+        bool write(const char *iData, size_t iSize, std::string &oError);
+        bool finish(std::string &oError);
+        void abort();
+
+        int jobId() const { return _upload.jobId(); }
+        void setBusy(bool iBusy) { _busy = iBusy; }
+
+    private:
+        enum State { CREATED, OPENED, FINISHED, ABORTED };
+
+        Napi::Value Open(const Napi::CallbackInfo& info);
+        Napi::Value Write(const Napi::CallbackInfo& info);
+        Napi::Value Finish(const Napi::CallbackInfo& info);
+        Napi::Value Abort(const Napi::CallbackInfo& info);
+        Napi::Value GetJobId(const Napi::CallbackInfo& info);
+
+        /** Validate the state, then create and queue a worker for iOperation
+         * @return worker, NULL if an exception was thrown
+         */
+        PrintStreamWorker* createWorker(const Napi::CallbackInfo& info, PrintStreamWorker::Operation iOperation, size_t iCallbackIndex);
+
+        std::string _printer_name;
+        std::string _docname;
+        std::string _format;
+        CupsOptionsPtr _options;
+        CupsJobUpload _upload;
+        State _state;
+        bool _busy;
+    };
+
+    PrintStreamWorker::PrintStreamWorker(PrintStream* iStream, Napi::Object iStreamObject, Operation iOperation, const Napi::Function& iCallback):
+        Napi::AsyncWorker(iCallback, "node-printer:PrintStream"),
+        _stream(iStream),
+        _stream_ref(Napi::Persistent(iStreamObject)),
+        _operation(iOperation)
+    {
+        _stream->setBusy(true);
+    }
+
+    void PrintStreamWorker::addChunk(Napi::Buffer<char> iBuffer)
+    {
+        _chunks.push_back(std::make_pair(iBuffer.Data(), iBuffer.Length()));
+        _chunks_refs.push_back(Napi::Persistent(static_cast<Napi::Object>(iBuffer)));
+    }
+
+    void PrintStreamWorker::Execute()
+    {
+        std::string error_str;
+        bool ok = true;
+        switch(_operation)
+        {
+        case OPEN:
+            ok = _stream->open(error_str);
+            break;
+        case WRITE:
+            for(ChunksType::const_iterator itChunk = _chunks.begin(); ok && itChunk != _chunks.end(); ++itChunk)
+            {
+                ok = _stream->write(itChunk->first, itChunk->second, error_str);
+            }
+            break;
+        case FINISH:
+            ok = _stream->finish(error_str);
+            break;
+        case ABORT:
+            _stream->abort();
+            break;
+        }
+        if(!ok)
+        {
+            SetError(error_str);
+        }
+    }
+
+    void PrintStreamWorker::OnOK()
+    {
+        _stream->setBusy(false);
+        Napi::AsyncWorker::OnOK();
+    }
+
+    void PrintStreamWorker::OnError(const Napi::Error& e)
+    {
+        _stream->setBusy(false);
+        Napi::AsyncWorker::OnError(e);
+    }
+
+    std::vector<napi_value> PrintStreamWorker::GetResult(Napi::Env env)
+    {
+        std::vector<napi_value> result;
+        result.push_back(env.Null());
+        result.push_back(Napi::Number::New(env, _stream->jobId()));
+        return result;
+    }
+
+    Napi::Function PrintStream::GetClass(Napi::Env env)
+    {
+        Napi::FunctionReference &constructor = getAddonData(env).constructors["PrintStream"];
+        if(constructor.IsEmpty())
+        {
+            constructor = Napi::Persistent(DefineClass(env, "PrintStream", {
+                InstanceMethod("open", &PrintStream::Open),
+                InstanceMethod("write", &PrintStream::Write),
+                InstanceMethod("finish", &PrintStream::Finish),
+                InstanceMethod("abort", &PrintStream::Abort),
+                InstanceAccessor("jobId", &PrintStream::GetJobId, nullptr)
+            }));
+        }
+        return constructor.Value();
+    }
+
+    PrintStream::PrintStream(const Napi::CallbackInfo& info):
+        Napi::ObjectWrap<PrintStream>(info),
+        _docname("node print job"),
+        _state(CREATED),
+        _busy(false)
+    {
+        Napi::Env env = info.Env();
+
+        if(info.Length() < 1 || !info[0].IsObject())
+        {
+            Napi::TypeError::New(env, "createPrintStream:first argument must be an object").ThrowAsJavaScriptException();
+            return;
+        }
+        Napi::Object arg_params = info[0].As<Napi::Object>();
+
+        // printer name
+        if(arg_params.Has("printer") && !arg_params.Get("printer").IsUndefined())
+        {
+            Napi::Value arg_value_printer = arg_params.Get("printer");
+            if(!arg_value_printer.IsString())
+            {
+                Napi::TypeError::New(env, "createPrintStream:printer parameter must be a string").ThrowAsJavaScriptException();
+                return;
+            }
+            _printer_name = arg_value_printer.As<Napi::String>().Utf8Value();
+        }
+        else
+        {
+            // if printer is not specified, then use default printer.
+            const char * default_printer_name = cupsGetDefault();
+            if(default_printer_name != NULL)
+            {
+                _printer_name = default_printer_name;
+            }
+        }
+
+        // type
+        std::string type_str = "RAW";
+        if(arg_params.Has("type") && !arg_params.Get("type").IsUndefined())
+        {
+            Napi::Value arg_value_type = arg_params.Get("type");
+            if(!arg_value_type.IsString())
+            {
+                Napi::TypeError::New(env, "createPrintStream:type parameter must be a string").ThrowAsJavaScriptException();
+                return;
+            }
+            type_str = arg_value_type.As<Napi::String>().Utf8Value();
+        }
+        FormatMapType::const_iterator itFormat = getPrinterFormatMap().find(type_str);
+        if(itFormat == getPrinterFormatMap().end())
+        {
+            Napi::TypeError::New(env, "createPrintStream: unsupported format type").ThrowAsJavaScriptException();
+            return;
+        }
+        _format = itFormat->second;
+
+        // docname
+        if(arg_params.Has("docname") && !arg_params.Get("docname").IsUndefined())
+        {
+            Napi::Value arg_value_docname = arg_params.Get("docname");
+            if(!arg_value_docname.IsString())
+            {
+                Napi::TypeError::New(env, "createPrintStream:docname parameter must be a string").ThrowAsJavaScriptException();
+                return;
+            }
+            _docname = arg_value_docname.As<Napi::String>().Utf8Value();
+        }
+
+        // options
+        if(!getCupsOptionsFromV8Value(arg_params.Get("options"), _options))
+        {
+            Napi::TypeError::New(env, "createPrintStream:options parameter must be an object").ThrowAsJavaScriptException();
+            return;
+        }
+        std::string preflight_error;
+        if(!preflightV8Params(arg_params, "", _printer_name, *_options, preflight_error))
+        {
+            Napi::Error::New(env, "createPrintStream: " + preflight_error).ThrowAsJavaScriptException();
+            return;
+        }
+    }
+
+    PrintStream::~PrintStream()
+    {
+        // workers reference the stream: none is running
+        _upload.cancelInBackground();
+    }
+
+    bool PrintStream::open(std::string &oError)
+    {
+        if(!_upload.start(_printer_name, _docname, _format, *_options, oError))
+        {
+            _state = ABORTED;
+            return false;
+        }
+        _state = OPENED;
+        return true;
+    }
+
+    bool PrintStream::write(const char *iData, size_t iSize, std::string &oError)
+    {
+        if(!_upload.write(iData, iSize, oError))
+        {
+            _state = ABORTED;
+            return false;
+        }
+        return true;
+    }
+
+    bool PrintStream::finish(std::string &oError)
+    {
+        _state = _upload.finish(oError) ? FINISHED : ABORTED;
+        return (_state == FINISHED);
+    }
+
+    void PrintStream::abort()
+    {
+        // on the worker of abort(): the cancel request waits for the CUPS server
+        _upload.cancel();
+        if(_state != FINISHED)
+        {
+            _state = ABORTED;
+        }
+    }
+
+    PrintStreamWorker* PrintStream::createWorker(const Napi::CallbackInfo& info, PrintStreamWorker::Operation iOperation, size_t iCallbackIndex)
+    {
+        Napi::Env env = info.Env();
+
+        if(info.Length() <= iCallbackIndex || !info[iCallbackIndex].IsFunction())
+        {
+            Napi::TypeError::New(env, "PrintStream:callback function expected").ThrowAsJavaScriptException();
+            return NULL;
+        }
+        if(_busy)
+        {
+            Napi::Error::New(env, "PrintStream:another operation is in progress").ThrowAsJavaScriptException();
+            return NULL;
+        }
+
+        const char *state_error = NULL;
+        switch(iOperation)
+        {
+        case PrintStreamWorker::OPEN:
+            state_error = (_state != CREATED) ? "PrintStream:stream is already opened" : NULL;
+            break;
+        case PrintStreamWorker::WRITE:
+        case PrintStreamWorker::FINISH:
+            state_error = (_state != OPENED) ? "PrintStream:stream is not opened" : NULL;
+            break;
+        case PrintStreamWorker::ABORT:
+            break;
+        }
+        if(state_error != NULL)
+        {
+            Napi::Error::New(env, state_error).ThrowAsJavaScriptException();
+            return NULL;
+        }
+
+        return new PrintStreamWorker(this, Value(), iOperation, info[iCallbackIndex].As<Napi::Function>());
+    }
+
+    Napi::Value PrintStream::Open(const Napi::CallbackInfo& info)
+    {
+        PrintStreamWorker *worker = createWorker(info, PrintStreamWorker::OPEN, 0);
+        if(worker != NULL)
+        {
+            worker->Queue();
+        }
+        return info.Env().Undefined();
+    }
+
+    Napi::Value PrintStream::Write(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+
+        // a single Buffer or an Array of Buffers (writev)
+        if(info.Length() < 1 || !(info[0].IsBuffer() || info[0].IsArray()))
+        {
+            Napi::TypeError::New(env, "PrintStream.write:first argument must be a Buffer or an Array of Buffers").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        std::vector<Napi::Buffer<char> > chunks;
+        if(info[0].IsBuffer())
+        {
+            chunks.push_back(info[0].As<Napi::Buffer<char> >());
+        }
+        else
+        {
+            Napi::Array arg_chunks = info[0].As<Napi::Array>();
+            for(uint32_t i = 0; i < arg_chunks.Length(); ++i)
+            {
+                Napi::Value chunk = arg_chunks.Get(i);
+                if(!chunk.IsBuffer())
+                {
+                    Napi::TypeError::New(env, "PrintStream.write:all chunks must be Buffers").ThrowAsJavaScriptException();
+                    return env.Undefined();
+                }
+                chunks.push_back(chunk.As<Napi::Buffer<char> >());
+            }
+        }
+
+        PrintStreamWorker *worker = createWorker(info, PrintStreamWorker::WRITE, 1);
+        if(worker != NULL)
+        {
+            for(std::vector<Napi::Buffer<char> >::const_iterator itChunk = chunks.begin(); itChunk != chunks.end(); ++itChunk)
+            {
+                worker->addChunk(*itChunk);
+            }
+            worker->Queue();
+        }
+        return env.Undefined();
+    }
+
+    Napi::Value PrintStream::Finish(const Napi::CallbackInfo& info)
+    {
+        PrintStreamWorker *worker = createWorker(info, PrintStreamWorker::FINISH, 0);
+        if(worker != NULL)
+        {
+            worker->Queue();
+        }
+        return info.Env().Undefined();
+    }
+
+    Napi::Value PrintStream::Abort(const Napi::CallbackInfo& info)
+    {
+        PrintStreamWorker *worker = createWorker(info, PrintStreamWorker::ABORT, 0);
+        if(worker != NULL)
+        {
+            worker->Queue();
+        }
+        return info.Env().Undefined();
+    }
+
+    Napi::Value PrintStream::GetJobId(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        return jobId() ? Napi::Number::New(env, jobId()) : env.Undefined();
+    }
+}
+
+Napi::Value createPrintStream(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 1)
+    {
+        Napi::TypeError::New(env, "createPrintStream:invalid number of arguments (1 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    Napi::Object result = PrintStream::GetClass(env).New({ info[0] });
+    if(env.IsExceptionPending())
+    {
+        return env.Undefined();
+    }
+    return result;
+}
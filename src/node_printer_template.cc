@@ -0,0 +1,376 @@
+#include "node_printer.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    /** Part of a label template: fixed bytes, or the value of a field
+     */
+    struct TemplateSegment
+    {
+        /** offset of the fixed bytes in LabelTemplate::_fixed */
+        size_t offset;
+        size_t length;
+        /** index of the field in LabelTemplate::_fields, or -1 for fixed bytes */
+        int field;
+    };
+
+    /** Value of a field for one label, measured before the output buffer is allocated
+     */
+    struct FieldValue
+    {
+        enum Kind { UTF8, BYTES, FORMATTED };
+
+        Kind kind;
+        napi_value value;
+        const char *bytes;
+        size_t length;
+        /** formatted number or other value converted to a string */
+        std::string formatted;
+    };
+
+    /** ZPL/EPL/ESC-POS label template compiled once, see compileLabelTemplate.
+     * Placeholders are `{{name}}`; everything else is copied verbatim.
+     * Labels are rendered straight into one Buffer sized from the fixed bytes and the field values.
+     */
+    class LabelTemplate: public Napi::ObjectWrap<LabelTemplate>
+    {
+    public:
+        static Napi::Function GetClass(Napi::Env env);
+
+        LabelTemplate(const Napi::CallbackInfo& info);
+
+    private:
+        Napi::Value Render(const Napi::CallbackInfo& info);
+        Napi::Value RenderBatch(const Napi::CallbackInfo& info);
+        Napi::Value GetFields(const Napi::CallbackInfo& info);
+        Napi::Value GetFixedSize(const Napi::CallbackInfo& info);
+
+        void parse(const std::string &iSource);
+        void addFixed(const std::string &iSource, size_t iBegin, size_t iEnd);
+
+        /** Read the values of a label from its fields object. Adds their size to ioSize
+         * @returns false with a pending exception on error
+         */
+        bool getValues(Napi::Env env, const char *iFunctionName, Napi::Value iRow, std::vector<FieldValue> &oValues, size_t &ioSize) const;
+
+        /** Write one label at oOutput, which has iAvailable bytes. Returns the number of bytes written
+         */
+        size_t write(Napi::Env env, const std::vector<FieldValue> &iValues, char *oOutput, size_t iAvailable) const;
+
+        std::string _fixed;
+        std::vector<TemplateSegment> _segments;
+        std::vector<std::string> _fields;
+    };
+
+    /** Valid placeholder name: letters, digits, '_', '-' and '.'
+     */
+    bool isFieldName(const std::string &iName)
+    {
+        if(iName.empty())
+        {
+            return false;
+        }
+        for(std::string::const_iterator it = iName.begin(); it != iName.end(); ++it)
+        {
+            char c = *it;
+            if(!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.'))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string trim(const std::string &iValue)
+    {
+        size_t begin = iValue.find_first_not_of(" \t");
+        if(begin == std::string::npos)
+        {
+            return std::string();
+        }
+        size_t end = iValue.find_last_not_of(" \t");
+        return iValue.substr(begin, end - begin + 1);
+    }
+
+    Napi::Function LabelTemplate::GetClass(Napi::Env env)
+    {
+        Napi::FunctionReference &constructor = getAddonData(env).constructors["LabelTemplate"];
+        if(constructor.IsEmpty())
+        {
+            constructor = Napi::Persistent(DefineClass(env, "LabelTemplate", {
+                InstanceAccessor("fields", &LabelTemplate::GetFields, nullptr),
+                InstanceAccessor("fixedSize", &LabelTemplate::GetFixedSize, nullptr),
+                InstanceMethod("render", &LabelTemplate::Render),
+                InstanceMethod("renderBatch", &LabelTemplate::RenderBatch)
+            }));
+        }
+        return constructor.Value();
+    }
+
+    LabelTemplate::LabelTemplate(const Napi::CallbackInfo& info):
+        Napi::ObjectWrap<LabelTemplate>(info)
+    {
+        Napi::Env env = info.Env();
+
+        std::string source;
+        if(info.Length() < 1 || !getStringOrBufferFromV8Value(info[0], source))
+        {
+            Napi::TypeError::New(env, "compileLabelTemplate:first argument must be a string or Buffer").ThrowAsJavaScriptException();
+            return;
+        }
+        parse(source);
+    }
+
+    void LabelTemplate::addFixed(const std::string &iSource, size_t iBegin, size_t iEnd)
+    {
+        if(iBegin >= iEnd)
+        {
+            return;
+        }
+        // consecutive fixed bytes are one segment
+        if(!_segments.empty() && _segments.back().field < 0)
+        {
+            _segments.back().length += iEnd - iBegin;
+        }
+        else
+        {
+            TemplateSegment segment = { _fixed.size(), iEnd - iBegin, -1 };
+            _segments.push_back(segment);
+        }
+        _fixed.append(iSource, iBegin, iEnd - iBegin);
+    }
+
+    void LabelTemplate::parse(const std::string &iSource)
+    {
+        std::map<std::string, int> field_indexes;
+        size_t position = 0;
+        while(position < iSource.size())
+        {
+            size_t open = iSource.find("{{", position);
+            size_t close = open == std::string::npos ? std::string::npos : iSource.find("}}", open + 2);
+            if(close == std::string::npos)
+            {
+                break;
+            }
+            std::string name = trim(iSource.substr(open + 2, close - open - 2));
+            if(!isFieldName(name))
+            {
+                // not a placeholder: keep the braces, which are valid printer data
+                addFixed(iSource, position, open + 2);
+                position = open + 2;
+                continue;
+            }
+            addFixed(iSource, position, open);
+
+            std::map<std::string, int>::const_iterator itField = field_indexes.find(name);
+            int field = 0;
+            if(itField == field_indexes.end())
+            {
+                field = static_cast<int>(_fields.size());
+                field_indexes[name] = field;
+                _fields.push_back(name);
+            }
+            else
+            {
+                field = itField->second;
+            }
+            TemplateSegment segment = { 0, 0, field };
+            _segments.push_back(segment);
+            position = close + 2;
+        }
+        addFixed(iSource, position, iSource.size());
+    }
+
+    bool LabelTemplate::getValues(Napi::Env env, const char *iFunctionName, Napi::Value iRow, std::vector<FieldValue> &oValues, size_t &ioSize) const
+    {
+        if(!iRow.IsObject())
+        {
+            Napi::TypeError::New(env, std::string(iFunctionName) + ":fields must be an object").ThrowAsJavaScriptException();
+            return false;
+        }
+        Napi::Object row = iRow.As<Napi::Object>();
+        oValues.resize(_fields.size());
+        for(size_t i = 0; i < _fields.size(); ++i)
+        {
+            FieldValue &value = oValues[i];
+            Napi::Value field_value = row.Get(_fields[i]);
+            value.value = field_value;
+            if(field_value.IsString())
+            {
+                value.kind = FieldValue::UTF8;
+                napi_get_value_string_utf8(env, field_value, NULL, 0, &value.length);
+            }
+            else if(field_value.IsBuffer())
+            {
+                // binary values such as graphics are copied as is
+                Napi::Buffer<char> buffer = field_value.As<Napi::Buffer<char> >();
+                value.kind = FieldValue::BYTES;
+                value.bytes = buffer.Data();
+                value.length = buffer.Length();
+            }
+            else if(field_value.IsNumber())
+            {
+                value.kind = FieldValue::FORMATTED;
+                double number = field_value.As<Napi::Number>().DoubleValue();
+                if(std::floor(number) == number && std::fabs(number) < 1e15)
+                {
+                    char formatted[32];
+                    snprintf(formatted, sizeof(formatted), "%lld", static_cast<long long>(number));
+                    value.formatted = formatted;
+                }
+                else
+                {
+                    value.formatted = field_value.ToString().Utf8Value();
+                }
+                value.length = value.formatted.size();
+            }
+            else if(field_value.IsUndefined() || field_value.IsNull())
+            {
+                Napi::TypeError::New(env, std::string(iFunctionName) + ":missing field " + _fields[i]).ThrowAsJavaScriptException();
+                return false;
+            }
+            else
+            {
+                value.kind = FieldValue::FORMATTED;
+                value.formatted = field_value.ToString().Utf8Value();
+                value.length = value.formatted.size();
+            }
+        }
+
+        ioSize += _fixed.size();
+        for(std::vector<TemplateSegment>::const_iterator itSegment = _segments.begin(); itSegment != _segments.end(); ++itSegment)
+        {
+            if(itSegment->field >= 0)
+            {
+                ioSize += oValues[itSegment->field].length;
+            }
+        }
+        return true;
+    }
+
+    size_t LabelTemplate::write(Napi::Env env, const std::vector<FieldValue> &iValues, char *oOutput, size_t iAvailable) const
+    {
+        char *output = oOutput;
+        for(std::vector<TemplateSegment>::const_iterator itSegment = _segments.begin(); itSegment != _segments.end(); ++itSegment)
+        {
+            if(itSegment->field < 0)
+            {
+                memcpy(output, _fixed.data() + itSegment->offset, itSegment->length);
+                output += itSegment->length;
+                continue;
+            }
+            const FieldValue &value = iValues[itSegment->field];
+            switch(value.kind)
+            {
+            case FieldValue::UTF8:
+                if(static_cast<size_t>(output - oOutput) + value.length < iAvailable)
+                {
+                    // encoded in place. The terminating NUL lands on bytes written next
+                    size_t written = 0;
+                    napi_get_value_string_utf8(env, value.value, output, value.length + 1, &written);
+                }
+                else
+                {
+                    // last bytes of the buffer: no room for the NUL
+                    std::string utf8 = Napi::Value(env, value.value).As<Napi::String>().Utf8Value();
+                    memcpy(output, utf8.data(), value.length);
+                }
+                break;
+            case FieldValue::BYTES:
+                memcpy(output, value.bytes, value.length);
+                break;
+            case FieldValue::FORMATTED:
+                memcpy(output, value.formatted.data(), value.length);
+                break;
+            }
+            output += value.length;
+        }
+        return output - oOutput;
+    }
+
+    Napi::Value LabelTemplate::Render(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+
+        std::vector<FieldValue> values;
+        size_t size = 0;
+        if(!getValues(env, "render", info.Length() > 0 ? info[0] : env.Undefined(), values, size))
+        {
+            return env.Undefined();
+        }
+        Napi::Buffer<char> result = Napi::Buffer<char>::New(env, size);
+        write(env, values, result.Data(), size);
+        return result;
+    }
+
+    Napi::Value LabelTemplate::RenderBatch(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+
+        if(info.Length() < 1 || !info[0].IsArray())
+        {
+            Napi::TypeError::New(env, "renderBatch:first argument must be an array of fields objects").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        Napi::Array rows = info[0].As<Napi::Array>();
+
+        // measure every label first, so that the batch is written into one allocation
+        std::vector<std::vector<FieldValue> > values(rows.Length());
+        size_t size = 0;
+        for(uint32_t i = 0; i < rows.Length(); ++i)
+        {
+            if(!getValues(env, "renderBatch", rows.Get(i), values[i], size))
+            {
+                return env.Undefined();
+            }
+        }
+
+        Napi::Buffer<char> result = Napi::Buffer<char>::New(env, size);
+        size_t offset = 0;
+        for(size_t i = 0; i < values.size(); ++i)
+        {
+            offset += write(env, values[i], result.Data() + offset, size - offset);
+        }
+        return result;
+    }
+
+    Napi::Value LabelTemplate::GetFields(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        Napi::Array result = Napi::Array::New(env, _fields.size());
+        for(uint32_t i = 0; i < _fields.size(); ++i)
+        {
+            result.Set(i, Napi::String::New(env, _fields[i]));
+        }
+        return result;
+    }
+
+    Napi::Value LabelTemplate::GetFixedSize(const Napi::CallbackInfo& info)
+    {
+        return Napi::Number::New(info.Env(), static_cast<double>(_fixed.size()));
+    }
+}
+
+Napi::Value compileLabelTemplate(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    if(info.Length() < 1)
+    {
+        Napi::TypeError::New(env, "compileLabelTemplate:invalid number of arguments (1 expected)").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    Napi::Object result = LabelTemplate::GetClass(env).New({ info[0] });
+    if(env.IsExceptionPending())
+    {
+        return env.Undefined();
+    }
+    return result;
+}
@@ -0,0 +1,377 @@
+#include "node_printer_posix.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+
+namespace
+{
+    /** Changes found by one poll
+     */
+    struct JobChanges
+    {
+        std::vector<IppJob> created;
+        /** jobs which changed their state, with their previous state */
+        std::vector<std::pair<IppJob, ipp_jstate_t> > changed;
+        std::vector<IppJob> completed;
+        /** jobs which disappeared before their final state was seen (purged) */
+        std::vector<int> removed;
+    };
+
+    /** Job state tracker, see createJobTracker.
+     * Remembers the highest job id seen and the state of every job which is not
+     * completed yet, so a poll transfers only the active jobs and the jobs
+     * completed since the previous poll, whatever the length of the job history.
+     */
+    class JobTracker: public Napi::ObjectWrap<JobTracker>
+    {
+    public:
+        static Napi::Function GetClass(Napi::Env env);
+
+        JobTracker(const Napi::CallbackInfo& info);
+        ~JobTracker();
+
+        /** Query the server and compute the changes. Called from a worker thread
+         * @return false on failure with oError set, the tracker state is unchanged then
+         */
+        bool poll(JobChanges &oChanges, std::string &oError);
+
+        void setBusy(bool iBusy) { _busy = iBusy; }
+
+    private:
+        Napi::Value Poll(const Napi::CallbackInfo& info);
+        Napi::Value Reset(const Napi::CallbackInfo& info);
+        Napi::Value GetPrinter(const Napi::CallbackInfo& info);
+        Napi::Value GetLastJobId(const Napi::CallbackInfo& info);
+
+        /** Get-Jobs on the tracked printer
+         * @param iFirstJobId first-job-id, 0 for none
+         * @param iIdsOnly request only job-id and job-state
+         */
+        bool getJobs(const char *iWhichJobs, int iFirstJobId, bool iIdsOnly, std::vector<IppJob> &oJobs, std::string &oError);
+
+        typedef std::map<int, ipp_jstate_t> ActiveJobsType;
+
+        std::string _printer_name;
+        http_t *_http;
+        int _last_id;
+        bool _primed;
+        ActiveJobsType _active;
+        bool _busy;
+    };
+
+    class JobTrackerWorker: public Napi::AsyncWorker
+    {
+    public:
+        JobTrackerWorker(JobTracker *iTracker, Napi::Object iTrackerObject, const Napi::Function& iCallback):
+            Napi::AsyncWorker(iCallback, "node-printer:JobTracker"),
+            _tracker(iTracker),
+            _tracker_ref(Napi::Persistent(iTrackerObject))
+        {
+            _tracker->setBusy(true);
+        }
+
+    protected:
+        void Execute()
+        {
+            std::string error_str;
+            if(!_tracker->poll(_changes, error_str))
+            {
+                SetError(error_str);
+            }
+        }
+
+        void OnOK()
+        {
+            _tracker->setBusy(false);
+            Napi::AsyncWorker::OnOK();
+        }
+
+        void OnError(const Napi::Error& e)
+        {
+            _tracker->setBusy(false);
+            Napi::AsyncWorker::OnError(e);
+        }
+
+        std::vector<napi_value> GetResult(Napi::Env env)
+        {
+            Napi::Object result = Napi::Object::New(env);
+
+            Napi::Array created = Napi::Array::New(env);
+            for(uint32_t i = 0; i < _changes.created.size(); ++i)
+            {
+                created.Set(i, ippJobToV8(_changes.created[i], env));
+            }
+            result.Set("created", created);
+
+            Napi::Array changed = Napi::Array::New(env);
+            for(uint32_t i = 0; i < _changes.changed.size(); ++i)
+            {
+                Napi::Object job = ippJobToV8(_changes.changed[i].first, env);
+                IppJob previous = _changes.changed[i].first;
+                previous.state = _changes.changed[i].second;
+                job.Set("previousStatus", ippJobToV8(previous, env).Get("status"));
+                changed.Set(i, job);
+            }
+            result.Set("changed", changed);
+
+            Napi::Array completed = Napi::Array::New(env);
+            for(uint32_t i = 0; i < _changes.completed.size(); ++i)
+            {
+                completed.Set(i, ippJobToV8(_changes.completed[i], env));
+            }
+            result.Set("completed", completed);
+
+            Napi::Array removed = Napi::Array::New(env);
+            for(uint32_t i = 0; i < _changes.removed.size(); ++i)
+            {
+                removed.Set(i, Napi::Number::New(env, _changes.removed[i]));
+            }
+            result.Set("removed", removed);
+
+            std::vector<napi_value> args;
+            args.push_back(env.Null());
+            args.push_back(result);
+            return args;
+        }
+
+    private:
+        JobTracker *_tracker;
+        Napi::ObjectReference _tracker_ref;
+        JobChanges _changes;
+    };
+
+    Napi::Function JobTracker::GetClass(Napi::Env env)
+    {
+        Napi::FunctionReference &constructor = getAddonData(env).constructors["JobTracker"];
+        if(constructor.IsEmpty())
+        {
+            constructor = Napi::Persistent(DefineClass(env, "JobTracker", {
+                InstanceMethod("poll", &JobTracker::Poll),
+                InstanceMethod("reset", &JobTracker::Reset),
+                InstanceAccessor("printer", &JobTracker::GetPrinter, nullptr),
+                InstanceAccessor("lastJobId", &JobTracker::GetLastJobId, nullptr)
+            }));
+        }
+        return constructor.Value();
+    }
+
+    JobTracker::JobTracker(const Napi::CallbackInfo& info):
+        Napi::ObjectWrap<JobTracker>(info),
+        _http(NULL),
+        _last_id(0),
+        _primed(false),
+        _busy(false)
+    {
+        Napi::Env env = info.Env();
+
+        if(info.Length() > 0 && !info[0].IsUndefined() && !info[0].IsNull())
+        {
+            if(!info[0].IsString())
+            {
+                Napi::TypeError::New(env, "createJobTracker:printer name must be a string").ThrowAsJavaScriptException();
+                return;
+            }
+            _printer_name = info[0].As<Napi::String>().Utf8Value();
+        }
+    }
+
+    JobTracker::~JobTracker()
+    {
+        if(_http != NULL)
+        {
+            httpClose(_http);
+        }
+    }
+
+    bool JobTracker::getJobs(const char *iWhichJobs, int iFirstJobId, bool iIdsOnly, std::vector<IppJob> &oJobs, std::string &oError)
+    {
+        ipp_t *request = ippNewRequest(IPP_OP_GET_JOBS);
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL, getPrinterUri(_printer_name).c_str());
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_NAME, "requesting-user-name", NULL, cupsUser());
+        ippAddString(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "which-jobs", NULL, iWhichJobs);
+        if(iFirstJobId > 0)
+        {
+            ippAddInteger(request, IPP_TAG_OPERATION, IPP_TAG_INTEGER, "first-job-id", iFirstJobId);
+        }
+        if(iIdsOnly)
+        {
+            static const char * const attrs[] = { "job-id", "job-state" };
+            ippAddStrings(request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD, "requested-attributes", 2, NULL, attrs);
+        }
+        else
+        {
+            addIppJobRequestedAttributes(request);
+        }
+
+        ipp_t *response = cupsDoRequest(_http, request, "/");
+        if(response == NULL || cupsLastError() > IPP_STATUS_OK_CONFLICTING)
+        {
+            oError = "Error on getting jobs: ";
+            oError += cupsLastErrorString();
+            ippDelete(response);
+            return false;
+        }
+        parseIppJobs(response, oJobs);
+        ippDelete(response);
+        return true;
+    }
+
+    bool JobTracker::poll(JobChanges &oChanges, std::string &oError)
+    {
+        if(_http == NULL)
+        {
+            _http = connectToCupsServer();
+            if(_http == NULL)
+            {
+                oError = "Error on getting jobs: unable to connect to CUPS server";
+                return false;
+            }
+        }
+
+        std::vector<IppJob> active_jobs;
+        if(!getJobs("not-completed", 0, false, active_jobs, oError))
+        {
+            return false;
+        }
+
+        int last_id = _last_id;
+        ActiveJobsType active;
+        for(std::vector<IppJob>::const_iterator itJob = active_jobs.begin(); itJob != active_jobs.end(); ++itJob)
+        {
+            active[itJob->id] = itJob->state;
+            last_id = std::max(last_id, itJob->id);
+            ActiveJobsType::const_iterator itKnown = _active.find(itJob->id);
+            if(itKnown == _active.end())
+            {
+                if(!_primed || itJob->id > _last_id)
+                {
+                    oChanges.created.push_back(*itJob);
+                }
+            }
+            else if(itKnown->second != itJob->state)
+            {
+                oChanges.changed.push_back(std::make_pair(*itJob, itKnown->second));
+            }
+        }
+
+        if(!_primed)
+        {
+            // first poll: the completed history is the baseline, only its highest id is needed
+            std::vector<IppJob> all_jobs;
+            if(!getJobs("all", 0, true, all_jobs, oError))
+            {
+                oChanges = JobChanges();
+                return false;
+            }
+            for(std::vector<IppJob>::const_iterator itJob = all_jobs.begin(); itJob != all_jobs.end(); ++itJob)
+            {
+                last_id = std::max(last_id, itJob->id);
+            }
+        }
+        else
+        {
+            // jobs known as active which are not active anymore
+            std::set<int> finished;
+            for(ActiveJobsType::const_iterator itKnown = _active.begin(); itKnown != _active.end(); ++itKnown)
+            {
+                if(active.find(itKnown->first) == active.end())
+                {
+                    finished.insert(itKnown->first);
+                }
+            }
+
+            // one request for both the finished jobs and the jobs created and completed since the last poll
+            int first_id = finished.empty() ? (_last_id + 1) : std::min(*finished.begin(), _last_id + 1);
+            std::vector<IppJob> completed_jobs;
+            if(!getJobs("completed", first_id, false, completed_jobs, oError))
+            {
+                oChanges = JobChanges();
+                return false;
+            }
+            for(std::vector<IppJob>::const_iterator itJob = completed_jobs.begin(); itJob != completed_jobs.end(); ++itJob)
+            {
+                if(itJob->id > _last_id)
+                {
+                    oChanges.created.push_back(*itJob);
+                    oChanges.completed.push_back(*itJob);
+                    last_id = std::max(last_id, itJob->id);
+                }
+                else if(finished.erase(itJob->id) > 0)
+                {
+                    oChanges.completed.push_back(*itJob);
+                }
+            }
+            oChanges.removed.assign(finished.begin(), finished.end());
+        }
+
+        _active.swap(active);
+        _last_id = last_id;
+        _primed = true;
+        return true;
+    }
+
+    Napi::Value JobTracker::Poll(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+
+        if(info.Length() < 1 || !info[0].IsFunction())
+        {
+            Napi::TypeError::New(env, "JobTracker:callback function expected").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        if(_busy)
+        {
+            Napi::Error::New(env, "JobTracker:another poll is in progress").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+
+        (new JobTrackerWorker(this, Value(), info[0].As<Napi::Function>()))->Queue();
+        return env.Undefined();
+    }
+
+    Napi::Value JobTracker::Reset(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+
+        if(_busy)
+        {
+            Napi::Error::New(env, "JobTracker:another poll is in progress").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        _last_id = 0;
+        _primed = false;
+        _active.clear();
+        return env.Undefined();
+    }
+
+    Napi::Value JobTracker::GetPrinter(const Napi::CallbackInfo& info)
+    {
+        Napi::Env env = info.Env();
+        if(_printer_name.empty())
+        {
+            return env.Null();
+        }
+        return Napi::String::New(env, _printer_name);
+    }
+
+    Napi::Value JobTracker::GetLastJobId(const Napi::CallbackInfo& info)
+    {
+        return Napi::Number::New(info.Env(), _last_id);
+    }
+}
+
+Napi::Value createJobTracker(const Napi::CallbackInfo& info)
+{
+    Napi::Env env = info.Env();
+
+    Napi::Value printer_name = (info.Length() > 0) ? info[0] : env.Undefined();
+    Napi::Object result = JobTracker::GetClass(env).New({ printer_name });
+    if(env.IsExceptionPending())
+    {
+        return env.Undefined();
+    }
+    return result;
+}
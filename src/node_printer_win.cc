@@ -584,10 +584,17 @@ Napi::Value PrintDirect(const Napi::CallbackInfo& info)
         return env.Undefined();
     }
     
-    // data
+    // data, strings are transcoded to their encoding if any
     Napi::Value arg_value_data = arg_params.Get("data");
     std::string data;
-    if(!getStringOrBufferFromV8Value(arg_value_data, data))
+    bool encoded = false;
+    std::string encoding_error;
+    if(!getEncodedDataFromV8Params(arg_params, data, encoded, encoding_error))
+    {
+        Napi::TypeError::New(env, "printDirect:" + encoding_error).ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    if(!encoded && !getStringOrBufferFromV8Value(arg_value_data, data))
     {
         Napi::TypeError::New(env, "printDirect:data parameter must be a string or Buffer").ThrowAsJavaScriptException();
         return env.Undefined();
@@ -704,6 +711,146 @@ Napi::Value PrintFile(const Napi::CallbackInfo& info)
     return env.Undefined();
 }
 
+Napi::Value createOptionSet(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "createOptionSet() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value PrintFileChunked(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "printFile() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value getPrintersAsync(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "getPrintersAsync() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value getPrinterAsync(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "getPrinterAsync() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value getPrintersMulti(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "getPrintersMulti() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value openSharedCache(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "openSharedCache() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value openSpoolJournal(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "openSpoolJournal() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value setPrintBackend(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "setPrintBackend() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value getPrintBackend(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "getPrintBackend() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value createJobScheduler(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "createJobScheduler() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value checkPrintOptions(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "checkPrintOptions() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value createJobTracker(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "createJobTracker() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value setJobs(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "setJobs() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value setJobAttributes(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "setJobAttributes() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value createPrinterPool(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "createPrinterPool() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value PrintFileSplit(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "printFileSplit() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value PrintDirectCoalesced(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "printDirectCoalesced() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value openPrinter(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "openPrinter() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value openIppPrinter(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "openIppPrinter() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
+Napi::Value createPrintStream(const Napi::CallbackInfo& info) 
+{
+    Napi::Env env = info.Env();
+    Napi::TypeError::New(env, "createPrintStream() is not implemented yet on Windows.").ThrowAsJavaScriptException();
+    return env.Undefined();
+}
+
 Napi::Value getSupportedPrintFormats(const Napi::CallbackInfo& info) 
 {
     Napi::Env env = info.Env();
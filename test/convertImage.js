@@ -0,0 +1,18 @@
+var printer = require("../");
+
+exports.testZpl = function(test) {
+  // 10x1 RGBA: black, then white, then transparent black
+  var rgba = Buffer.alloc(40, 255);
+  rgba.fill(0, 0, 3);
+  rgba.fill(0, 36, 40);
+  var data = printer.convertImage({data: rgba, width: 10, height: 1}, {label: false});
+  test.equal(data.toString(), "^GFA,2,2,2,8000");
+  test.done();
+}
+
+exports.testEscPos = function(test) {
+  var gray = Buffer.alloc(16 * 2, 0);
+  var data = printer.convertImage({data: gray, width: 16, height: 2, channels: 1}, {format: 'escpos', width: 8});
+  test.deepEqual(Array.from(data), [0x1d, 0x76, 0x30, 0, 1, 0, 1, 0, 0xff]);
+  test.done();
+}
@@ -0,0 +1,9 @@
+var printer = require("../");
+
+exports.testEncode = function(test) {
+  test.deepEqual(Array.from(printer.encode("Café €", 'cp858')), [0x43, 0x61, 0x66, 0x82, 0x20, 0xd5]);
+  test.deepEqual(Array.from(printer.encode("Café €", 'cp437', {replacement: ''})), [0x43, 0x61, 0x66, 0x82, 0x20]);
+  test.equal(printer.encode("€", 'windows-1252')[0], 0x80);
+  test.throws(function(){ printer.encode("x", 'ebcdic'); });
+  test.done();
+}
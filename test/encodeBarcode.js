@@ -0,0 +1,69 @@
+var printer = require("../");
+
+/** Rows of a 1 bit per pixel bitmap as strings of '0' and '1'
+ */
+function bitmapRows(data, width, height) {
+  var stride = Math.ceil(width / 8), rows = [];
+  for (var y = 0; y < height; ++y) {
+    var row = '';
+    for (var x = 0; x < width; ++x) {
+      row += (data[y * stride + (x >> 3)] >> (7 - (x & 7))) & 1;
+    }
+    rows.push(row);
+  }
+  return rows;
+}
+
+exports.testEan13 = function(test) {
+  var options = {format: 'bitmap', module: 1, quietZone: 0, height: 0.2, dpi: 254};
+  var data = printer.encodeBarcode('ean13', '400638133393', options);
+  // 95 modules: 12 bytes per row, 2 rows
+  test.equal(data.length, 24);
+  // 4006381333931: guards, LGLLGG left digits, R right digits
+  test.deepEqual(bitmapRows(data, 95, 2), [
+    '10100011010100111010111101111010001001011001101010100001010000101000010111010010000101100110101',
+    '10100011010100111010111101111010001001011001101010100001010000101000010111010010000101100110101'
+  ]);
+  // check digit 1 is computed, or accepted when given
+  test.deepEqual(printer.encodeBarcode('ean13', '4006381333931', options), data);
+  test.throws(function(){ printer.encodeBarcode('ean13', '4006381333932'); });
+  test.done();
+}
+
+exports.testQr = function(test) {
+  // version 1-M, alphanumeric mode, mask 0
+  var data = printer.encodeBarcode('qr', 'HELLO WORLD', {format: 'bitmap', module: 1, quietZone: 0});
+  test.equal(data.length, 3 * 21);
+  test.deepEqual(bitmapRows(data, 21, 21), [
+    '111111100010101111111',
+    '100000101110001000001',
+    '101110100010101011101',
+    '101110100010101011101',
+    '101110101011101011101',
+    '100000100111001000001',
+    '111111101010101111111',
+    '000000000000000000000',
+    '101010100100100010010',
+    '011110001001000010001',
+    '000111111101001011000',
+    '111101011001110101110',
+    '010011110101001110101',
+    '000000001010001000101',
+    '111111100000100101100',
+    '100000100110001101000',
+    '101110101100101111111',
+    '101110100011010100010',
+    '101110101111011101001',
+    '100000100001110001011',
+    '111111101101011100001'
+  ]);
+  test.done();
+}
+
+exports.testBatch = function(test) {
+  var one = printer.encodeBarcode('qr', 'HELLO WORLD');
+  var batch = printer.encodeBarcode('qr', ['HELLO WORLD', 'HELLO WORLD']);
+  test.equal(one.toString().indexOf('^XA^FO0,0^GFA,'), 0);
+  test.equal(batch.toString(), one.toString() + one.toString());
+  test.done();
+}
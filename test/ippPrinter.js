@@ -0,0 +1,83 @@
+var child_process = require("child_process")
+  , net = require("net")
+  , printer = require("../");
+
+// needs ippeveprinter (CUPS 2.3+) or ippserver in the PATH, skipped otherwise
+function startIppPrinter(callback) {
+  var probe = net.createServer();
+  probe.listen(0, "127.0.0.1", function(){
+    var port = probe.address().port;
+    probe.close(function(){
+      var server = child_process.spawn("ippeveprinter", ["-p", String(port), "-f", "application/octet-stream", "-k", "node-printer-test"]);
+      server.on("error", function(){ callback(null); });
+      // wait until it accepts connections
+      (function connect(tries){
+        var socket = net.connect(port, "127.0.0.1", function(){
+          socket.end();
+          callback(server, "ipp://127.0.0.1:" + port + "/ipp/print");
+        });
+        socket.on("error", function(){
+          if(tries > 0 && server.exitCode === null){
+            setTimeout(function(){ connect(tries - 1); }, 100);
+          }
+        });
+      })(50);
+    });
+  });
+}
+
+exports.testIppPrinter = function(test) {
+  startIppPrinter(function(server, uri){
+    if(!server){
+      return test.done();
+    }
+    var handle = printer.openIppPrinter(uri);
+    test.equal(handle.uri, uri);
+    test.equal(handle.name, "node-printer-test");
+
+    var attributes = handle.attributes(["printer-name", "document-format-supported"]);
+    test.equal(attributes["printer-name"], "node-printer-test");
+
+    var job = handle.print({data: "^XA^FDnode^XZ", docname: "ipp test"});
+    test.ok(job.id > 0);
+    var jobs = handle.jobs("all").filter(function(j){ return j.id === job.id; });
+    test.equal(jobs.length, 1);
+    test.equal(jobs[0].name, "ipp test");
+    handle.close();
+
+    // printDirect routes ipp:// printers to a cached handle
+    printer.printDirect({data: "^XA^XZ", printer: uri, success: function(id){
+      test.ok(id > job.id);
+      server.kill();
+      test.done();
+    }, error: function(err){
+      test.ifError(err);
+      server.kill();
+      test.done();
+    }});
+  });
+}
+
+exports.testIppPrinterAsync = function(test) {
+  startIppPrinter(function(server, uri){
+    if(!server){
+      return test.done();
+    }
+    printer.openIppPrinter(uri, function(err, handle){
+      test.ifError(err);
+      test.equal(handle.name, "node-printer-test");
+      // queued behind each other on the handle connection
+      handle.print({data: "^XA^FDasync^XZ", docname: "ipp async test"}, function(err, job){
+        test.ifError(err);
+        test.ok(job.id > 0);
+        handle.jobs("all", function(err, jobs){
+          test.ifError(err);
+          test.equal(jobs.filter(function(j){ return j.id === job.id; }).length, 1);
+          handle.close();
+          server.kill();
+          test.done();
+        });
+      });
+    });
+  });
+}
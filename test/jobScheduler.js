@@ -0,0 +1,36 @@
+var printer = require("../");
+
+exports.testJobScheduler = function(test) {
+  if(process.platform === 'win32') {
+    test.done();
+    return;
+  }
+  printer.setPrintBackend('null');
+  var scheduler = printer.createJobScheduler({concurrency: 1, tenants: {a: 2, b: 1}});
+  test.throws(function(){ scheduler.submit({data: "x", printer: 'bench', class: 'lowest'}, function(){}); });
+  test.throws(function(){ printer.createJobScheduler({classes: {top: 200}}); });
+
+  var remaining = 3;
+  function done(err, job) {
+    test.ifError(err);
+    test.ok(job.id > 0);
+    test.ok(job.waitMs >= 0);
+    if(--remaining === 0) {
+      var stats = scheduler.stats();
+      test.equal(stats.urgent.submitted, 1);
+      test.equal(stats.normal.submitted, 1);
+      test.equal(stats.bulk.submitted, 1);
+      test.equal(stats.bulk.queued, 0);
+      scheduler.close();
+      test.throws(function(){ scheduler.submit({data: "x", printer: 'bench'}, function(){}); });
+      printer.setPrintBackend('cups');
+      test.done();
+    }
+  }
+  scheduler.submit({data: "bulk", printer: 'bench', type: 'RAW', class: 'bulk', tenant: 'a'}, done);
+  scheduler.submit({data: Buffer.from("normal"), printer: 'bench', type: 'RAW', tenant: 'b'}, function(err, job) {
+    test.equal(job && job['class'], 'normal');
+    done(err, job);
+  });
+  scheduler.submit({data: "urgent", printer: 'bench', type: 'RAW', class: 'urgent', options: {'job-priority': '100'}}, done);
+}
@@ -0,0 +1,18 @@
+var printer = require("../");
+
+exports.testRender = function(test) {
+  var label = printer.compileLabelTemplate("^XA^FD{{name}}^FS^FD{{ qty }}^FS^FD{{name}}^FS^XZ");
+  test.deepEqual(label.fields, ['name', 'qty']);
+  test.equal(label.fixedSize, "^XA^FD^FS^FD^FS^FD^FS^XZ".length);
+  test.equal(label.render({name: 'café', qty: 12}).toString(), "^XA^FDcafé^FS^FD12^FS^FDcafé^FS^XZ");
+  test.throws(function(){ label.render({name: 'x'}); });
+  test.done();
+}
+
+exports.testRenderBatch = function(test) {
+  var label = printer.compileLabelTemplate("{ {{a}} }\n");
+  var data = label.renderBatch([{a: 'x'}, {a: Buffer.from([0x41, 0x42])}, {a: 1.5}]);
+  test.ok(Buffer.isBuffer(data));
+  test.equal(data.toString(), "{ x }\n{ AB }\n{ 1.5 }\n");
+  test.done();
+}
@@ -0,0 +1,28 @@
+var printer = require("../"),
+    fs = require("fs"),
+    os = require("os"),
+    path = require("path");
+
+exports.testPrintBackend = function(test) {
+  if(process.platform === 'win32') {
+    test.done();
+    return;
+  }
+  var directory = fs.mkdtempSync(path.join(os.tmpdir(), 'node-printer-backend-'));
+
+  printer.setPrintBackend('file', {directory: directory});
+  printer.printDirect({data: "label 1", printer: 'bench', type: 'RAW', success: function(id){ test.equal(id, 1); }, error: test.ifError});
+  printer.printDirect({data: Buffer.from("label 2"), printer: 'bench', type: 'RAW', success: function(id){ test.equal(id, 2); }, error: test.ifError});
+  test.equal(fs.readFileSync(path.join(directory, '0000000002-bench.prn'), 'utf8'), "label 2");
+  test.deepEqual(printer.getPrintBackend(), {name: 'file', jobs: 2, bytes: 14, errors: 0});
+
+  printer.setPrintBackend('null');
+  printer.printDirect({data: "label 3", printer: 'bench', type: 'RAW', success: function(id){ test.equal(id, 1); }, error: test.ifError});
+  test.equal(printer.getPrintBackend().jobs, 1);
+  test.throws(function(){ printer.setPrintBackend('lpd'); });
+
+  printer.setPrintBackend('cups');
+  test.equal(printer.getPrintBackend().name, 'cups');
+  fs.rmSync(directory, {recursive: true});
+  test.done();
+}
@@ -0,0 +1,50 @@
+var net = require("net")
+  , printer = require("../");
+
+exports.testSocketPrinter = function(test) {
+  var connections = 0
+    , received = ""
+    , printed = 0;
+  var server = net.createServer(function(socket){
+    connections++;
+    socket.on('data', function(data){
+      received += data.toString();
+      if(received === "^XA^XZ^XA^FDnode^XZ"){
+        socket.end();
+      }
+    });
+  });
+  server.listen(0, "127.0.0.1", function(){
+    var uri = "socket://127.0.0.1:" + server.address().port;
+    function done(){
+      if(++printed < 2){
+        return;
+      }
+      setTimeout(function(){
+        test.equal(received, "^XA^XZ^XA^FDnode^XZ");
+        // both jobs on one connection
+        test.equal(connections, 1);
+        server.close();
+        test.done();
+      }, 50);
+    }
+    printer.printDirect({data: "^XA^XZ", printer: uri, success: done, error: function(err){ test.ifError(err); }});
+    printer.printDirect({data: Buffer.from("^XA^FDnode^XZ"), printer: uri, success: done, error: function(err){ test.ifError(err); }});
+  });
+}
+
+exports.testSocketPrinterRefused = function(test) {
+  var server = net.createServer();
+  server.listen(0, "127.0.0.1", function(){
+    var uri = "socket://127.0.0.1:" + server.address().port;
+    server.close(function(){
+      printer.printDirect({data: "x", printer: uri, success: function(){
+        test.ok(false);
+        test.done();
+      }, error: function(err){
+        test.ok(err instanceof Error);
+        test.done();
+      }});
+    });
+  });
+}
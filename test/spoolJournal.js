@@ -0,0 +1,43 @@
+var printer = require("../"),
+    fs = require("fs"),
+    os = require("os"),
+    path = require("path");
+
+exports.testSpoolJournal = function(test) {
+  if(process.platform === 'win32') {
+    test.done();
+    return;
+  }
+  // no server: the drainer keeps the jobs pending
+  var cupsServer = process.env.CUPS_SERVER;
+  process.env.CUPS_SERVER = path.join(os.tmpdir(), 'node-printer-no-cupsd.sock');
+  var directory = fs.mkdtempSync(path.join(os.tmpdir(), 'node-printer-journal-'));
+  try {
+    var journal = printer.openSpoolJournal(directory, {segmentSize: 64 * 1024});
+    test.equal(journal.append({data: "label 1", printer: 'journal_test'}), 1);
+    test.equal(journal.append({data: Buffer.alloc(40000), printer: 'journal_test', type: 'RAW'}), 2);
+    // does not fit in the first segment anymore
+    test.equal(journal.append({data: Buffer.alloc(40000), printer: 'journal_test', options: {copies: '2'}}), 3);
+    test.throws(function(){ journal.append({data: Buffer.alloc(70000), printer: 'journal_test'}); });
+    test.equal(journal.sync(), 3);
+    // one process at a time
+    test.throws(function(){ printer.openSpoolJournal(directory); });
+    journal.close();
+
+    var reopened = printer.openSpoolJournal(directory);
+    var stats = reopened.stats();
+    test.equal(stats.pending, 3);
+    test.equal(stats.sequence, 3);
+    test.equal(stats.segments, 2);
+    test.equal(reopened.append({data: "label 4", printer: 'journal_test'}), 4);
+    reopened.close();
+  } finally {
+    fs.rmSync(directory, {recursive: true});
+    if(cupsServer === undefined) {
+      delete process.env.CUPS_SERVER;
+    } else {
+      process.env.CUPS_SERVER = cupsServer;
+    }
+  }
+  test.done();
+}
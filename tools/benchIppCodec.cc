@@ -0,0 +1,218 @@
+// Allocations and time of a 10k jobs Get-Jobs listing: native IPP codec vs the libcups path.
+//
+// The libcups path is what cupsGetJobs does with the response: ippRead into an ipp_t,
+// then one cups_job_t per job with a copy of each of its strings. The codec path decodes
+// the same bytes in place, the attributes in an arena, and extracts the job views.
+// No server is needed: the response is generated in memory.
+//
+// Linux/glibc only (malloc is counted by interposition). Build and run from the repository root:
+//   g++ -O2 -Isrc tools/benchIppCodec.cc src/node_printer_ipp_codec.cc $(pkg-config --cflags --libs cups) -o benchIppCodec
+//   ./benchIppCodec [jobs] [iterations]
+
+#include "node_printer_ipp_codec.hpp"
+
+#include <cups/cups.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+
+    static size_t allocations = 0;
+
+    void *malloc(size_t size)
+    {
+        ++allocations;
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        ++allocations;
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        ++allocations;
+        return __libc_realloc(ptr, size);
+    }
+}
+
+namespace
+{
+    /** Get-Jobs response with iJobs jobs, attributes as requested by cupsGetJobs
+     */
+    std::string makeGetJobsResponse(int iJobs)
+    {
+        IppEncoder response;
+        // successful-ok status instead of an operation
+        response.begin(IPP_STATUS_OK, 1);
+        for(int i = 1; i <= iJobs; ++i)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "shipping label %d", i);
+            response.group(IPP_CODEC_TAG_JOB);
+            response.addString(IPP_CODEC_TAG_MIMETYPE, "document-format", "application/vnd.cups-raw");
+            response.addInteger(IPP_CODEC_TAG_INTEGER, "job-id", i);
+            response.addInteger(IPP_CODEC_TAG_INTEGER, "job-k-octets", 4);
+            response.addString(IPP_CODEC_TAG_NAME, "job-name", name);
+            response.addString(IPP_CODEC_TAG_NAME, "job-originating-user-name", "warehouse");
+            response.addString(IPP_CODEC_TAG_URI, "job-printer-uri", "ipp://localhost/printers/zebra_dock_12");
+            response.addInteger(IPP_CODEC_TAG_INTEGER, "job-priority", 50);
+            response.addInteger(IPP_CODEC_TAG_ENUM, "job-state", IPP_JSTATE_COMPLETED);
+            response.addInteger(IPP_CODEC_TAG_INTEGER, "time-at-completed", 1700000000 + i);
+            response.addInteger(IPP_CODEC_TAG_INTEGER, "time-at-creation", 1700000000 + i);
+            response.addInteger(IPP_CODEC_TAG_INTEGER, "time-at-processing", 1700000000 + i);
+        }
+        response.end();
+        return response.data();
+    }
+
+    struct MemoryReader
+    {
+        const std::string *data;
+        size_t position;
+    };
+
+    ssize_t readMemory(void *iContext, ipp_uchar_t *oBuffer, size_t iBytes)
+    {
+        MemoryReader *reader = static_cast<MemoryReader*>(iContext);
+        size_t bytes = reader->data->size() - reader->position;
+        if(bytes > iBytes)
+        {
+            bytes = iBytes;
+        }
+        memcpy(oBuffer, reader->data->data() + reader->position, bytes);
+        reader->position += bytes;
+        return static_cast<ssize_t>(bytes);
+    }
+
+    /** ippRead of the response and cups_job_t conversion, as cupsGetJobs2 does
+     * @return number of jobs
+     */
+    int listWithLibcups(const std::string &iResponse)
+    {
+        MemoryReader reader = { &iResponse, 0 };
+        ipp_t *response = ippNew();
+        if(ippReadIO(&reader, readMemory, 1, NULL, response) != IPP_STATE_DATA)
+        {
+            ippDelete(response);
+            return -1;
+        }
+
+        int num_jobs = 0;
+        for(ipp_attribute_t *attr = ippFirstAttribute(response); attr != NULL; attr = ippNextAttribute(response))
+        {
+            if(ippGetName(attr) != NULL && strcmp(ippGetName(attr), "job-id") == 0)
+            {
+                ++num_jobs;
+            }
+        }
+        cups_job_t *jobs = static_cast<cups_job_t*>(calloc(static_cast<size_t>(num_jobs), sizeof(cups_job_t)));
+        cups_job_t *job = jobs - 1;
+        for(ipp_attribute_t *attr = ippFirstAttribute(response); attr != NULL; attr = ippNextAttribute(response))
+        {
+            const char *name = ippGetName(attr);
+            if(name == NULL)
+            {
+                continue;
+            }
+            if(strcmp(name, "job-id") == 0)
+            {
+                ++job;
+                job->id = ippGetInteger(attr, 0);
+            }
+            else if(job < jobs)
+            {
+                continue;
+            }
+            else if(strcmp(name, "job-state") == 0)
+            {
+                job->state = static_cast<ipp_jstate_t>(ippGetInteger(attr, 0));
+            }
+            else if(strcmp(name, "job-name") == 0)
+            {
+                job->title = strdup(ippGetString(attr, 0, NULL));
+            }
+            else if(strcmp(name, "job-originating-user-name") == 0)
+            {
+                job->user = strdup(ippGetString(attr, 0, NULL));
+            }
+            else if(strcmp(name, "job-printer-uri") == 0)
+            {
+                job->dest = strdup(strrchr(ippGetString(attr, 0, NULL), '/') + 1);
+            }
+            else if(strcmp(name, "document-format") == 0)
+            {
+                job->format = strdup(ippGetString(attr, 0, NULL));
+            }
+        }
+        ippDelete(response);
+
+        for(int i = 0; i < num_jobs; ++i)
+        {
+            free(jobs[i].title);
+            free(jobs[i].user);
+            free(jobs[i].dest);
+            free(jobs[i].format);
+        }
+        free(jobs);
+        return num_jobs;
+    }
+
+    /** Decode in place and extract the job views, reusing the arena and the views vector
+     * @return number of jobs
+     */
+    int listWithCodec(const std::string &iResponse, IppArena &ioArena, std::vector<IppJobView> &ioJobs)
+    {
+        IppMessage message;
+        std::string error_str;
+        if(!decodeIppMessage(iResponse.data(), iResponse.size(), ioArena, message, error_str))
+        {
+            return -1;
+        }
+        ioJobs.clear();
+        getIppJobViews(message, ioJobs);
+        return static_cast<int>(ioJobs.size());
+    }
+
+    template<typename LISTING> void run(const char *iName, int iIterations, LISTING iListing)
+    {
+        // first listing warms the reused buffers up
+        int jobs = iListing();
+        size_t allocations_before = allocations;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for(int i = 0; i < iIterations; ++i)
+        {
+            iListing();
+        }
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("%-8s %6d jobs: %10.1f allocations/listing %8.2f ms/listing\n", iName, jobs,
+               static_cast<double>(allocations - allocations_before) / iIterations, elapsed / iIterations);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int num_jobs = (argc > 1) ? atoi(argv[1]) : 10000;
+    int iterations = (argc > 2) ? atoi(argv[2]) : 20;
+
+    std::string response = makeGetJobsResponse(num_jobs);
+    printf("Get-Jobs response: %zu bytes\n", response.size());
+
+    run("libcups", iterations, [&]() { return listWithLibcups(response); });
+
+    IppArena arena;
+    std::vector<IppJobView> jobs;
+    run("codec", iterations, [&]() { return listWithCodec(response, arena, jobs); });
+    return 0;
+}
@@ -1,30 +1,397 @@
+import { Writable } from "stream";
+
 export function getPrinters(): PrinterDetails[];
 export function getPrinter(printerName: string): PrinterDetails;
+export function getPrintersAsync(options?: PrinterQueryOptions): Promise<PrinterDetails[]>;
+export function getPrintersAsync(callback: (err: Error | null, printers: PrinterDetails[]) => void): void;
+export function getPrintersAsync(options: PrinterQueryOptions, callback: (err: Error | null, printers: PrinterDetails[]) => void): void;
+export function getPrinterAsync(printerName?: string, options?: PrinterQueryOptions): Promise<PrinterDetails>;
+export function getPrinterAsync(printerName: string | undefined, callback: (err: Error | null, printer: PrinterDetails) => void): void;
+export function getPrinterAsync(printerName: string | undefined, options: PrinterQueryOptions, callback: (err: Error | null, printer: PrinterDetails) => void): void;
+export function getPrintersMulti(servers: string[], options?: MultiServerQueryOptions): Promise<MultiServerPrinters>;
+export function getPrintersMulti(servers: string[], callback: (err: Error | null, result: MultiServerPrinters) => void): void;
+export function getPrintersMulti(servers: string[], options: MultiServerQueryOptions, callback: (err: Error | null, result: MultiServerPrinters) => void): void;
+export function enableSharedCache(options?: SharedCacheOptions): void;
+export function openSpoolJournal(directory: string, options?: SpoolJournalOptions): SpoolJournal;
+export function setPrintBackend(name: 'cups' | 'null'): void;
+export function setPrintBackend(name: 'file', options: { directory: string; sync?: boolean }): void;
+export function getPrintBackend(): PrintBackendStats;
+export function createJobScheduler(options?: JobSchedulerOptions): JobScheduler;
+export function checkPrintOptions(printerName: string, options?: { [key: string]: string } | OptionSet, params?: { server?: string }): PrintOptionsCheck;
+export function disableSharedCache(): void;
 export function getPrinterDriverOptions(printerName: string): PrinterDriverOptions;
 export function getSelectedPaperSize(printerName: string): string;
 export function getDefaultPrinterName(): string | undefined;
 export function printDirect(options: PrintDirectOptions): void;
-export function printFile(options: PrintFileOptions): void;
+export function printFile(options: PrintFileOptions): void | PrintFileTransfer;
+export function openPrinter(printerName?: string, options?: { server?: string }): PrinterHandle;
+export function openIppPrinter(uri: string): IppPrinterHandle;
+export function openIppPrinter(uri: string, callback: (err: Error | null, handle: IppPrinterHandle) => void): void;
+export function createPrinterPool(printerNames: string[], options?: PrinterPoolOptions): PrinterPool;
+export function createOptionSet(options: { [key: string]: string | number | boolean }): OptionSet;
+export function compileLabelTemplate(source: string | Buffer): LabelTemplate;
+export function convertImage(image: RasterImage, options?: ConvertImageOptions): Buffer;
+export function encodeBarcode(type: 'code128' | 'ean13' | 'qr', data: string | string[], options?: EncodeBarcodeOptions): Buffer;
+export function encode(data: string, encoding: PrinterEncoding, options?: { replacement?: string }): Buffer;
+export function createPrintStream(options?: PrintStreamOptions): PrintStream;
 export function getSupportedPrintFormats(): string[];
 export function getJob(printerName: string, jobId: number): JobDetails;
 export function setJob(printerName: string, jobId: number, command: 'CANCEL' | string): void;
 export function getSupportedJobCommands(): string[];
+export function createJobTracker(printerName?: string): JobTracker;
+export function setJobAttributes(printerName: string, jobIds: number[], attributes: JobAttributes): Promise<BulkJobResult[]>;
+export function setJobAttributes(printerName: string, jobIds: number[], attributes: JobAttributes, callback: (err: Error | null, results: BulkJobResult[]) => void): void;
+export function setJobs(printerName: string, command: BulkJobCommand, jobIds?: number[]): Promise<BulkJobResult[]>;
+export function setJobs(printerName: string, command: BulkJobCommand, jobIds: number[] | undefined, callback: (err: Error | null, results: BulkJobResult[]) => void): void;
+
+export interface PrinterQueryOptions {
+    /** reuse an already fetched result not older than maxAge milliseconds */
+    maxAge?: number;
+    /** CUPS server to query: host, host:port or [ipv6]:port. The configured server if missing */
+    server?: string;
+}
+
+export interface PrintBackendStats {
+    name: 'cups' | 'null' | 'file';
+    /** jobs accepted since the backend was selected */
+    jobs: number;
+    bytes: number;
+    errors: number;
+}
+
+export interface PrintOptionsCheck {
+    valid: boolean;
+    /** unsupported values and conflicting options */
+    errors: string[];
+}
+
+export interface JobSchedulerOptions {
+    /** jobs submitted at the same time, 4 by default */
+    concurrency?: number;
+    /** job-priority (1..100) of each class, { urgent: 90, normal: 50, bulk: 10 } by default */
+    classes?: { [name: string]: number };
+    /** ms a class waits before being served as the next higher class, 2000 by default */
+    aging?: number;
+    /** share of each tenant inside a class, 1 by default */
+    tenants?: { [name: string]: number };
+}
+
+export type ScheduledJobOptions = Pick<PrintDirectOptions, 'data' | 'printer' | 'server' | 'type' | 'options' | 'encoding' | 'replacement' | 'preflight'> & {
+    docname?: string | undefined;
+    /** middle class by default */
+    class?: string | undefined;
+    tenant?: string | undefined;
+};
+
+export interface ScheduledJob {
+    id: number;
+    class: string;
+    tenant: string;
+    /** ms spent in the scheduler queue */
+    waitMs: number;
+}
+
+export interface JobClassStats {
+    priority: number;
+    queued: number;
+    submitted: number;
+    failed: number;
+    waitAvgMs: number;
+    waitMaxMs: number;
+    /** wait of the oldest queued job */
+    oldestMs: number;
+}
+
+export interface JobScheduler {
+    submit(job: ScheduledJobOptions, callback: (err: Error | null, job: ScheduledJob) => void): void;
+    stats(): { [className: string]: JobClassStats };
+    /** queued jobs are still submitted, new ones are refused */
+    close(): void;
+}
+
+export interface SpoolJournalOptions {
+    /** bytes of a segment file, 16 MiB by default */
+    segmentSize?: number;
+    /** ms between two syncs to disk, 10 by default */
+    syncInterval?: number;
+    /** appended bytes which are synced at once, 1 MiB by default */
+    syncBytes?: number;
+    /** ms a job is retried while the server fails before it is dropped, 10 minutes by default, 0 for no limit */
+    retryTimeout?: number;
+    /** called once a job is submitted to CUPS, or dropped because CUPS refused it or kept failing */
+    onJob?: (err: Error | null, job: { sequence: number; id?: number }) => void;
+}
+
+export interface SpoolJournalStats {
+    appended: number;
+    pending: number;
+    submitted: number;
+    failed: number;
+    /** last appended sequence */
+    sequence: number;
+    /** last sequence written to disk */
+    syncedSequence: number;
+    segments: number;
+}
+
+export interface SpoolJournal {
+    readonly directory: string;
+    /** @return sequence of the job in the journal */
+    append(params: Pick<PrintDirectOptions, 'data' | 'printer' | 'type' | 'options' | 'encoding' | 'replacement' | 'preflight'> & { docname?: string }): number;
+    /** write the appended jobs to disk now, @return last sequence on disk */
+    sync(): number;
+    stats(): SpoolJournalStats;
+    close(): void;
+}
+
+export interface SharedCacheOptions {
+    /** shared memory segment name, the same in all processes, 'node-printer' by default */
+    name?: string;
+    /** age in ms of published printers which are still used, 2000 by default */
+    maxAge?: number;
+    /** this process refreshes the segment every maxAge / 2 ms */
+    owner?: boolean;
+    /** segment size in bytes if it is created, 4 MiB by default */
+    size?: number;
+}
+
+export interface MultiServerQueryOptions {
+    /** connection timeout in ms per server, 30000 by default */
+    timeout?: number;
+}
+
+export interface MultiServerPrinters {
+    /** printers of all servers which answered */
+    printers: Array<PrinterDetails & { server: string }>;
+    /** servers which failed */
+    errors: Array<{ server: string; message: string }>;
+}
 
 export interface PrintDirectOptions {
     data: string | Buffer;
+    /** printer name, or socket://host[:port] to send RAW data straight to the device */
     printer?: string | undefined;
+    /** CUPS server (host[:port]) to submit to, its default printer if printer is missing */
+    server?: string | undefined;
+    /** append to this journal instead of submitting: success receives the journal sequence */
+    journal?: SpoolJournal | undefined;
     type?: 'RAW' | 'TEXT' | 'PDF' | 'JPEG' | 'POSTSCRIPT' | 'COMMAND' | 'AUTO' | undefined;
-    options?: { [key: string]: string } | undefined;
+    options?: { [key: string]: string } | OptionSet | undefined;
     success?: PrintOnSuccessFunction | undefined;
     error?: PrintOnErrorFunction | undefined;
+    /** concatenate RAW data sent to the same printer in a time window into one job (POSIX only);
+     * success is called once CUPS accepted the combined job, not once it is printed */
+    coalesce?: boolean | PrintCoalesceOptions | undefined;
+    /** codepage a string data is transcoded to */
+    encoding?: PrinterEncoding | undefined;
+    /** ASCII written instead of the characters missing from the codepage, '?' by default */
+    replacement?: string | undefined;
+    /** reject the job before sending data if the printer does not support its options (POSIX only) */
+    preflight?: boolean | undefined;
+}
+
+export type PrinterEncoding = 'cp437' | 'cp850' | 'cp858' | 'windows-1252' | 'cp1252' | 'utf8';
+
+export interface PrintCoalesceOptions {
+    /** ms during which data is collected, 50 by default */
+    window?: number;
+    /** combined job size which sends it at once, 64 KiB by default */
+    maxBytes?: number;
 }
 
 export interface PrintFileOptions {
     filename: string;
     printer?: string | undefined;
-    options?: { [key: string]: string } | undefined;
+    /** CUPS server (host[:port]) to submit to, its default printer if printer is missing */
+    server?: string | undefined;
+    options?: { [key: string]: string } | OptionSet | undefined;
+    /** reject the job before uploading the file if the printer does not support its options (POSIX only) */
+    preflight?: boolean | undefined;
     success?: PrintOnSuccessFunction | undefined;
     error?: PrintOnErrorFunction | undefined;
+    /** send the file by chunks of chunkSize bytes (POSIX only) */
+    chunkSize?: number | undefined;
+    /** progress of a chunked or split transfer (POSIX only) */
+    progress?: ((progress: PrintFileProgress | PrintFileSplitProgress) => any) | undefined;
+    type?: 'RAW' | 'TEXT' | 'PDF' | 'JPEG' | 'POSTSCRIPT' | 'COMMAND' | 'AUTO' | undefined;
+    /** split the pages between these printers, one job per printer (POSIX only); each job uploads the whole file */
+    printers?: string[] | undefined;
+    /** page count for split mode; if it cannot be read reliably from the PDF, the file is sent to the first printer */
+    pageCount?: number | undefined;
+}
+
+export interface PrintFileProgress {
+    bytesSent: number;
+    totalBytes: number;
+    percent: number;
+    mbPerSecond: number;
+    /** estimated remaining seconds */
+    eta: number;
+}
+
+export interface PrintFileSplitProgress {
+    bytesSent: number;
+    totalBytes: number;
+    percent: number;
+    jobsDone: number;
+    jobs: number;
+}
+
+export interface PrintFileSplitJob {
+    printer: string;
+    /** page range, e.g. '1-500', or 'all' when the page count was unknown */
+    pages: string;
+    ok: boolean;
+    id?: number;
+    error?: string;
+}
+
+export interface PrintFileTransfer {
+    /** abort the chunked transfer and cancel the job */
+    cancel(): void;
+}
+
+export interface PrintStreamOptions {
+    printer?: string | undefined;
+    docname?: string | undefined;
+    type?: 'RAW' | 'TEXT' | 'PDF' | 'JPEG' | 'POSTSCRIPT' | 'COMMAND' | 'AUTO' | undefined;
+    options?: { [key: string]: string } | OptionSet | undefined;
+    highWaterMark?: number | undefined;
+    /** refuse to create the stream if the printer does not support its options */
+    preflight?: boolean | undefined;
+}
+
+export interface PrintStream extends Writable {
+    /** job id, available once the 'job' event was emitted */
+    jobId?: number;
+    on(event: 'job', listener: (jobId: number) => void): this;
+    on(event: string | symbol, listener: (...args: any[]) => void): this;
+}
+
+export interface PrinterHandle {
+    readonly name: string;
+    readonly uri?: string;
+    print(options: PrinterHandlePrintOptions): { id: number };
+    printFile(options: PrinterHandlePrintFileOptions): { id: number };
+    jobs(which?: 'all' | 'active' | 'completed'): JobDetails[];
+    cancel(jobId: number): boolean;
+    close(): void;
+}
+
+/** Methods with a callback run on a worker, the requests of one handle are sent in call order */
+export interface IppPrinterHandle extends PrinterHandle {
+    readonly uri: string;
+    /** Get-Printer-Attributes, all attributes by default */
+    attributes(names?: string[]): { [name: string]: string | number | boolean | Array<string | number | boolean> };
+    attributes(names: string[] | undefined, callback: (err: Error | null, attributes: { [name: string]: string | number | boolean | Array<string | number | boolean> }) => void): void;
+    print(options: PrinterHandlePrintOptions): { id: number };
+    print(options: PrinterHandlePrintOptions, callback: (err: Error | null, job: { id: number }) => void): void;
+    printFile(options: PrinterHandlePrintFileOptions): { id: number };
+    printFile(options: PrinterHandlePrintFileOptions, callback: (err: Error | null, job: { id: number }) => void): void;
+    jobs(which?: 'all' | 'active' | 'completed'): JobDetails[];
+    jobs(which: 'all' | 'active' | 'completed' | undefined, callback: (err: Error | null, jobs: JobDetails[]) => void): void;
+    cancel(jobId: number): boolean;
+    cancel(jobId: number, callback: (err: Error | null, cancelled: boolean) => void): void;
+}
+
+export interface PrinterHandlePrintOptions {
+    data: string | Buffer;
+    docname?: string | undefined;
+    type?: 'RAW' | 'TEXT' | 'PDF' | 'JPEG' | 'POSTSCRIPT' | 'COMMAND' | 'AUTO' | undefined;
+    options?: { [key: string]: string } | OptionSet | undefined;
+    /** reject the job before sending data if the printer does not support its options (CUPS queues and pools only) */
+    preflight?: boolean | undefined;
+}
+
+export interface PrinterHandlePrintFileOptions {
+    filename: string;
+    docname?: string | undefined;
+    type?: 'RAW' | 'TEXT' | 'PDF' | 'JPEG' | 'POSTSCRIPT' | 'COMMAND' | 'AUTO' | undefined;
+    options?: { [key: string]: string } | OptionSet | undefined;
+    /** reject the job before sending data if the printer does not support its options (CUPS queues and pools only) */
+    preflight?: boolean | undefined;
+}
+
+export interface PrinterPoolOptions {
+    strategy?: 'least-loaded' | 'round-robin';
+    /** ms between two refreshes of the members state and queue depth, 1000 by default */
+    refreshInterval?: number;
+}
+
+export interface PrinterPoolMemberStats {
+    name: string;
+    status: 'IDLE' | 'PRINTING' | 'STOPPED';
+    available: boolean;
+    queued: number;
+    inFlight: number;
+    inFlightBytes: number;
+    submitted: number;
+}
+
+export interface PrinterPool {
+    print(options: PrinterHandlePrintOptions, callback: (err: Error | null, job: { id: number, printer: string }) => void): void;
+    stats(): PrinterPoolMemberStats[];
+}
+
+export type LabelFieldValue = string | number | boolean | Buffer;
+
+/** Label template compiled once, rendering labels without going through JS strings */
+export interface LabelTemplate {
+    /** placeholder names, in order of first appearance */
+    readonly fields: string[];
+    /** bytes of the template outside placeholders */
+    readonly fixedSize: number;
+    render(fields: { [name: string]: LabelFieldValue }): Buffer;
+    /** all the labels concatenated in one Buffer, e.g. for one RAW job */
+    renderBatch(rows: Array<{ [name: string]: LabelFieldValue }>): Buffer;
+}
+
+export interface RasterImage {
+    /** gray, gray + alpha, RGB or RGBA pixels, row by row */
+    data: Buffer;
+    width: number;
+    height: number;
+    /** 1 to 4, computed from the data size if missing */
+    channels?: number;
+}
+
+export interface RasterOutputOptions {
+    format?: 'zpl' | 'escpos' | 'bitmap';
+    /** ZPL only: Z64 compressed data (POSIX only) */
+    compress?: boolean;
+    /** ZPL only: complete ^XA...^XZ label, true by default */
+    label?: boolean;
+}
+
+export interface ConvertImageOptions extends RasterOutputOptions {
+    /** printed size in dots, the aspect ratio is kept if only one is set */
+    width?: number;
+    height?: number;
+    dither?: 'threshold' | 'floyd-steinberg';
+    /** gray level under which a dot is black, 128 by default */
+    threshold?: number;
+    invert?: boolean;
+}
+
+export interface EncodeBarcodeOptions extends RasterOutputOptions {
+    /** printer resolution, 203 by default */
+    dpi?: number;
+    /** narrow bar or QR module size in mm */
+    moduleSize?: number;
+    /** narrow bar or QR module size in dots, instead of moduleSize */
+    module?: number;
+    /** bars height in mm, 15 by default */
+    height?: number;
+    /** margin in modules */
+    quietZone?: number;
+    /** QR only, 'M' by default */
+    errorCorrection?: 'L' | 'M' | 'Q' | 'H';
+}
+
+/** Precompiled CUPS options, reusable by any print call */
+export interface OptionSet {
+    readonly size: number;
+    toObject(): { [key: string]: string };
 }
 
 export type PrintOnSuccessFunction = (jobId: string) => any;
@@ -54,4 +421,39 @@ export interface JobDetails {
     processingTime: Date;
 }
 
+export type BulkJobCommand = 'CANCEL' | 'CANCEL-MY' | 'PURGE' | 'HOLD' | 'RELEASE' | 'RESTART';
+
+export interface BulkJobResult {
+    id: number;
+    ok: boolean;
+    error?: string;
+}
+
+export interface JobAttributes {
+    /** job-priority, 1 to 100 */
+    priority?: number;
+    /** job-hold-until, e.g. 'indefinite', 'no-hold', 'night' */
+    holdUntil?: string;
+    copies?: number;
+    name?: string;
+    /** move the jobs to this printer */
+    printer?: string;
+    [attribute: string]: string | number | boolean | undefined;
+}
+
+export interface JobChanges {
+    created: JobDetails[];
+    changed: Array<JobDetails & { previousStatus: JobStatus[] }>;
+    completed: JobDetails[];
+    /** ids of jobs purged before their final state was seen */
+    removed: number[];
+}
+
+export interface JobTracker {
+    readonly printer: string | null;
+    readonly lastJobId: number;
+    poll(callback: (err: Error | null, changes: JobChanges) => void): void;
+    reset(): void;
+}
+
 export type JobStatus = 'PAUSED' | 'PRINTING' | 'PRINTED' | 'CANCELLED' | 'PENDING' | 'ABORTED';
\ No newline at end of file